@@ -6,31 +6,59 @@
 
 using namespace std;
 
+// Bucket placement only has to be unpredictable without nKey, so it uses
+// SipHash keyed with the first 128 bits of it instead of double SHA-256
+static CSipHasher GetBucketHasher(const std::vector<unsigned char> &nKey)
+{
+    uint64 k0, k1;
+    memcpy(&k0, &nKey[0], 8);
+    memcpy(&k1, &nKey[8], 8);
+    return CSipHasher(k0, k1);
+}
+
+// Group and address keys are short, so a one byte length prefix keeps
+// adjacent fields from running into each other
+static void HashBytes(CSipHasher &hasher, const std::vector<unsigned char> &vch)
+{
+    unsigned char nSize = vch.size();
+    hasher.Write(&nSize, 1);
+    if (!vch.empty())
+        hasher.Write(&vch[0], vch.size());
+}
+
+static void HashInt(CSipHasher &hasher, uint64 n)
+{
+    unsigned char pch[8];
+    for (int i = 0; i < 8; i++)
+        pch[i] = n >> (8 * i);
+    hasher.Write(pch, 8);
+}
+
 int CAddrInfo::GetTriedBucket(const std::vector<unsigned char> &nKey) const
 {
-    CDataStream ss1(SER_GETHASH, 0);
-    std::vector<unsigned char> vchKey = GetKey();
-    ss1 << nKey << vchKey;
-    uint64 hash1 = Hash(ss1.begin(), ss1.end()).Get64();
-
-    CDataStream ss2(SER_GETHASH, 0);
-    std::vector<unsigned char> vchGroupKey = GetGroup();
-    ss2 << nKey << vchGroupKey << (hash1 % ADDRMAN_TRIED_BUCKETS_PER_GROUP);
-    uint64 hash2 = Hash(ss2.begin(), ss2.end()).Get64();
+    CSipHasher hasher1 = GetBucketHasher(nKey);
+    HashBytes(hasher1, GetKey());
+    uint64 hash1 = hasher1.Finalize();
+
+    CSipHasher hasher2 = GetBucketHasher(nKey);
+    HashBytes(hasher2, GetGroup());
+    HashInt(hasher2, hash1 % ADDRMAN_TRIED_BUCKETS_PER_GROUP);
+    uint64 hash2 = hasher2.Finalize();
     return hash2 % ADDRMAN_TRIED_BUCKET_COUNT;
 }
 
 int CAddrInfo::GetNewBucket(const std::vector<unsigned char> &nKey, const CNetAddr& src) const
 {
-    CDataStream ss1(SER_GETHASH, 0);
-    std::vector<unsigned char> vchGroupKey = GetGroup();
     std::vector<unsigned char> vchSourceGroupKey = src.GetGroup();
-    ss1 << nKey << vchGroupKey << vchSourceGroupKey;
-    uint64 hash1 = Hash(ss1.begin(), ss1.end()).Get64();
-
-    CDataStream ss2(SER_GETHASH, 0);
-    ss2 << nKey << vchSourceGroupKey << (hash1 % ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP);
-    uint64 hash2 = Hash(ss2.begin(), ss2.end()).Get64();
+    CSipHasher hasher1 = GetBucketHasher(nKey);
+    HashBytes(hasher1, GetGroup());
+    HashBytes(hasher1, vchSourceGroupKey);
+    uint64 hash1 = hasher1.Finalize();
+
+    CSipHasher hasher2 = GetBucketHasher(nKey);
+    HashBytes(hasher2, vchSourceGroupKey);
+    HashInt(hasher2, hash1 % ADDRMAN_NEW_BUCKETS_PER_SOURCE_GROUP);
+    uint64 hash2 = hasher2.Finalize();
     return hash2 % ADDRMAN_NEW_BUCKET_COUNT;
 }
 
@@ -123,9 +151,21 @@ void CAddrMan::SwapRandom(int nRndPos1, int nRndPos2)
     vRandom[nRndPos2] = nId1;
 }
 
+void CAddrMan::Delete(int nId)
+{
+    assert(mapInfo.count(nId) == 1);
+    CAddrInfo &info = mapInfo[nId];
+    assert(!info.fInTried && info.nRefCount == 0);
+    SwapRandom(info.nRandomPos, vRandom.size()-1);
+    vRandom.pop_back();
+    mapAddr.erase(info);
+    mapInfo.erase(nId);
+    nNew--;
+}
+
 int CAddrMan::SelectTried(int nKBucket)
 {
-    std::vector<int> &vTried = vvTried[nKBucket];
+    CAddrTriedBucket &vTried = vvTried[nKBucket];
 
     // random shuffle the first few elements (using the entire list)
     // find the least recently tried among them
@@ -133,7 +173,7 @@ int CAddrMan::SelectTried(int nKBucket)
     int nOldestPos = -1;
     for (unsigned int i = 0; i < ADDRMAN_TRIED_ENTRIES_INSPECT_ON_EVICT && i < vTried.size(); i++)
     {
-        int nPos = GetRandInt(vTried.size() - i) + i;
+        int nPos = GetFastRandInt(vTried.size() - i) + i;
         int nTemp = vTried[nPos];
         vTried[nPos] = vTried[i];
         vTried[i] = nTemp;
@@ -150,53 +190,37 @@ int CAddrMan::SelectTried(int nKBucket)
 int CAddrMan::ShrinkNew(int nUBucket)
 {
     assert(nUBucket >= 0 && nUBucket < vvNew.size());
-    std::set<int> &vNew = vvNew[nUBucket];
+    CAddrNewBucket &vNew = vvNew[nUBucket];
 
     // first look for deletable items
-    for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
+    for (unsigned int i = 0; i < vNew.size(); i++)
     {
-        assert(mapInfo.count(*it));
-        CAddrInfo &info = mapInfo[*it];
+        int nId = vNew[i];
+        assert(mapInfo.count(nId));
+        CAddrInfo &info = mapInfo[nId];
         if (info.IsTerrible())
         {
+            vNew.erase(nId);
             if (--info.nRefCount == 0)
-            {
-                SwapRandom(info.nRandomPos, vRandom.size()-1);
-                vRandom.pop_back();
-                mapAddr.erase(info);
-                mapInfo.erase(*it);
-                nNew--;
-            }
-            vNew.erase(it);
+                Delete(nId);
             return 0;
         }
     }
 
     // otherwise, select four randomly, and pick the oldest of those to replace
-    int n[4] = {GetRandInt(vNew.size()), GetRandInt(vNew.size()), GetRandInt(vNew.size()), GetRandInt(vNew.size())};
-    int nI = 0;
     int nOldest = -1;
-    for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
+    for (int n = 0; n < 4; n++)
     {
-        if (nI == n[0] || nI == n[1] || nI == n[2] || nI == n[3])
-        {
-            assert(nOldest == -1 || mapInfo.count(*it) == 1);
-            if (nOldest == -1 || mapInfo[*it].nTime < mapInfo[nOldest].nTime)
-                nOldest = *it;
-        }
-        nI++;
+        int nId = vNew[GetFastRandInt(vNew.size())];
+        assert(mapInfo.count(nId) == 1);
+        if (nOldest == -1 || mapInfo[nId].nTime < mapInfo[nOldest].nTime)
+            nOldest = nId;
     }
     assert(mapInfo.count(nOldest) == 1);
     CAddrInfo &info = mapInfo[nOldest];
-    if (--info.nRefCount == 0) 
-    {
-        SwapRandom(info.nRandomPos, vRandom.size()-1);
-        vRandom.pop_back();
-        mapAddr.erase(info);
-        mapInfo.erase(nOldest);
-        nNew--;
-    }
     vNew.erase(nOldest);
+    if (--info.nRefCount == 0)
+        Delete(nOldest);
 
     return 1;
 }
@@ -206,7 +230,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
     assert(vvNew[nOrigin].count(nId) == 1);
 
     // remove the entry from all new buckets
-    for (std::vector<std::set<int> >::iterator it = vvNew.begin(); it != vvNew.end(); it++)
+    for (std::vector<CAddrNewBucket>::iterator it = vvNew.begin(); it != vvNew.end() && info.nRefCount > 0; it++)
     {
         if ((*it).erase(nId))
             info.nRefCount--;
@@ -217,12 +241,12 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
 
     // what tried bucket to move the entry to
     int nKBucket = info.GetTriedBucket(nKey);
-    std::vector<int> &vTried = vvTried[nKBucket];
+    CAddrTriedBucket &vTried = vvTried[nKBucket];
 
     // first check whether there is place to just add it
-    if (vTried.size() < ADDRMAN_TRIED_BUCKET_SIZE)
+    if (!vTried.full())
     {
-        vTried.push_back(nId);
+        vTried.insert(nId);
         nTried++;
         info.fInTried = true;
         return;
@@ -234,7 +258,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
     // find which new bucket it belongs to
     assert(mapInfo.count(vTried[nPos]) == 1);
     int nUBucket = mapInfo[vTried[nPos]].GetNewBucket(nKey);
-    std::set<int> &vNew = vvNew[nUBucket];
+    CAddrNewBucket &vNew = vvNew[nUBucket];
 
     // remove the to-be-replaced tried entry from the tried set
     CAddrInfo& infoOld = mapInfo[vTried[nPos]];
@@ -243,7 +267,7 @@ void CAddrMan::MakeTried(CAddrInfo& info, int nId, int nOrigin)
     // do not update nTried, as we are going to move something else there immediately
 
     // check whether there is place in that one, 
-    if (vNew.size() < ADDRMAN_NEW_BUCKET_SIZE)
+    if (!vNew.full())
     {
         // if so, move it back there
         vNew.insert(vTried[nPos]);
@@ -287,12 +311,12 @@ void CAddrMan::Good_(const CService &addr, int64 nTime)
         return;
 
     // find a bucket it is in now
-    int nRnd = GetRandInt(vvNew.size());
+    int nRnd = GetFastRandInt(vvNew.size());
     int nUBucket = -1;
     for (unsigned int n = 0; n < vvNew.size(); n++)
     {
         int nB = (n+nRnd) % vvNew.size();
-        std::set<int> &vNew = vvNew[nB];
+        CAddrNewBucket &vNew = vvNew[nB];
         if (vNew.count(nId))
         {
             nUBucket = nB;
@@ -346,7 +370,7 @@ bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, int64 nTimePen
         int nFactor = 1;
         for (int n=0; n<pinfo->nRefCount; n++)
             nFactor *= 2;
-        if (nFactor > 1 && (GetRandInt(nFactor) != 0))
+        if (nFactor > 1 && (GetFastRandInt(nFactor) != 0))
             return false;
     } else {
         pinfo = Create(addr, source, &nId);
@@ -357,13 +381,13 @@ bool CAddrMan::Add_(const CAddress &addr, const CNetAddr& source, int64 nTimePen
     }
 
     int nUBucket = pinfo->GetNewBucket(nKey, source);
-    std::set<int> &vNew = vvNew[nUBucket];
+    CAddrNewBucket &vNew = vvNew[nUBucket];
     if (!vNew.count(nId))
     {
         pinfo->nRefCount++;
-        if (vNew.size() == ADDRMAN_NEW_BUCKET_SIZE)
+        if (vNew.full())
             ShrinkNew(nUBucket);
-        vvNew[nUBucket].insert(nId);
+        vNew.insert(nId);
     }
     return fNew;
 }
@@ -394,19 +418,19 @@ CAddress CAddrMan::Select_(int nUnkBias)
 
     double nCorTried = sqrt(nTried) * (100.0 - nUnkBias);
     double nCorNew = sqrt(nNew) * nUnkBias;
-    if ((nCorTried + nCorNew)*GetRandInt(1<<30)/(1<<30) < nCorTried)
+    if ((nCorTried + nCorNew)*GetFastRandInt(1<<30)/(1<<30) < nCorTried)
     {
         // use a tried node
         double fChanceFactor = 1.0;
         while(1)
         {
-            int nKBucket = GetRandInt(vvTried.size());
-            std::vector<int> &vTried = vvTried[nKBucket];
+            int nKBucket = GetFastRandInt(vvTried.size());
+            CAddrTriedBucket &vTried = vvTried[nKBucket];
             if (vTried.size() == 0) continue;
-            int nPos = GetRandInt(vTried.size());
+            int nPos = GetFastRandInt(vTried.size());
             assert(mapInfo.count(vTried[nPos]) == 1);
             CAddrInfo &info = mapInfo[vTried[nPos]];
-            if (GetRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
+            if (GetFastRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -415,16 +439,13 @@ CAddress CAddrMan::Select_(int nUnkBias)
         double fChanceFactor = 1.0;
         while(1)
         {
-            int nUBucket = GetRandInt(vvNew.size());
-            std::set<int> &vNew = vvNew[nUBucket];
+            int nUBucket = GetFastRandInt(vvNew.size());
+            CAddrNewBucket &vNew = vvNew[nUBucket];
             if (vNew.size() == 0) continue;
-            int nPos = GetRandInt(vNew.size());
-            std::set<int>::iterator it = vNew.begin();
-            while (nPos--)
-                it++;
-            assert(mapInfo.count(*it) == 1);
-            CAddrInfo &info = mapInfo[*it];
-            if (GetRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
+            int nPos = GetFastRandInt(vNew.size());
+            assert(mapInfo.count(vNew[nPos]) == 1);
+            CAddrInfo &info = mapInfo[vNew[nPos]];
+            if (GetFastRandInt(1<<30) < fChanceFactor*info.GetChance()*(1<<30))
                 return info;
             fChanceFactor *= 1.2;
         }
@@ -465,22 +486,22 @@ int CAddrMan::Check_()
 
     for (int n=0; n<vvTried.size(); n++)
     {
-        std::vector<int> &vTried = vvTried[n];
-        for (std::vector<int>::iterator it = vTried.begin(); it != vTried.end(); it++)
+        CAddrTriedBucket &vTried = vvTried[n];
+        for (unsigned int i = 0; i < vTried.size(); i++)
         {
-            if (!setTried.count(*it)) return -11;
-            setTried.erase(*it);
+            if (!setTried.count(vTried[i])) return -11;
+            setTried.erase(vTried[i]);
         }
     }
 
     for (int n=0; n<vvNew.size(); n++)
     {
-        std::set<int> &vNew = vvNew[n];
-        for (std::set<int>::iterator it = vNew.begin(); it != vNew.end(); it++)
+        CAddrNewBucket &vNew = vvNew[n];
+        for (unsigned int i = 0; i < vNew.size(); i++)
         {
-            if (!mapNew.count(*it)) return -12;
-            if (--mapNew[*it] == 0)
-                mapNew.erase(*it);
+            if (!mapNew.count(vNew[i])) return -12;
+            if (--mapNew[vNew[i]] == 0)
+                mapNew.erase(vNew[i]);
         }
     }
 
@@ -500,7 +521,7 @@ void CAddrMan::GetAddr_(std::vector<CAddress> &vAddr)
     // perform a random shuffle over the first nNodes elements of vRandom (selecting from all)
     for (int n = 0; n<nNodes; n++)
     {
-        int nRndPos = GetRandInt(vRandom.size() - n) + n;
+        int nRndPos = GetFastRandInt(vRandom.size() - n) + n;
         SwapRandom(n, nRndPos);
         assert(mapInfo.count(vRandom[n]) == 1);
         vAddr.push_back(mapInfo[vRandom[n]]);
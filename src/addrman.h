@@ -160,6 +160,68 @@ public:
 // the maximum number of nodes to return in a getaddr call
 #define ADDRMAN_GETADDR_MAX 2500
 
+/** Fixed-capacity bucket of address ids. Elements are kept unordered in a
+ * plain array, so picking a random one is O(1); erase moves the last
+ * element into the hole. */
+template<unsigned int nCapacity>
+class CAddrBucket
+{
+private:
+    unsigned int nSize;
+    int vId[nCapacity];
+
+public:
+    CAddrBucket() : nSize(0) {}
+
+    unsigned int size() const { return nSize; }
+    bool full() const { return nSize == nCapacity; }
+
+    int& operator[](unsigned int nPos)
+    {
+        assert(nPos < nSize);
+        return vId[nPos];
+    }
+
+    int operator[](unsigned int nPos) const
+    {
+        assert(nPos < nSize);
+        return vId[nPos];
+    }
+
+    int count(int nId) const
+    {
+        for (unsigned int i = 0; i < nSize; i++)
+            if (vId[i] == nId)
+                return 1;
+        return 0;
+    }
+
+    // Add nId unless it is already present. The bucket must not be full.
+    void insert(int nId)
+    {
+        if (count(nId))
+            return;
+        assert(nSize < nCapacity);
+        vId[nSize++] = nId;
+    }
+
+    int erase(int nId)
+    {
+        for (unsigned int i = 0; i < nSize; i++)
+        {
+            if (vId[i] == nId)
+            {
+                vId[i] = vId[--nSize];
+                return 1;
+            }
+        }
+        return 0;
+    }
+};
+
+typedef CAddrBucket<ADDRMAN_TRIED_BUCKET_SIZE> CAddrTriedBucket;
+typedef CAddrBucket<ADDRMAN_NEW_BUCKET_SIZE> CAddrNewBucket;
+
 /** Stochastical (IP) address manager */
 class CAddrMan
 {
@@ -186,13 +248,13 @@ private:
     int nTried;
 
     // list of "tried" buckets
-    std::vector<std::vector<int> > vvTried;
+    std::vector<CAddrTriedBucket> vvTried;
 
     // number of (unique) "new" entries
     int nNew;
 
     // list of "new" buckets
-    std::vector<std::set<int> > vvNew;
+    std::vector<CAddrNewBucket> vvNew;
 
 protected:
 
@@ -209,8 +271,12 @@ protected:
     // Return position in given bucket to replace.
     int SelectTried(int nKBucket);
 
+    // Drop an entry that is no longer referenced by any bucket.
+    void Delete(int nId);
+
     // Remove an element from a "new" bucket.
-    // This is the only place where actual deletes occur.
+    // This is the only place where actual deletes occur, apart from entries
+    // that do not fit their bucket when peers.dat is loaded.
     // They are never deleted while in the "tried" table, only possibly evicted back to the "new" table.
     int ShrinkNew(int nUBucket);
  
@@ -247,7 +313,7 @@ public:
     IMPLEMENT_SERIALIZE
     (({
         // serialized format:
-        // * version byte (currently 0)
+        // * version byte (currently 1)
         // * nKey
         // * nNew
         // * nTried
@@ -261,14 +327,16 @@ public:
         // Notice that vvTried, mapAddr and vVector are never encoded explicitly;
         // they are instead reconstructed from the other information.
         //
-        // vvNew is serialized, but only used if ADDRMAN_UNKOWN_BUCKET_COUNT didn't change,
-        // otherwise it is reconstructed as well.
+        // vvNew is serialized, but only used if ADDRMAN_UNKOWN_BUCKET_COUNT didn't change
+        // and the file is at least version 1, otherwise it is reconstructed as well.
+        // Version 0 files placed addresses with a SHA-256 based bucket hash instead of
+        // SipHash, so their bucket lists are read but ignored.
         //
         // This format is more complex, but significantly smaller (at most 1.5 MiB), and supports
         // changes to the ADDRMAN_ parameters without breaking the on-disk structure.
         {
             LOCK(cs);
-            unsigned char nVersion = 0;
+            unsigned char nVersion = 1;
             READWRITE(nVersion);
             READWRITE(nKey);
             READWRITE(nNew);
@@ -303,26 +371,27 @@ public:
                         nIds++;
                     }
                 }
-                for (std::vector<std::set<int> >::iterator it = am->vvNew.begin(); it != am->vvNew.end(); it++)
+                for (std::vector<CAddrNewBucket>::iterator it = am->vvNew.begin(); it != am->vvNew.end(); it++)
                 {
-                    const std::set<int> &vNew = (*it);
+                    const CAddrNewBucket &vNew = (*it);
                     int nSize = vNew.size();
                     READWRITE(nSize);
-                    for (std::set<int>::iterator it2 = vNew.begin(); it2 != vNew.end(); it2++)
+                    for (unsigned int i = 0; i < vNew.size(); i++)
                     {
-                        int nIndex = mapUnkIds[*it2];
+                        int nIndex = mapUnkIds[vNew[i]];
                         READWRITE(nIndex);
                     }
                 }
             } else {
                 int nUBuckets = 0;
                 READWRITE(nUBuckets);
+                bool fRebucket = (nVersion == 0 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT);
                 am->nIdCount = 0;
                 am->mapInfo.clear();
                 am->mapAddr.clear();
                 am->vRandom.clear();
-                am->vvTried = std::vector<std::vector<int> >(ADDRMAN_TRIED_BUCKET_COUNT, std::vector<int>(0));
-                am->vvNew = std::vector<std::set<int> >(ADDRMAN_NEW_BUCKET_COUNT, std::set<int>());
+                am->vvTried = std::vector<CAddrTriedBucket>(ADDRMAN_TRIED_BUCKET_COUNT);
+                am->vvNew = std::vector<CAddrNewBucket>(ADDRMAN_NEW_BUCKET_COUNT);
                 for (int n = 0; n < am->nNew; n++)
                 {
                     CAddrInfo &info = am->mapInfo[n];
@@ -330,10 +399,14 @@ public:
                     am->mapAddr[info] = n;
                     info.nRandomPos = vRandom.size();
                     am->vRandom.push_back(n);
-                    if (nUBuckets != ADDRMAN_NEW_BUCKET_COUNT)
+                    if (fRebucket)
                     {
-                        am->vvNew[info.GetNewBucket(am->nKey)].insert(n);
-                        info.nRefCount++;
+                        CAddrNewBucket &vNew = am->vvNew[info.GetNewBucket(am->nKey)];
+                        if (!vNew.full())
+                        {
+                            vNew.insert(n);
+                            info.nRefCount++;
+                        }
                     }
                 }
                 am->nIdCount = am->nNew;
@@ -342,15 +415,15 @@ public:
                 {
                     CAddrInfo info;
                     READWRITE(info);
-                    std::vector<int> &vTried = am->vvTried[info.GetTriedBucket(am->nKey)];
-                    if (vTried.size() < ADDRMAN_TRIED_BUCKET_SIZE)
+                    CAddrTriedBucket &vTried = am->vvTried[info.GetTriedBucket(am->nKey)];
+                    if (!vTried.full())
                     {
                         info.nRandomPos = vRandom.size();
                         info.fInTried = true;
                         am->vRandom.push_back(am->nIdCount);
                         am->mapInfo[am->nIdCount] = info;
                         am->mapAddr[info] = am->nIdCount;
-                        vTried.push_back(am->nIdCount);
+                        vTried.insert(am->nIdCount);
                         am->nIdCount++;
                     } else {
                         nLost++;
@@ -359,26 +432,33 @@ public:
                 am->nTried -= nLost;
                 for (int b = 0; b < nUBuckets; b++)
                 {
-                    std::set<int> &vNew = am->vvNew[b];
                     int nSize = 0;
                     READWRITE(nSize);
                     for (int n = 0; n < nSize; n++)
                     {
                         int nIndex = 0;
                         READWRITE(nIndex);
+                        if (fRebucket || nIndex < 0 || nIndex >= am->nNew)
+                            continue;
+                        CAddrNewBucket &vNew = am->vvNew[b];
                         CAddrInfo &info = am->mapInfo[nIndex];
-                        if (nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS)
+                        if (info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS && !vNew.full() && !vNew.count(nIndex))
                         {
                             info.nRefCount++;
                             vNew.insert(nIndex);
                         }
                     }
                 }
+                // entries that found no room in any bucket are dropped
+                int nLoaded = am->nNew;
+                for (int n = 0; n < nLoaded; n++)
+                    if (am->mapInfo[n].nRefCount == 0)
+                        am->Delete(n);
             }
         }
     });)
 
-    CAddrMan() : vRandom(0), vvTried(ADDRMAN_TRIED_BUCKET_COUNT, std::vector<int>(0)), vvNew(ADDRMAN_NEW_BUCKET_COUNT, std::set<int>())
+    CAddrMan() : vRandom(0), vvTried(ADDRMAN_TRIED_BUCKET_COUNT), vvNew(ADDRMAN_NEW_BUCKET_COUNT)
     {
          nKey.resize(32);
          RAND_bytes(&nKey[0], 32);
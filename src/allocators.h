@@ -7,6 +7,9 @@
 
 #include <string.h>
 #include <string>
+#if __cplusplus >= 201103L
+#include <type_traits>
+#endif
 
 #ifdef WIN32
 #ifdef _WIN32_WINNT
@@ -116,6 +119,70 @@ struct zero_after_free_allocator : public std::allocator<T>
     }
 };
 
+
+//
+// Buffers for CDataStream are taken from and returned to a per-thread pool,
+// so that short-lived streams don't hit the heap each time (see util.cpp)
+//
+void* StreamBufferAllocate(std::size_t nSize);
+void StreamBufferFree(void* p, std::size_t nSize);
+
+//
+// Allocator for CDataStream buffers. Contents are only cleared before the
+// buffer goes back to the pool if fSecure is set, for streams that may hold
+// private keys.
+//
+template<typename T>
+struct stream_allocator : public std::allocator<T>
+{
+    // MSVC8 default copy constructor is broken
+    typedef std::allocator<T> base;
+    typedef typename base::size_type size_type;
+    typedef typename base::difference_type  difference_type;
+    typedef typename base::pointer pointer;
+    typedef typename base::const_pointer const_pointer;
+    typedef typename base::reference reference;
+    typedef typename base::const_reference const_reference;
+    typedef typename base::value_type value_type;
+    bool fSecure;
+    explicit stream_allocator(bool fSecureIn=false) throw() : fSecure(fSecureIn) {}
+    stream_allocator(const stream_allocator& a) throw() : base(a), fSecure(a.fSecure) {}
+    template <typename U>
+    stream_allocator(const stream_allocator<U>& a) throw() : base(a), fSecure(a.fSecure) {}
+    ~stream_allocator() throw() {}
+    template<typename _Other> struct rebind
+    { typedef stream_allocator<_Other> other; };
+
+#if __cplusplus >= 201103L
+    // The traits inherited from std::allocator say any two instances are
+    // equal. Here fSecure travels with the buffer it was allocated for,
+    // so a buffer holding a copy of secure data is itself cleared on free
+    typedef std::false_type is_always_equal;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+#endif
+
+    T* allocate(std::size_t n, const void *hint = 0)
+    {
+        return (T*)StreamBufferAllocate(sizeof(T) * n);
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (p == NULL)
+            return;
+        if (fSecure)
+            memset(p, 0, sizeof(T) * n);
+        StreamBufferFree(p, sizeof(T) * n);
+    }
+};
+
+template<typename T, typename U>
+inline bool operator==(const stream_allocator<T>& a, const stream_allocator<U>& b) { return a.fSecure == b.fSecure; }
+template<typename T, typename U>
+inline bool operator!=(const stream_allocator<T>& a, const stream_allocator<U>& b) { return a.fSecure != b.fSecure; }
+
 // This is exactly like std::string, but with a custom allocator.
 typedef std::basic_string<char, std::char_traits<char>, secure_allocator<char> > SecureString;
 
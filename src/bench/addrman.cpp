@@ -0,0 +1,32 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+#include "addrman.h"
+
+using namespace std;
+
+// Address manager with 10000 new and 1000 tried entries from 100 sources
+static void AddrManSelect(CBenchState& state)
+{
+    CAddrMan addrman;
+    int64 nNow = GetAdjustedTime();
+    for (int nSource = 0; nSource < 100; nSource++)
+    {
+        CNetAddr source(strprintf("%d.%d.1.1", 20 + nSource / 50, nSource % 50).c_str());
+        vector<CAddress> vAddr;
+        for (int i = 0; i < 110; i++)
+        {
+            CAddress addr(CService(strprintf("%d.%d.%d.%d", 30 + nSource % 60, i, nSource, 1 + i % 200), 9901));
+            addr.nTime = nNow - i * 60;
+            vAddr.push_back(addr);
+        }
+        addrman.Add(vAddr, source);
+        for (int i = 0; i < 10; i++)
+            addrman.Good(vAddr[i], nNow);
+    }
+
+    while (state.KeepRunning())
+        addrman.Select();
+}
+BENCHMARK(AddrManSelect);
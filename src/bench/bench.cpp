@@ -0,0 +1,80 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <iostream>
+
+#include "bench.h"
+#include "json/json_spirit_writer_template.h"
+
+using namespace std;
+using namespace json_spirit;
+
+bool CBenchState::UpdateTimer()
+{
+    int64 nNow = GetTimeMicros();
+    if (nCount == 0)
+    {
+        nStartTime = nLastTime = nNow;
+        ++nCount;
+        return true;
+    }
+
+    // All iterations since the last clock read took nNow - nLastTime
+    int64 nBatchElapsed = nNow - nLastTime;
+    double dBatchTime = (double)nBatchElapsed / (nCount - nLastCount);
+    if (nLastCount == 0 || dBatchTime < dMinTime)
+        dMinTime = dBatchTime;
+    if (dBatchTime > dMaxTime)
+        dMaxTime = dBatchTime;
+    nLastCount = nCount;
+    nLastTime = nNow;
+
+    if (nNow - nStartTime >= nMaxElapsed)
+        return false;
+    // Read the clock less often while batches are too short to time
+    if (nBatchElapsed * 1024 < nMaxElapsed && nCountMask < (1 << 20))
+        nCountMask = nCountMask * 2 + 1;
+    ++nCount;
+    return true;
+}
+
+map<string, BenchFunction>& CBenchRunner::GetBenchmarks()
+{
+    // Function-local so that it exists before the static registrations
+    static map<string, BenchFunction> mapBenchmarks;
+    return mapBenchmarks;
+}
+
+CBenchRunner::CBenchRunner(const string& strName, BenchFunction func)
+{
+    GetBenchmarks()[strName] = func;
+}
+
+void CBenchRunner::RunAll(const string& strFilter, int64 nMaxElapsed)
+{
+    Array results;
+    for (map<string, BenchFunction>::iterator it = GetBenchmarks().begin(); it != GetBenchmarks().end(); ++it)
+    {
+        if ((*it).first.find(strFilter) == string::npos)
+            continue;
+        CBenchState state(nMaxElapsed);
+        (*it).second(state);
+
+        // Times are in nanoseconds per iteration, rounded so that the output
+        // only changes when the measurement does
+        Object result;
+        result.push_back(Pair("name", (*it).first));
+        result.push_back(Pair("iterations", (boost::int64_t)state.GetIterations()));
+        result.push_back(Pair("total_us", (boost::int64_t)state.GetElapsed()));
+        int64 nAverage = (state.GetIterations() > 0 ? state.GetElapsed() * 1000 / state.GetIterations() : 0);
+        result.push_back(Pair("avg_ns", (boost::int64_t)nAverage));
+        result.push_back(Pair("min_ns", (boost::int64_t)(state.GetMinTime() * 1000 + 0.5)));
+        result.push_back(Pair("max_ns", (boost::int64_t)(state.GetMaxTime() * 1000 + 0.5)));
+        results.push_back(result);
+    }
+
+    Object obj;
+    obj.push_back(Pair("version", FormatFullVersion()));
+    obj.push_back(Pair("benchmarks", results));
+    cout << write_string(Value(obj), true) << endl;
+}
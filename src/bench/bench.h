@@ -0,0 +1,90 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_BENCH_H
+#define PPCOIN_BENCH_H
+
+#include <map>
+#include <string>
+
+#include "util.h"
+
+//
+// Micro-benchmarks for bench_pfn. A benchmark is a function that does its
+// setup, then loops on CBenchState::KeepRunning() around the code being
+// measured:
+//
+//     static void SHA256(CBenchState& state)
+//     {
+//         ...setup...
+//         while (state.KeepRunning())
+//             ...measured code...
+//     }
+//     BENCHMARK(SHA256);
+//
+// The clock is read once per batch of iterations, and the batch grows until
+// it takes a measurable time, so the loop overhead stays negligible.
+//
+class CBenchState
+{
+private:
+    int64 nMaxElapsed;
+    int64 nStartTime;
+    int64 nLastTime;
+    int64 nCount;
+    int64 nCountMask;
+    int64 nLastCount;
+    double dMinTime;
+    double dMaxTime;
+
+public:
+    CBenchState(int64 nMaxElapsedIn) : nMaxElapsed(nMaxElapsedIn), nStartTime(0), nLastTime(0), nCount(0), nCountMask(0), nLastCount(0), dMinTime(0), dMaxTime(0) {}
+
+    bool KeepRunning()
+    {
+        if ((nCount & nCountMask) != 0)
+        {
+            ++nCount;
+            return true;
+        }
+        return UpdateTimer();
+    }
+
+    bool UpdateTimer();
+
+    int64 GetIterations() const { return nCount; }
+    int64 GetElapsed() const { return nLastTime - nStartTime; }
+    double GetMinTime() const { return dMinTime; }
+    double GetMaxTime() const { return dMaxTime; }
+};
+
+typedef void (*BenchFunction)(CBenchState&);
+
+class CBenchRunner
+{
+private:
+    static std::map<std::string, BenchFunction>& GetBenchmarks();
+
+public:
+    CBenchRunner(const std::string& strName, BenchFunction func);
+
+    // Run every benchmark whose name contains strFilter for about
+    // nMaxElapsed microseconds each, and print the results as JSON
+    static void RunAll(const std::string& strFilter, int64 nMaxElapsed);
+};
+
+// Feed the blocks of a bootstrap or blkNNNN.dat style file through
+// ProcessBlock, stopping after nMaxBlocks if it is positive, and print
+// throughput and per-phase validation times as JSON
+bool ReplayBlockFile(const std::string& strFile, int nMaxBlocks);
+
+// Open nPeers loopback connections to the node at strNode, announce nRate
+// transactions per second on each for nSeconds, and print the request
+// latencies, plus the node's CPU and memory use if nPid is its process id
+bool RunLoadGenerator(const std::string& strNode, int nPeers, int nSeconds, int nRate, int nPid);
+
+#define BENCHMARK_CONCAT2(a, b) a ## b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT2(a, b)
+#define BENCHMARK(n) static CBenchRunner BENCHMARK_CONCAT(benchRunner_, __LINE__)(#n, n)
+
+#endif
@@ -0,0 +1,69 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <boost/filesystem.hpp>
+
+#include "bench.h"
+#include "db.h"
+#include "wallet.h"
+
+using namespace std;
+
+CWallet* pwalletMain;
+
+void Shutdown(void* parg)
+{
+    exit(0);
+}
+
+void StartShutdown()
+{
+    exit(0);
+}
+
+int main(int argc, char* argv[])
+{
+    ParseParameters(argc, argv);
+    if (mapArgs.count("-?") || mapArgs.count("--help"))
+    {
+        printf("Usage: bench_pfn [options]\n"
+               "  -filter=<text>   Only run benchmarks whose name contains <text>\n"
+               "  -time=<ms>       Time to spend on each benchmark (default: 1000)\n"
+               "  -replay=<file>   Replay the blocks in <file> instead of running the benchmarks\n"
+               "                   and time its phases with the histograms a node serves with\n"
+               "                   -metricsport=<port>\n"
+               "  -maxblocks=<n>   Stop the replay after <n> blocks\n"
+               "  -loadgen=<addr>  Load the node at <addr> with synthetic peers instead of\n"
+               "                   running the benchmarks\n"
+               "  -peers=<n>       Number of loopback peers for -loadgen (default: 200)\n"
+               "  -duration=<s>    Seconds to run -loadgen for (default: 30)\n"
+               "  -rate=<n>        Transactions announced per second by each peer (default: 1)\n"
+               "  -pid=<n>         Process id of the node, to report its CPU and memory use\n"
+               "  -testnet         Use the test network\n"
+               "  -regtest         Use the regression test chain. With -loadgen, the peers are\n"
+               "                   funded through the node's RPC (-rpcuser, -rpcpassword,\n"
+               "                   -rpcport) and send transactions it relays\n");
+        return 0;
+    }
+
+    fRegTest = GetBoolArg("-regtest");
+    fTestNet = GetBoolArg("-testnet") || fRegTest;
+
+    // The block chain benchmarks append synthetic blocks and transaction
+    // indexes, so they always get a fresh data directory
+    boost::filesystem::path pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("bench_pfn_%%%%%%%%");
+    boost::filesystem::create_directories(pathTemp);
+    mapArgs["-datadir"] = pathTemp.string();
+
+    int nRet = 0;
+    if (mapArgs.count("-loadgen"))
+        nRet = (RunLoadGenerator(mapArgs["-loadgen"], GetArg("-peers", 200), GetArg("-duration", 30), GetArg("-rate", 1), GetArg("-pid", 0)) ? 0 : 1);
+    else if (mapArgs.count("-replay"))
+        nRet = (ReplayBlockFile(mapArgs["-replay"], GetArg("-maxblocks", 0)) ? 0 : 1);
+    else
+        CBenchRunner::RunAll(GetArg("-filter", ""), GetArg("-time", 1000) * 1000);
+
+    DBFlush(true);
+    boost::filesystem::remove_all(pathTemp);
+    return nRet;
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+#include "base58.h"
+#include "key.h"
+
+using namespace std;
+
+extern void SHA256Transform(void* pstate, void* pinput, const void* pinit);
+
+static void SHA256Transform(CBenchState& state)
+{
+    static const unsigned int pSHA256InitState[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    unsigned char pinput[64];
+    for (int i = 0; i < 64; i++)
+        pinput[i] = i;
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        SHA256Transform(&hash, pinput, pSHA256InitState);
+        pinput[0] = hash.Get64() & 0xff;
+    }
+}
+BENCHMARK(SHA256Transform);
+
+// Double SHA-256 of a block header
+static void HashHeader(CBenchState& state)
+{
+    vector<unsigned char> vch(80, 0x5a);
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        hash = Hash(vch.begin(), vch.end());
+        vch[0] = hash.Get64() & 0xff;
+    }
+}
+BENCHMARK(HashHeader);
+
+// Double SHA-256 of a typical transaction sized buffer
+static void Hash1KB(CBenchState& state)
+{
+    vector<unsigned char> vch(1024, 0x5a);
+    uint256 hash;
+    while (state.KeepRunning())
+    {
+        hash = Hash(vch.begin(), vch.end());
+        vch[0] = hash.Get64() & 0xff;
+    }
+}
+BENCHMARK(Hash1KB);
+
+static void KeyVerify(CBenchState& state)
+{
+    CKey key;
+    key.MakeNewKey(false);
+    string strMessage = "bench_pfn";
+    uint256 hash = Hash(strMessage.begin(), strMessage.end());
+    vector<unsigned char> vchSig;
+    key.Sign(hash, vchSig);
+    CKey keyVerify;
+    keyVerify.SetPubKey(key.GetPubKey());
+    while (state.KeepRunning())
+        if (!keyVerify.Verify(hash, vchSig))
+            throw runtime_error("KeyVerify : signature does not verify");
+}
+BENCHMARK(KeyVerify);
+
+static void Base58Encode(CBenchState& state)
+{
+    // Size of a pay-to-pubkey-hash address with version and checksum
+    vector<unsigned char> vch(25);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = i * 37 + 11;
+    while (state.KeepRunning())
+        EncodeBase58(vch);
+}
+BENCHMARK(Base58Encode);
+
+static void Base58Decode(CBenchState& state)
+{
+    vector<unsigned char> vch(25);
+    for (unsigned int i = 0; i < vch.size(); i++)
+        vch[i] = i * 37 + 11;
+    string str = EncodeBase58(vch);
+    while (state.KeepRunning())
+        if (!DecodeBase58(str, vch))
+            throw runtime_error("Base58Decode : decode failed");
+}
+BENCHMARK(Base58Decode);
@@ -0,0 +1,116 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <boost/foreach.hpp>
+
+#include "bench.h"
+#include "kernel.h"
+
+using namespace std;
+
+// Synthetic main chain of 3000 block indexes about ten minutes apart, three
+// quarters of them proof-of-stake, with their stake modifiers computed. The
+// timestamps are after the v0.4 protocol switch.
+struct CBenchChain
+{
+    vector<CBlockIndex*> vIndex;
+    vector<uint256*> vHash;
+
+    CBenchChain()
+    {
+        uint64 nRand = 42;
+        unsigned int nTime = 1840000000;
+        CBlockIndex* pindexPrev = NULL;
+        for (int i = 0; i < 3000; i++)
+        {
+            CBlockIndex* pindex = new CBlockIndex();
+            uint256* phash = new uint256();
+            for (int j = 0; j < 4; j++)
+            {
+                nRand = nRand * 6364136223846793005ULL + 1442695040888963407ULL;
+                *phash <<= 64;
+                *phash |= nRand;
+            }
+            pindex->phashBlock = phash;
+            pindex->pprev = pindexPrev;
+            if (pindexPrev)
+                pindexPrev->pnext = pindex;
+            pindex->nHeight = i;
+            pindex->nTime = nTime;
+            nTime += 300 + (nRand >> 33) % 600;
+            if ((nRand >> 40) % 4 != 0)
+            {
+                pindex->SetProofOfStake();
+                pindex->hashProofOfStake = Hash(phash->begin(), phash->end());
+            }
+            pindex->SetStakeEntropyBit((nRand >> 50) & 1);
+
+            uint64 nStakeModifier = 0;
+            bool fGenerated = false;
+            if (!ComputeNextStakeModifier(pindex, nStakeModifier, fGenerated))
+                throw runtime_error("CBenchChain : ComputeNextStakeModifier failed");
+            pindex->SetStakeModifier(nStakeModifier, fGenerated);
+
+            vIndex.push_back(pindex);
+            vHash.push_back(phash);
+            pindexPrev = pindex;
+        }
+    }
+
+    ~CBenchChain()
+    {
+        ResetStakeModifierCandidates();
+        BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+            delete pindex;
+        BOOST_FOREACH(uint256* phash, vHash)
+            delete phash;
+    }
+};
+
+// Each iteration recomputes the modifiers of the whole 3000 block chain, as
+// connecting those blocks would
+static void ComputeNextStakeModifier(CBenchState& state)
+{
+    CBenchChain chain;
+    while (state.KeepRunning())
+    {
+        BOOST_FOREACH(CBlockIndex* pindex, chain.vIndex)
+        {
+            uint64 nStakeModifier = 0;
+            bool fGenerated = false;
+            ComputeNextStakeModifier(pindex, nStakeModifier, fGenerated);
+        }
+    }
+}
+BENCHMARK(ComputeNextStakeModifier);
+
+// Kernel of a coinstake spending an output of a block early in the chain,
+// after its kernel stake modifier is known
+static void CheckStakeKernelHash(CBenchState& state)
+{
+    CBenchChain chain;
+    CBlockIndex* pindexFrom = chain.vIndex[10];
+
+    CBlock blockFrom;
+    blockFrom.nTime = pindexFrom->nTime;
+    CTransaction txPrev;
+    txPrev.nTime = blockFrom.nTime;
+    txPrev.vout.resize(1);
+    txPrev.vout[0].nValue = 1000 * COIN;
+    COutPoint prevout(txPrev.GetHash(), 0);
+    unsigned int nTimeTx = chain.vIndex.back()->nTime;
+
+    // Make the chain the main chain for the modifier lookup
+    CBlockIndex* pindexBestSave = pindexBest;
+    pindexBest = chain.vIndex.back();
+    uint256 hashBlockFrom = blockFrom.GetHash();
+    mapBlockIndex[hashBlockFrom] = pindexFrom;
+
+    uint256 hashProofOfStake;
+    while (state.KeepRunning())
+        CheckStakeKernelHash(0x1d00ffff, blockFrom, 81, txPrev, prevout, nTimeTx, hashProofOfStake);
+
+    mapBlockIndex.erase(hashBlockFrom);
+    pindexBest = pindexBestSave;
+}
+BENCHMARK(CheckStakeKernelHash);
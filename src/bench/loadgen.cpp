@@ -0,0 +1,627 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "base58.h"
+#include "bench.h"
+#include "bitcoinrpc.h"
+#include "json/json_spirit_writer_template.h"
+#include "keystore.h"
+#include "main.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace json_spirit;
+
+// Handshakes, and answers from the node during the run, are given up on
+// after this long
+static const int64 LOADGEN_TIMEOUT = 30 * 1000000;
+
+// A transaction announced to the node
+struct CLoadInv
+{
+    int64 nTime;
+    CTransaction tx;
+    bool fFunded;
+};
+
+// One loopback connection to the node under test
+struct CLoadPeer
+{
+    SOCKET hSocket;
+    bool fVerack;
+    vector<char> vRecv;
+    vector<char> vSend;
+    int64 nNextInv;
+    int nInvSent;
+    int64 nBlockRequested;
+    map<uint256, CLoadInv> mapInvSent;
+
+    // With -regtest, the coin the peer spends: output nCoinOut of txCoin,
+    // paying to scriptPubKey; nCoinOut is -1 once it has run out
+    CTransaction txCoin;
+    int nCoinOut;
+    CScript scriptPubKey;
+
+    CLoadPeer(SOCKET hSocketIn) : hSocket(hSocketIn), fVerack(false), nNextInv(0), nInvSent(0), nBlockRequested(0), nCoinOut(-1) {}
+};
+
+class CLoadGenerator
+{
+private:
+    CService addrNode;
+    uint256 hashGenesis;
+    vector<CLoadPeer*> vPeers;
+
+    int64 nMessagesSent;
+    int64 nMessagesReceived;
+    int64 nBytesSent;
+    int64 nBytesReceived;
+    int64 nDisconnected;
+    int64 nInvExpired;
+    int64 nRelayExpired;
+    vector<int64> vInvLatency;
+    vector<int64> vBlockLatency;
+    vector<int64> vRelayLatency;
+
+    // Keys of the peers' coins, and the funded transactions sent to the
+    // node by hash, with the time they were announced
+    CBasicKeyStore keystore;
+    map<uint256, int64> mapRelayWait;
+
+    void PushMessage(CLoadPeer* peer, const char* pszCommand, const CDataStream& ssPayload);
+    bool ProcessMessage(CLoadPeer* peer, const string& strCommand, CDataStream& vRecv);
+    bool ProcessRecv(CLoadPeer* peer);
+    void SendLoad(CLoadPeer* peer, int64 nNow, int64 nInterval);
+    bool Poll(int64 nNow, int64 nInterval);
+    void Expire(int64 nNow, int64 nTimeout);
+
+public:
+    CLoadGenerator(const CService& addrNodeIn);
+    ~CLoadGenerator();
+
+    int Connect(int nPeers);
+    int Handshake(int64 nTimeout);
+    bool Fund(int64 nPerPeer);
+    void Run(int64 nDuration, int64 nInterval, int64 nTimeout);
+    void Report(Object& obj) const;
+    int64 GetMessages() const { return nMessagesSent + nMessagesReceived; }
+};
+
+// Node CPU time in microseconds and resident memory in kB, from /proc
+static bool GetProcessUsage(int nPid, int64& nCPUMicros, int64& nRSSKB)
+{
+    ifstream fileStat(strprintf("/proc/%d/stat", nPid).c_str());
+    string strStat;
+    if (!getline(fileStat, strStat))
+        return false;
+    // The fields after the parenthesized command name start at 3; user and
+    // system time are 14 and 15
+    istringstream streamStat(strStat.substr(strStat.rfind(')') + 2));
+    string strField;
+    for (int i = 3; i < 14; i++)
+        streamStat >> strField;
+    int64 nUser = 0, nSystem = 0;
+    streamStat >> nUser >> nSystem;
+    nCPUMicros = (nUser + nSystem) * 1000000 / sysconf(_SC_CLK_TCK);
+
+    ifstream fileStatus(strprintf("/proc/%d/status", nPid).c_str());
+    string strLine;
+    while (getline(fileStatus, strLine))
+    {
+        if (strLine.compare(0, 6, "VmRSS:") == 0)
+        {
+            nRSSKB = atoi64(strLine.substr(6));
+            return true;
+        }
+    }
+    return false;
+}
+
+static void AddLatency(Object& obj, const string& strName, vector<int64> vLatency)
+{
+    Object latency;
+    latency.push_back(Pair("count", (int)vLatency.size()));
+    if (!vLatency.empty())
+    {
+        sort(vLatency.begin(), vLatency.end());
+        int64 nSum = 0;
+        BOOST_FOREACH(int64 n, vLatency)
+            nSum += n;
+        latency.push_back(Pair("avg_us", (boost::int64_t)(nSum / vLatency.size())));
+        latency.push_back(Pair("p50_us", (boost::int64_t)vLatency[vLatency.size() / 2]));
+        latency.push_back(Pair("p99_us", (boost::int64_t)vLatency[vLatency.size() * 99 / 100]));
+        latency.push_back(Pair("max_us", (boost::int64_t)vLatency.back()));
+    }
+    obj.push_back(Pair(strName, latency));
+}
+
+CLoadGenerator::CLoadGenerator(const CService& addrNodeIn) : addrNode(addrNodeIn)
+{
+    hashGenesis = (fRegTest ? hashGenesisBlockRegTest : fTestNet ? hashGenesisBlockTestNet : hashGenesisBlockOfficial);
+    nMessagesSent = nMessagesReceived = nBytesSent = nBytesReceived = nDisconnected = 0;
+    nInvExpired = nRelayExpired = 0;
+}
+
+CLoadGenerator::~CLoadGenerator()
+{
+    BOOST_FOREACH(CLoadPeer* peer, vPeers)
+    {
+        closesocket(peer->hSocket);
+        delete peer;
+    }
+}
+
+void CLoadGenerator::PushMessage(CLoadPeer* peer, const char* pszCommand, const CDataStream& ssPayload)
+{
+    CMessageHeader hdr(pszCommand, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    memcpy(&hdr.nChecksum, &hash, sizeof(hdr.nChecksum));
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
+    ssHeader << hdr;
+    peer->vSend.insert(peer->vSend.end(), ssHeader.begin(), ssHeader.end());
+    peer->vSend.insert(peer->vSend.end(), ssPayload.begin(), ssPayload.end());
+    nMessagesSent++;
+}
+
+bool CLoadGenerator::ProcessMessage(CLoadPeer* peer, const string& strCommand, CDataStream& vRecv)
+{
+    int64 nNow = GetTimeMicros();
+    if (strCommand == "version")
+    {
+        PushMessage(peer, "verack", CDataStream(SER_NETWORK, PROTOCOL_VERSION));
+    }
+    else if (strCommand == "verack")
+    {
+        peer->fVerack = true;
+    }
+    else if (strCommand == "getdata")
+    {
+        // The node asks for the transactions we announced
+        vector<CInv> vInv;
+        vRecv >> vInv;
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            map<uint256, CLoadInv>::iterator mi = peer->mapInvSent.find(inv.hash);
+            if (inv.type != MSG_TX || mi == peer->mapInvSent.end())
+                continue;
+            vInvLatency.push_back(nNow - (*mi).second.nTime);
+            CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+            ssTx << (*mi).second.tx;
+            PushMessage(peer, "tx", ssTx);
+            if ((*mi).second.fFunded)
+                mapRelayWait[inv.hash] = (*mi).second.nTime;
+            peer->mapInvSent.erase(mi);
+        }
+    }
+    else if (strCommand == "inv")
+    {
+        // A funded transaction is relayed once the node announces it to
+        // any of the other peers
+        vector<CInv> vInv;
+        vRecv >> vInv;
+        BOOST_FOREACH(const CInv& inv, vInv)
+        {
+            map<uint256, int64>::iterator mi = mapRelayWait.find(inv.hash);
+            if (inv.type != MSG_TX || mi == mapRelayWait.end())
+                continue;
+            vRelayLatency.push_back(nNow - (*mi).second);
+            mapRelayWait.erase(mi);
+        }
+    }
+    else if (strCommand == "block")
+    {
+        // The block hash only covers the 80 byte header
+        if (vRecv.size() >= 80 && Hash(vRecv.begin(), vRecv.begin() + 80) == hashGenesis && peer->nBlockRequested != 0)
+        {
+            vBlockLatency.push_back(nNow - peer->nBlockRequested);
+            peer->nBlockRequested = 0;
+        }
+    }
+    return true;
+}
+
+bool CLoadGenerator::ProcessRecv(CLoadPeer* peer)
+{
+    static const unsigned int nHeaderSize = ::GetSerializeSize(CMessageHeader(), SER_NETWORK, PROTOCOL_VERSION);
+    while (peer->vRecv.size() >= nHeaderSize)
+    {
+        CMessageHeader hdr;
+        CDataStream ssHeader(&peer->vRecv[0], &peer->vRecv[0] + nHeaderSize, SER_NETWORK, PROTOCOL_VERSION);
+        ssHeader >> hdr;
+        if (!hdr.IsValid())
+            return error("CLoadGenerator::ProcessRecv() : invalid message header");
+        if (peer->vRecv.size() < nHeaderSize + hdr.nMessageSize)
+            break;
+        CDataStream vMsg(&peer->vRecv[0] + nHeaderSize, &peer->vRecv[0] + nHeaderSize + hdr.nMessageSize, SER_NETWORK, PROTOCOL_VERSION);
+        peer->vRecv.erase(peer->vRecv.begin(), peer->vRecv.begin() + nHeaderSize + hdr.nMessageSize);
+        nMessagesReceived++;
+        try {
+            ProcessMessage(peer, hdr.GetCommand(), vMsg);
+        }
+        catch (std::exception& e) {
+            return error("CLoadGenerator::ProcessRecv() : %s", e.what());
+        }
+    }
+    return true;
+}
+
+// Announce a fresh transaction every nInterval, and ask for the genesis
+// block every tenth time. A peer with a coin spends it back to itself, so
+// the node accepts and relays the transaction. Otherwise the transaction
+// spends an output that does not exist, and the node fetches it and keeps
+// it as an orphan without relaying it.
+void CLoadGenerator::SendLoad(CLoadPeer* peer, int64 nNow, int64 nInterval)
+{
+    if (!peer->fVerack || nNow < peer->nNextInv)
+        return;
+    if (peer->nNextInv == 0)
+    {
+        // Spread the peers over the interval
+        peer->nNextInv = nNow + GetRand(nInterval);
+        return;
+    }
+    peer->nNextInv += nInterval;
+
+    CLoadInv loadinv;
+    loadinv.nTime = nNow;
+    loadinv.fFunded = false;
+    CTransaction& tx = loadinv.tx;
+    if (peer->nCoinOut >= 0)
+    {
+        // A transaction may not be older than the ones it spends, and the
+        // node's clock runs ahead after generating blocks
+        int64 nValue = peer->txCoin.vout[peer->nCoinOut].nValue - MIN_TX_FEE;
+        tx.nTime = max(tx.nTime, peer->txCoin.nTime);
+        tx.vin.push_back(CTxIn(COutPoint(peer->txCoin.GetHash(), peer->nCoinOut)));
+        tx.vout.push_back(CTxOut(nValue, peer->scriptPubKey));
+        if (nValue >= MIN_TXOUT_AMOUNT && SignSignature(keystore, peer->txCoin, tx, 0))
+        {
+            loadinv.fFunded = true;
+            peer->txCoin = tx;
+            peer->nCoinOut = 0;
+        }
+        else
+        {
+            tx = CTransaction();
+            peer->nCoinOut = -1;
+        }
+    }
+    if (!loadinv.fFunded)
+    {
+        tx.vin.push_back(CTxIn(COutPoint(GetRandHash(), 0)));
+        tx.vin[0].scriptSig << vector<unsigned char>(72, 0x30) << vector<unsigned char>(33, 0x02);
+        uint256 hashKey = GetRandHash();
+        tx.vout.push_back(CTxOut(COIN, CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(hashKey.begin(), hashKey.begin() + 20) << OP_EQUALVERIFY << OP_CHECKSIG));
+    }
+    uint256 hash = tx.GetHash();
+    peer->mapInvSent[hash] = loadinv;
+
+    CDataStream ssInv(SER_NETWORK, PROTOCOL_VERSION);
+    ssInv << vector<CInv>(1, CInv(MSG_TX, hash));
+    PushMessage(peer, "inv", ssInv);
+
+    if (++peer->nInvSent % 10 == 0 && peer->nBlockRequested == 0)
+    {
+        CDataStream ssGetData(SER_NETWORK, PROTOCOL_VERSION);
+        ssGetData << vector<CInv>(1, CInv(MSG_BLOCK, hashGenesis));
+        PushMessage(peer, "getdata", ssGetData);
+        peer->nBlockRequested = nNow;
+    }
+}
+
+int CLoadGenerator::Connect(int nPeers)
+{
+    for (int i = 0; i < nPeers; i++)
+    {
+        SOCKET hSocket;
+        if (!ConnectSocket(addrNode, hSocket))
+            break;
+#ifdef WIN32
+        u_long nOne = 1;
+        ioctlsocket(hSocket, FIONBIO, &nOne);
+#else
+        fcntl(hSocket, F_SETFL, O_NONBLOCK);
+#endif
+        CLoadPeer* peer = new CLoadPeer(hSocket);
+        vPeers.push_back(peer);
+
+        // The version message is read before the versions are agreed, so
+        // its addresses are serialized without a time
+        CAddress addrYou(addrNode);
+        CAddress addrMe(CService("0.0.0.0", 0));
+        CDataStream ssVersion(SER_NETWORK, MIN_PROTO_VERSION);
+        ssVersion << PROTOCOL_VERSION << (uint64)0 << GetTime() << addrYou << addrMe << GetRand(numeric_limits<uint64>::max()) << string("/bench_pfn:loadgen/") << 0;
+        PushMessage(peer, "version", ssVersion);
+    }
+    return vPeers.size();
+}
+
+// Exchange queued messages with every peer, waiting up to nInterval for
+// traffic. Peers the node disconnects are dropped.
+bool CLoadGenerator::Poll(int64 nNow, int64 nInterval)
+{
+    fd_set fdsetRecv;
+    fd_set fdsetSend;
+    FD_ZERO(&fdsetRecv);
+    FD_ZERO(&fdsetSend);
+    SOCKET hSocketMax = 0;
+    BOOST_FOREACH(CLoadPeer* peer, vPeers)
+    {
+        FD_SET(peer->hSocket, &fdsetRecv);
+        if (!peer->vSend.empty())
+            FD_SET(peer->hSocket, &fdsetSend);
+        hSocketMax = max(hSocketMax, peer->hSocket);
+    }
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = min(nInterval, (int64)50000);
+    if (select(hSocketMax + 1, &fdsetRecv, &fdsetSend, NULL, &timeout) == SOCKET_ERROR)
+        return false;
+
+    char pchBuf[0x10000];
+    for (vector<CLoadPeer*>::iterator it = vPeers.begin(); it != vPeers.end(); )
+    {
+        CLoadPeer* peer = *it;
+        bool fOK = true;
+        if (FD_ISSET(peer->hSocket, &fdsetRecv))
+        {
+            int nBytes = recv(peer->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
+            if (nBytes > 0)
+            {
+                nBytesReceived += nBytes;
+                peer->vRecv.insert(peer->vRecv.end(), pchBuf, pchBuf + nBytes);
+                fOK = ProcessRecv(peer);
+            }
+            else if (nBytes == 0 || WSAGetLastError() != WSAEWOULDBLOCK)
+                fOK = false;
+        }
+        if (fOK && FD_ISSET(peer->hSocket, &fdsetSend))
+        {
+            int nBytes = send(peer->hSocket, &peer->vSend[0], peer->vSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (nBytes > 0)
+            {
+                nBytesSent += nBytes;
+                peer->vSend.erase(peer->vSend.begin(), peer->vSend.begin() + nBytes);
+            }
+            else if (WSAGetLastError() != WSAEWOULDBLOCK)
+                fOK = false;
+        }
+        if (!fOK)
+        {
+            closesocket(peer->hSocket);
+            delete peer;
+            it = vPeers.erase(it);
+            nDisconnected++;
+            continue;
+        }
+        ++it;
+    }
+    return true;
+}
+
+// Forget transactions the node never asked for or never relayed, so that
+// a long run doesn't keep them all
+void CLoadGenerator::Expire(int64 nNow, int64 nTimeout)
+{
+    BOOST_FOREACH(CLoadPeer* peer, vPeers)
+    {
+        for (map<uint256, CLoadInv>::iterator mi = peer->mapInvSent.begin(); mi != peer->mapInvSent.end(); )
+        {
+            if (nNow - (*mi).second.nTime > nTimeout)
+            {
+                peer->mapInvSent.erase(mi++);
+                nInvExpired++;
+            }
+            else
+                ++mi;
+        }
+    }
+    for (map<uint256, int64>::iterator mi = mapRelayWait.begin(); mi != mapRelayWait.end(); )
+    {
+        if (nNow - (*mi).second > nTimeout)
+        {
+            mapRelayWait.erase(mi++);
+            nRelayExpired++;
+        }
+        else
+            ++mi;
+    }
+}
+
+int CLoadGenerator::Handshake(int64 nTimeout)
+{
+    int64 nStart = GetTimeMicros();
+    while (GetTimeMicros() - nStart < nTimeout)
+    {
+        int nVerack = 0;
+        BOOST_FOREACH(CLoadPeer* peer, vPeers)
+            if (peer->fVerack)
+                nVerack++;
+        if (nVerack == (int)vPeers.size())
+            break;
+        if (!Poll(GetTimeMicros(), 50000))
+            break;
+    }
+    int nVerack = 0;
+    BOOST_FOREACH(CLoadPeer* peer, vPeers)
+        if (peer->fVerack)
+            nVerack++;
+    return nVerack;
+}
+
+// Result of an RPC call to the node; an error reply is thrown
+static Value CallNode(const string& strMethod, const Array& params)
+{
+    Object reply = CallRPC(strMethod, params);
+    const Value& error = find_value(reply, "error");
+    if (error.type() != null_type)
+        throw runtime_error(strMethod + " : " + write_string(error, false));
+    return find_value(reply, "result");
+}
+
+// Give each peer a coin of up to nPerPeer from the node's wallet, through
+// its RPC. Blocks are generated until the wallet has that much, or as much
+// as a few rounds give. One transaction pays a new key of every peer, and
+// a further block confirms it.
+bool CLoadGenerator::Fund(int64 nPerPeer)
+{
+    try
+    {
+        int64 nReserve = 100 * MIN_TX_FEE;
+        int64 nBalance = AmountFromValue(CallNode("getbalance", Array()));
+        for (int i = 0; i < 20 && nBalance < nPerPeer * (int64)vPeers.size() + nReserve; i++)
+        {
+            Array params;
+            params.push_back(10);
+            CallNode("generate", params);
+            nBalance = AmountFromValue(CallNode("getbalance", Array()));
+        }
+        int64 nAmount = min(nPerPeer, (nBalance - nReserve) / (int64)vPeers.size());
+        if (nAmount < MIN_TX_FEE + MIN_TXOUT_AMOUNT)
+            return error("CLoadGenerator::Fund() : the node's wallet has %s, not enough to fund %d peers", FormatMoney(nBalance).c_str(), (int)vPeers.size());
+
+        Object sendTo;
+        BOOST_FOREACH(CLoadPeer* peer, vPeers)
+        {
+            CKey key;
+            key.MakeNewKey(true);
+            keystore.AddKey(key);
+            peer->scriptPubKey.SetBitcoinAddress(key.GetPubKey());
+            sendTo.push_back(Pair(CBitcoinAddress(key.GetPubKey()).ToString(), ValueFromAmount(nAmount)));
+        }
+        Array params;
+        params.push_back("");
+        params.push_back(sendTo);
+        string strHash = CallNode("sendmany", params).get_str();
+        Array paramsGenerate;
+        paramsGenerate.push_back(1);
+        CallNode("generate", paramsGenerate);
+
+        Array paramsRaw;
+        paramsRaw.push_back(strHash);
+        vector<unsigned char> vchTx = ParseHex(CallNode("getrawtransaction", paramsRaw).get_str());
+        CDataStream ssTx(vchTx, SER_NETWORK, PROTOCOL_VERSION);
+        CTransaction txFund;
+        ssTx >> txFund;
+        BOOST_FOREACH(CLoadPeer* peer, vPeers)
+        {
+            for (unsigned int i = 0; i < txFund.vout.size(); i++)
+            {
+                if (txFund.vout[i].scriptPubKey == peer->scriptPubKey)
+                {
+                    peer->txCoin = txFund;
+                    peer->nCoinOut = i;
+                }
+            }
+        }
+        printf("CLoadGenerator::Fund() : %s to each of %d peers in %s\n", FormatMoney(nAmount).c_str(), (int)vPeers.size(), strHash.c_str());
+    }
+    catch (std::exception& e)
+    {
+        return error("CLoadGenerator::Fund() : %s", e.what());
+    }
+    return true;
+}
+
+void CLoadGenerator::Run(int64 nDuration, int64 nInterval, int64 nTimeout)
+{
+    // Only count the traffic of the run itself
+    nMessagesSent = nMessagesReceived = nBytesSent = nBytesReceived = 0;
+    int64 nStart = GetTimeMicros();
+    int64 nLastExpire = nStart;
+    int64 nNow;
+    while ((nNow = GetTimeMicros()) - nStart < nDuration && !vPeers.empty())
+    {
+        BOOST_FOREACH(CLoadPeer* peer, vPeers)
+            SendLoad(peer, nNow, nInterval);
+        if (!Poll(nNow, nInterval))
+            break;
+        if (nNow - nLastExpire > 1000000)
+        {
+            Expire(nNow, nTimeout);
+            nLastExpire = nNow;
+        }
+    }
+}
+
+void CLoadGenerator::Report(Object& obj) const
+{
+    obj.push_back(Pair("messages_sent", (boost::int64_t)nMessagesSent));
+    obj.push_back(Pair("messages_received", (boost::int64_t)nMessagesReceived));
+    obj.push_back(Pair("bytes_sent", (boost::int64_t)nBytesSent));
+    obj.push_back(Pair("bytes_received", (boost::int64_t)nBytesReceived));
+    obj.push_back(Pair("disconnected", (boost::int64_t)nDisconnected));
+    obj.push_back(Pair("inv_unanswered", (boost::int64_t)nInvExpired));
+    obj.push_back(Pair("tx_not_relayed", (boost::int64_t)nRelayExpired));
+    AddLatency(obj, "inv_to_getdata", vInvLatency);
+    AddLatency(obj, "getdata_to_block", vBlockLatency);
+    AddLatency(obj, "inv_to_relay", vRelayLatency);
+}
+
+bool RunLoadGenerator(const string& strNode, int nPeers, int nSeconds, int nRate, int nPid)
+{
+    CService addrNode;
+    if (!Lookup(strNode.c_str(), addrNode, GetDefaultPort(), false))
+        return error("RunLoadGenerator() : invalid node address %s", strNode.c_str());
+    if (nPeers > FD_SETSIZE - 16)
+        nPeers = FD_SETSIZE - 16;
+    int64 nInterval = 1000000 / max(nRate, 1);
+
+    Object obj;
+    obj.push_back(Pair("version", FormatFullVersion()));
+    obj.push_back(Pair("node", addrNode.ToString()));
+
+    int64 nCPUBefore = 0, nRSSBefore = 0;
+    bool fUsage = (nPid > 0 && GetProcessUsage(nPid, nCPUBefore, nRSSBefore));
+
+    CLoadGenerator loadgen(addrNode);
+    obj.push_back(Pair("peers_connected", loadgen.Connect(nPeers)));
+    int nPeersReady = loadgen.Handshake(LOADGEN_TIMEOUT);
+    obj.push_back(Pair("peers_ready", nPeersReady));
+    if (nPeersReady == 0)
+        return error("RunLoadGenerator() : no peer completed the handshake with %s", strNode.c_str());
+
+    int64 nCPUIdle = 0, nRSSPeers = 0;
+    if (fUsage && GetProcessUsage(nPid, nCPUIdle, nRSSPeers))
+    {
+        obj.push_back(Pair("node_rss_kb", (boost::int64_t)nRSSBefore));
+        obj.push_back(Pair("node_rss_per_peer_bytes", (boost::int64_t)((nRSSPeers - nRSSBefore) * 1024 / nPeersReady)));
+    }
+
+    // On the regression test chain the peers can be given coins, so that
+    // the node relays what they send. The funding isn't counted in the
+    // node's CPU use.
+    if (fRegTest)
+    {
+        if (!loadgen.Fund((nSeconds * (int64)nRate + 1) * MIN_TX_FEE + MIN_TXOUT_AMOUNT))
+            return false;
+        if (fUsage)
+            GetProcessUsage(nPid, nCPUIdle, nRSSPeers);
+    }
+
+    loadgen.Run(nSeconds * (int64)1000000, nInterval, LOADGEN_TIMEOUT);
+    loadgen.Report(obj);
+
+    // CPU per message counts everything the node did during the run,
+    // divided by the messages exchanged with it
+    int64 nCPUAfter = 0, nRSSAfter = 0;
+    if (fUsage && GetProcessUsage(nPid, nCPUAfter, nRSSAfter))
+    {
+        int64 nMessages = loadgen.GetMessages();
+        obj.push_back(Pair("node_cpu_ms", (boost::int64_t)((nCPUAfter - nCPUIdle) / 1000)));
+        obj.push_back(Pair("node_cpu_us_per_message", (boost::int64_t)(nMessages > 0 ? (nCPUAfter - nCPUIdle) / nMessages : 0)));
+        obj.push_back(Pair("node_rss_after_kb", (boost::int64_t)nRSSAfter));
+    }
+    cout << write_string(Value(obj), true) << endl;
+    return true;
+}
@@ -0,0 +1,53 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+#include "keystore.h"
+#include "script.h"
+
+using namespace std;
+
+// Uncontended lock and unlock of a recursive critical section
+static void LockUnlock(CBenchState& state)
+{
+    CCriticalSection cs;
+    int n = 0;
+    while (state.KeepRunning())
+    {
+        LOCK(cs);
+        n++;
+    }
+}
+BENCHMARK(LockUnlock);
+
+// Uncontended shared lock and unlock, as readers of the key store take it
+static void ReadLockUnlock(CBenchState& state)
+{
+    CSharedCriticalSection cs;
+    int n = 0;
+    while (state.KeepRunning())
+    {
+        READ_LOCK(cs);
+        n++;
+    }
+}
+BENCHMARK(ReadLockUnlock);
+
+// Key store lookup for an address it doesn't have, as IsMine does for most
+// outputs
+static void KeyStoreHaveKey(CBenchState& state)
+{
+    CBasicKeyStore keystore;
+    for (int i = 0; i < 100; i++)
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+    }
+    CKey keyOther;
+    keyOther.MakeNewKey(true);
+    CBitcoinAddress address(keyOther.GetPubKey());
+    while (state.KeepRunning())
+        keystore.HaveKey(address);
+}
+BENCHMARK(KeyStoreHaveKey);
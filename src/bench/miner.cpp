@@ -0,0 +1,84 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <boost/foreach.hpp>
+
+#include "bench.h"
+#include "db.h"
+#include "wallet.h"
+
+using namespace std;
+
+// Block template from a synthetic memory pool of 1000 signed transactions
+// spending confirmed outputs, and 250 more spending outputs of those. The
+// confirmed outputs come from a funding transaction written to the block
+// file and transaction index of the benchmark data directory.
+static void CreateNewBlock(CBenchState& state)
+{
+    if (!LoadBlockIndex())
+        throw runtime_error("CreateNewBlock : LoadBlockIndex failed");
+    CWallet wallet("bench_wallet.dat");
+    bool fFirstRun = true;
+    wallet.LoadWallet(fFirstRun);
+    CReserveKey reservekey(&wallet);
+    CScript scriptPubKey;
+    scriptPubKey.SetBitcoinAddress(reservekey.GetReservedKey());
+
+    int64 nNow = GetAdjustedTime();
+    CTransaction txFund;
+    txFund.nTime = nNow - 3600;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(Hash(BEGIN(nNow), END(nNow)), 0);
+    txFund.vout.resize(1000);
+    BOOST_FOREACH(CTxOut& txout, txFund.vout)
+    {
+        txout.nValue = 100 * COIN;
+        txout.scriptPubKey = scriptPubKey;
+    }
+    {
+        CBlock blockFund;
+        blockFund.vtx.push_back(txFund);
+        unsigned int nFile, nBlockPos;
+        if (!blockFund.WriteToDisk(nFile, nBlockPos))
+            throw runtime_error("CreateNewBlock : WriteToDisk failed");
+        unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(blockFund.vtx.size());
+        CTxDB txdb("r+");
+        if (!txdb.UpdateTxIndex(txFund.GetHash(), CTxIndex(CDiskTxPos(nFile, nBlockPos, nTxPos), txFund.vout.size())))
+            throw runtime_error("CreateNewBlock : UpdateTxIndex failed");
+    }
+
+    vector<CTransaction> vtx;
+    for (unsigned int i = 0; i < 1250; i++)
+    {
+        // The first 1000 spend the funding transaction, the rest the second
+        // output of one of them
+        const CTransaction& txFrom = (i < 1000 ? txFund : vtx[i - 1000]);
+        CTransaction tx;
+        tx.nTime = nNow - 60;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(txFrom.GetHash(), i < 1000 ? i : 1);
+        tx.vout.resize(2);
+        tx.vout[0].nValue = 10 * COIN;
+        tx.vout[0].scriptPubKey = scriptPubKey;
+        tx.vout[1].nValue = txFrom.vout[tx.vin[0].prevout.n].nValue - tx.vout[0].nValue - (1 + i % 4) * MIN_TX_FEE;
+        tx.vout[1].scriptPubKey = scriptPubKey;
+        if (!SignSignature(wallet, txFrom, tx, 0))
+            throw runtime_error("CreateNewBlock : SignSignature failed");
+        vtx.push_back(tx);
+    }
+    BOOST_FOREACH(CTransaction& tx, vtx)
+        mempool.addUnchecked(tx);
+
+    while (state.KeepRunning())
+    {
+        CBlock* pblock = CreateNewBlock(reservekey, &wallet);
+        if (!pblock || pblock->vtx.size() != vtx.size() + 1)
+            throw runtime_error("CreateNewBlock : block template is missing transactions");
+        delete pblock;
+    }
+
+    BOOST_FOREACH(CTransaction& tx, vtx)
+        mempool.remove(tx);
+    reservekey.ReturnKey();
+}
+BENCHMARK(CreateNewBlock);
@@ -0,0 +1,123 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <iostream>
+#include <boost/filesystem.hpp>
+
+#include "bench.h"
+#include "json/json_spirit_writer_template.h"
+#include "main.h"
+#include "metrics.h"
+
+using namespace std;
+using namespace json_spirit;
+
+static boost::uintmax_t GetBlockFilesSize()
+{
+    boost::uintmax_t nSize = 0;
+    for (unsigned int nFile = 1; ; nFile++)
+    {
+        boost::filesystem::path pathBlockFile = GetDataDir() / strprintf("blk%04d.dat", nFile);
+        if (!boost::filesystem::exists(pathBlockFile))
+            break;
+        nSize += boost::filesystem::file_size(pathBlockFile);
+    }
+    return nSize;
+}
+
+static int64 PerSecond(int64 n, int64 nMicros)
+{
+    return (nMicros > 0 ? n * 1000000 / nMicros : 0);
+}
+
+bool ReplayBlockFile(const string& strFile, int nMaxBlocks)
+{
+    fMetrics = true;
+    if (!LoadBlockIndex())
+        return error("ReplayBlockFile() : LoadBlockIndex failed");
+
+    CAutoFile filein = CAutoFile(fopen(strFile.c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReplayBlockFile() : cannot open %s", strFile.c_str());
+
+    unsigned char pchMessageStart[4];
+    GetMessageStart(pchMessageStart, true);
+    boost::uintmax_t nBlockFilesBefore = GetBlockFilesSize();
+    int64 nSignatureChecksBefore = metricSignatureChecks.Get().Get();
+    int64 nBytesWrittenBefore = metricDBBytesWritten.Get().Get();
+
+    int nBlocks = 0;
+    int nRejected = 0;
+    int nSkipped = 0;
+    int64 nTransactions = 0;
+    int64 nStart = GetTimeMicros();
+    while (nMaxBlocks <= 0 || nBlocks + nRejected < nMaxBlocks)
+    {
+        // Find the next record header, resyncing byte by byte after junk
+        unsigned char pchHeader[4];
+        if (fread(pchHeader, 1, 4, filein) != 4)
+            break;
+        while (memcmp(pchHeader, pchMessageStart, 4) != 0)
+        {
+            memmove(pchHeader, pchHeader + 1, 3);
+            if (fread(pchHeader + 3, 1, 1, filein) != 1)
+                break;
+        }
+        if (memcmp(pchHeader, pchMessageStart, 4) != 0)
+            break;
+
+        unsigned int nSize;
+        CBlock block;
+        try {
+            filein >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                continue;
+            filein >> block;
+        }
+        catch (std::exception &e) {
+            break;
+        }
+
+        LOCK(cs_main);
+        if (mapBlockIndex.count(block.GetHash()))
+        {
+            nSkipped++;
+            continue;
+        }
+        if (ProcessBlock(NULL, &block))
+        {
+            nBlocks++;
+            nTransactions += block.vtx.size();
+        }
+        else
+            nRejected++;
+    }
+    int64 nElapsed = GetTimeMicros() - nStart;
+
+    // SetBestChain includes the connect phases, which include the second
+    // CheckBlock done by ConnectBlock
+    Object phases;
+    phases.push_back(Pair("checkblock", (boost::int64_t)(metricCheckBlock.Get().GetSumMicros() / 1000)));
+    phases.push_back(Pair("fetchinputs", (boost::int64_t)(metricFetchInputs.Get().GetSumMicros() / 1000)));
+    phases.push_back(Pair("connectinputs", (boost::int64_t)(metricConnectInputs.Get().GetSumMicros() / 1000)));
+    phases.push_back(Pair("setbestchain", (boost::int64_t)(metricSetBestChain.Get().GetSumMicros() / 1000)));
+
+    int64 nSignatureChecks = metricSignatureChecks.Get().Get() - nSignatureChecksBefore;
+    Object obj;
+    obj.push_back(Pair("version", FormatFullVersion()));
+    obj.push_back(Pair("blocks", nBlocks));
+    obj.push_back(Pair("transactions", (boost::int64_t)nTransactions));
+    obj.push_back(Pair("skipped", nSkipped));
+    obj.push_back(Pair("rejected", nRejected));
+    obj.push_back(Pair("height", nBestHeight));
+    obj.push_back(Pair("elapsed_ms", (boost::int64_t)(nElapsed / 1000)));
+    obj.push_back(Pair("blocks_per_s", (boost::int64_t)PerSecond(nBlocks, nElapsed)));
+    obj.push_back(Pair("transactions_per_s", (boost::int64_t)PerSecond(nTransactions, nElapsed)));
+    obj.push_back(Pair("signature_checks", (boost::int64_t)nSignatureChecks));
+    obj.push_back(Pair("signature_checks_per_s", (boost::int64_t)PerSecond(nSignatureChecks, nElapsed)));
+    obj.push_back(Pair("db_bytes_written", (boost::int64_t)(metricDBBytesWritten.Get().Get() - nBytesWrittenBefore)));
+    obj.push_back(Pair("blockfile_bytes_written", (boost::int64_t)(GetBlockFilesSize() - nBlockFilesBefore)));
+    obj.push_back(Pair("phases_ms", phases));
+    cout << write_string(Value(obj), true) << endl;
+    return true;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+#include "keystore.h"
+#include "main.h"
+
+using namespace std;
+
+extern uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
+
+// A pay-to-pubkey-hash output and a two input transaction spending it
+struct CBenchP2PKH
+{
+    CBasicKeyStore keystore;
+    CTransaction txFrom;
+    CTransaction txTo;
+
+    CBenchP2PKH()
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        keystore.AddKey(key);
+
+        txFrom.vout.resize(2);
+        for (int i = 0; i < 2; i++)
+        {
+            txFrom.vout[i].nValue = (i + 1) * COIN;
+            txFrom.vout[i].scriptPubKey.SetBitcoinAddress(key.GetPubKey());
+        }
+
+        txTo.vin.resize(2);
+        txTo.vout.resize(2);
+        for (int i = 0; i < 2; i++)
+        {
+            txTo.vin[i].prevout = COutPoint(txFrom.GetHash(), i);
+            txTo.vout[i].nValue = COIN;
+            txTo.vout[i].scriptPubKey.SetBitcoinAddress(key.GetPubKey());
+        }
+        for (int i = 0; i < 2; i++)
+            if (!SignSignature(keystore, txFrom, txTo, i))
+                throw runtime_error("CBenchP2PKH : signing failed");
+    }
+};
+
+static void SignatureHash(CBenchState& state)
+{
+    CBenchP2PKH p2pkh;
+    while (state.KeepRunning())
+        SignatureHash(p2pkh.txFrom.vout[0].scriptPubKey, p2pkh.txTo, 0, SIGHASH_ALL);
+}
+BENCHMARK(SignatureHash);
+
+// scriptSig then scriptPubKey, as VerifyScript runs them
+static void EvalScriptP2PKH(CBenchState& state)
+{
+    CBenchP2PKH p2pkh;
+    const CScript& scriptSig = p2pkh.txTo.vin[0].scriptSig;
+    const CScript& scriptPubKey = p2pkh.txFrom.vout[0].scriptPubKey;
+    vector<vector<unsigned char> > stack;
+    while (state.KeepRunning())
+    {
+        stack.clear();
+        if (!EvalScript(stack, scriptSig, p2pkh.txTo, 0, 0) || !EvalScript(stack, scriptPubKey, p2pkh.txTo, 0, 0))
+            throw runtime_error("EvalScriptP2PKH : script failed");
+    }
+}
+BENCHMARK(EvalScriptP2PKH);
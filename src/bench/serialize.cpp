@@ -0,0 +1,58 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include "bench.h"
+#include "main.h"
+
+using namespace std;
+
+// Block of 500 one-input two-output transactions, about 115KB on the wire
+static CBlock BenchBlock()
+{
+    CBlock block;
+    block.nTime = 1400000000;
+    block.nBits = 0x1d00ffff;
+    for (int i = 0; i < 500; i++)
+    {
+        CTransaction tx;
+        tx.nTime = block.nTime;
+        tx.vin.resize(1);
+        tx.vin[0].prevout = COutPoint(Hash(BEGIN(i), END(i)), i % 3);
+        tx.vin[0].scriptSig = CScript() << vector<unsigned char>(72, i & 0xff) << vector<unsigned char>(33, 0x02);
+        tx.vout.resize(2);
+        for (int j = 0; j < 2; j++)
+        {
+            tx.vout[j].nValue = (i + j + 1) * CENT;
+            tx.vout[j].scriptPubKey = CScript() << OP_DUP << OP_HASH160 << vector<unsigned char>(20, j) << OP_EQUALVERIFY << OP_CHECKSIG;
+        }
+        block.vtx.push_back(tx);
+    }
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+static void SerializeBlock(CBenchState& state)
+{
+    CBlock block = BenchBlock();
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.reserve(::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    while (state.KeepRunning())
+    {
+        ss.clear();
+        ss << block;
+    }
+}
+BENCHMARK(SerializeBlock);
+
+static void DeserializeBlock(CBenchState& state)
+{
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << BenchBlock();
+    while (state.KeepRunning())
+    {
+        CDataStream ss(ssBlock.begin(), ssBlock.end(), SER_NETWORK, PROTOCOL_VERSION);
+        CBlock block;
+        ss >> block;
+    }
+}
+BENCHMARK(DeserializeBlock);
@@ -11,8 +11,11 @@
 #include "net.h"
 #include "init.h"
 #include "checkpoints.h"
+#include "config.h"
+#include "metrics.h"
 #include "ui_interface.h"
 #include "bitcoinrpc.h"
+#include "jsonparse.h"
 
 #undef printf
 #include <boost/asio.hpp>
@@ -206,8 +209,13 @@ string CRPCTable::help(string strCommand) const
         try
         {
             Array params;
+            if (pcmd->streamer)
+            {
+                CRPCStreamWriter writer;
+                (*pcmd->streamer)(params, true, writer);
+            }
             rpcfn_type pfn = pcmd->actor;
-            if (setDone.insert(pfn).second)
+            if (pfn && setDone.insert(pfn).second)
                 (*pfn)(params, true);
         }
         catch (std::exception& e)
@@ -333,6 +341,68 @@ Value getpeerinfo(const Array& params, bool fHelp)
     return ret;
 }
 
+Value getlockstats(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getlockstats [reset=false]\n"
+            "Returns acquisition counts, wait and hold times in milliseconds per lock site,\n"
+            "ordered by total wait time. Requires -lockprofile.\n"
+            "If [reset] is true, the counters are cleared.");
+
+    if (!fLockProfile)
+        throw JSONRPCError(-1, "Error: lock profiling is disabled, restart with -lockprofile");
+
+    bool fReset = false;
+    if (params.size() > 0)
+        fReset = params[0].get_bool();
+
+    vector<CLockStats> vStats;
+    GetLockStats(vStats, fReset);
+
+    Array ret;
+    BOOST_FOREACH(const CLockStats& stats, vStats)
+    {
+        Object obj;
+        obj.push_back(Pair("lock", stats.strName));
+        obj.push_back(Pair("location", stats.strLocation));
+        obj.push_back(Pair("count", (boost::int64_t)stats.nCount));
+        obj.push_back(Pair("contended", (boost::int64_t)stats.nContended));
+        obj.push_back(Pair("waittime", (double)stats.nWaitMicros / 1000));
+        obj.push_back(Pair("maxwaittime", (double)stats.nMaxWaitMicros / 1000));
+        obj.push_back(Pair("holdtime", (double)stats.nHoldMicros / 1000));
+        ret.push_back(obj);
+    }
+
+    return ret;
+}
+
+Value setconfig(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() == 1 || params.size() > 2)
+        throw runtime_error(
+            "setconfig [<name> <value>]\n"
+            "Changes the runtime setting <name> (such as keypool or reservebalance)\n"
+            "as if started with -<name>=<value>, until restart.\n"
+            "Settings such as maxconnections that are sized at startup can't be changed.\n"
+            "Returns the current value of all settings.");
+
+    if (params.size() == 2)
+    {
+        string strError;
+        string strValue = (params[1].type() == str_type ? params[1].get_str() : write_string(params[1], false));
+        if (!SetConfig(params[0].get_str(), strValue, strError))
+            throw JSONRPCError(-8, strError);
+    }
+
+    vector<pair<string, string> > vConfig;
+    GetConfig(vConfig);
+    Object ret;
+    for (unsigned int i = 0; i < vConfig.size(); i++)
+        ret.push_back(Pair(vConfig[i].first.substr(1), vConfig[i].second));
+    return ret;
+}
+
 
 Value getdifficulty(const Array& params, bool fHelp)
 {
@@ -386,6 +456,59 @@ Value setgenerate(const Array& params, bool fHelp)
 }
 
 
+// PFN: mine or mint blocks on the regression test chain without waiting
+Value generate(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "generate <nblocks> [proofofstake=false]\n"
+            "Immediately mine <nblocks> proof-of-work blocks, or mint proof-of-stake blocks, to the wallet.\n"
+            "Only available with -regtest. The node's clock is moved forward by the target spacing\n"
+            "for each block so that coins mature and gain age.\n"
+            "Returns the hashes of the new blocks.");
+
+    if (!fRegTest)
+        throw JSONRPCError(-32601, "generate is only available with -regtest");
+    if (pwalletMain->IsLocked())
+        throw JSONRPCError(-13, "Error: Please enter the wallet passphrase with walletpassphrase first.");
+
+    int nBlocks = params[0].get_int();
+    bool fProofOfStake = (params.size() > 1 && params[1].get_bool());
+
+    CReserveKey reservekey(pwalletMain);
+    unsigned int nExtraNonce = 0;
+    Array ret;
+    for (int i = 0; i < nBlocks; i++)
+    {
+        int64 nBlockTime = pindexBest->GetBlockTime() + STAKE_TARGET_SPACING;
+        if (nBlockTime > GetTime())
+            AdvanceTime(nBlockTime - GetTime());
+
+        CBlockIndex* pindexPrev = pindexBest;
+        auto_ptr<CBlock> pblock(CreateNewBlock(reservekey, pwalletMain, fProofOfStake));
+        if (!pblock.get())
+            throw JSONRPCError(-7, "Out of memory");
+        if (fProofOfStake && !pblock->IsProofOfStake())
+            throw JSONRPCError(-6, "No stake kernel found, coins may be too young");
+        IncrementExtraNonce(pblock.get(), pindexPrev, nExtraNonce);
+
+        if (pblock->IsProofOfWork())
+        {
+            uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+            while (pblock->GetHash() > hashTarget)
+                pblock->nNonce++;
+        }
+
+        if (!pblock->SignBlock(*pwalletMain))
+            throw JSONRPCError(-100, "Unable to sign block, wallet locked?");
+        if (!CheckWork(pblock.get(), *pwalletMain, reservekey))
+            throw JSONRPCError(-1, "Generated block was not accepted");
+        ret.push_back(pblock->GetHash().GetHex());
+    }
+    return ret;
+}
+
+
 Value gethashespersec(const Array& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -818,16 +941,21 @@ Value getreceivedbyaddress(const Array& params, bool fHelp)
 
     // Tally
     int64 nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    const map<CBitcoinAddress, vector<COutPoint> >& mapAddressReceived = pwalletMain->GetAddressReceived();
+    map<CBitcoinAddress, vector<COutPoint> >::const_iterator mi = mapAddressReceived.find(address);
+    if (mi != mapAddressReceived.end())
     {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !wtx.IsFinal())
-            continue;
+        BOOST_FOREACH(const COutPoint& outpoint, (*mi).second)
+        {
+            const CWalletTx& wtx = pwalletMain->mapWallet[outpoint.hash];
+            if (!wtx.IsFinal())
+                continue;
 
-        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            const CTxOut& txout = wtx.vout[outpoint.n];
             if (txout.scriptPubKey == scriptPubKey)
                 if (wtx.GetDepthInMainChain() >= nMinDepth)
                     nAmount += txout.nValue;
+        }
     }
 
     return  ValueFromAmount(nAmount);
@@ -865,18 +993,18 @@ Value getreceivedbyaccount(const Array& params, bool fHelp)
 
     // Tally
     int64 nAmount = 0;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    const map<CBitcoinAddress, vector<COutPoint> >& mapAddressReceived = pwalletMain->GetAddressReceived();
+    BOOST_FOREACH(const CBitcoinAddress& address, setAddress)
     {
-        const CWalletTx& wtx = (*it).second;
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !wtx.IsFinal())
+        map<CBitcoinAddress, vector<COutPoint> >::const_iterator mi = mapAddressReceived.find(address);
+        if (mi == mapAddressReceived.end() || !pwalletMain->HaveKey(address))
             continue;
 
-        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        BOOST_FOREACH(const COutPoint& outpoint, (*mi).second)
         {
-            CBitcoinAddress address;
-            if (ExtractAddress(txout.scriptPubKey, address) && pwalletMain->HaveKey(address) && setAddress.count(address))
-                if (wtx.GetDepthInMainChain() >= nMinDepth)
-                    nAmount += txout.nValue;
+            const CWalletTx& wtx = pwalletMain->mapWallet[outpoint.hash];
+            if (wtx.IsFinal() && wtx.GetDepthInMainChain() >= nMinDepth)
+                nAmount += wtx.vout[outpoint.n].nValue;
         }
     }
 
@@ -884,35 +1012,9 @@ Value getreceivedbyaccount(const Array& params, bool fHelp)
 }
 
 
-int64 GetAccountBalance(CWalletDB& walletdb, const string& strAccount, int nMinDepth)
-{
-    int64 nBalance = 0;
-
-    // Tally wallet transactions
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
-    {
-        const CWalletTx& wtx = (*it).second;
-        if (!wtx.IsFinal())
-            continue;
-
-        int64 nGenerated, nReceived, nSent, nFee;
-        wtx.GetAccountAmounts(strAccount, nGenerated, nReceived, nSent, nFee);
-
-        if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
-            nBalance += nReceived;
-        nBalance += nGenerated - nSent - nFee;
-    }
-
-    // Tally internal accounting entries
-    nBalance += walletdb.GetAccountCreditDebit(strAccount);
-
-    return nBalance;
-}
-
 int64 GetAccountBalance(const string& strAccount, int nMinDepth)
 {
-    CWalletDB walletdb(pwalletMain->strWalletFile);
-    return GetAccountBalance(walletdb, strAccount, nMinDepth);
+    return pwalletMain->GetAccountBalance(strAccount, nMinDepth);
 }
 
 
@@ -1012,6 +1114,8 @@ Value movecmd(const Array& params, bool fHelp)
 
     if (!walletdb.TxnCommit())
         throw JSONRPCError(-20, "database error");
+    pwalletMain->AddAccountCreditDebit(strFrom, -nAmount);
+    pwalletMain->AddAccountCreditDebit(strTo, nAmount);
 
     return true;
 }
@@ -1236,25 +1340,25 @@ Value ListReceived(const Array& params, bool fByAccounts)
 
     // Tally
     map<CBitcoinAddress, tallyitem> mapTally;
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); ++it)
+    const map<CBitcoinAddress, vector<COutPoint> >& mapAddressReceived = pwalletMain->GetAddressReceived();
+    for (map<CBitcoinAddress, vector<COutPoint> >::const_iterator it = mapAddressReceived.begin(); it != mapAddressReceived.end(); ++it)
     {
-        const CWalletTx& wtx = (*it).second;
-
-        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !wtx.IsFinal())
+        const CBitcoinAddress& address = (*it).first;
+        if (!pwalletMain->HaveKey(address) || !address.IsValid())
             continue;
 
-        int nDepth = wtx.GetDepthInMainChain();
-        if (nDepth < nMinDepth)
-            continue;
-
-        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+        BOOST_FOREACH(const COutPoint& outpoint, (*it).second)
         {
-            CBitcoinAddress address;
-            if (!ExtractAddress(txout.scriptPubKey, address) || !pwalletMain->HaveKey(address) || !address.IsValid())
+            const CWalletTx& wtx = pwalletMain->mapWallet[outpoint.hash];
+            if (!wtx.IsFinal())
+                continue;
+
+            int nDepth = wtx.GetDepthInMainChain();
+            if (nDepth < nMinDepth)
                 continue;
 
             tallyitem& item = mapTally[address];
-            item.nAmount += txout.nValue;
+            item.nAmount += wtx.vout[outpoint.n].nValue;
             item.nConf = min(item.nConf, nDepth);
         }
     }
@@ -1436,7 +1540,17 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Ar
     }
 }
 
-Value listtransactions(const Array& params, bool fHelp)
+// An item of listtransactions, a wallet transaction or an accounting entry,
+// and the number of its first entry counting from the newest
+struct CListTransactionsItem
+{
+    uint256 hashTx;
+    CAccountingEntry* pacentry;
+    int nFirst;
+    int nEntries;
+};
+
+void listtransactions(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() > 3)
         throw runtime_error(
@@ -1458,7 +1572,6 @@ Value listtransactions(const Array& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(-8, "Negative from");
 
-    Array ret;
     CWalletDB walletdb(pwalletMain->strWalletFile);
 
     // First: get all CWalletTx and CAccountingEntry into a sorted-by-time multimap.
@@ -1480,38 +1593,54 @@ Value listtransactions(const Array& params, bool fHelp)
         txByTime.insert(make_pair(entry.nTime, TxPair((CWalletTx*)0, &entry)));
     }
 
-    // iterate backwards until we have nCount items to return:
-    for (TxItems::reverse_iterator it = txByTime.rbegin(); it != txByTime.rend(); ++it)
+    // Entries newest to oldest are numbered from 0; iterate backwards
+    // until we have the items holding [nFrom, nFrom+nCount). Only where
+    // each item is found is kept, its entries are built again when written.
+    vector<CListTransactionsItem> vItems;
+    int nEntries = 0;
+    for (TxItems::reverse_iterator it = txByTime.rbegin(); it != txByTime.rend() && nEntries < nCount+nFrom; ++it)
     {
+        Array entries;
+        CListTransactionsItem item;
         CWalletTx *const pwtx = (*it).second.first;
+        item.hashTx = (pwtx != 0 ? pwtx->GetHash() : 0);
         if (pwtx != 0)
-            ListTransactions(*pwtx, strAccount, 0, true, ret);
-        CAccountingEntry *const pacentry = (*it).second.second;
-        if (pacentry != 0)
-            AcentryToJSON(*pacentry, strAccount, ret);
-
-        if (ret.size() >= (nCount+nFrom)) break;
+            ListTransactions(*pwtx, strAccount, 0, true, entries);
+        item.pacentry = (*it).second.second;
+        if (item.pacentry != 0)
+            AcentryToJSON(*item.pacentry, strAccount, entries);
+        item.nFirst = nEntries;
+        item.nEntries = entries.size();
+        nEntries += item.nEntries;
+        if (item.nEntries > 0 && nEntries > nFrom)
+            vItems.push_back(item);
+    }
+
+    // Write them oldest to newest. The wallet may change while a chunk is
+    // sent, so transactions are found again by hash.
+    writer.BeginArray();
+    BOOST_REVERSE_FOREACH(const CListTransactionsItem& item, vItems)
+    {
+        Array entries;
+        if (item.pacentry != 0)
+            AcentryToJSON(*item.pacentry, strAccount, entries);
+        else
+        {
+            map<uint256, CWalletTx>::const_iterator mi = pwalletMain->mapWallet.find(item.hashTx);
+            if (mi == pwalletMain->mapWallet.end())
+                continue;
+            ListTransactions((*mi).second, strAccount, 0, true, entries);
+        }
+        for (int i = min((int)entries.size(), item.nEntries) - 1; i >= 0; i--)
+        {
+            int nEntry = item.nFirst + i;
+            if (nEntry >= nFrom && nEntry < nFrom + nCount)
+                writer.Write(entries[i]);
+        }
     }
-    // ret is newest to oldest
-    
-    if (nFrom > (int)ret.size())
-        nFrom = ret.size();
-    if ((nFrom + nCount) > (int)ret.size())
-        nCount = ret.size() - nFrom;
-    Array::iterator first = ret.begin();
-    std::advance(first, nFrom);
-    Array::iterator last = ret.begin();
-    std::advance(last, nFrom+nCount);
-
-    if (last != ret.end()) ret.erase(last, ret.end());
-    if (first != ret.begin()) ret.erase(ret.begin(), first);
-
-    std::reverse(ret.begin(), ret.end()); // Return oldest to newest
-
-    return ret;
 }
 
-Value listaccounts(const Array& params, bool fHelp)
+void listaccounts(const Array& params, bool fHelp, CRPCStreamWriter& writer)
 {
     if (fHelp || params.size() > 1)
         throw runtime_error(
@@ -1555,11 +1684,10 @@ Value listaccounts(const Array& params, bool fHelp)
     BOOST_FOREACH(const CAccountingEntry& entry, acentries)
         mapAccountBalances[entry.strAccount] += entry.nCreditDebit;
 
-    Object ret;
+    writer.BeginObject();
     BOOST_FOREACH(const PAIRTYPE(string, int64)& accountBalance, mapAccountBalances) {
-        ret.push_back(Pair(accountBalance.first, ValueFromAmount(accountBalance.second)));
+        writer.Write(accountBalance.first, ValueFromAmount(accountBalance.second));
     }
-    return ret;
 }
 
 Value listsinceblock(const Array& params, bool fHelp)
@@ -1690,7 +1818,7 @@ Value keypoolrefill(const Array& params, bool fHelp)
 
     pwalletMain->TopUpKeyPool();
 
-    if (pwalletMain->GetKeyPoolSize() < GetArg("-keypool", 100))
+    if (pwalletMain->GetKeyPoolSize() < configKeyPool.Get())
         throw JSONRPCError(-4, "Error refreshing keypool.");
 
     return Value::null;
@@ -2241,10 +2369,7 @@ Value getblockhash(const Array& params, bool fHelp)
     if (nHeight < 0 || nHeight > nBestHeight)
         throw runtime_error("Block number out of range.");
 
-    CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hashBestChain];
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
+    CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
     return pblockindex->phashBlock->GetHex();
 }
 
@@ -2269,6 +2394,122 @@ Value getblock(const Array& params, bool fHelp)
     return blockToJSON(block, pblockindex, params.size() > 1 ? params[1].get_bool() : false);
 }
 
+void getblockrange(const Array& params, bool fHelp, CRPCStreamWriter& writer)
+{
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "getblockrange <start> <count> [txinfo]\n"
+            "txinfo optional to print more detailed tx info\n"
+            "Returns details of up to <count> blocks of the best block chain, from height <start> on.\n"
+            "At most 1000 blocks are returned per call. If the best chain changes while they are\n"
+            "sent, the list stops at the last block of the old chain, so it may hold fewer blocks;\n"
+            "call again from the height after the last one returned.");
+
+    int nStart = params[0].get_int();
+    if (nStart < 0 || nStart > nBestHeight)
+        throw runtime_error("Block number out of range.");
+    int nCount = params[1].get_int();
+    if (nCount < 0)
+        throw runtime_error("Negative count");
+    nCount = min(nCount, min(1000, nBestHeight - nStart + 1));
+    bool fTxInfo = params.size() > 2 ? params[2].get_bool() : false;
+
+    // Each block is looked up again by height, as the chain may change
+    // while a chunk is being sent. The list ends where the next block no
+    // longer follows the last one written, so it never mixes two chains.
+    writer.BeginArray();
+    uint256 hashLast = 0;
+    for (int nHeight = nStart; nHeight < nStart + nCount; nHeight++)
+    {
+        CBlock block;
+        CBlockIndex* pblockindex = FindBlockByHeight(nHeight);
+        if (!pblockindex)
+            break;
+        if (nHeight > nStart && (!pblockindex->pprev || pblockindex->pprev->GetBlockHash() != hashLast))
+            break;
+        hashLast = pblockindex->GetBlockHash();
+        if (!block.ReadFromDisk(pblockindex, true))
+            throw JSONRPCError(-20, "Block read failed");
+        writer.Write(blockToJSON(block, pblockindex, fTxInfo));
+    }
+}
+
+
+// Raw serialized data as a JSON string in the format named by params[nParam]
+static Value RawDataToJSON(const vector<char>& vch, const Array& params, unsigned int nParam)
+{
+    string strFormat = params.size() > nParam ? params[nParam].get_str() : "hex";
+    const unsigned char* pbegin = (const unsigned char*)&vch[0];
+    if (strFormat == "hex")
+        return HexStr(pbegin, pbegin + vch.size());
+    if (strFormat == "base64")
+        return EncodeBase64(pbegin, vch.size());
+    throw JSONRPCError(-8, "Invalid format, use hex or base64");
+}
+
+Value getrawblock(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getrawblock <hash> [format=hex]\n"
+            "Returns the serialized block with given block-hash as stored on disk.\n"
+            "[format] is hex or base64.");
+
+    uint256 hash(params[0].get_str());
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        throw JSONRPCError(-5, "Block not found");
+
+    vector<char> vch;
+    if (!ReadBlockBytes((*mi).second->nFile, (*mi).second->nBlockPos, vch))
+        throw JSONRPCError(-20, "Block read failed");
+    return RawDataToJSON(vch, params, 1);
+}
+
+Value getrawtransaction(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getrawtransaction <txid> [format=hex]\n"
+            "Returns the serialized transaction <txid> from the memory pool or the block chain.\n"
+            "[format] is hex or base64.");
+
+    uint256 hash(params[0].get_str());
+    vector<char> vch;
+    {
+        LOCK(mempool.cs);
+        if (mempool.exists(hash))
+        {
+            CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+            ss << mempool.lookup(hash);
+            vch.assign(ss.begin(), ss.end());
+        }
+    }
+    if (vch.empty())
+    {
+        CTxIndex txindex;
+        if (!CTxDB("r").ReadTxIndex(hash, txindex))
+            throw JSONRPCError(-5, "No information available about transaction");
+        if (!ReadTransactionBytes(txindex.pos, vch))
+            throw JSONRPCError(-20, "Transaction read failed");
+    }
+    return RawDataToJSON(vch, params, 1);
+}
+
+Value getrawmempool(const Array& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getrawmempool\n"
+            "Returns all transaction ids in memory pool.");
+
+    Array ret;
+    LOCK(mempool.cs);
+    for (map<uint256, CTransaction>::const_iterator mi = mempool.mapTx.begin(); mi != mempool.mapTx.end(); ++mi)
+        ret.push_back((*mi).first.GetHex());
+    return ret;
+}
+
 
 // PFN: get information of sync-checkpoint
 Value getcheckpoint(const Array& params, bool fHelp)
@@ -2314,20 +2555,18 @@ Value reservebalance(const Array& params, bool fHelp)
             nAmount = (nAmount / CENT) * CENT;  // round to cent
             if (nAmount < 0)
                 throw runtime_error("amount cannot be negative.\n");
-            mapArgs["-reservebalance"] = FormatMoney(nAmount).c_str();
+            configReserveBalance.Set(FormatMoney(nAmount));
         }
         else
         {
             if (params.size() > 1)
                 throw runtime_error("cannot specify amount to turn off reserve.\n");
-            mapArgs["-reservebalance"] = "0";
+            configReserveBalance.Set("0");
         }
     }
 
     Object result;
-    int64 nReserveBalance = 0;
-    if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-        throw runtime_error("invalid reserve balance amount\n");
+    int64 nReserveBalance = configReserveBalance.Get();
     result.push_back(Pair("reserve", (nReserveBalance > 0)));
     result.push_back(Pair("amount", ValueFromAmount(nReserveBalance)));
     return result;
@@ -2484,63 +2723,70 @@ Value sendalert(const Array& params, bool fHelp)
 
 
 static const CRPCCommand vRPCCommands[] =
-{ //  name                      function                 safe mode?
-  //  ------------------------  -----------------------  ----------
-    { "help",                   &help,                   true },
-    { "stop",                   &stop,                   true },
-    { "getblockcount",          &getblockcount,          true },
-    { "getblocknumber",         &getblocknumber,         true },
-    { "getconnectioncount",     &getconnectioncount,     true },
-    { "getpeerinfo",            &getpeerinfo,            true },
-    { "getdifficulty",          &getdifficulty,          true },
-    { "getgenerate",            &getgenerate,            true },
-    { "setgenerate",            &setgenerate,            true },
-    { "gethashespersec",        &gethashespersec,        true },
-    { "getnetworkghps",         &getnetworkghps,         true },
-    { "getinfo",                &getinfo,                true },
-    { "getmininginfo",          &getmininginfo,          true },
-    { "getnewaddress",          &getnewaddress,          true },
-    { "getaccountaddress",      &getaccountaddress,      true },
-    { "setaccount",             &setaccount,             true },
-    { "getaccount",             &getaccount,             false },
-    { "getaddressesbyaccount",  &getaddressesbyaccount,  true },
-    { "sendtoaddress",          &sendtoaddress,          false },
-    { "getreceivedbyaddress",   &getreceivedbyaddress,   false },
-    { "getreceivedbyaccount",   &getreceivedbyaccount,   false },
-    { "listreceivedbyaddress",  &listreceivedbyaddress,  false },
-    { "listreceivedbyaccount",  &listreceivedbyaccount,  false },
-    { "backupwallet",           &backupwallet,           true },
-    { "keypoolrefill",          &keypoolrefill,          true },
-    { "walletpassphrase",       &walletpassphrase,       true },
-    { "walletpassphrasechange", &walletpassphrasechange, false },
-    { "walletlock",             &walletlock,             true },
-    { "encryptwallet",          &encryptwallet,          false },
-    { "validateaddress",        &validateaddress,        true },
-    { "getbalance",             &getbalance,             false },
-    { "move",                   &movecmd,                false },
-    { "sendfrom",               &sendfrom,               false },
-    { "sendmany",               &sendmany,               false },
-    { "addmultisigaddress",     &addmultisigaddress,     false },
-    { "getblock",               &getblock,               false },
-    { "getblockhash",           &getblockhash,           false },
-    { "gettransaction",         &gettransaction,         false },
-    { "listtransactions",       &listtransactions,       false },
-    { "signmessage",            &signmessage,            false },
-    { "verifymessage",          &verifymessage,          false },
-    { "getwork",                &getwork,                true },
-    { "listaccounts",           &listaccounts,           false },
-    { "settxfee",               &settxfee,               false },
-    { "getblocktemplate",       &getblocktemplate,       true },
-    { "submitblock",            &submitblock,            false },
-    { "listsinceblock",         &listsinceblock,         false },
-    { "dumpprivkey",            &dumpprivkey,            false },
-    { "importprivkey",          &importprivkey,          false },
-    { "getcheckpoint",          &getcheckpoint,          true },
-    { "reservebalance",         &reservebalance,         false},
-    { "checkwallet",            &checkwallet,            false},
-    { "repairwallet",           &repairwallet,           false},
-    { "makekeypair",            &makekeypair,            false},
-    { "sendalert",              &sendalert,              false},
+{ //  name                      function                 safe mode?  streaming function
+  //  ------------------------  -----------------------  ----------  ------------------
+    { "help",                   &help,                   true,       NULL },
+    { "stop",                   &stop,                   true,       NULL },
+    { "getblockcount",          &getblockcount,          true,       NULL },
+    { "getblocknumber",         &getblocknumber,         true,       NULL },
+    { "getconnectioncount",     &getconnectioncount,     true,       NULL },
+    { "getpeerinfo",            &getpeerinfo,            true,       NULL },
+    { "getlockstats",           &getlockstats,           true,       NULL },
+    { "setconfig",              &setconfig,              false,      NULL },
+    { "getdifficulty",          &getdifficulty,          true,       NULL },
+    { "getgenerate",            &getgenerate,            true,       NULL },
+    { "setgenerate",            &setgenerate,            true,       NULL },
+    { "generate",               &generate,               true,       NULL },
+    { "gethashespersec",        &gethashespersec,        true,       NULL },
+    { "getnetworkghps",         &getnetworkghps,         true,       NULL },
+    { "getinfo",                &getinfo,                true,       NULL },
+    { "getmininginfo",          &getmininginfo,          true,       NULL },
+    { "getnewaddress",          &getnewaddress,          true,       NULL },
+    { "getaccountaddress",      &getaccountaddress,      true,       NULL },
+    { "setaccount",             &setaccount,             true,       NULL },
+    { "getaccount",             &getaccount,             false,      NULL },
+    { "getaddressesbyaccount",  &getaddressesbyaccount,  true,       NULL },
+    { "sendtoaddress",          &sendtoaddress,          false,      NULL },
+    { "getreceivedbyaddress",   &getreceivedbyaddress,   false,      NULL },
+    { "getreceivedbyaccount",   &getreceivedbyaccount,   false,      NULL },
+    { "listreceivedbyaddress",  &listreceivedbyaddress,  false,      NULL },
+    { "listreceivedbyaccount",  &listreceivedbyaccount,  false,      NULL },
+    { "backupwallet",           &backupwallet,           true,       NULL },
+    { "keypoolrefill",          &keypoolrefill,          true,       NULL },
+    { "walletpassphrase",       &walletpassphrase,       true,       NULL },
+    { "walletpassphrasechange", &walletpassphrasechange, false,      NULL },
+    { "walletlock",             &walletlock,             true,       NULL },
+    { "encryptwallet",          &encryptwallet,          false,      NULL },
+    { "validateaddress",        &validateaddress,        true,       NULL },
+    { "getbalance",             &getbalance,             false,      NULL },
+    { "move",                   &movecmd,                false,      NULL },
+    { "sendfrom",               &sendfrom,               false,      NULL },
+    { "sendmany",               &sendmany,               false,      NULL },
+    { "addmultisigaddress",     &addmultisigaddress,     false,      NULL },
+    { "getblock",               &getblock,               false,      NULL },
+    { "getblockhash",           &getblockhash,           false,      NULL },
+    { "getblockrange",          NULL,                    false,      &getblockrange },
+    { "getrawblock",            &getrawblock,            false,      NULL },
+    { "getrawtransaction",      &getrawtransaction,      false,      NULL },
+    { "getrawmempool",          &getrawmempool,          true,       NULL },
+    { "gettransaction",         &gettransaction,         false,      NULL },
+    { "listtransactions",       NULL,                    false,      &listtransactions },
+    { "signmessage",            &signmessage,            false,      NULL },
+    { "verifymessage",          &verifymessage,          false,      NULL },
+    { "getwork",                &getwork,                true,       NULL },
+    { "listaccounts",           NULL,                    false,      &listaccounts },
+    { "settxfee",               &settxfee,               false,      NULL },
+    { "getblocktemplate",       &getblocktemplate,       true,       NULL },
+    { "submitblock",            &submitblock,            false,      NULL },
+    { "listsinceblock",         &listsinceblock,         false,      NULL },
+    { "dumpprivkey",            &dumpprivkey,            false,      NULL },
+    { "importprivkey",          &importprivkey,          false,      NULL },
+    { "getcheckpoint",          &getcheckpoint,          true,       NULL },
+    { "reservebalance",         &reservebalance,         false,      NULL },
+    { "checkwallet",            &checkwallet,            false,      NULL },
+    { "repairwallet",           &repairwallet,           false,      NULL },
+    { "makekeypair",            &makekeypair,            false,      NULL },
+    { "sendalert",              &sendalert,              false,      NULL },
 };
 
 CRPCTable::CRPCTable()
@@ -2643,12 +2889,18 @@ static string HTTPReply(int nStatus, const string& strMsg)
         strMsg.c_str());
 }
 
-int ReadHTTPStatus(std::basic_istream<char>& stream)
+int ReadHTTPStatus(std::basic_istream<char>& stream, int& nProtoRet)
 {
     string str;
     getline(stream, str);
     vector<string> vWords;
     boost::split(vWords, str, boost::is_any_of(" "));
+    // The version is the first word of a status line and the last word of
+    // a request line; nProtoRet is its minor number, 1 for HTTP/1.1
+    nProtoRet = 0;
+    BOOST_FOREACH(const string& strWord, vWords)
+        if (strWord.substr(0, 7) == "HTTP/1.")
+            nProtoRet = atoi(strWord.c_str() + 7);
     if (vWords.size() < 2)
         return 500;
     return atoi(vWords[1].c_str());
@@ -2679,19 +2931,39 @@ int ReadHTTPHeader(std::basic_istream<char>& stream, map<string, string>& mapHea
     return nLen;
 }
 
-int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet)
+int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet, int& nProtoRet)
 {
     mapHeadersRet.clear();
     strMessageRet = "";
 
     // Read status
-    int nStatus = ReadHTTPStatus(stream);
+    int nStatus = ReadHTTPStatus(stream, nProtoRet);
 
     // Read header
     int nLen = ReadHTTPHeader(stream, mapHeadersRet);
     if (nLen < 0 || nLen > (int)MAX_SIZE)
         return 500;
 
+    // Read chunked message, as sent for streamed replies
+    if (mapHeadersRet["transfer-encoding"] == "chunked")
+    {
+        loop
+        {
+            string str;
+            std::getline(stream, str);
+            unsigned int nChunk = strtoul(str.c_str(), NULL, 16);
+            if (nChunk == 0 || !stream)
+                break;
+            if (strMessageRet.size() + nChunk > MAX_SIZE)
+                return 500;
+            vector<char> vch(nChunk);
+            stream.read(&vch[0], nChunk);
+            strMessageRet.append(vch.begin(), vch.end());
+            std::getline(stream, str);
+        }
+        return nStatus;
+    }
+
     // Read message
     if (nLen > 0)
     {
@@ -2755,6 +3027,110 @@ void ErrorReply(std::ostream& stream, const Object& objError, const Value& id)
     stream << HTTPReply(nStatus, strReply) << std::flush;
 }
 
+// Streamed replies go out in chunks of about this size
+static const unsigned int RPC_STREAM_CHUNK_SIZE = 64 * 1024;
+
+CRPCStreamWriter::CRPCStreamWriter() : pstream(NULL), plockMain(NULL), plockWallet(NULL), fBegun(false), fObject(false), fFirst(true), fStarted(false)
+{
+}
+
+CRPCStreamWriter::CRPCStreamWriter(std::ostream& streamIn, const Value& idIn) : pstream(&streamIn), plockMain(NULL), plockWallet(NULL), id(idIn), fBegun(false), fObject(false), fFirst(true), fStarted(false)
+{
+}
+
+void CRPCStreamWriter::SetLocks(CCriticalBlock* plockMainIn, CCriticalBlock* plockWalletIn)
+{
+    plockMain = plockMainIn;
+    plockWallet = plockWalletIn;
+}
+
+void CRPCStreamWriter::Append(const string& str)
+{
+    strBuffer += str;
+    if (strBuffer.size() >= RPC_STREAM_CHUNK_SIZE)
+        SendChunk();
+}
+
+void CRPCStreamWriter::SendChunk()
+{
+    if (plockWallet)
+        plockWallet->Leave();
+    if (plockMain)
+        plockMain->Leave();
+    if (!fStarted)
+    {
+        *pstream << strprintf(
+            "HTTP/1.1 200 OK\r\n"
+            "Date: %s\r\n"
+            "Connection: close\r\n"
+            "Transfer-Encoding: chunked\r\n"
+            "Content-Type: application/json\r\n"
+            "Server: PFN-json-rpc/%s\r\n"
+            "\r\n",
+            rfc1123Time().c_str(),
+            FormatFullVersion().c_str());
+        fStarted = true;
+    }
+    if (!strBuffer.empty())
+    {
+        *pstream << strprintf("%x\r\n", (unsigned int)strBuffer.size()) << strBuffer << "\r\n";
+        strBuffer.clear();
+    }
+    if (plockMain)
+        plockMain->Enter("cs_main", __FILE__, __LINE__);
+    if (plockWallet)
+        plockWallet->Enter("pwalletMain->cs_wallet", __FILE__, __LINE__);
+}
+
+void CRPCStreamWriter::BeginArray()
+{
+    fBegun = true;
+    fObject = false;
+    if (pstream)
+        Append("{\"result\":[");
+}
+
+void CRPCStreamWriter::BeginObject()
+{
+    fBegun = true;
+    fObject = true;
+    if (pstream)
+        Append("{\"result\":{");
+}
+
+void CRPCStreamWriter::Write(const Value& value)
+{
+    if (!pstream)
+    {
+        array.push_back(value);
+        return;
+    }
+    Append((fFirst ? "" : ",") + write_string(value, false));
+    fFirst = false;
+}
+
+void CRPCStreamWriter::Write(const string& strName, const Value& value)
+{
+    if (!pstream)
+    {
+        object.push_back(Pair(strName, value));
+        return;
+    }
+    Append((fFirst ? "" : ",") + write_string(Value(strName), false) + ":" + write_string(value, false));
+    fFirst = false;
+}
+
+void CRPCStreamWriter::Finish(const Value& error)
+{
+    if (!pstream)
+        return;
+    string str = (!fBegun ? "{\"result\":null" : (fObject ? "}" : "]"));
+    str += ",\"error\":" + write_string(error, false) + ",\"id\":" + write_string(id, false) + "}\n";
+    strBuffer += str;
+    SendChunk();
+    *pstream << "0\r\n\r\n" << std::flush;
+}
+
 bool ClientAllowed(const string& strAddress)
 {
     if (strAddress == asio::ip::address_v4::loopback().to_string())
@@ -2877,7 +3253,7 @@ void ThreadRPCServer2(void* parg)
     asio::ip::address bindAddress = mapArgs.count("-rpcallowip") ? asio::ip::address_v4::any() : asio::ip::address_v4::loopback();
 
     asio::io_service io_service;
-    ip::tcp::endpoint endpoint(bindAddress, GetArg("-rpcport", fTestNet? TESTNET_RPC_PORT : RPC_PORT));
+    ip::tcp::endpoint endpoint(bindAddress, GetArg("-rpcport", fRegTest? REGTEST_RPC_PORT : fTestNet? TESTNET_RPC_PORT : RPC_PORT));
     ip::tcp::acceptor acceptor(io_service);
     try
     {
@@ -2938,8 +3314,9 @@ void ThreadRPCServer2(void* parg)
 
         map<string, string> mapHeaders;
         string strRequest;
+        int nProto = 0;
 
-        boost::thread api_caller(ReadHTTP, boost::ref(stream), boost::ref(mapHeaders), boost::ref(strRequest));
+        boost::thread api_caller(ReadHTTP, boost::ref(stream), boost::ref(mapHeaders), boost::ref(strRequest), boost::ref(nProto));
         if (!api_caller.timed_join(boost::posix_time::seconds(GetArg("-rpctimeout", 30))))
         {   // Timed out:
             acceptor.cancel();
@@ -2971,7 +3348,7 @@ void ThreadRPCServer2(void* parg)
         {
             // Parse request
             Value valRequest;
-            if (!read_string(strRequest, valRequest) || valRequest.type() != obj_type)
+            if (!ParseJSON(strRequest, valRequest) || valRequest.type() != obj_type)
                 throw JSONRPCError(-32700, "Parse error");
             const Object& request = valRequest.get_obj();
 
@@ -2998,7 +3375,23 @@ void ThreadRPCServer2(void* parg)
             else
                 throw JSONRPCError(-32600, "Params must be an array");
 
-            Value result = tableRPC.execute(strMethod, params);
+            // Streaming commands send their reply while they run, as chunked
+            // transfer encoding needs HTTP/1.1; older clients get it buffered
+            CRPCStreamWriter writer(stream, id);
+            Value result;
+            try
+            {
+                result = tableRPC.execute(strMethod, params, (nProto >= 1 ? &writer : NULL));
+            }
+            catch (Object& objError)
+            {
+                if (!writer.IsStarted())
+                    throw;
+                writer.Finish(objError);
+                continue;
+            }
+            if (writer.IsStarted())
+                continue;
 
             // Send reply
             string strReply = JSONRPCReply(result, Value::null, id);
@@ -3015,7 +3408,7 @@ void ThreadRPCServer2(void* parg)
     }
 }
 
-json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params) const
+json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_spirit::Array &params, CRPCStreamWriter* pwriter) const
 {
     // Find method
     const CRPCCommand *pcmd = tableRPC[strMethod];
@@ -3028,10 +3421,35 @@ json_spirit::Value CRPCTable::execute(const std::string &strMethod, const json_s
         !pcmd->okSafeMode)
         throw JSONRPCError(-2, string("Safe mode: ") + strWarning);
 
+    CMetricTimer timer(fMetrics ? &metricRPC.Get(strMethod) : NULL);
     try
     {
         // Execute
         Value result;
+        if (pcmd->streamer)
+        {
+            CRPCStreamWriter writerCollect;
+            CRPCStreamWriter& writer = (pwriter ? *pwriter : writerCollect);
+            {
+                CCriticalBlock lockMain(cs_main, "cs_main", __FILE__, __LINE__);
+                CCriticalBlock lockWallet(pwalletMain->cs_wallet, "pwalletMain->cs_wallet", __FILE__, __LINE__);
+                writer.SetLocks(&lockMain, &lockWallet);
+                try
+                {
+                    (*pcmd->streamer)(params, false, writer);
+                }
+                catch (...)
+                {
+                    writer.SetLocks(NULL, NULL);
+                    throw;
+                }
+                writer.SetLocks(NULL, NULL);
+            }
+            writer.Finish();
+            if (!pwriter)
+                result = writerCollect.GetResult();
+        }
+        else
         {
             LOCK2(cs_main, pwalletMain->cs_wallet);
             result = pcmd->actor(params, false);
@@ -3061,7 +3479,7 @@ Object CallRPC(const string& strMethod, const Array& params)
     SSLStream sslStream(io_service, context);
     SSLIOStreamDevice d(sslStream, fUseSSL);
     iostreams::stream<SSLIOStreamDevice> stream(d);
-    if (!d.connect(GetArg("-rpcconnect", "127.0.0.1"), GetArg("-rpcport", CBigNum(fTestNet? TESTNET_RPC_PORT : RPC_PORT).ToString().c_str())))
+    if (!d.connect(GetArg("-rpcconnect", "127.0.0.1"), GetArg("-rpcport", CBigNum(fRegTest? REGTEST_RPC_PORT : fTestNet? TESTNET_RPC_PORT : RPC_PORT).ToString().c_str())))
         throw runtime_error("couldn't connect to server");
 
     // HTTP basic authentication
@@ -3077,7 +3495,8 @@ Object CallRPC(const string& strMethod, const Array& params)
     // Receive reply
     map<string, string> mapHeaders;
     string strReply;
-    int nStatus = ReadHTTP(stream, mapHeaders, strReply);
+    int nProto = 0;
+    int nStatus = ReadHTTP(stream, mapHeaders, strReply, nProto);
     if (nStatus == 401)
         throw runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
     else if (nStatus >= 400 && nStatus != 400 && nStatus != 404 && nStatus != 500)
@@ -3087,7 +3506,7 @@ Object CallRPC(const string& strMethod, const Array& params)
 
     // Parse reply
     Value valReply;
-    if (!read_string(strReply, valReply))
+    if (!ParseJSON(strReply, valReply))
         throw runtime_error("couldn't parse reply from server");
     const Object& reply = valReply.get_obj();
     if (reply.empty())
@@ -3129,7 +3548,10 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     // Special case non-string parameter types
     //
     if (strMethod == "setgenerate"            && n > 0) ConvertTo<bool>(params[0]);
+    if (strMethod == "getlockstats"           && n > 0) ConvertTo<bool>(params[0]);
     if (strMethod == "setgenerate"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "generate"               && n > 0) ConvertTo<boost::int64_t>(params[0]);
+    if (strMethod == "generate"               && n > 1) ConvertTo<bool>(params[1]);
     if (strMethod == "sendtoaddress"          && n > 1) ConvertTo<double>(params[1]);
     if (strMethod == "settxfee"               && n > 0) ConvertTo<double>(params[0]);
     if (strMethod == "getreceivedbyaddress"   && n > 1) ConvertTo<boost::int64_t>(params[1]);
@@ -3141,6 +3563,9 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "getbalance"             && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "getblockhash"           && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "getblock"               && n > 1) ConvertTo<bool>(params[1]);
+    if (strMethod == "getblockrange"          && n > 0) ConvertTo<boost::int64_t>(params[0]);
+    if (strMethod == "getblockrange"          && n > 1) ConvertTo<boost::int64_t>(params[1]);
+    if (strMethod == "getblockrange"          && n > 2) ConvertTo<bool>(params[2]);
     if (strMethod == "move"                   && n > 2) ConvertTo<double>(params[2]);
     if (strMethod == "move"                   && n > 3) ConvertTo<boost::int64_t>(params[3]);
     if (strMethod == "sendfrom"               && n > 2) ConvertTo<double>(params[2]);
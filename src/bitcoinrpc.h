@@ -14,6 +14,7 @@ class CReserveKey;
 #include "json/json_spirit_reader_template.h"
 #include "json/json_spirit_writer_template.h"
 #include "json/json_spirit_utils.h"
+#include "util.h"
 
 void ThreadRPCServer(void* parg);
 int CommandLineRPC(int argc, char *argv[]);
@@ -21,7 +22,72 @@ int CommandLineRPC(int argc, char *argv[]);
 /** Convert parameter values for RPC call from strings to command-specific JSON objects. */
 json_spirit::Array RPCConvertValues(const std::string &strMethod, const std::vector<std::string> &strParams);
 
+/** Send a request to the server named by -rpcconnect and -rpcport, and return the whole reply. */
+json_spirit::Object CallRPC(const std::string& strMethod, const json_spirit::Array& params);
+int64 AmountFromValue(const json_spirit::Value& value);
+json_spirit::Value ValueFromAmount(int64 amount);
+
+/**
+ * Receives the result of a streaming RPC command one element at a time.
+ * Without a stream it collects the result into a Value. With one, it writes
+ * the JSON-RPC reply to the HTTP stream in chunks as the elements come in,
+ * so a large result is never held in memory as a whole.
+ *
+ * Each chunk is built while the command holds cs_main and cs_wallet, and
+ * sent with both released, so a slow client does not hold up block and
+ * transaction processing. A command must therefore not keep pointers into
+ * the chain or the wallet across Write.
+ */
+class CRPCStreamWriter
+{
+private:
+    std::ostream* pstream;
+    CCriticalBlock* plockMain;
+    CCriticalBlock* plockWallet;
+    json_spirit::Value id;
+    json_spirit::Array array;
+    json_spirit::Object object;
+    std::string strBuffer;
+    bool fBegun;
+    bool fObject;
+    bool fFirst;
+    bool fStarted;
+
+    void Append(const std::string& str);
+    void SendChunk();
+
+public:
+    CRPCStreamWriter();
+    CRPCStreamWriter(std::ostream& streamIn, const json_spirit::Value& idIn);
+
+    // Locks of cs_main and cs_wallet to release while a chunk is sent,
+    // or NULL when they are not held
+    void SetLocks(CCriticalBlock* plockMainIn, CCriticalBlock* plockWalletIn);
+
+    // The result is an array of the values or an object of the pairs
+    // written after this
+    void BeginArray();
+    void BeginObject();
+    void Write(const json_spirit::Value& value);
+    void Write(const std::string& strName, const json_spirit::Value& value);
+
+    // True once reply bytes have gone out; an error must then be reported
+    // through Finish instead of a new reply
+    bool IsStarted() const { return fStarted; }
+
+    // End the reply, with the error if the command failed after starting
+    void Finish(const json_spirit::Value& error = json_spirit::Value::null);
+
+    json_spirit::Value GetResult() const
+    {
+        if (fObject)
+            return object;
+        return array;
+    }
+};
+
 typedef json_spirit::Value(*rpcfn_type)(const json_spirit::Array& params, bool fHelp);
+typedef void(*rpcstreamfn_type)(const json_spirit::Array& params, bool fHelp, CRPCStreamWriter& writer);
 
 class CRPCCommand
 {
@@ -29,6 +95,7 @@ public:
     std::string name;
     rpcfn_type actor;
     bool okSafeMode;
+    rpcstreamfn_type streamer; // set instead of actor for streaming commands
 };
 
 /**
@@ -47,10 +114,11 @@ public:
      * Execute a method.
      * @param method   Method to execute
      * @param params   Array of arguments (JSON objects)
-     * @returns Result of the call.
+     * @param pwriter  Writer a streaming command sends its result to
+     * @returns Result of the call, or null if it was sent to pwriter.
      * @throws an exception (json_spirit::Value) when an error happens.
      */
-    json_spirit::Value execute(const std::string &method, const json_spirit::Array &params) const;
+    json_spirit::Value execute(const std::string &method, const json_spirit::Array &params, CRPCStreamWriter* pwriter = NULL) const;
 };
 
 extern const CRPCTable tableRPC;
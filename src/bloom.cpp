@@ -0,0 +1,89 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <math.h>
+
+#include "bloom.h"
+
+using namespace std;
+
+CRollingBloomFilter::CRollingBloomFilter(unsigned int nElements, double fpRate)
+{
+    // The optimal number of hash functions for a given rate is -log2(fpRate),
+    // and up to three generations (1.5 * nElements keys) can be live at once
+    double logFpRate = log(fpRate);
+    nHashFuncs = max(1, min((int)(logFpRate / log(0.5) + 0.5), 50));
+    nEntriesPerGeneration = max(1U, (nElements + 1) / 2);
+    double nMaxElements = nEntriesPerGeneration * 3.0;
+    unsigned int nFilterBits = (unsigned int)ceil(-1.0 * nHashFuncs * nMaxElements / log(1.0 - exp(logFpRate / nHashFuncs)));
+    data.resize(((nFilterBits + 63) / 64) * 2);
+    reset();
+}
+
+// Two SipHash values, combined as h1 + i * h2 for the i-th hash function
+void CRollingBloomFilter::GetHashes(const unsigned char* pch, size_t nSize, uint64& h1, uint64& h2) const
+{
+    h1 = CSipHasher(nTweak0, nTweak1).Write(pch, nSize).Finalize();
+    h2 = CSipHasher(nTweak1, nTweak0).Write(pch, nSize).Finalize() | 1;
+}
+
+void CRollingBloomFilter::insert(const unsigned char* pch, size_t nSize)
+{
+    if (nEntriesThisGeneration == nEntriesPerGeneration)
+    {
+        nEntriesThisGeneration = 0;
+        nGeneration++;
+        if (nGeneration == 4)
+            nGeneration = 1;
+        // Clear every cell that holds the generation we are about to reuse
+        uint64 nGenerationMask1 = 0 - (uint64)(nGeneration & 1);
+        uint64 nGenerationMask2 = 0 - (uint64)(nGeneration >> 1);
+        for (unsigned int p = 0; p < data.size(); p += 2)
+        {
+            uint64 p1 = data[p], p2 = data[p + 1];
+            uint64 mask = (p1 ^ nGenerationMask1) | (p2 ^ nGenerationMask2);
+            data[p] = p1 & mask;
+            data[p + 1] = p2 & mask;
+        }
+    }
+    nEntriesThisGeneration++;
+
+    uint64 h1, h2;
+    GetHashes(pch, nSize, h1, h2);
+    unsigned int nWords = data.size() / 2;
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint64 h = h1 + n * h2;
+        int bit = h & 0x3F;
+        unsigned int pos = ((h >> 32) * nWords) >> 32;
+        data[2 * pos] = (data[2 * pos] & ~(1ULL << bit)) | ((uint64)(nGeneration & 1)) << bit;
+        data[2 * pos + 1] = (data[2 * pos + 1] & ~(1ULL << bit)) | ((uint64)(nGeneration >> 1)) << bit;
+    }
+}
+
+bool CRollingBloomFilter::contains(const unsigned char* pch, size_t nSize) const
+{
+    uint64 h1, h2;
+    GetHashes(pch, nSize, h1, h2);
+    unsigned int nWords = data.size() / 2;
+    for (int n = 0; n < nHashFuncs; n++)
+    {
+        uint64 h = h1 + n * h2;
+        int bit = h & 0x3F;
+        unsigned int pos = ((h >> 32) * nWords) >> 32;
+        // A cell is set if it holds any generation
+        if (!(((data[2 * pos] | data[2 * pos + 1]) >> bit) & 1))
+            return false;
+    }
+    return true;
+}
+
+void CRollingBloomFilter::reset()
+{
+    uint256 hashTweak = GetFastRandHash();
+    nTweak0 = hashTweak.Get64(0);
+    nTweak1 = hashTweak.Get64(1);
+    nEntriesThisGeneration = 0;
+    nGeneration = 1;
+    fill(data.begin(), data.end(), 0);
+}
@@ -0,0 +1,52 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_BLOOM_H
+#define PPCOIN_BLOOM_H
+
+#include <vector>
+
+#include "uint256.h"
+#include "util.h"
+
+/** Fixed-memory filter that remembers roughly the last nElements keys
+ * inserted, with a false positive rate of at most fpRate for them. Keys are
+ * never reported missing while they are among the last nElements / 2.
+ *
+ * Cells hold a two bit generation number (1, 2 or 3), split across a pair
+ * of 64-bit words so that a whole word of cells can be tested or cleared at
+ * once. Every nElements / 2 inserts the generation advances and the cells of
+ * the oldest one are cleared, which forgets the keys inserted two
+ * generations ago.
+ */
+class CRollingBloomFilter
+{
+private:
+    int nEntriesPerGeneration;
+    int nEntriesThisGeneration;
+    int nGeneration;
+    int nHashFuncs;
+    uint64 nTweak0;
+    uint64 nTweak1;
+    std::vector<uint64> data;
+
+    void GetHashes(const unsigned char* pch, size_t nSize, uint64& h1, uint64& h2) const;
+
+public:
+    CRollingBloomFilter(unsigned int nElements, double fpRate);
+
+    void insert(const unsigned char* pch, size_t nSize);
+    void insert(const std::vector<unsigned char>& vKey) { insert(vKey.empty() ? NULL : &vKey[0], vKey.size()); }
+    void insert(const uint256& hash) { insert((const unsigned char*)&hash, sizeof(hash)); }
+
+    bool contains(const unsigned char* pch, size_t nSize) const;
+    bool contains(const std::vector<unsigned char>& vKey) const { return contains(vKey.empty() ? NULL : &vKey[0], vKey.size()); }
+    bool contains(const uint256& hash) const { return contains((const unsigned char*)&hash, sizeof(hash)); }
+
+    // Forget everything, and pick new hash keys
+    void reset();
+
+    size_t GetMemoryUsage() const { return data.size() * sizeof(uint64); }
+};
+
+#endif
@@ -0,0 +1,127 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/foreach.hpp>
+
+#include "config.h"
+#include "ui_interface.h"
+
+using namespace std;
+
+// Settings that setconfig may change while running are marked true. The
+// others size something once at startup (the outbound connection semaphore,
+// the overview chart), so a new value would disagree with what is in use.
+CConfigBool configAllowReceiveByIP("-allowreceivebyip", false, true);
+CConfigBool configAvatar("-avatar", false, true);
+CConfigBool configChart("-chart", true);
+CConfigBool configTestSafeMode("-testsafemode", false, true);
+CConfigInt configBanScore("-banscore", 100, true);
+CConfigInt configBanTime("-bantime", 60*60*24, true);
+CConfigInt configDropMessagesTest("-dropmessagestest", 0, true);
+CConfigInt configKeyPool("-keypool", 100, true);
+CConfigInt configLimitFreeRelay("-limitfreerelay", 15, true);
+CConfigInt configMaxConnections("-maxconnections", 125);
+CConfigInt configMaxSigCacheSize("-maxsigcachesize", 50000, true);
+CConfigInt configMaxUploadTarget("-maxuploadtarget", 0, true);
+CConfigMoney configReserveBalance("-reservebalance", 0, true);
+
+// Constructed on first use, settings register themselves during static
+// initialization
+static map<string, CConfigSetting*>& GetConfigRegistry()
+{
+    static map<string, CConfigSetting*> mapConfig;
+    return mapConfig;
+}
+
+static CCriticalSection cs_config;
+
+CConfigSetting::CConfigSetting(const char* pszName, const char* pszDefault, bool fRuntimeIn) : strName(pszName), strDefault(pszDefault), fRuntime(fRuntimeIn)
+{
+    GetConfigRegistry()[strName] = this;
+}
+
+bool CConfigSetting::Set(const string& strValue)
+{
+    LOCK(cs_config);
+    return Parse(strValue);
+}
+
+bool CConfigSetting::Load()
+{
+    LOCK(cs_config);
+    if (mapArgs.count(strName))
+        return Parse(mapArgs[strName]);
+    return Parse(strDefault);
+}
+
+// Same as GetBoolArg: a bare -option is true
+bool CConfigBool::Parse(const string& strValue)
+{
+    fValue = (strValue.empty() || atoi(strValue) != 0);
+    return true;
+}
+
+bool CConfigInt::Parse(const string& strValue)
+{
+    const char* psz = strValue.c_str();
+    char* pszEnd = NULL;
+    errno = 0;
+    int64 n = strtoll(psz, &pszEnd, 10);
+    if (pszEnd == psz || *pszEnd != '\0' || errno != 0)
+        return false;
+    Store(n);
+    return true;
+}
+
+bool CConfigMoney::Parse(const string& strValue)
+{
+    int64 n = 0;
+    if (!ParseMoney(strValue, n) || n < 0)
+        return false;
+    Store(n);
+    return true;
+}
+
+bool InitConfig(string& strErrorRet)
+{
+    BOOST_FOREACH(const PAIRTYPE(string, CConfigSetting*)& item, GetConfigRegistry())
+    {
+        if (!item.second->Load())
+        {
+            strErrorRet = strprintf(_("Invalid value for %s"), item.first.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SetConfig(const string& strNameIn, const string& strValue, string& strErrorRet)
+{
+    string strName = (strNameIn.size() > 0 && strNameIn[0] == '-') ? strNameIn : "-" + strNameIn;
+    map<string, CConfigSetting*>::iterator mi = GetConfigRegistry().find(strName);
+    if (mi == GetConfigRegistry().end())
+    {
+        strErrorRet = strprintf("Unknown setting %s", strName.c_str());
+        return false;
+    }
+    if (!(*mi).second->IsRuntime())
+    {
+        strErrorRet = strprintf("%s can only be set at startup", strName.c_str());
+        return false;
+    }
+    if (!(*mi).second->Set(strValue))
+    {
+        strErrorRet = strprintf("Invalid value for %s", strName.c_str());
+        return false;
+    }
+    printf("SetConfig() : %s set to %s\n", strName.c_str(), (*mi).second->ToString().c_str());
+    return true;
+}
+
+void GetConfig(vector<pair<string, string> >& vConfig)
+{
+    vConfig.clear();
+    BOOST_FOREACH(const PAIRTYPE(string, CConfigSetting*)& item, GetConfigRegistry())
+        vConfig.push_back(make_pair(item.first, item.second->ToString()));
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_CONFIG_H
+#define PPCOIN_CONFIG_H
+
+#include "util.h"
+
+//
+// Typed configuration settings for options read at runtime.
+// Each setting is parsed from mapArgs once by InitConfig, so reading it is a
+// plain load instead of a mapArgs search and string conversion. Settings
+// registered as runtime can be changed while running with SetConfig (the
+// setconfig RPC); the new value is stored with a single atomic write.
+// mapArgs is only read at startup and is never written afterwards, so code
+// that needs the current value must use the setting, not GetArg.
+// Anything that names a command or file to run stays a startup-only GetArg.
+//
+class CConfigSetting
+{
+protected:
+    std::string strName;
+    std::string strDefault;
+    bool fRuntime;
+
+    // Parse and store a new value; false if the value doesn't parse
+    virtual bool Parse(const std::string& strValue) = 0;
+
+public:
+    CConfigSetting(const char* pszName, const char* pszDefault, bool fRuntimeIn);
+    virtual ~CConfigSetting() {}
+
+    const std::string& GetName() const { return strName; }
+    bool IsRuntime() const { return fRuntime; }
+    virtual std::string ToString() const = 0;
+
+    bool Set(const std::string& strValue);
+
+    // Reload from mapArgs, or the default if the option isn't given
+    bool Load();
+};
+
+class CConfigBool : public CConfigSetting
+{
+private:
+    volatile bool fValue;
+
+protected:
+    bool Parse(const std::string& strValue);
+
+public:
+    CConfigBool(const char* pszName, bool fDefault, bool fRuntimeIn = false) : CConfigSetting(pszName, fDefault ? "1" : "0", fRuntimeIn), fValue(fDefault) {}
+
+    bool Get() const { return fValue; }
+    std::string ToString() const { return fValue ? "1" : "0"; }
+};
+
+class CConfigInt : public CConfigSetting
+{
+protected:
+    volatile int64 nValue;
+
+    bool Parse(const std::string& strValue);
+    void Store(int64 n) { __sync_lock_test_and_set(&nValue, n); }
+
+public:
+    CConfigInt(const char* pszName, int64 nDefault, bool fRuntimeIn = false) : CConfigSetting(pszName, i64tostr(nDefault).c_str(), fRuntimeIn), nValue(nDefault) {}
+
+    int64 Get() const { return nValue; }
+    std::string ToString() const { return i64tostr(nValue); }
+};
+
+// Amount of coins, given as in -paytxfee
+class CConfigMoney : public CConfigInt
+{
+protected:
+    bool Parse(const std::string& strValue);
+
+public:
+    CConfigMoney(const char* pszName, int64 nDefault, bool fRuntimeIn = false) : CConfigInt(pszName, nDefault, fRuntimeIn) { strDefault = FormatMoney(nDefault); }
+
+    std::string ToString() const { return FormatMoney(nValue); }
+};
+
+extern CConfigBool configAllowReceiveByIP;
+extern CConfigBool configAvatar;
+extern CConfigBool configChart;
+extern CConfigBool configTestSafeMode;
+extern CConfigInt configBanScore;
+extern CConfigInt configBanTime;
+extern CConfigInt configDropMessagesTest;
+extern CConfigInt configKeyPool;
+extern CConfigInt configLimitFreeRelay;
+extern CConfigInt configMaxConnections;
+extern CConfigInt configMaxSigCacheSize;
+extern CConfigInt configMaxUploadTarget;
+extern CConfigMoney configReserveBalance;
+
+// Load all settings from mapArgs; on failure strErrorRet names the option
+bool InitConfig(std::string& strErrorRet);
+bool SetConfig(const std::string& strName, const std::string& strValue, std::string& strErrorRet);
+void GetConfig(std::vector<std::pair<std::string, std::string> >& vConfig);
+
+#endif
@@ -68,7 +68,7 @@ public:
 instance_of_cdbinit;
 
 
-CDB::CDB(const char *pszFile, const char* pszMode) : pdb(NULL)
+CDB::CDB(const char *pszFile, const char* pszMode) : pdb(NULL), fSecure(false)
 {
     int ret;
     if (pszFile == NULL)
@@ -218,6 +218,7 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                 string strFileRes = strFile + ".rewrite";
                 { // surround usage of db with extra {}
                     CDB db(strFile.c_str(), "r");
+                    db.fSecure = true;
                     Db* pdbCopy = new Db(&dbenv, 0);
     
                     int ret = pdbCopy->open(NULL,                 // Txn pointer
@@ -236,8 +237,8 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
                     if (pcursor)
                         while (fSuccess)
                         {
-                            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
-                            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+                            CDataStream ssKey(SER_DISK, CLIENT_VERSION, true);
+                            CDataStream ssValue(SER_DISK, CLIENT_VERSION, true);
                             int ret = db.ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT);
                             if (ret == DB_NOTFOUND)
                             {
@@ -529,6 +530,10 @@ bool CTxDB::WriteV04UpgradeTime(const unsigned int& nUpgradeTime)
     return Write(string("nProtocolV04UpgradeTime"), nUpgradeTime);
 }
 
+// Hashes of block index records loaded in a format older than
+// DISK_BLOCKINDEX_TRUST_VERSION, to be rewritten by ThreadUpgradeBlockIndex
+static vector<uint256> vBlockIndexUpgrade;
+
 CBlockIndex static * InsertBlockIndex(uint256 hash)
 {
     if (hash == 0)
@@ -556,6 +561,11 @@ bool CTxDB::LoadBlockIndex()
     if (!pcursor)
         return false;
 
+    // Blocks whose chain trust and stake modifier checksum must be computed,
+    // and blocks with stored ones at stake modifier checkpoint heights
+    vector<pair<int, CBlockIndex*> > vSortedByHeight;
+    vector<CBlockIndex*> vCheckpointed;
+
     // Load mapBlockIndex
     unsigned int fFlags = DB_SET_RANGE;
     loop
@@ -593,6 +603,8 @@ bool CTxDB::LoadBlockIndex()
             pindexNew->nMoneySupply   = diskindex.nMoneySupply;
             pindexNew->nFlags         = diskindex.nFlags;
             pindexNew->nStakeModifier = diskindex.nStakeModifier;
+            pindexNew->bnChainTrust   = diskindex.bnChainTrust;
+            pindexNew->nStakeModifierChecksum = diskindex.nStakeModifierChecksum;
             pindexNew->prevoutStake   = diskindex.prevoutStake;
             pindexNew->nStakeTime     = diskindex.nStakeTime;
             pindexNew->hashProofOfStake = diskindex.hashProofOfStake;
@@ -612,6 +624,13 @@ bool CTxDB::LoadBlockIndex()
             // PFN: build setStakeSeen
             if (pindexNew->IsProofOfStake())
                 setStakeSeen.insert(make_pair(pindexNew->prevoutStake, pindexNew->nStakeTime));
+
+            // PFN: records written before DISK_BLOCKINDEX_TRUST_VERSION have
+            // no chain trust, which is at least 1 for any block
+            if (pindexNew->bnChainTrust == 0)
+                vSortedByHeight.push_back(make_pair(pindexNew->nHeight, pindexNew));
+            else if (IsStakeModifierCheckpointHeight(pindexNew->nHeight))
+                vCheckpointed.push_back(pindexNew);
         }
         else
         {
@@ -627,14 +646,7 @@ bool CTxDB::LoadBlockIndex()
     if (fRequestShutdown)
         return true;
 
-    // Calculate bnChainTrust
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
-    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
-    }
+    // Calculate bnChainTrust of blocks from older versions
     sort(vSortedByHeight.begin(), vSortedByHeight.end());
     BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
     {
@@ -644,6 +656,17 @@ bool CTxDB::LoadBlockIndex()
         pindex->nStakeModifierChecksum = GetStakeModifierChecksum(pindex);
         if (!CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
             return error("CTxDB::LoadBlockIndex() : Failed stake modifier checkpoint height=%d, modifier=0x%016"PRI64x, pindex->nHeight, pindex->nStakeModifier);
+        vBlockIndexUpgrade.push_back(pindex->GetBlockHash());
+    }
+    if (!vSortedByHeight.empty())
+        printf("LoadBlockIndex(): %d block index records of older versions\n", vSortedByHeight.size());
+
+    // PFN: verify stored stake modifier checksums at checkpoint heights
+    BOOST_FOREACH(CBlockIndex* pindex, vCheckpointed)
+    {
+        if (GetStakeModifierChecksum(pindex) != pindex->nStakeModifierChecksum ||
+            !CheckStakeModifierCheckpoints(pindex->nHeight, pindex->nStakeModifierChecksum))
+            return error("CTxDB::LoadBlockIndex() : Failed stake modifier checkpoint height=%d, modifier=0x%016"PRI64x, pindex->nHeight, pindex->nStakeModifier);
     }
 
     // Load hashBestChain pointer to end of best chain
@@ -657,6 +680,7 @@ bool CTxDB::LoadBlockIndex()
         return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
     pindexBest = mapBlockIndex[hashBestChain];
     nBestHeight = pindexBest->nHeight;
+    SetBlockIndexByHeight(pindexBest);
     bnBestChainTrust = pindexBest->bnChainTrust;
     printf("LoadBlockIndex(): hashBestChain=%s  height=%d  trust=%s\n", hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainTrust.ToString().c_str());
 
@@ -796,6 +820,59 @@ bool CTxDB::LoadBlockIndex()
     return true;
 }
 
+// PFN: rewrite block index records of older versions so that chain trust and
+// stake modifier checksum are loaded from disk on the next start
+static void UpgradeBlockIndex()
+{
+    printf("ThreadUpgradeBlockIndex started, %d records\n", vBlockIndexUpgrade.size());
+    unsigned int nUpgraded = 0;
+    while (!fShutdown && nUpgraded < vBlockIndexUpgrade.size())
+    {
+        {
+            LOCK(cs_main);
+            CTxDB txdb;
+            txdb.TxnBegin();
+            for (unsigned int n = 0; n < 1000 && nUpgraded < vBlockIndexUpgrade.size(); n++, nUpgraded++)
+            {
+                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(vBlockIndexUpgrade[nUpgraded]);
+                if (mi != mapBlockIndex.end())
+                    txdb.WriteBlockIndex(CDiskBlockIndex((*mi).second));
+            }
+            if (!txdb.TxnCommit())
+            {
+                printf("ThreadUpgradeBlockIndex : TxnCommit failed\n");
+                return;
+            }
+        }
+        Sleep(100);
+    }
+    if (nUpgraded == vBlockIndexUpgrade.size())
+    {
+        printf("ThreadUpgradeBlockIndex upgraded %u records\n", nUpgraded);
+        vBlockIndexUpgrade.clear();
+    }
+}
+
+void ThreadUpgradeBlockIndex(void* parg)
+{
+    if (vBlockIndexUpgrade.empty())
+        return;
+
+    try
+    {
+        vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX]++;
+        UpgradeBlockIndex();
+        vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX]--;
+        PrintException(&e, "ThreadUpgradeBlockIndex()");
+    } catch (...) {
+        vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX]--;
+        PrintException(NULL, "ThreadUpgradeBlockIndex()");
+    }
+}
+
 
 
 
@@ -7,6 +7,7 @@
 #define BITCOIN_DB_H
 
 #include "main.h"
+#include "metrics.h"
 
 #include <map>
 #include <string>
@@ -31,6 +32,7 @@ extern DbEnv dbenv;
 
 extern void DBFlush(bool fShutdown);
 void ThreadFlushWalletDB(void* parg);
+void ThreadUpgradeBlockIndex(void* parg);
 bool BackupWallet(const CWallet& wallet, const std::string& strDest);
 
 
@@ -42,6 +44,7 @@ protected:
     std::string strFile;
     std::vector<DbTxn*> vTxn;
     bool fReadOnly;
+    bool fSecure; // records may hold private keys; clear all buffers after use
 
     explicit CDB(const char* pszFile, const char* pszMode="r+");
     ~CDB() { Close(); }
@@ -59,7 +62,7 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
@@ -67,14 +70,19 @@ protected:
         // Read
         Dbt datValue;
         datValue.set_flags(DB_DBT_MALLOC);
-        int ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
-        memset(datKey.get_data(), 0, datKey.get_size());
+        int ret;
+        {
+            CMetricTimer timer(metricDBRead.Get());
+            ret = pdb->get(GetTxn(), &datKey, &datValue, 0);
+        }
+        if (fSecure)
+            memset(datKey.get_data(), 0, datKey.get_size());
         if (datValue.get_data() == NULL)
             return false;
 
         // Unserialize value
         try {
-            CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue((char*)datValue.get_data(), (char*)datValue.get_data() + datValue.get_size(), SER_DISK, CLIENT_VERSION, fSecure);
             ssValue >> value;
         }
         catch (std::exception &e) {
@@ -82,7 +90,8 @@ protected:
         }
 
         // Clear and free memory
-        memset(datValue.get_data(), 0, datValue.get_size());
+        if (fSecure)
+            memset(datValue.get_data(), 0, datValue.get_size());
         free(datValue.get_data());
         return (ret == 0);
     }
@@ -96,23 +105,25 @@ protected:
             assert(!"Write called on database in read-only mode");
 
         // Key
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Value
-        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION, fSecure);
         ssValue.reserve(10000);
         ssValue << value;
         Dbt datValue(&ssValue[0], ssValue.size());
 
         // Write
-        int ret = pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
-
-        // Clear memory in case it was a private key
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
+        int ret;
+        {
+            CMetricTimer timer(metricDBWrite.Get());
+            ret = pdb->put(GetTxn(), &datKey, &datValue, (fOverwrite ? 0 : DB_NOOVERWRITE));
+        }
+        if (fMetrics && ret == 0)
+            metricDBBytesWritten.Get().Inc(ssKey.size() + ssValue.size());
         return (ret == 0);
     }
 
@@ -125,16 +136,13 @@ protected:
             assert(!"Erase called on database in read-only mode");
 
         // Key
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Erase
         int ret = pdb->del(GetTxn(), &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
         return (ret == 0 || ret == DB_NOTFOUND);
     }
 
@@ -145,16 +153,13 @@ protected:
             return false;
 
         // Key
-        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION, fSecure);
         ssKey.reserve(1000);
         ssKey << key;
         Dbt datKey(&ssKey[0], ssKey.size());
 
         // Exists
         int ret = pdb->exists(GetTxn(), &datKey, 0);
-
-        // Clear memory
-        memset(datKey.get_data(), 0, datKey.get_size());
         return (ret == 0);
     }
 
@@ -201,8 +206,11 @@ protected:
         ssValue.write((char*)datValue.get_data(), datValue.get_size());
 
         // Clear and free memory
-        memset(datKey.get_data(), 0, datKey.get_size());
-        memset(datValue.get_data(), 0, datValue.get_size());
+        if (fSecure)
+        {
+            memset(datKey.get_data(), 0, datKey.get_size());
+            memset(datValue.get_data(), 0, datValue.get_size());
+        }
         free(datKey.get_data());
         free(datValue.get_data());
         return 0;
@@ -11,6 +11,8 @@
 #include "util.h"
 #include "ui_interface.h"
 #include "checkpoints.h"
+#include "config.h"
+#include "metrics.h"
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <boost/filesystem/convenience.hpp>
@@ -76,6 +78,7 @@ void Shutdown(void* parg)
         CreateThread(ExitTimeout, NULL);
         Sleep(50);
         printf("PFN exiting\n\n");
+        StopLogWriter();
         fExit = true;
 #ifndef QT_GUI
         // ensure non UI client get's exited here, but let Bitcoin-Qt reach return 0; in bitcoin.cpp
@@ -209,6 +212,7 @@ bool AppInit2(int argc, char* argv[])
             "  -bantime=<n>     \t  "   + _("Number of seconds to keep misbehaving peers from reconnecting (default: 86400)") + "\n" +
             "  -maxreceivebuffer=<n>\t  " + _("Maximum per-connection receive buffer, <n>*1000 bytes (default: 10000)") + "\n" +
             "  -maxsendbuffer=<n>\t  "   + _("Maximum per-connection send buffer, <n>*1000 bytes (default: 10000)") + "\n" +
+            "  -maxuploadtarget=<n>\t  " + _("Limit upload to <n>*1000 bytes per second, serving new blocks first and old blocks last (default: 0 = unlimited)") + "\n" +
 #ifdef USE_UPNP
 #if USE_UPNP
             "  -upnp            \t  "   + _("Use Universal Plug and Play to map the listening port (default: 1)") + "\n" +
@@ -225,8 +229,15 @@ bool AppInit2(int argc, char* argv[])
             "  -daemon          \t\t  " + _("Run in the background as a daemon and accept commands") + "\n" +
 #endif
             "  -testnet         \t\t  " + _("Use the test network") + "\n" +
+            "  -regtest         \t\t  " + _("Use a private regression test chain whose blocks can be generated instantly") + "\n" +
+            "  -stakeminage=<n> \t\t  " + _("Minimum coin age in seconds for staking on the regression test chain (default: 60)") + "\n" +
+            "  -coinbasematurity=<n>\t  " + _("Confirmations before coinbase outputs can be spent on the regression test chain (default: 10)") + "\n" +
             "  -debug           \t\t  " + _("Output extra debugging information") + "\n" +
             "  -logtimestamps   \t  "   + _("Prepend debug output with timestamp") + "\n" +
+            "  -loglevel=<category>:<level>\t  " + _("Set the debug output level (none, info, debug) of a category, or all of them") + "\n" +
+            "  -lockprofile     \t  "   + _("Record lock wait and hold times (see getlockstats)") + "\n" +
+            "  -lockstatsinterval=<n>\t  " + _("With -lockprofile, write the lock profile to debug.log every <n> seconds, 0 to disable (default: 100)") + "\n" +
+            "  -metricsport=<port>\t  " + _("Serve counters and latency histograms for Prometheus on 127.0.0.1:<port>") + "\n" +
             "  -printtoconsole  \t  "   + _("Send trace/debug info to console instead of debug.log file") + "\n" +
 #ifdef WIN32
             "  -printtodebugger \t  "   + _("Send trace/debug info to debugger") + "\n" +
@@ -264,12 +275,27 @@ bool AppInit2(int argc, char* argv[])
         return false;
     }
 
-    fTestNet = GetBoolArg("-testnet");
-    if (fTestNet)
+    // PFN: the regression test chain uses the test network rules, without
+    // checkpoints, on its own port and data directory
+    fRegTest = GetBoolArg("-regtest");
+    fTestNet = GetBoolArg("-testnet") || fRegTest;
+    if (fRegTest)
+    {
+        SoftSetBoolArg("-irc", false);
+        SoftSetBoolArg("-dnsseed", false);
+    }
+    else if (fTestNet)
     {
         SoftSetBoolArg("-irc", true);
     }
 
+    string strConfigError;
+    if (!InitConfig(strConfigError))
+    {
+        ThreadSafeMessageBox(strConfigError, _("PFN"), wxOK | wxMODAL);
+        return false;
+    }
+
     fDebug = GetBoolArg("-debug");
     fDetachDB = GetBoolArg("-detachdb", false);
 
@@ -291,6 +317,8 @@ bool AppInit2(int argc, char* argv[])
     fPrintToConsole = GetBoolArg("-printtoconsole");
     fPrintToDebugger = GetBoolArg("-printtodebugger");
     fLogTimestamps = GetBoolArg("-logtimestamps");
+    fLockProfile = GetBoolArg("-lockprofile");
+    InitLogLevels();
 
 #ifndef QT_GUI
     for (int i = 1; i < argc; i++)
@@ -328,6 +356,7 @@ bool AppInit2(int argc, char* argv[])
 
     if (!fDebug)
         ShrinkDebugFile();
+    StartLogWriter();
     printf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     printf("PFN version %s (%s)\n", FormatFullVersion().c_str(), CLIENT_DATE.c_str());
     printf("Default data directory %s\n", GetDefaultDataDir().string().c_str());
@@ -584,16 +613,6 @@ bool AppInit2(int argc, char* argv[])
             ThreadSafeMessageBox(_("Warning: -paytxfee is set very high.  This is the transaction fee you will pay if you send a transaction."), _("PFN"), wxOK | wxICON_EXCLAMATION | wxMODAL);
     }
 
-    if (mapArgs.count("-reservebalance")) // PFN: reserve balance amount
-    {
-        int64 nReserveBalance = 0;
-        if (!ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-        {
-            ThreadSafeMessageBox(_("Invalid amount for -reservebalance=<amount>"), _("PFN"), wxOK | wxMODAL);
-            return false;
-        }
-    }
-
     if (mapArgs.count("-checkpointkey")) // PFN: checkpoint master priv key
     {
         if (!Checkpoints::SetCheckpointPrivKey(GetArg("-checkpointkey", "")))
@@ -613,9 +632,15 @@ bool AppInit2(int argc, char* argv[])
     if (!CreateThread(StartNode, NULL))
         ThreadSafeMessageBox(_("Error: CreateThread(StartNode) failed"), _("PFN"), wxOK | wxMODAL);
 
+    // PFN: rewrite block index records of older versions in the background
+    CreateThread(ThreadUpgradeBlockIndex, NULL);
+
     if (fServer)
         CreateThread(ThreadRPCServer, NULL);
 
+    if (mapArgs.count("-metricsport"))
+        CreateThread(ThreadMetricsServer, NULL);
+
 #ifdef QT_GUI
     if (GetStartOnSystemStartup())
         SetStartOnSystemStartup(true); // Remove startup links
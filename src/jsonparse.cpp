@@ -0,0 +1,356 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#include <limits>
+#include <ctype.h>
+#include <string.h>
+#include <boost/version.hpp>
+
+#if BOOST_VERSION >= 103800
+    #include <boost/spirit/include/classic_core.hpp>
+    #include <boost/spirit/include/classic_assign_actor.hpp>
+    #define spirit_namespace boost::spirit::classic
+#else
+    #include <boost/spirit/core.hpp>
+    #include <boost/spirit/actor/assign_actor.hpp>
+    #define spirit_namespace boost::spirit
+#endif
+
+#include "jsonparse.h"
+
+using namespace std;
+using namespace json_spirit;
+
+// Nesting deeper than this is rejected instead of recursing further
+static const int MAX_JSON_DEPTH = 512;
+
+class CJSONParser
+{
+private:
+    const char* p;
+    const char* pend;
+    int nDepth;
+
+    static bool IsSpace(char c)
+    {
+        return (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f');
+    }
+
+    static bool IsDigit(char c)
+    {
+        return (c >= '0' && c <= '9');
+    }
+
+    static int HexValue(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    }
+
+    // The lexer only accepts \x followed by one or two hex digits
+    // that fit in a signed char
+    bool CheckHexEscape(const char* pc) const
+    {
+        int n = 0;
+        int nDigits = 0;
+        for (; pc < pend && nDigits < 2 && isxdigit((unsigned char)*pc); pc++, nDigits++)
+            n = n * 16 + HexValue(*pc);
+        return (nDigits > 0 && n <= 127);
+    }
+
+    void SkipSpace()
+    {
+        while (p < pend && IsSpace(*p))
+            p++;
+    }
+
+    bool Match(const char* psz)
+    {
+        size_t nLen = strlen(psz);
+        if ((size_t)(pend - p) < nLen || memcmp(p, psz, nLen) != 0)
+            return false;
+        p += nLen;
+        return true;
+    }
+
+    bool ParseString(string& strRet);
+    bool ParseNumber(Value& valueRet);
+    bool ParseObject(Value& valueRet);
+    bool ParseArray(Value& valueRet);
+
+public:
+    CJSONParser(const char* pbegin, const char* pendIn) : p(pbegin), pend(pendIn), nDepth(0) {}
+
+    bool ParseValue(Value& valueRet);
+};
+
+// Escapes are substituted as json_spirit does: unknown ones are dropped,
+// \xHH is accepted, and \uHHHH keeps only the low byte of the code point.
+// Like json_spirit, \x and \u always take the next 2 or 4 characters
+// whatever the lexer matched, and a backslash left as the last character
+// is kept as it is.
+bool CJSONParser::ParseString(string& strRet)
+{
+    if (p == pend || *p != '"')
+        return false;
+    const char* pbegin = ++p;
+    bool fEscapes = false;
+    while (true)
+    {
+        const char* pquote = (const char*)memchr(p, '"', pend - p);
+        if (pquote == NULL)
+            return false;
+        const char* pesc = (const char*)memchr(p, '\\', pquote - p);
+        if (pesc == NULL)
+        {
+            p = pquote;
+            break;
+        }
+        // Skip the escaped character, which may be the quote we found
+        fEscapes = true;
+        p = pesc + 1;
+        if (p == pend)
+            return false;
+        if ((*p == 'x' || *p == 'X') && !CheckHexEscape(p + 1))
+            return false;
+        p++;
+    }
+    const char* pclose = p++;
+
+    if (!fEscapes)
+    {
+        strRet.assign(pbegin, pclose);
+        return true;
+    }
+    strRet.clear();
+    strRet.reserve(pclose - pbegin);
+    const char* pcur = pbegin;
+    while (pcur < pclose)
+    {
+        const char* pesc = (const char*)memchr(pcur, '\\', pclose - 1 - pcur);
+        if (pesc == NULL)
+        {
+            strRet.append(pcur, pclose);
+            break;
+        }
+        strRet.append(pcur, pesc);
+        const char* pc = pesc + 1;
+        switch (*pc)
+        {
+            case 't':  strRet += '\t'; break;
+            case 'b':  strRet += '\b'; break;
+            case 'f':  strRet += '\f'; break;
+            case 'n':  strRet += '\n'; break;
+            case 'r':  strRet += '\r'; break;
+            case '\\': strRet += '\\'; break;
+            case '/':  strRet += '/';  break;
+            case '"':  strRet += '"';  break;
+            case 'x':
+                if (pclose - pc >= 3)
+                {
+                    strRet += (char)((HexValue(pc[1]) << 4) + HexValue(pc[2]));
+                    pc += 2;
+                }
+                break;
+            case 'u':
+                if (pclose - pc >= 5)
+                {
+                    strRet += (char)((HexValue(pc[1]) << 12) + (HexValue(pc[2]) << 8) + (HexValue(pc[3]) << 4) + HexValue(pc[4]));
+                    pc += 4;
+                }
+                break;
+        }
+        pcur = pc + 1;
+    }
+    return true;
+}
+
+// A real needs a dot or an exponent; anything else is a signed 64-bit
+// integer, or failing that an unsigned one
+bool CJSONParser::ParseNumber(Value& valueRet)
+{
+    const char* pbegin = p;
+    const char* q = p;
+    bool fNegative = false;
+    if (q < pend && (*q == '+' || *q == '-'))
+        fNegative = (*q++ == '-');
+    const char* pdigits = q;
+    while (q < pend && IsDigit(*q))
+        q++;
+    const char* pdigitsEnd = q;
+    bool fReal = false;
+    bool fMantissa = (q > pdigits);
+    if (q < pend && *q == '.')
+    {
+        const char* pfrac = ++q;
+        while (q < pend && IsDigit(*q))
+            q++;
+        fMantissa |= (q > pfrac);
+        fReal = fMantissa;
+    }
+    if (fMantissa && q < pend && (*q == 'e' || *q == 'E'))
+    {
+        const char* pexp = q + 1;
+        if (pexp < pend && (*pexp == '+' || *pexp == '-'))
+            pexp++;
+        // An 'e' without exponent digits makes the whole real invalid
+        fReal = (pexp < pend && IsDigit(*pexp));
+        while (pexp < pend && IsDigit(*pexp))
+            pexp++;
+        q = pexp;
+    }
+
+    if (fReal)
+    {
+        p = q;
+        // Converted by the same Spirit parser as in read_string, whose
+        // rounding is not strtod's: long mantissas, values just past
+        // DBL_MAX and the smallest denormals come out differently. It also
+        // rejects reals whose digits alone overflow a double, and so must we
+        double d = 0;
+        if (!spirit_namespace::parse(pbegin, q, spirit_namespace::strict_real_p[spirit_namespace::assign_a(d)]).full)
+            return false;
+        // Zero times an overflowing power of ten, as in 0e400, is NaN there
+        if (d != d)
+            d = 0;
+        valueRet = Value(d);
+        return true;
+    }
+
+    if (pdigitsEnd == pdigits)
+        return false;
+    boost::uint64_t n = 0;
+    for (const char* pc = pdigits; pc < pdigitsEnd; pc++)
+    {
+        boost::uint64_t nDigit = *pc - '0';
+        if (n > (numeric_limits<boost::uint64_t>::max() - nDigit) / 10)
+            return false;
+        n = n * 10 + nDigit;
+    }
+    p = pdigitsEnd;
+    if (fNegative)
+    {
+        if (n > (boost::uint64_t)numeric_limits<boost::int64_t>::max() + 1)
+            return false;
+        valueRet = Value((boost::int64_t)(0 - n));
+    }
+    else if (n <= (boost::uint64_t)numeric_limits<boost::int64_t>::max())
+        valueRet = Value((boost::int64_t)n);
+    else if (*pbegin == '+')
+        return false;
+    else
+        valueRet = Value(n);
+    return true;
+}
+
+bool CJSONParser::ParseObject(Value& valueRet)
+{
+    p++;
+    valueRet = Object();
+    Object& obj = valueRet.get_obj();
+    SkipSpace();
+    if (p < pend && *p == '}')
+    {
+        p++;
+        return true;
+    }
+    while (true)
+    {
+        SkipSpace();
+        obj.push_back(Pair(string(), Value()));
+        Pair& pair = obj.back();
+        if (!ParseString(pair.name_))
+            return false;
+        SkipSpace();
+        if (p == pend || *p != ':')
+            return false;
+        p++;
+        if (!ParseValue(pair.value_))
+            return false;
+        SkipSpace();
+        if (p == pend)
+            return false;
+        if (*p == '}')
+            break;
+        if (*p != ',')
+            return false;
+        p++;
+    }
+    p++;
+    return true;
+}
+
+bool CJSONParser::ParseArray(Value& valueRet)
+{
+    p++;
+    valueRet = Array();
+    Array& array = valueRet.get_array();
+    SkipSpace();
+    if (p < pend && *p == ']')
+    {
+        p++;
+        return true;
+    }
+    while (true)
+    {
+        array.push_back(Value());
+        if (!ParseValue(array.back()))
+            return false;
+        SkipSpace();
+        if (p == pend)
+            return false;
+        if (*p == ']')
+            break;
+        if (*p != ',')
+            return false;
+        p++;
+    }
+    p++;
+    return true;
+}
+
+bool CJSONParser::ParseValue(Value& valueRet)
+{
+    SkipSpace();
+    if (p == pend)
+        return false;
+    switch (*p)
+    {
+        case '"':
+        {
+            string str;
+            if (!ParseString(str))
+                return false;
+            valueRet = Value(str);
+            return true;
+        }
+        case '{':
+        case '[':
+        {
+            if (++nDepth > MAX_JSON_DEPTH)
+                return false;
+            bool fRet = (*p == '{' ? ParseObject(valueRet) : ParseArray(valueRet));
+            nDepth--;
+            return fRet;
+        }
+        case 't':
+            valueRet = Value(true);
+            return Match("true");
+        case 'f':
+            valueRet = Value(false);
+            return Match("false");
+        case 'n':
+            valueRet = Value();
+            return Match("null");
+        default:
+            return ParseNumber(valueRet);
+    }
+}
+
+bool ParseJSON(const string& str, Value& valueRet)
+{
+    CJSONParser parser(str.data(), str.data() + str.size());
+    return parser.ParseValue(valueRet);
+}
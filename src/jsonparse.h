@@ -0,0 +1,24 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_JSONPARSE_H
+#define PPCOIN_JSONPARSE_H
+
+#include <string>
+
+#include "json/json_spirit_value.h"
+
+//
+// Single-pass JSON parser for RPC requests and replies.
+// It builds the same json_spirit::Value as json_spirit::read_string,
+// including its leniencies (leading or trailing dots in reals, leading '+',
+// unknown escapes dropped, text after the value ignored), but works on the
+// characters directly and constructs each value in place instead of going
+// through a Boost.Spirit grammar. Only reals still go through Spirit's real
+// parser, so that they round, overflow and underflow exactly as there; the
+// one difference is that zero times an overflowing power of ten, as in
+// 0e400, is 0 rather than NaN.
+//
+bool ParseJSON(const std::string& str, json_spirit::Value& valueRet);
+
+#endif
@@ -76,52 +76,112 @@ static int64 GetStakeModifierSelectionInterval()
     return nSelectionInterval;
 }
 
+// Candidate blocks are ordered by timestamp, then by block hash
+static bool CompareCandidateByTimestamp(const CBlockIndex* pa, const CBlockIndex* pb)
+{
+    if (pa->GetBlockTime() != pb->GetBlockTime())
+        return pa->GetBlockTime() < pb->GetBlockTime();
+    return pa->GetBlockHash() < pb->GetBlockHash();
+}
+
+// Candidate window of the last modifier computation. Consecutive
+// computations on the main chain have overlapping selection intervals, so
+// the next one only drops the blocks before its interval start and merges
+// in the blocks connected since.
+static vector<const CBlockIndex*> vCandidateWindow;
+static const CBlockIndex* pindexCandidateWindowLast = NULL;
+static int64 nCandidateWindowStart = 0;
+static int nCandidateWindowHeightFirst = 0;
+
+void ResetStakeModifierCandidates()
+{
+    vCandidateWindow.clear();
+    pindexCandidateWindowLast = NULL;
+    nCandidateWindowStart = 0;
+    nCandidateWindowHeightFirst = 0;
+}
+
+// Get the blocks from pindexPrev back to the first block with timestamp
+// before nSelectionIntervalStart (exclusive), sorted by timestamp
+static const vector<const CBlockIndex*>& GetStakeModifierCandidates(const CBlockIndex* pindexPrev, int64 nSelectionIntervalStart, int& nHeightFirstCandidate)
+{
+    // walk back to the interval start, or to the last block of the cached
+    // window if this interval starts no earlier than the cached one
+    const CBlockIndex* pindexStop = (nSelectionIntervalStart >= nCandidateWindowStart)? pindexCandidateWindowLast : NULL;
+    vector<const CBlockIndex*> vNew;
+    const CBlockIndex* pindex = pindexPrev;
+    while (pindex && pindex != pindexStop && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    {
+        vNew.push_back(pindex);
+        pindex = pindex->pprev;
+    }
+
+    if (pindexStop && pindex == pindexStop)
+    {
+        // the first candidate follows the last cached block, by height,
+        // with timestamp before the interval start
+        int nHeightBoundary = nCandidateWindowHeightFirst - 1;
+        BOOST_FOREACH(const CBlockIndex* pindexCandidate, vCandidateWindow)
+        {
+            if (pindexCandidate->GetBlockTime() >= nSelectionIntervalStart)
+                break;
+            nHeightBoundary = max(nHeightBoundary, pindexCandidate->nHeight);
+        }
+        vector<const CBlockIndex*> vKept;
+        vKept.reserve(vCandidateWindow.size() + vNew.size());
+        BOOST_FOREACH(const CBlockIndex* pindexCandidate, vCandidateWindow)
+            if (pindexCandidate->nHeight > nHeightBoundary)
+                vKept.push_back(pindexCandidate);
+        vCandidateWindow.swap(vKept);
+        nCandidateWindowHeightFirst = nHeightBoundary + 1;
+    }
+    else
+    {
+        vCandidateWindow.clear();
+        vCandidateWindow.reserve(64 * nModifierInterval / STAKE_TARGET_SPACING);
+        nCandidateWindowHeightFirst = pindex ? (pindex->nHeight + 1) : 0;
+    }
+
+    sort(vNew.begin(), vNew.end(), CompareCandidateByTimestamp);
+    size_t nKept = vCandidateWindow.size();
+    vCandidateWindow.insert(vCandidateWindow.end(), vNew.begin(), vNew.end());
+    inplace_merge(vCandidateWindow.begin(), vCandidateWindow.begin() + nKept, vCandidateWindow.end(), CompareCandidateByTimestamp);
+
+    pindexCandidateWindowLast = pindexPrev;
+    nCandidateWindowStart = nSelectionIntervalStart;
+    nHeightFirstCandidate = nCandidateWindowHeightFirst;
+    return vCandidateWindow;
+}
+
 // select a block from the candidate blocks in vSortedByTimestamp, excluding
-// already selected blocks in vSelectedBlocks, and with timestamp up to
-// nSelectionIntervalStop.
+// already selected blocks in vSelected, and with timestamp up to
+// nSelectionIntervalStop. vSelectionHash holds the selection hash of each
+// candidate.
 static bool SelectBlockFromCandidates(
-    vector<pair<int64, uint256> >& vSortedByTimestamp,
-    map<uint256, const CBlockIndex*>& mapSelectedBlocks,
-    int64 nSelectionIntervalStop, uint64 nStakeModifierPrev,
-    const CBlockIndex** pindexSelected)
+    const vector<const CBlockIndex*>& vSortedByTimestamp,
+    const vector<uint256>& vSelectionHash,
+    const vector<bool>& vSelected,
+    int64 nSelectionIntervalStop,
+    unsigned int* pnSelected)
 {
     bool fSelected = false;
-    uint256 hashBest = 0;
-    *pindexSelected = (const CBlockIndex*) 0;
-    BOOST_FOREACH(const PAIRTYPE(int64, uint256)& item, vSortedByTimestamp)
+    const uint256* phashBest = NULL;
+    *pnSelected = 0;
+    for (unsigned int i = 0; i < vSortedByTimestamp.size(); i++)
     {
-        if (!mapBlockIndex.count(item.second))
-            return error("SelectBlockFromCandidates: failed to find block index for candidate block %s", item.second.ToString().c_str());
-        const CBlockIndex* pindex = mapBlockIndex[item.second];
-        if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+        if (fSelected && vSortedByTimestamp[i]->GetBlockTime() > nSelectionIntervalStop)
             break;
-        if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+        if (vSelected[i])
             continue;
-        // compute the selection hash by hashing its proof-hash and the
-        // previous proof-of-stake modifier
-        uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
-        CDataStream ss(SER_GETHASH, 0);
-        ss << hashProof << nStakeModifierPrev;
-        uint256 hashSelection = Hash(ss.begin(), ss.end());
-        // the selection hash is divided by 2**32 so that proof-of-stake block
-        // is always favored over proof-of-work block. this is to preserve
-        // the energy efficiency property
-        if (pindex->IsProofOfStake())
-            hashSelection >>= 32;
-        if (fSelected && hashSelection < hashBest)
-        {
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
-        }
-        else if (!fSelected)
+        if (!fSelected || vSelectionHash[i] < *phashBest)
         {
             fSelected = true;
-            hashBest = hashSelection;
-            *pindexSelected = (const CBlockIndex*) pindex;
+            phashBest = &vSelectionHash[i];
+            *pnSelected = i;
         }
     }
-    if (fDebug && GetBoolArg("-printstakemodifier"))
-        printf("SelectBlockFromCandidates: selection hash=%s\n", hashBest.ToString().c_str());
+    if (LogAccept(LOG_STAKEMODIFIER))
+        printf("SelectBlockFromCandidates: selection hash=%s\n", (phashBest ? *phashBest : uint256(0)).ToString().c_str());
     return fSelected;
 }
 
@@ -186,47 +246,54 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64& nStakeMo
     }
 
     // Sort candidate blocks by timestamp
-    vector<pair<int64, uint256> > vSortedByTimestamp;
-    vSortedByTimestamp.reserve(64 * nModifierInterval / STAKE_TARGET_SPACING);
     int64 nSelectionInterval = GetStakeModifierSelectionInterval();
     int64 nSelectionIntervalStart = (pindexPrev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
-    const CBlockIndex* pindex = pindexPrev;
-    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    int nHeightFirstCandidate = 0;
+    const vector<const CBlockIndex*>& vSortedByTimestamp = GetStakeModifierCandidates(pindexPrev, nSelectionIntervalStart, nHeightFirstCandidate);
+
+    // compute the selection hash of each candidate by hashing its proof-hash
+    // and the previous proof-of-stake modifier. the selection hash is divided
+    // by 2**32 so that proof-of-stake block is always favored over
+    // proof-of-work block. this is to preserve the energy efficiency property
+    vector<uint256> vSelectionHash(vSortedByTimestamp.size());
+    for (unsigned int i = 0; i < vSortedByTimestamp.size(); i++)
     {
-        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
-        pindex = pindex->pprev;
+        const CBlockIndex* pindexCandidate = vSortedByTimestamp[i];
+        uint256 hashProof = pindexCandidate->IsProofOfStake()? pindexCandidate->hashProofOfStake : pindexCandidate->GetBlockHash();
+        vSelectionHash[i] = Hash(BEGIN(hashProof), END(hashProof), BEGIN(nStakeModifier), END(nStakeModifier));
+        if (pindexCandidate->IsProofOfStake())
+            vSelectionHash[i] >>= 32;
     }
-    int nHeightFirstCandidate = pindex ? (pindex->nHeight + 1) : 0;
-    reverse(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
-    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
 
     // Select 64 blocks from candidate blocks to generate stake modifier
     uint64 nStakeModifierNew = 0;
     int64 nSelectionIntervalStop = nSelectionIntervalStart;
-    map<uint256, const CBlockIndex*> mapSelectedBlocks;
+    vector<bool> vSelected(vSortedByTimestamp.size(), false);
     for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
     {
         // add an interval section to the current selection round
         nSelectionIntervalStop += GetStakeModifierSelectionIntervalSection(nRound);
         // select a block from the candidates of current round
-        if (!SelectBlockFromCandidates(vSortedByTimestamp, mapSelectedBlocks, nSelectionIntervalStop, nStakeModifier, &pindex))
+        unsigned int nSelected = 0;
+        if (!SelectBlockFromCandidates(vSortedByTimestamp, vSelectionHash, vSelected, nSelectionIntervalStop, &nSelected))
             return error("ComputeNextStakeModifier: unable to select block at round %d", nRound);
+        const CBlockIndex* pindex = vSortedByTimestamp[nSelected];
         // write the entropy bit of the selected block
         nStakeModifierNew |= (((uint64)pindex->GetStakeEntropyBit()) << nRound);
         // add the selected block from candidates to selected list
-        mapSelectedBlocks.insert(make_pair(pindex->GetBlockHash(), pindex));
-        if (fDebug && GetBoolArg("-printstakemodifier"))
+        vSelected[nSelected] = true;
+        if (LogAccept(LOG_STAKEMODIFIER))
             printf("ComputeNextStakeModifier: selected round %d stop=%s height=%d bit=%d\n",
                 nRound, DateTimeStrFormat(nSelectionIntervalStop).c_str(), pindex->nHeight, pindex->GetStakeEntropyBit());
     }
 
     // Print selection map for visualization of the selected blocks
-    if (fDebug && GetBoolArg("-printstakemodifier"))
+    if (LogAccept(LOG_STAKEMODIFIER))
     {
         string strSelectionMap = "";
         // '-' indicates proof-of-work blocks not selected
         strSelectionMap.insert(0, pindexPrev->nHeight - nHeightFirstCandidate + 1, '-');
-        pindex = pindexPrev;
+        const CBlockIndex* pindex = pindexPrev;
         while (pindex && pindex->nHeight >= nHeightFirstCandidate)
         {
             // '=' indicates proof-of-stake blocks not selected
@@ -234,11 +301,14 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64& nStakeMo
                 strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, "=");
             pindex = pindex->pprev;
         }
-        BOOST_FOREACH(const PAIRTYPE(uint256, const CBlockIndex*)& item, mapSelectedBlocks)
+        for (unsigned int i = 0; i < vSortedByTimestamp.size(); i++)
         {
+            if (!vSelected[i])
+                continue;
             // 'S' indicates selected proof-of-stake blocks
             // 'W' indicates selected proof-of-work blocks
-            strSelectionMap.replace(item.second->nHeight - nHeightFirstCandidate, 1, item.second->IsProofOfStake()? "S" : "W");
+            pindex = vSortedByTimestamp[i];
+            strSelectionMap.replace(pindex->nHeight - nHeightFirstCandidate, 1, pindex->IsProofOfStake()? "S" : "W");
         }
         printf("ComputeNextStakeModifier: selection height [%d, %d] map %s\n", nHeightFirstCandidate, pindexPrev->nHeight, strSelectionMap.c_str());
     }
@@ -252,14 +322,70 @@ bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64& nStakeMo
     return true;
 }
 
+// Blocks on the main chain whose kernel stake modifier is not yet known,
+// waiting for a later block to generate a modifier far enough ahead.
+static vector<CBlockIndex*> vKernelModifierPending;
+
+// Whether the cached kernel stake modifier of a block is still usable.
+// The cached block lies on the chain after pindexFrom, so as long as it is
+// in the main chain the blocks in between are unchanged.
+static bool HaveKernelStakeModifier(const CBlockIndex* pindexFrom)
+{
+    return (pindexFrom->pindexKernelModifier && pindexFrom->pindexKernelModifier->IsInMainChain());
+}
+
+// Called after a block is attached to the end of the main chain
+// (pindexNew->pprev->pnext == pindexNew): resolve the pending blocks whose
+// kernel stake modifier is the one generated by the new block.
+void ConnectKernelStakeModifier(CBlockIndex* pindexNew)
+{
+    if (pindexNew->GeneratedStakeModifier())
+    {
+        int64 nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
+        vector<CBlockIndex*> vStillPending;
+        vStillPending.reserve(vKernelModifierPending.size());
+        BOOST_FOREACH(CBlockIndex* pindex, vKernelModifierPending)
+        {
+            // drop blocks disconnected or already resolved by a lookup
+            if (!pindex->pnext || HaveKernelStakeModifier(pindex))
+                continue;
+            if (pindexNew->GetBlockTime() >= pindex->GetBlockTime() + nStakeModifierSelectionInterval)
+                pindex->pindexKernelModifier = pindexNew;
+            else
+                vStillPending.push_back(pindex);
+        }
+        vKernelModifierPending.swap(vStillPending);
+    }
+    pindexNew->pindexKernelModifier = NULL;
+    vKernelModifierPending.push_back(pindexNew);
+}
+
+// Called when a block is detached from the main chain by a reorganization.
+// Blocks that were resolved to it fail HaveKernelStakeModifier() from now on
+// and are resolved again on their next lookup.
+void DisconnectKernelStakeModifier(CBlockIndex* pindex)
+{
+    pindex->pindexKernelModifier = NULL;
+    vKernelModifierPending.erase(remove(vKernelModifierPending.begin(), vKernelModifierPending.end(), pindex), vKernelModifierPending.end());
+}
+
 // The stake modifier used to hash for a stake kernel is chosen as the stake
 // modifier about a selection interval later than the coin generating the kernel
-static bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64& nStakeModifier, int& nStakeModifierHeight, int64& nStakeModifierTime, bool fPrintProofOfStake)
+bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64& nStakeModifier, int& nStakeModifierHeight, int64& nStakeModifierTime, bool fPrintProofOfStake)
 {
     nStakeModifier = 0;
-    if (!mapBlockIndex.count(hashBlockFrom))
+    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlockFrom);
+    if (mi == mapBlockIndex.end())
         return error("GetKernelStakeModifier() : block not indexed");
-    const CBlockIndex* pindexFrom = mapBlockIndex[hashBlockFrom];
+    CBlockIndex* pindexFrom = (*mi).second;
+    if (HaveKernelStakeModifier(pindexFrom))
+    {
+        const CBlockIndex* pindex = pindexFrom->pindexKernelModifier;
+        nStakeModifier = pindex->nStakeModifier;
+        nStakeModifierHeight = pindex->nHeight;
+        nStakeModifierTime = pindex->GetBlockTime();
+        return true;
+    }
     nStakeModifierHeight = pindexFrom->nHeight;
     nStakeModifierTime = pindexFrom->GetBlockTime();
     int64 nStakeModifierSelectionInterval = GetStakeModifierSelectionInterval();
@@ -283,6 +409,7 @@ static bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64& nStakeModifier
         }
     }
     nStakeModifier = pindex->nStakeModifier;
+    pindexFrom->pindexKernelModifier = pindex;
     return true;
 }
 
@@ -442,3 +569,10 @@ bool CheckStakeModifierCheckpoints(int nHeight, unsigned int nStakeModifierCheck
         return nStakeModifierChecksum == mapStakeModifierCheckpoints[nHeight];
     return true;
 }
+
+// Whether there is a stake modifier hard checkpoint at the given height
+bool IsStakeModifierCheckpointHeight(int nHeight)
+{
+    if (fTestNet) return false; // Testnet has no checkpoints
+    return (mapStakeModifierCheckpoints.count(nHeight) > 0);
+}
@@ -28,6 +28,17 @@ bool IsProtocolV04(unsigned int nTimeBlock);
 // Compute the hash modifier for proof-of-stake
 bool ComputeNextStakeModifier(const CBlockIndex* pindexCurrent, uint64& nStakeModifier, bool& fGeneratedStakeModifier);
 
+// Forget the candidate blocks kept between modifier computations, before
+// the block indexes they point to are freed
+void ResetStakeModifierCandidates();
+
+// Maintain the per-block kernel stake modifier cache as the main chain changes
+void ConnectKernelStakeModifier(CBlockIndex* pindexNew);
+void DisconnectKernelStakeModifier(CBlockIndex* pindex);
+
+// Get the stake modifier used to hash for a stake kernel from the given block
+bool GetKernelStakeModifier(uint256 hashBlockFrom, uint64& nStakeModifier, int& nStakeModifierHeight, int64& nStakeModifierTime, bool fPrintProofOfStake);
+
 // Check whether stake kernel meets hash target
 // Sets hashProofOfStake on success return
 bool CheckStakeKernelHash(unsigned int nBits, const CBlock& blockFrom, unsigned int nTxPrevOffset, const CTransaction& txPrev, const COutPoint& prevout, unsigned int nTimeTx, uint256& hashProofOfStake, bool fPrintProofOfStake=false);
@@ -45,4 +56,7 @@ unsigned int GetStakeModifierChecksum(const CBlockIndex* pindex);
 // Check stake modifier hard checkpoints
 bool CheckStakeModifierCheckpoints(int nHeight, unsigned int nStakeModifierChecksum);
 
+// Whether there is a stake modifier hard checkpoint at the given height
+bool IsStakeModifierCheckpointHeight(int nHeight);
+
 #endif // PPCOIN_KERNEL_H
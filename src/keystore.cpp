@@ -20,7 +20,7 @@ bool CBasicKeyStore::AddKey(const CKey& key)
     bool fCompressed = false;
     CSecret secret = key.GetSecret(fCompressed);
     {
-        LOCK(cs_KeyStore);
+        WRITE_LOCK(cs_KeyStore);
         mapKeys[CBitcoinAddress(key.GetPubKey())] = make_pair(secret, fCompressed);
     }
     return true;
@@ -29,7 +29,7 @@ bool CBasicKeyStore::AddKey(const CKey& key)
 bool CBasicKeyStore::AddCScript(const CScript& redeemScript)
 {
     {
-        LOCK(cs_KeyStore);
+        WRITE_LOCK(cs_KeyStore);
         mapScripts[Hash160(redeemScript)] = redeemScript;
     }
     return true;
@@ -39,7 +39,7 @@ bool CBasicKeyStore::HaveCScript(const uint160& hash) const
 {
     bool result;
     {
-        LOCK(cs_KeyStore);
+        READ_LOCK(cs_KeyStore);
         result = (mapScripts.count(hash) > 0);
     }
     return result;
@@ -49,7 +49,7 @@ bool CBasicKeyStore::HaveCScript(const uint160& hash) const
 bool CBasicKeyStore::GetCScript(const uint160 &hash, CScript& redeemScriptOut) const
 {
     {
-        LOCK(cs_KeyStore);
+        READ_LOCK(cs_KeyStore);
         ScriptMap::const_iterator mi = mapScripts.find(hash);
         if (mi != mapScripts.end())
         {
@@ -63,7 +63,7 @@ bool CBasicKeyStore::GetCScript(const uint160 &hash, CScript& redeemScriptOut) c
 bool CCryptoKeyStore::SetCrypted()
 {
     {
-        LOCK(cs_KeyStore);
+        WRITE_LOCK(cs_KeyStore);
         if (fUseCrypto)
             return true;
         if (!mapKeys.empty())
@@ -75,11 +75,11 @@ bool CCryptoKeyStore::SetCrypted()
 
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
-    {
-        LOCK(cs_KeyStore);
-        if (!SetCrypted())
-            return false;
+    if (!SetCrypted())
+        return false;
 
+    {
+        WRITE_LOCK(cs_KeyStore);
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
         for (; mi != mapCryptedKeys.end(); ++mi)
         {
@@ -104,34 +104,39 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 
 bool CCryptoKeyStore::AddKey(const CKey& key)
 {
+    std::vector<unsigned char> vchCryptedSecret;
+    std::vector<unsigned char> vchPubKey = key.GetPubKey();
     {
-        LOCK(cs_KeyStore);
-        if (!IsCrypted())
-            return CBasicKeyStore::AddKey(key);
+        WRITE_LOCK(cs_KeyStore);
+        if (!fUseCrypto)
+        {
+            bool fCompressed = false;
+            CSecret secret = key.GetSecret(fCompressed);
+            mapKeys[CBitcoinAddress(vchPubKey)] = make_pair(secret, fCompressed);
+            return true;
+        }
 
-        if (IsLocked())
+        if (vMasterKey.empty())
             return false;
 
-        std::vector<unsigned char> vchCryptedSecret;
-        std::vector<unsigned char> vchPubKey = key.GetPubKey();
         bool fCompressed;
         if (!EncryptSecret(vMasterKey, key.GetSecret(fCompressed), Hash(vchPubKey.begin(), vchPubKey.end()), vchCryptedSecret))
             return false;
-
-        if (!AddCryptedKey(key.GetPubKey(), vchCryptedSecret))
-            return false;
     }
-    return true;
+
+    // virtual, and may write to the wallet database: call without the lock.
+    // fUseCrypto is never cleared again, so the store is still encrypted.
+    return AddCryptedKey(vchPubKey, vchCryptedSecret);
 }
 
 
 bool CCryptoKeyStore::AddCryptedKey(const std::vector<unsigned char> &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
-    {
-        LOCK(cs_KeyStore);
-        if (!SetCrypted())
-            return false;
+    if (!SetCrypted())
+        return false;
 
+    {
+        WRITE_LOCK(cs_KeyStore);
         mapCryptedKeys[CBitcoinAddress(vchPubKey)] = make_pair(vchPubKey, vchCryptedSecret);
     }
     return true;
@@ -140,9 +145,9 @@ bool CCryptoKeyStore::AddCryptedKey(const std::vector<unsigned char> &vchPubKey,
 bool CCryptoKeyStore::GetKey(const CBitcoinAddress &address, CKey& keyOut) const
 {
     {
-        LOCK(cs_KeyStore);
-        if (!IsCrypted())
-            return CBasicKeyStore::GetKey(address, keyOut);
+        READ_LOCK(cs_KeyStore);
+        if (!fUseCrypto)
+            return GetPlainKey(address, keyOut);
 
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
@@ -165,9 +170,15 @@ bool CCryptoKeyStore::GetKey(const CBitcoinAddress &address, CKey& keyOut) const
 bool CCryptoKeyStore::GetPubKey(const CBitcoinAddress &address, std::vector<unsigned char>& vchPubKeyOut) const
 {
     {
-        LOCK(cs_KeyStore);
-        if (!IsCrypted())
-            return CKeyStore::GetPubKey(address, vchPubKeyOut);
+        READ_LOCK(cs_KeyStore);
+        if (!fUseCrypto)
+        {
+            CKey key;
+            if (!GetPlainKey(address, key))
+                return false;
+            vchPubKeyOut = key.GetPubKey();
+            return true;
+        }
 
         CryptedKeyMap::const_iterator mi = mapCryptedKeys.find(address);
         if (mi != mapCryptedKeys.end())
@@ -181,12 +192,14 @@ bool CCryptoKeyStore::GetPubKey(const CBitcoinAddress &address, std::vector<unsi
 
 bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
 {
+    // Encrypt every key into a new map and only switch over once all of
+    // them succeeded, so that a failure leaves the store unencrypted
+    CryptedKeyMap mapCryptedKeysNew;
     {
-        LOCK(cs_KeyStore);
-        if (!mapCryptedKeys.empty() || IsCrypted())
+        WRITE_LOCK(cs_KeyStore);
+        if (!mapCryptedKeys.empty() || fUseCrypto)
             return false;
 
-        fUseCrypto = true;
         BOOST_FOREACH(KeyMap::value_type& mKey, mapKeys)
         {
             CKey key;
@@ -197,10 +210,18 @@ bool CCryptoKeyStore::EncryptKeys(CKeyingMaterial& vMasterKeyIn)
             bool fCompressed;
             if (!EncryptSecret(vMasterKeyIn, key.GetSecret(fCompressed), Hash(vchPubKey.begin(), vchPubKey.end()), vchCryptedSecret))
                 return false;
-            if (!AddCryptedKey(vchPubKey, vchCryptedSecret))
-                return false;
+            mapCryptedKeysNew[CBitcoinAddress(vchPubKey)] = make_pair(vchPubKey, vchCryptedSecret);
         }
+
+        fUseCrypto = true;
+        mapCryptedKeys = mapCryptedKeysNew;
         mapKeys.clear();
     }
+
+    // AddCryptedKey is virtual and may write to the wallet database: call
+    // it without the lock, only to store keys already in place
+    BOOST_FOREACH(const CryptedKeyMap::value_type& mKey, mapCryptedKeysNew)
+        if (!AddCryptedKey(mKey.second.first, mKey.second.second))
+            return false;
     return true;
 }
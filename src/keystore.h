@@ -15,7 +15,10 @@ class CScript;
 class CKeyStore
 {
 protected:
-    mutable CCriticalSection cs_KeyStore;
+    // Read-mostly: IsMine looks up keys and scripts for every transaction.
+    // Not recursive, so nothing may call back into the key store while
+    // holding it; AddCryptedKey in particular is overridden by CWallet.
+    mutable CSharedCriticalSection cs_KeyStore;
 
 public:
     virtual ~CKeyStore() {}
@@ -54,13 +57,24 @@ protected:
     KeyMap mapKeys;
     ScriptMap mapScripts;
 
+    // caller must hold cs_KeyStore
+    bool GetPlainKey(const CBitcoinAddress &address, CKey &keyOut) const
+    {
+        KeyMap::const_iterator mi = mapKeys.find(address);
+        if (mi == mapKeys.end())
+            return false;
+        keyOut.Reset();
+        keyOut.SetSecret((*mi).second.first, (*mi).second.second);
+        return true;
+    }
+
 public:
     bool AddKey(const CKey& key);
     bool HaveKey(const CBitcoinAddress &address) const
     {
         bool result;
         {
-            LOCK(cs_KeyStore);
+            READ_LOCK(cs_KeyStore);
             result = (mapKeys.count(address) > 0);
         }
         return result;
@@ -69,7 +83,7 @@ public:
     {
         setAddress.clear();
         {
-            LOCK(cs_KeyStore);
+            READ_LOCK(cs_KeyStore);
             KeyMap::const_iterator mi = mapKeys.begin();
             while (mi != mapKeys.end())
             {
@@ -80,17 +94,8 @@ public:
     }
     bool GetKey(const CBitcoinAddress &address, CKey &keyOut) const
     {
-        {
-            LOCK(cs_KeyStore);
-            KeyMap::const_iterator mi = mapKeys.find(address);
-            if (mi != mapKeys.end())
-            {
-                keyOut.Reset();
-                keyOut.SetSecret((*mi).second.first, (*mi).second.second);
-                return true;
-            }
-        }
-        return false;
+        READ_LOCK(cs_KeyStore);
+        return GetPlainKey(address, keyOut);
     }
     virtual bool AddCScript(const CScript& redeemScript);
     virtual bool HaveCScript(const uint160 &hash) const;
@@ -133,14 +138,8 @@ public:
 
     bool IsLocked() const
     {
-        if (!IsCrypted())
-            return false;
-        bool result;
-        {
-            LOCK(cs_KeyStore);
-            result = vMasterKey.empty();
-        }
-        return result;
+        READ_LOCK(cs_KeyStore);
+        return fUseCrypto && vMasterKey.empty();
     }
 
     bool Lock()
@@ -149,7 +148,7 @@ public:
             return false;
 
         {
-            LOCK(cs_KeyStore);
+            WRITE_LOCK(cs_KeyStore);
             vMasterKey.clear();
         }
 
@@ -160,29 +159,32 @@ public:
     bool AddKey(const CKey& key);
     bool HaveKey(const CBitcoinAddress &address) const
     {
-        {
-            LOCK(cs_KeyStore);
-            if (!IsCrypted())
-                return CBasicKeyStore::HaveKey(address);
-            return mapCryptedKeys.count(address) > 0;
-        }
-        return false;
+        // test fUseCrypto under the lock, so EncryptKeys cannot switch the
+        // maps over between the test and the lookup
+        READ_LOCK(cs_KeyStore);
+        if (!fUseCrypto)
+            return mapKeys.count(address) > 0;
+        return mapCryptedKeys.count(address) > 0;
     }
     bool GetKey(const CBitcoinAddress &address, CKey& keyOut) const;
     bool GetPubKey(const CBitcoinAddress &address, std::vector<unsigned char>& vchPubKeyOut) const;
     void GetKeys(std::set<CBitcoinAddress> &setAddress) const
     {
-        if (!IsCrypted())
-        {
-            CBasicKeyStore::GetKeys(setAddress);
-            return;
-        }
         setAddress.clear();
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        while (mi != mapCryptedKeys.end())
         {
-            setAddress.insert((*mi).first);
-            mi++;
+            READ_LOCK(cs_KeyStore);
+            if (!fUseCrypto)
+            {
+                for (KeyMap::const_iterator mi = mapKeys.begin(); mi != mapKeys.end(); mi++)
+                    setAddress.insert((*mi).first);
+                return;
+            }
+            CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
+            while (mi != mapCryptedKeys.end())
+            {
+                setAddress.insert((*mi).first);
+                mi++;
+            }
         }
     }
 };
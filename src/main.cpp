@@ -10,6 +10,9 @@
 #include "init.h"
 #include "ui_interface.h"
 #include "kernel.h"
+#include "txview.h"
+#include "config.h"
+#include "metrics.h"
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -27,6 +30,7 @@ set<CWallet*> setpwalletRegistered;
 CCriticalSection cs_main;
 
 CTxMemPool mempool;
+COrphanPool orphanpool;
 unsigned int nTransactionsUpdated = 0;
 
 map<uint256, CBlockIndex*> mapBlockIndex;
@@ -44,6 +48,7 @@ CBigNum bnBestInvalidTrust = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
+static vector<CBlockIndex*> vBlockIndexByHeight; // PFN: main chain by height
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
@@ -52,8 +57,6 @@ multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 set<pair<COutPoint, unsigned int> > setStakeSeenOrphan;
 map<uint256, uint256> mapProofOfStake;
 
-map<uint256, CDataStream*> mapOrphanTransactions;
-map<uint256, map<uint256, CDataStream*> > mapOrphanTransactionsByPrev;
 
 // Constant stuff for coinbase transactions we create:
 CScript COINBASE_FLAGS;
@@ -179,75 +182,124 @@ void static ResendWalletTransactions()
 
 //////////////////////////////////////////////////////////////////////////////
 //
-// mapOrphanTransactions
+// COrphanPool
 //
 
-bool AddOrphanTx(const CDataStream& vMsg)
+bool COrphanPool::add(const CTransaction& tx, const CNetAddr& addrFrom)
 {
-    CTransaction tx;
-    CDataStream(vMsg) >> tx;
     uint256 hash = tx.GetHash();
-    if (mapOrphanTransactions.count(hash))
+    if (mapTx.count(hash))
         return false;
 
-    CDataStream* pvMsg = new CDataStream(vMsg);
-
     // Ignore big transactions, to avoid a
     // send-big-orphans memory exhaustion attack. If a peer has a legitimate
     // large transaction with a missing parent then we assume
     // it will rebroadcast it later, after the parent transaction(s)
     // have been mined or received.
-    // 10,000 orphans, each of which is at most 5,000 bytes big is
-    // at most 500 megabytes of orphans:
-    if (pvMsg->size() > 5000)
+    unsigned int nSize = ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION);
+    if (nSize > MAX_ORPHAN_TX_SIZE)
+    {
+        printf("ignoring large orphan tx (size: %u, hash: %s)\n", nSize, hash.ToString().substr(0,10).c_str());
+        return false;
+    }
+
+    expire();
+
+    // Rough heap footprint of the deserialized copy
+    unsigned int nTxUsage = nSize + sizeof(COrphanTx) + tx.vin.size() * sizeof(CTxIn) + tx.vout.size() * sizeof(CTxOut);
+    if (GetUsage(addrFrom) + nTxUsage > MAX_ORPHAN_PEER_USAGE)
     {
-        printf("ignoring large orphan tx (size: %u, hash: %s)\n", pvMsg->size(), hash.ToString().substr(0,10).c_str());
-        delete pvMsg;
+        printf("ignoring orphan tx %s, %s is over its share\n", hash.ToString().substr(0,10).c_str(), addrFrom.ToString().c_str());
         return false;
     }
 
-    mapOrphanTransactions[hash] = pvMsg;
+    COrphanTx& orphan = mapTx[hash];
+    orphan.tx = tx;
+    orphan.addrFrom = addrFrom;
+    orphan.nTimeExpire = GetTime() + ORPHAN_TX_EXPIRE_TIME;
+    orphan.nUsage = nTxUsage;
     BOOST_FOREACH(const CTxIn& txin, tx.vin)
-        mapOrphanTransactionsByPrev[txin.prevout.hash].insert(make_pair(hash, pvMsg));
+        mapByPrev[txin.prevout.hash].insert(hash);
+    setByExpire.insert(make_pair(orphan.nTimeExpire, hash));
+    CPeerOrphans& peer = mapPeer[addrFrom];
+    peer.setByExpire.insert(make_pair(orphan.nTimeExpire, hash));
+    peer.nUsage += nTxUsage;
+    nUsage += nTxUsage;
+
+    printf("stored orphan tx %s (mapsz %u, %u bytes)\n", hash.ToString().substr(0,10).c_str(),
+        mapTx.size(), nUsage);
+    return true;
+}
 
-    printf("stored orphan tx %s (mapsz %u)\n", hash.ToString().substr(0,10).c_str(),
-        mapOrphanTransactions.size());
+bool COrphanPool::erase(const uint256& hash)
+{
+    map<uint256, COrphanTx>::iterator it = mapTx.find(hash);
+    if (it == mapTx.end())
+        return false;
+    const COrphanTx& orphan = (*it).second;
+    BOOST_FOREACH(const CTxIn& txin, orphan.tx.vin)
+    {
+        map<uint256, set<uint256> >::iterator mi = mapByPrev.find(txin.prevout.hash);
+        if (mi == mapByPrev.end())
+            continue;
+        (*mi).second.erase(hash);
+        if ((*mi).second.empty())
+            mapByPrev.erase(mi);
+    }
+    setByExpire.erase(make_pair(orphan.nTimeExpire, hash));
+    map<CNetAddr, CPeerOrphans>::iterator mi = mapPeer.find(orphan.addrFrom);
+    if (mi != mapPeer.end())
+    {
+        (*mi).second.setByExpire.erase(make_pair(orphan.nTimeExpire, hash));
+        (*mi).second.nUsage -= orphan.nUsage;
+        if ((*mi).second.setByExpire.empty())
+            mapPeer.erase(mi);
+    }
+    nUsage -= orphan.nUsage;
+    mapTx.erase(it);
     return true;
 }
 
-void static EraseOrphanTx(uint256 hash)
+unsigned int COrphanPool::expire()
 {
-    if (!mapOrphanTransactions.count(hash))
-        return;
-    const CDataStream* pvMsg = mapOrphanTransactions[hash];
-    CTransaction tx;
-    CDataStream(*pvMsg) >> tx;
-    BOOST_FOREACH(const CTxIn& txin, tx.vin)
+    unsigned int nExpired = 0;
+    int64 nNow = GetTime();
+    while (!setByExpire.empty() && (*setByExpire.begin()).first <= nNow)
     {
-        mapOrphanTransactionsByPrev[txin.prevout.hash].erase(hash);
-        if (mapOrphanTransactionsByPrev[txin.prevout.hash].empty())
-            mapOrphanTransactionsByPrev.erase(txin.prevout.hash);
+        uint256 hash = (*setByExpire.begin()).second;
+        erase(hash);
+        nExpired++;
     }
-    delete pvMsg;
-    mapOrphanTransactions.erase(hash);
+    if (nExpired > 0)
+        printf("expired %u orphan tx\n", nExpired);
+    return nExpired;
 }
 
-unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans)
+unsigned int COrphanPool::limit(unsigned int nMaxUsage)
 {
     unsigned int nEvicted = 0;
-    while (mapOrphanTransactions.size() > nMaxOrphans)
+    expire();
+    while (nUsage > nMaxUsage && !mapPeer.empty())
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, CDataStream*>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        map<CNetAddr, CPeerOrphans>::iterator miBiggest = mapPeer.begin();
+        for (map<CNetAddr, CPeerOrphans>::iterator mi = mapPeer.begin(); mi != mapPeer.end(); ++mi)
+            if ((*mi).second.nUsage > (*miBiggest).second.nUsage)
+                miBiggest = mi;
+        uint256 hash = (*(*miBiggest).second.setByExpire.begin()).second;
+        erase(hash);
         ++nEvicted;
     }
     return nEvicted;
 }
 
+void COrphanPool::getChildren(const uint256& hashPrev, vector<uint256>& vHashRet) const
+{
+    map<uint256, set<uint256> >::const_iterator mi = mapByPrev.find(hashPrev);
+    if (mi != mapByPrev.end())
+        vHashRet.insert(vHashRet.end(), (*mi).second.begin(), (*mi).second.end());
+}
+
+
 
 
 
@@ -443,60 +495,75 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
 
 
 
-bool CTransaction::CheckTransaction() const
+// The checks that don't depend on any context, shared by CTransaction and
+// CTransactionView so that a transaction from the network can be checked
+// before it is built
+template<typename TxType>
+static bool CheckTransactionFields(const TxType& tx)
 {
     // Basic checks that don't depend on any context
-    if (vin.empty())
-        return DoS(10, error("CTransaction::CheckTransaction() : vin empty"));
-    if (vout.empty())
-        return DoS(10, error("CTransaction::CheckTransaction() : vout empty"));
+    if (tx.vin.empty())
+        return tx.DoS(10, error("CTransaction::CheckTransaction() : vin empty"));
+    if (tx.vout.empty())
+        return tx.DoS(10, error("CTransaction::CheckTransaction() : vout empty"));
     // Size limits
-    if (::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
-        return DoS(100, error("CTransaction::CheckTransaction() : size limits failed"));
+    if (tx.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
+        return tx.DoS(100, error("CTransaction::CheckTransaction() : size limits failed"));
 
     // Check for negative or overflow output values
     int64 nValueOut = 0;
-    for (int i = 0; i < vout.size(); i++)
+    for (int i = 0; i < tx.vout.size(); i++)
     {
-        const CTxOut& txout = vout[i];
-        if (txout.IsEmpty() && (!IsCoinBase()) && (!IsCoinStake()))
-            return DoS(100, error("CTransaction::CheckTransaction() : txout empty for user transaction"));
+        bool fEmpty = tx.vout[i].IsEmpty();
+        int64 nValue = tx.vout[i].nValue;
+        if (fEmpty && (!tx.IsCoinBase()) && (!tx.IsCoinStake()))
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : txout empty for user transaction"));
         // PFN: enforce minimum output amount
-        if ((!txout.IsEmpty()) && (!IsCoinBase() && txout.nValue < MIN_TXOUT_AMOUNT))
-            return DoS(100, error("CTransaction::CheckTransaction() : txout.nValue below minimum"));
-        if ((!txout.IsEmpty()) && txout.nValue < 0)
-            return DoS(100, error("CTransaction::CheckTransaction() : txout.nValue negative"));
-        if (txout.nValue > MAX_MONEY)
-            return DoS(100, error("CTransaction::CheckTransaction() : txout.nValue too high"));
-        nValueOut += txout.nValue;
+        if ((!fEmpty) && (!tx.IsCoinBase() && nValue < MIN_TXOUT_AMOUNT))
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : txout.nValue below minimum"));
+        if ((!fEmpty) && nValue < 0)
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : txout.nValue negative"));
+        if (nValue > MAX_MONEY)
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : txout.nValue too high"));
+        nValueOut += nValue;
         if (!MoneyRange(nValueOut))
-            return DoS(100, error("CTransaction::CheckTransaction() : txout total out of range"));
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : txout total out of range"));
     }
 
     // Check for duplicate inputs
     set<COutPoint> vInOutPoints;
-    BOOST_FOREACH(const CTxIn& txin, vin)
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
     {
-        if (vInOutPoints.count(txin.prevout))
+        if (vInOutPoints.count(tx.vin[i].prevout))
             return false;
-        vInOutPoints.insert(txin.prevout);
+        vInOutPoints.insert(tx.vin[i].prevout);
     }
 
-    if (IsCoinBase())
+    if (tx.IsCoinBase())
     {
-        if (vin[0].scriptSig.size() < 2 || vin[0].scriptSig.size() > 100)
-            return DoS(100, error("CTransaction::CheckTransaction() : coinbase script size"));
+        if (tx.vin[0].scriptSig.size() < 2 || tx.vin[0].scriptSig.size() > 100)
+            return tx.DoS(100, error("CTransaction::CheckTransaction() : coinbase script size"));
     }
     else
     {
-        BOOST_FOREACH(const CTxIn& txin, vin)
-            if (txin.prevout.IsNull())
-                return DoS(10, error("CTransaction::CheckTransaction() : prevout is null"));
+        for (unsigned int i = 0; i < tx.vin.size(); i++)
+            if (tx.vin[i].prevout.IsNull())
+                return tx.DoS(10, error("CTransaction::CheckTransaction() : prevout is null"));
     }
 
     return true;
 }
 
+bool CTransaction::CheckTransaction() const
+{
+    return CheckTransactionFields(*this);
+}
+
+bool CTransactionView::CheckTransaction() const
+{
+    return CheckTransactionFields(*this);
+}
+
 bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
                         bool* pfMissingInputs)
 {
@@ -606,7 +673,7 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
                 nLastTime = nNow;
                 // -limitfreerelay unit is thousand-bytes-per-minute
                 // At default rate it would take over a month to fill 1GB
-                if (dFreeCount > GetArg("-limitfreerelay", 15)*10*1000 && !IsFromMe(tx))
+                if (dFreeCount > configLimitFreeRelay.Get()*10*1000 && !IsFromMe(tx))
                     return error("CTxMemPool::accept() : free transaction rejected by rate limiter");
                 if (fDebug)
                     printf("Rate limit dFreeCount: %g => %g\n", dFreeCount, dFreeCount+nSize);
@@ -644,7 +711,12 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
 
 bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMissingInputs)
 {
-    return mempool.accept(txdb, *this, fCheckInputs, pfMissingInputs);
+    CMetricTimer timer(metricMempoolAccept.Get());
+    if (mempool.accept(txdb, *this, fCheckInputs, pfMissingInputs))
+        return true;
+    if (fMetrics)
+        metricMempoolRejects.Get().Inc();
+    return false;
 }
 
 bool CTxMemPool::addUnchecked(CTransaction &tx)
@@ -855,7 +927,7 @@ int64 GetProofOfStakeReward(int64 nCoinAge, int nHeight)
 {
     int64 nRewardCoinYear = GetProofOfStakeRewardYear(nHeight);  // creation amount per coin-year
     int64 nSubsidy = nRewardCoinYear * nCoinAge * 33 / (365 * 33 + 8);
-    if (fDebug && GetBoolArg("-printcreation"))
+    if (LogAccept(LOG_CREATION))
         printf("GetProofOfStakeReward(): create=%s nCoinAge=%"PRI64d"\n", FormatMoney(nSubsidy).c_str(), nCoinAge);
     return nSubsidy;
 }
@@ -1038,6 +1110,7 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
     // (in which case the transaction should be stored as an orphan)
     // or because the transaction is malformed (in which case the transaction should
     // be dropped).  If tx is definitely invalid, fInvalid will be set to true.
+    CMetricTimer timer(metricFetchInputs.Get());
     fInvalid = false;
 
     if (IsCoinBase())
@@ -1156,6 +1229,7 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
     // fMiner is true when called from the internal bitcoin miner
     // ... both are false when called from CTransaction::AcceptToMemoryPool
+    CMetricTimer timer(metricConnectInputs.Get());
     if (!IsCoinBase())
     {
         int64 nValueIn = 0;
@@ -1208,6 +1282,8 @@ bool CTransaction::ConnectInputs(CTxDB& txdb, MapPrevTx inputs,
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
                 // Verify signature
+                if (fMetrics)
+                    metricSignatureChecks.Get().Inc();
                 if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0))
                 {
                     // only during transition phase for P2SH: do not invoke anti-DoS code for
@@ -1336,6 +1412,8 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
+    CMetricTimer timer(metricConnectBlock.Get());
+
     // Check it again in case a previous version let a bad block in
     if (!CheckBlock())
         return false;
@@ -1433,7 +1511,7 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 
     // PFN: fees are not collected by miners as in bitcoin
     // PFN: fees are destroyed to compensate the entire network
-    if (fDebug && GetBoolArg("-printcreation"))
+    if (LogAccept(LOG_CREATION))
         printf("ConnectBlock() : destroy=%s nFees=%"PRI64d"\n", FormatMoney(nFees).c_str(), nFees);
 
     // Update block index on disk without changing it in memory.
@@ -1529,13 +1607,19 @@ bool Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
 
     // Disconnect shorter branch
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect)
+    {
         if (pindex->pprev)
             pindex->pprev->pnext = NULL;
+        DisconnectKernelStakeModifier(pindex);
+    }
 
     // Connect longer branch
     BOOST_FOREACH(CBlockIndex* pindex, vConnect)
+    {
         if (pindex->pprev)
             pindex->pprev->pnext = pindex;
+        ConnectKernelStakeModifier(pindex);
+    }
 
     // Resurrect memory transactions that were in the disconnected branch
     BOOST_FOREACH(CTransaction& tx, vResurrect)
@@ -1576,6 +1660,7 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
 
     // Add to current best branch
     pindexNew->pprev->pnext = pindexNew;
+    ConnectKernelStakeModifier(pindexNew);
 
     // Delete redundant memory transactions
     BOOST_FOREACH(CTransaction& tx, vtx)
@@ -1586,6 +1671,7 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
 
 bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 {
+    CMetricTimer timer(metricSetBestChain.Get());
     uint256 hash = GetHash();
 
     if (!txdb.TxnBegin())
@@ -1597,6 +1683,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
         if (!txdb.TxnCommit())
             return error("SetBestChain() : TxnCommit failed");
         pindexGenesisBlock = pindexNew;
+        ConnectKernelStakeModifier(pindexNew);
     }
     else if (hashPrevBlock == hashBestChain)
     {
@@ -1660,6 +1747,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     // New best block
     hashBestChain = hash;
     pindexBest = pindexNew;
+    SetBlockIndexByHeight(pindexBest);
     nBestHeight = pindexBest->nHeight;
     bnBestChainTrust = pindexNew->bnChainTrust;
     nTimeBestReceived = GetTime();
@@ -1678,6 +1766,29 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 }
 
 
+// PFN: keep the height lookup of FindBlockByHeight in step with a new best
+// block; only the blocks above the fork point are rewritten. NULL empties it.
+void SetBlockIndexByHeight(CBlockIndex* pindexNew)
+{
+    if (!pindexNew)
+    {
+        vBlockIndexByHeight.clear();
+        return;
+    }
+    vBlockIndexByHeight.resize(pindexNew->nHeight + 1);
+    for (CBlockIndex* pindex = pindexNew; pindex && vBlockIndexByHeight[pindex->nHeight] != pindex; pindex = pindex->pprev)
+        vBlockIndexByHeight[pindex->nHeight] = pindex;
+}
+
+// Block of the main chain at nHeight, or NULL if there is none
+CBlockIndex* FindBlockByHeight(int nHeight)
+{
+    if (nHeight < 0 || nHeight >= (int)vBlockIndexByHeight.size())
+        return NULL;
+    return vBlockIndexByHeight[nHeight];
+}
+
+
 // PFN: total coin age spent in transaction, in the unit of coin-days.
 // Only those coins meeting minimum age requirement counts. As those
 // transactions not in main chain are not currently indexed so we
@@ -1713,12 +1824,12 @@ bool CTransaction::GetCoinAge(CTxDB& txdb, uint64& nCoinAge) const
         int64 nValueIn = txPrev.vout[txin.prevout.n].nValue;
         bnCentSecond += CBigNum(nValueIn) * (nTime-txPrev.nTime) / CENT;
 
-        if (fDebug && GetBoolArg("-printcoinage"))
+        if (LogAccept(LOG_COINAGE))
             printf("coin age nValueIn=%-12I64d nTimeDiff=%d bnCentSecond=%s\n", nValueIn, nTime - txPrev.nTime, bnCentSecond.ToString().c_str());
     }
 
     CBigNum bnCoinDay = bnCentSecond * CENT / COIN / (24 * 60 * 60);
-    if (fDebug && GetBoolArg("-printcoinage"))
+    if (LogAccept(LOG_COINAGE))
         printf("coin age bnCoinDay=%s\n", bnCoinDay.ToString().c_str());
     nCoinAge = bnCoinDay.getuint64();
     return true;
@@ -1741,7 +1852,7 @@ bool CBlock::GetCoinAge(uint64& nCoinAge) const
 
     if (nCoinAge == 0) // block coin age minimum 1 coin-day
         nCoinAge = 1;
-    if (fDebug && GetBoolArg("-printcoinage"))
+    if (LogAccept(LOG_COINAGE))
         printf("block coin age total nCoinDays=%"PRI64d"\n", nCoinAge);
     return true;
 }
@@ -1828,92 +1939,107 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
 
 
 
-bool CBlock::CheckBlock() const
+// The checks that don't depend on any context, shared by CBlock and
+// CBlockView so that a block from the network can be checked before it is
+// built
+template<typename BlockType>
+static bool CheckBlockFields(const BlockType& block)
 {
     // These are checks that are independent of context
     // that can be verified before saving an orphan block.
+    CMetricTimer timer(metricCheckBlock.Get());
 
     // Size limits
-    if (vtx.empty() || vtx.size() > MAX_BLOCK_SIZE || ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
-        return DoS(100, error("CheckBlock() : size limits failed"));
+    if (block.vtx.empty() || block.vtx.size() > MAX_BLOCK_SIZE || block.GetSerializeSize(SER_NETWORK, PROTOCOL_VERSION) > MAX_BLOCK_SIZE)
+        return block.DoS(100, error("CheckBlock() : size limits failed"));
 
     // Check proof of work matches claimed amount
-    if (IsProofOfWork() && !CheckProofOfWork(GetHash(), nBits))
-        return DoS(50, error("CheckBlock() : proof of work failed"));
+    if (block.IsProofOfWork() && !CheckProofOfWork(block.GetHash(), block.nBits))
+        return block.DoS(50, error("CheckBlock() : proof of work failed"));
 
     // Check timestamp
-    if (GetBlockTime() > GetAdjustedTime() + nMaxClockDrift)
+    if (block.GetBlockTime() > GetAdjustedTime() + nMaxClockDrift)
         return error("CheckBlock() : block timestamp too far in the future");
 
     // First transaction must be coinbase, the rest must not be
-    if (vtx.empty() || !vtx[0].IsCoinBase())
-        return DoS(100, error("CheckBlock() : first tx is not coinbase"));
-    for (unsigned int i = 1; i < vtx.size(); i++)
-        if (vtx[i].IsCoinBase())
-            return DoS(100, error("CheckBlock() : more than one coinbase"));
+    if (block.vtx.empty() || !block.vtx[0].IsCoinBase())
+        return block.DoS(100, error("CheckBlock() : first tx is not coinbase"));
+    for (unsigned int i = 1; i < block.vtx.size(); i++)
+        if (block.vtx[i].IsCoinBase())
+            return block.DoS(100, error("CheckBlock() : more than one coinbase"));
 
     // PFN: only the second transaction can be the optional coinstake
-    for (int i = 2; i < vtx.size(); i++)
-        if (vtx[i].IsCoinStake())
-            return DoS(100, error("CheckBlock() : coinstake in wrong position"));
+    for (int i = 2; i < block.vtx.size(); i++)
+        if (block.vtx[i].IsCoinStake())
+            return block.DoS(100, error("CheckBlock() : coinstake in wrong position"));
 
     // PFN: coinbase output should be empty if proof-of-stake block
-    if (IsProofOfStake() && (vtx[0].vout.size() != 1 || !vtx[0].vout[0].IsEmpty()))
+    if (block.IsProofOfStake() && (block.vtx[0].vout.size() != 1 || !block.vtx[0].vout[0].IsEmpty()))
         return error("CheckBlock() : coinbase output not empty for proof-of-stake block");
 
     // Check coinbase timestamp
-    if (GetBlockTime() > (int64)vtx[0].nTime + nMaxClockDrift)
-        return DoS(50, error("CheckBlock() : coinbase timestamp is too early"));
+    if (block.GetBlockTime() > (int64)block.vtx[0].nTime + nMaxClockDrift)
+        return block.DoS(50, error("CheckBlock() : coinbase timestamp is too early"));
 
     // Check coinstake timestamp
-    if (IsProofOfStake() && !CheckCoinStakeTimestamp(GetBlockTime(), (int64)vtx[1].nTime))
-        return DoS(50, error("CheckBlock() : coinstake timestamp violation nTimeBlock=%u nTimeTx=%u", GetBlockTime(), vtx[1].nTime));
+    if (block.IsProofOfStake() && !CheckCoinStakeTimestamp(block.GetBlockTime(), (int64)block.vtx[1].nTime))
+        return block.DoS(50, error("CheckBlock() : coinstake timestamp violation nTimeBlock=%u nTimeTx=%u", block.GetBlockTime(), block.vtx[1].nTime));
 
     // Check coinbase reward
-    if (vtx[0].GetValueOut() > (IsProofOfWork()? (GetProofOfWorkReward(hashPrevBlock) - vtx[0].GetMinFee() + MIN_TX_FEE) : 0))
-        return DoS(50, error("CheckBlock() : coinbase reward exceeded %s > %s", 
-                   FormatMoney(vtx[0].GetValueOut()).c_str(),
-                   FormatMoney(IsProofOfWork()? GetProofOfWorkReward(hashPrevBlock) : 0).c_str()));
+    if (block.vtx[0].GetValueOut() > (block.IsProofOfWork()? (GetProofOfWorkReward(block.hashPrevBlock) - block.vtx[0].GetMinFee() + MIN_TX_FEE) : 0))
+        return block.DoS(50, error("CheckBlock() : coinbase reward exceeded %s > %s", 
+                   FormatMoney(block.vtx[0].GetValueOut()).c_str(),
+                   FormatMoney(block.IsProofOfWork()? GetProofOfWorkReward(block.hashPrevBlock) : 0).c_str()));
 
     // Check transactions
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        if (!tx.CheckTransaction())
-            return DoS(tx.nDoS, error("CheckBlock() : CheckTransaction failed"));
+        if (!block.vtx[i].CheckTransaction())
+            return block.DoS(block.vtx[i].nDoS, error("CheckBlock() : CheckTransaction failed"));
         // PFN: check transaction timestamp
-        if (GetBlockTime() < (int64)tx.nTime)
-            return DoS(50, error("CheckBlock() : block timestamp earlier than transaction timestamp"));
+        if (block.GetBlockTime() < (int64)block.vtx[i].nTime)
+            return block.DoS(50, error("CheckBlock() : block timestamp earlier than transaction timestamp"));
     }
 
     // Check for duplicate txids. This is caught by ConnectInputs(),
     // but catching it earlier avoids a potential DoS attack:
     set<uint256> uniqueTx;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        uniqueTx.insert(tx.GetHash());
+        uniqueTx.insert(block.vtx[i].GetHash());
     }
-    if (uniqueTx.size() != vtx.size())
-        return DoS(100, error("CheckBlock() : duplicate transaction"));
+    if (uniqueTx.size() != block.vtx.size())
+        return block.DoS(100, error("CheckBlock() : duplicate transaction"));
 
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
-        nSigOps += tx.GetLegacySigOpCount();
+        nSigOps += block.vtx[i].GetLegacySigOpCount();
     }
     if (nSigOps > MAX_BLOCK_SIGOPS)
-        return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
+        return block.DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
 
     // Check merkleroot
-    if (hashMerkleRoot != BuildMerkleTree())
-        return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
+    if (block.hashMerkleRoot != block.BuildMerkleTree())
+        return block.DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
 
     // PFN: check block signature
-    if (!CheckBlockSignature())
-        return DoS(100, error("CheckBlock() : bad block signature"));
+    if (!block.CheckBlockSignature())
+        return block.DoS(100, error("CheckBlock() : bad block signature"));
 
     return true;
 }
 
+bool CBlock::CheckBlock() const
+{
+    return CheckBlockFields(*this);
+}
+
+bool CBlockView::CheckBlock() const
+{
+    return CheckBlockFields(*this);
+}
+
 bool CBlock::AcceptBlock()
 {
     // Check for duplicate
@@ -1936,7 +2062,7 @@ bool CBlock::AcceptBlock()
     if (GetBlockTime() <= pindexPrev->GetMedianTimePast() || GetBlockTime() + nMaxClockDrift < pindexPrev->GetBlockTime())
         return error("AcceptBlock() : block's timestamp is too early");
         
-    if (IsProofOfWork() && nHeight > LAST_POW_BLOCK)
+    if (IsProofOfWork() && nHeight > LAST_POW_BLOCK && !fRegTest)
         return DoS(100, error("AcceptBlock() : reject proof-of-work at height %d", nHeight));        
 
     // Check that all transactions are finalized
@@ -1978,7 +2104,7 @@ bool CBlock::AcceptBlock()
     return true;
 }
 
-bool ProcessBlock(CNode* pfrom, CBlock* pblock)
+bool ProcessBlock(CNode* pfrom, CBlock* pblock, bool fCheckedBlock)
 {
     // Check for duplicate
     uint256 hash = pblock->GetHash();
@@ -1993,8 +2119,8 @@ bool ProcessBlock(CNode* pfrom, CBlock* pblock)
     if (pblock->IsProofOfStake() && setStakeSeen.count(pblock->GetProofOfStake()) && !mapOrphanBlocksByPrev.count(hash) && !Checkpoints::WantedByPendingSyncCheckpoint(hash))
         return error("ProcessBlock() : duplicate proof-of-stake (%s, %d) for block %s", pblock->GetProofOfStake().first.ToString().c_str(), pblock->GetProofOfStake().second, hash.ToString().c_str());
 
-    // Preliminary checks
-    if (!pblock->CheckBlock())
+    // Preliminary checks, unless the caller ran them on a view of the block
+    if (!fCheckedBlock && !pblock->CheckBlock())
         return error("ProcessBlock() : CheckBlock FAILED");
 
     // PFN: verify hash target and signature of coinstake tx
@@ -2118,17 +2244,17 @@ bool CBlock::SignBlock(const CKeyStore& keystore)
     return false;
 }
 
-// PFN: check block signature
-bool CBlock::CheckBlockSignature() const
+// PFN: check block signature against the key paid by the first output of
+// the coinbase, or the second of the coinstake
+static bool CheckBlockSignature(const uint256& hashBlock, const CScript& scriptPubKey, const vector<unsigned char>& vchBlockSig)
 {
-    if (GetHash() == hashGenesisBlock)
+    if (hashBlock == hashGenesisBlock)
         return vchBlockSig.empty();
 
     vector<valtype> vSolutions;
     txnouttype whichType;
-    const CTxOut& txout = IsProofOfStake()? vtx[1].vout[1] : vtx[0].vout[0];
 
-    if (!Solver(txout.scriptPubKey, whichType, vSolutions))
+    if (!Solver(scriptPubKey, whichType, vSolutions))
         return false;
     if (whichType == TX_PUBKEY)
     {
@@ -2138,11 +2264,23 @@ bool CBlock::CheckBlockSignature() const
             return false;
         if (vchBlockSig.empty())
             return false;
-        return key.Verify(GetHash(), vchBlockSig);
+        return key.Verify(hashBlock, vchBlockSig);
     }
     return false;
 }
 
+bool CBlock::CheckBlockSignature() const
+{
+    const CTxOut& txout = IsProofOfStake()? vtx[1].vout[1] : vtx[0].vout[0];
+    return ::CheckBlockSignature(GetHash(), txout.scriptPubKey, vchBlockSig);
+}
+
+bool CBlockView::CheckBlockSignature() const
+{
+    const CTxOutView& txout = IsProofOfStake()? vtx[1].vout[1] : vtx[0].vout[0];
+    return ::CheckBlockSignature(GetHash(), txout.scriptPubKey.ToScript(), vchBlockSig.ToVector());
+}
+
 // PFN: entropy bit for stake modifier if chosen by modifier
 unsigned int CBlock::GetStakeEntropyBit() const
 {
@@ -2150,18 +2288,18 @@ unsigned int CBlock::GetStakeEntropyBit() const
     if (IsProtocolV04(nTime))
     {
         nEntropyBit = ((GetHash().Get64()) & 1llu);// last bit of block hash
-        if (fDebug && GetBoolArg("-printstakemodifier"))
+        if (LogAccept(LOG_STAKEMODIFIER))
             printf("GetStakeEntropyBit(v0.4+): nTime=%u hashBlock=%s entropybit=%d\n", nTime, GetHash().ToString().c_str(), nEntropyBit);
     }
     else
     {
         // old protocol for entropy bit pre v0.4
         uint160 hashSig = Hash160(vchBlockSig);
-        if (fDebug && GetBoolArg("-printstakemodifier"))
+        if (LogAccept(LOG_STAKEMODIFIER))
             printf("GetStakeEntropyBit(v0.3): nTime=%u hashSig=%s", nTime, hashSig.ToString().c_str());
         hashSig >>= 159; // take the first bit of the hash
         nEntropyBit = hashSig.Get64();
-        if (fDebug && GetBoolArg("-printstakemodifier"))
+        if (LogAccept(LOG_STAKEMODIFIER))
             printf(" entropybit=%d\n", nEntropyBit);
     }
     return nEntropyBit;
@@ -2207,6 +2345,50 @@ FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszM
     return file;
 }
 
+// PFN: copy serialized bytes straight out of a block file, from nPos up to
+// the end of the block at nBlockPos; WriteToDisk stores the block size just
+// ahead of the block
+static bool ReadBlockFileBytes(unsigned int nFile, unsigned int nBlockPos, unsigned int nPos, std::vector<char>& vchRet)
+{
+    if (nBlockPos < sizeof(unsigned int) || nPos < nBlockPos)
+        return error("ReadBlockFileBytes() : invalid position");
+    CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos - sizeof(unsigned int), "rb"), SER_DISK, CLIENT_VERSION);
+    if (!filein)
+        return error("ReadBlockFileBytes() : OpenBlockFile failed");
+    try {
+        unsigned int nSize;
+        filein >> nSize;
+        if (nSize > MAX_BLOCK_SIZE || nPos - nBlockPos >= nSize)
+            return error("ReadBlockFileBytes() : invalid block size %u", nSize);
+        if (nPos != nBlockPos && fseek(filein, nPos, SEEK_SET) != 0)
+            return error("ReadBlockFileBytes() : fseek failed");
+        vchRet.resize(nSize - (nPos - nBlockPos));
+        filein.read(&vchRet[0], vchRet.size());
+    }
+    catch (std::exception &e) {
+        return error("%s() : I/O error", __PRETTY_FUNCTION__);
+    }
+    return true;
+}
+
+bool ReadBlockBytes(unsigned int nFile, unsigned int nBlockPos, std::vector<char>& vchRet)
+{
+    return ReadBlockFileBytes(nFile, nBlockPos, nBlockPos, vchRet);
+}
+
+// The transaction size is not stored, so the rest of the block is read and
+// the transaction's extent found with a view
+bool ReadTransactionBytes(const CDiskTxPos& pos, std::vector<char>& vchRet)
+{
+    if (!ReadBlockFileBytes(pos.nFile, pos.nBlockPos, pos.nTxPos, vchRet))
+        return false;
+    CTransactionView txView;
+    if (!txView.SetData(&vchRet[0], &vchRet[0] + vchRet.size()))
+        return error("ReadTransactionBytes() : invalid transaction data");
+    vchRet.resize(txView.GetSerializeSize());
+    return true;
+}
+
 static unsigned int nCurrentBlockFile = 1;
 
 FILE* AppendBlockFile(unsigned int& nFileRet)
@@ -2241,9 +2423,20 @@ bool LoadBlockIndex(bool fAllowNew)
         bnInitialHashTarget = CBigNum(~uint256(0) >> 29);
         nModifierInterval = 60 * 20; // test net modifier interval is 20 minutes
     }
+    if (fRegTest)
+    {
+        // PFN: regression test chain, any hash is nearly enough work or stake
+        hashGenesisBlock = hashGenesisBlockRegTest;
+        bnProofOfWorkLimit = CBigNum(~uint256(0) >> 1);
+        bnProofOfStakeLimit = bnProofOfWorkLimit;
+        bnInitialHashTarget = bnProofOfWorkLimit;
+        nStakeMinAge = GetArg("-stakeminage", 60);
+        nCoinbaseMaturity = GetArg("-coinbasematurity", 10);
+        nModifierInterval = 60;
+    }
 
     printf("%s Network: genesis=0x%s nBitsLimit=0x%08x nBitsInitial=0x%08x nStakeMinAge=%d nCoinbaseMaturity=%d nModifierInterval=%d\n",
-           fTestNet? "Test" : "PFN", hashGenesisBlock.ToString().substr(0, 20).c_str(), bnProofOfWorkLimit.GetCompact(), bnInitialHashTarget.GetCompact(), nStakeMinAge, nCoinbaseMaturity, nModifierInterval);
+           fRegTest? "RegTest" : fTestNet? "Test" : "PFN", hashGenesisBlock.ToString().substr(0, 20).c_str(), bnProofOfWorkLimit.GetCompact(), bnInitialHashTarget.GetCompact(), nStakeMinAge, nCoinbaseMaturity, nModifierInterval);
 
     //
     // Load block index
@@ -2290,6 +2483,8 @@ bool LoadBlockIndex(bool fAllowNew)
             block.nTime    = 1430859770;
             block.nNonce   = 0;
         }
+        if (fRegTest)
+            block.nNonce   = 2;
 
         //// debug print
         printf("%s\n", block.GetHash().ToString().c_str());
@@ -2466,7 +2661,7 @@ string GetWarnings(string strFor)
     int nPriority = 0;
     string strStatusBar;
     string strRPC;
-    if (GetBoolArg("-testsafemode"))
+    if (configTestSafeMode.Get())
         strRPC = "test";
 
     // PFN: wallet lock warning for minting
@@ -2602,7 +2797,7 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
             txInMap = (mempool.exists(inv.hash));
             }
         return txInMap ||
-               mapOrphanTransactions.count(inv.hash) ||
+               orphanpool.exists(inv.hash) ||
                txdb.ContainsTx(inv.hash);
         }
 
@@ -2617,6 +2812,72 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 
 
 
+// PFN: getdata is served only while the peer's send queue has room. What is
+// left waits in vRecvGetData, and its other messages wait behind it, until
+// the socket thread has written enough out. So a peer syncing old blocks
+// under -maxuploadtarget is slowed down rather than flood disconnected.
+void static ProcessGetData(CNode* pfrom)
+{
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+    while (it != pfrom->vRecvGetData.end() && pfrom->GetSendQueueSize() < SendBufferSize())
+    {
+        if (fShutdown)
+            break;
+        const CInv& inv = *it++;
+        printf("received getdata for: %s\n", inv.ToString().c_str());
+
+        if (inv.type == MSG_BLOCK)
+        {
+            // Send block from disk
+            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+            // PFN: the bytes are relayed as stored, without building the block
+            vector<char> vchBlock;
+            if (mi != mapBlockIndex.end() && ReadBlockBytes((*mi).second->nFile, (*mi).second->nBlockPos, vchBlock))
+            {
+                CDataStream ssBlock(vchBlock, SER_NETWORK, PROTOCOL_VERSION);
+                // PFN: old blocks for syncing peers queue behind relay. A
+                // newer block follows them while any are still queued, so a
+                // request that straddles the boundary is answered in order
+                // and does not arrive as orphans.
+                int nPriority = SEND_PRIORITY_NEW;
+                if ((*mi).second->nHeight < nBestHeight - HISTORICAL_BLOCK_DEPTH || !pfrom->SendQueueEmpty(SEND_PRIORITY_HISTORICAL))
+                    nPriority = SEND_PRIORITY_HISTORICAL;
+                pfrom->PushMessageWithPriority(nPriority, "block", ssBlock);
+
+                // Trigger them to send a getblocks request for the next batch of inventory
+                if (inv.hash == pfrom->hashContinue)
+                {
+                    // Bypass PushInventory, this must send even if redundant,
+                    // and we want it right after the last block so they don't
+                    // wait for other stuff first.
+                    // PFN: send latest proof-of-work block to allow the
+                    // download node to accept as orphan (proof-of-stake 
+                    // block might be rejected by stake connection check)
+                    vector<CInv> vInv;
+                    vInv.push_back(CInv(MSG_BLOCK, GetLastBlockIndex(pindexBest, false)->GetBlockHash()));
+                    pfrom->PushMessageWithPriority(nPriority, "inv", vInv);
+                    pfrom->hashContinue = 0;
+                }
+            }
+        }
+        else if (inv.IsKnownType())
+        {
+            // Send stream from relay memory
+            {
+                LOCK(cs_mapRelay);
+                map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
+                if (mi != mapRelay.end())
+                    pfrom->PushMessage(inv.GetCommand(), (*mi).second);
+            }
+        }
+
+        // Track requests for our stuff
+        Inventory(inv.hash);
+    }
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+}
+
+
 bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 {
     static map<CService, vector<unsigned char> > mapReuseKey;
@@ -2625,7 +2886,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         printf("%s ", DateTimeStrFormat(GetTime()).c_str());
         printf("received: %s (%d bytes)\n", strCommand.c_str(), vRecv.size());
     }
-    if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
+    if (configDropMessagesTest.Get() > 0 && GetRand(configDropMessagesTest.Get()) == 0)
     {
         printf("dropmessagestest DROPPING RECV MESSAGE\n");
         return true;
@@ -2808,7 +3069,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                 {
                     LOCK(cs_vNodes);
                     // Use deterministic randomness to send to the same nodes for 24 hours
-                    // at a time so the setAddrKnowns of the chosen nodes prevent repeats
+                    // at a time so the filterAddrKnowns of the chosen nodes prevent repeats
                     static uint256 hashSalt;
                     if (hashSalt == 0)
                         hashSalt = GetRandHash();
@@ -2899,52 +3160,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             return error("message getdata size() = %d", vInv.size());
         }
 
-        BOOST_FOREACH(const CInv& inv, vInv)
-        {
-            if (fShutdown)
-                return true;
-            printf("received getdata for: %s\n", inv.ToString().c_str());
-
-            if (inv.type == MSG_BLOCK)
-            {
-                // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
-                {
-                    CBlock block;
-                    block.ReadFromDisk((*mi).second);
-                    pfrom->PushMessage("block", block);
-
-                    // Trigger them to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        // PFN: send latest proof-of-work block to allow the
-                        // download node to accept as orphan (proof-of-stake 
-                        // block might be rejected by stake connection check)
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, GetLastBlockIndex(pindexBest, false)->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue = 0;
-                    }
-                }
-            }
-            else if (inv.IsKnownType())
-            {
-                // Send stream from relay memory
-                {
-                    LOCK(cs_mapRelay);
-                    map<CInv, CDataStream>::iterator mi = mapRelay.find(inv);
-                    if (mi != mapRelay.end())
-                        pfrom->PushMessage(inv.GetCommand(), (*mi).second);
-                }
-            }
-
-            // Track requests for our stuff
-            Inventory(inv.hash);
-        }
+        pfrom->vRecvGetData.insert(pfrom->vRecvGetData.end(), vInv.begin(), vInv.end());
+        ProcessGetData(pfrom);
     }
 
 
@@ -3030,13 +3247,50 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     {
         vector<uint256> vWorkQueue;
         vector<uint256> vEraseQueue;
-        CDataStream vMsg(vRecv);
         CTxDB txdb("r");
+
+        // PFN: hash the transaction on a view of the message, and drop
+        // there what CTxMemPool::accept rejects before fetching inputs: a
+        // transaction failing CheckTransaction, a coinbase or coinstake, one
+        // already in the pool or the chain, and one spending an output the
+        // pool already spends. It is built only when it may be kept. A
+        // message with sizes not in their shortest encoding takes the full
+        // path, as its id is that of the transaction serialized again.
+        CTransactionView txView;
+        bool fView = txView.SetData(vRecv) && txView.IsCanonical();
+        if (fView)
+        {
+            CInv inv(MSG_TX, txView.GetHash());
+            pfrom->AddInventoryKnown(inv);
+
+            bool fReject = !txView.CheckTransaction();
+            if (!fReject && (txView.IsCoinBase() || txView.IsCoinStake()))
+                fReject = !txView.DoS(100, error("ProcessMessage() : coinbase or coinstake as individual tx"));
+            if (!fReject)
+            {
+                LOCK(mempool.cs);
+                if (mempool.exists(inv.hash))
+                    fReject = true;
+                BOOST_FOREACH(const CTxInView& txin, txView.vin)
+                    if (mempool.mapNextTx.count(txin.prevout))
+                        fReject = true;
+            }
+            if (!fReject && txdb.ContainsTx(inv.hash))
+                fReject = true;
+            if (fReject)
+            {
+                if (txView.nDoS) pfrom->Misbehaving(txView.nDoS);
+                return true;
+            }
+        }
+
+        CDataStream vMsg(vRecv);
         CTransaction tx;
         vRecv >> tx;
 
-        CInv inv(MSG_TX, tx.GetHash());
-        pfrom->AddInventoryKnown(inv);
+        CInv inv(MSG_TX, fView ? txView.GetHash() : tx.GetHash());
+        if (!fView)
+            pfrom->AddInventoryKnown(inv);
 
         bool fMissingInputs = false;
         if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs))
@@ -3050,22 +3304,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             // Recursively process any orphan transactions that depended on this one
             for (unsigned int i = 0; i < vWorkQueue.size(); i++)
             {
-                uint256 hashPrev = vWorkQueue[i];
-                for (map<uint256, CDataStream*>::iterator mi = mapOrphanTransactionsByPrev[hashPrev].begin();
-                     mi != mapOrphanTransactionsByPrev[hashPrev].end();
-                     ++mi)
+                vector<uint256> vOrphans;
+                orphanpool.getChildren(vWorkQueue[i], vOrphans);
+                BOOST_FOREACH(const uint256& hashOrphan, vOrphans)
                 {
-                    const CDataStream& vMsg = *((*mi).second);
-                    CTransaction tx;
-                    CDataStream(vMsg) >> tx;
-                    CInv inv(MSG_TX, tx.GetHash());
+                    // PFN: orphans are stored deserialized, no need to parse again
+                    CTransaction* ptx = orphanpool.lookup(hashOrphan);
+                    if (!ptx)
+                        continue;
+                    CTransaction& tx = *ptx;
+                    CInv inv(MSG_TX, hashOrphan);
                     bool fMissingInputs2 = false;
 
                     if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs2))
                     {
                         printf("   accepted orphan tx %s\n", inv.hash.ToString().substr(0,10).c_str());
                         SyncWithWallets(tx, NULL, true);
-                        RelayMessage(inv, vMsg);
+                        RelayMessage(inv, tx);
                         mapAlreadyAskedFor.erase(inv);
                         vWorkQueue.push_back(inv.hash);
                         vEraseQueue.push_back(inv.hash);
@@ -3080,16 +3335,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             }
 
             BOOST_FOREACH(uint256 hash, vEraseQueue)
-                EraseOrphanTx(hash);
+                orphanpool.erase(hash);
         }
         else if (fMissingInputs)
         {
-            AddOrphanTx(vMsg);
+            orphanpool.add(tx, pfrom->addr);
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nEvicted = LimitOrphanTxSize(MAX_ORPHAN_TRANSACTIONS);
+            // DoS prevention: do not allow the orphan pool to grow unbounded
+            unsigned int nEvicted = orphanpool.limit(MAX_ORPHAN_POOL_USAGE);
             if (nEvicted > 0)
-                printf("mapOrphan overflow, removed %u tx\n", nEvicted);
+                printf("orphan pool overflow, removed %u tx\n", nEvicted);
         }
         if (tx.nDoS) pfrom->Misbehaving(tx.nDoS);
     }
@@ -3097,6 +3352,32 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
     else if (strCommand == "block")
     {
+        // PFN: hash and check the block on a view of the message, so that
+        // duplicates and blocks failing CheckBlock are dropped without
+        // building the CBlock. A message with sizes not in their shortest
+        // encoding takes the full path, as the hashes that count are those
+        // of the block serialized again.
+        CBlockView blockView;
+        bool fCheckedBlock = false;
+        if (blockView.SetData(vRecv) && blockView.IsCanonical())
+        {
+            CInv inv(MSG_BLOCK, blockView.GetHash());
+            pfrom->AddInventoryKnown(inv);
+            if (mapBlockIndex.count(inv.hash) || mapOrphanBlocks.count(inv.hash))
+            {
+                if (fDebug)
+                    printf("received block %s (already have)\n", inv.hash.ToString().substr(0,20).c_str());
+                return true;
+            }
+            if (!blockView.CheckBlock())
+            {
+                printf("received block %s (CheckBlock FAILED)\n", inv.hash.ToString().substr(0,20).c_str());
+                if (blockView.nDoS) pfrom->Misbehaving(blockView.nDoS);
+                return true;
+            }
+            fCheckedBlock = true;
+        }
+
         CBlock block;
         vRecv >> block;
 
@@ -3106,7 +3387,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         CInv inv(MSG_BLOCK, block.GetHash());
         pfrom->AddInventoryKnown(inv);
 
-        if (ProcessBlock(pfrom, &block))
+        if (ProcessBlock(pfrom, &block, fCheckedBlock))
             mapAlreadyAskedFor.erase(inv);
         if (block.nDoS) pfrom->Misbehaving(block.nDoS);
     }
@@ -3126,7 +3407,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         uint256 hashReply;
         vRecv >> hashReply;
 
-        if (!GetBoolArg("-allowreceivebyip"))
+        if (!configAllowReceiveByIP.Get())
         {
             pfrom->PushMessage("reply", hashReply, (int)2, string(""));
             return true;
@@ -3199,7 +3480,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (alert.ProcessAlert())
         {
             // Relay
-            pfrom->setKnown.insert(alert.GetHash());
+            pfrom->filterKnown.insert(alert.GetHash());
             {
                 LOCK(cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
@@ -3240,6 +3521,17 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
 bool ProcessMessages(CNode* pfrom)
 {
+    // PFN: finish earlier getdata requests before reading anything new
+    if (!pfrom->vRecvGetData.empty())
+    {
+        {
+            LOCK(cs_main);
+            ProcessGetData(pfrom);
+        }
+        if (!pfrom->vRecvGetData.empty())
+            return true;
+    }
+
     CDataStream& vRecv = pfrom->vRecv;
     if (vRecv.empty())
         return true;
@@ -3258,7 +3550,7 @@ bool ProcessMessages(CNode* pfrom)
     unsigned char pchMessageStart[4];
     GetMessageStart(pchMessageStart);
     static int64 nTimeLastPrintMessageStart = 0;
-    if (fDebug && GetBoolArg("-printmessagestart") && nTimeLastPrintMessageStart + 30 < GetAdjustedTime())
+    if (LogAccept(LOG_MESSAGESTART) && nTimeLastPrintMessageStart + 30 < GetAdjustedTime())
     {
         string strMessageStart((const char *)pchMessageStart, sizeof(pchMessageStart));
         vector<unsigned char> vchMessageStart(strMessageStart.begin(), strMessageStart.end());
@@ -3268,6 +3560,10 @@ bool ProcessMessages(CNode* pfrom)
 
     loop
     {
+        // Stop at a getdata that could not be served in full
+        if (!pfrom->vRecvGetData.empty())
+            break;
+
         // Scan for message start
         CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(), BEGIN(pchMessageStart), END(pchMessageStart));
         int nHeaderSize = vRecv.GetSerializeSize(CMessageHeader());
@@ -3320,6 +3616,12 @@ bool ProcessMessages(CNode* pfrom)
             continue;
         }
 
+        if (fMetrics)
+        {
+            metricMessagesReceived.Get(strCommand).Inc();
+            metricBytesReceived.Get(strCommand).Inc(nHeaderSize + nMessageSize);
+        }
+
         // Copy message to its own buffer
         CDataStream vMsg(vRecv.begin(), vRecv.begin() + nMessageSize, vRecv.nType, vRecv.nVersion);
         vRecv.ignore(nMessageSize);
@@ -3377,7 +3679,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
 
         // Keep-alive ping. We send a nonce of zero because we don't use it anywhere
         // right now.
-        if (pto->nLastSend && GetTime() - pto->nLastSend > 30 * 60 && pto->vSend.empty()) {
+        if (pto->nLastSend && GetTime() - pto->nLastSend > 30 * 60 && pto->SendQueueEmpty()) {
             uint64 nonce = 0;
             if (pto->nVersion > BIP0031_VERSION)
                 pto->PushMessage("ping", nonce);
@@ -3396,9 +3698,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                 LOCK(cs_vNodes);
                 BOOST_FOREACH(CNode* pnode, vNodes)
                 {
-                    // Periodically clear setAddrKnown to allow refresh broadcasts
+                    // Periodically clear filterAddrKnown to allow refresh broadcasts
                     if (nLastRebroadcast)
-                        pnode->setAddrKnown.clear();
+                        pnode->filterAddrKnown.reset();
 
                     // Rebroadcast our address
                     if (!fNoListen && !fUseProxy && addrLocalHost.IsRoutable())
@@ -3421,9 +3723,10 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vAddr.reserve(pto->vAddrToSend.size());
             BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                vector<unsigned char> vchKey = addr.GetKey();
+                if (!pto->filterAddrKnown.contains(vchKey))
                 {
+                    pto->filterAddrKnown.insert(vchKey);
                     vAddr.push_back(addr);
                     // receiver rejects addr messages larger than 1000
                     if (vAddr.size() >= 1000)
@@ -3450,7 +3753,7 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
             vInvWait.reserve(pto->vInventoryToSend.size());
             BOOST_FOREACH(const CInv& inv, pto->vInventoryToSend)
             {
-                if (pto->setInventoryKnown.count(inv))
+                if (pto->filterInventoryKnown.contains(inv.hash))
                     continue;
 
                 // trickle out tx inv to protect privacy
@@ -3480,9 +3783,9 @@ bool SendMessages(CNode* pto, bool fSendTrickle)
                     }
                 }
 
-                // returns true if wasn't already contained in the set
-                if (pto->setInventoryKnown.insert(inv).second)
+                if (!pto->filterInventoryKnown.contains(inv.hash))
                 {
+                    pto->filterInventoryKnown.insert(inv.hash);
                     vInv.push_back(inv);
                     if (vInv.size() >= 1000)
                     {
@@ -3730,7 +4033,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfS
 
                 dPriority += (double)nValueIn * nConf;
 
-                if (fDebug && GetBoolArg("-printpriority"))
+                if (LogAccept(LOG_PRIORITY))
                     printf("priority     nValueIn=%-12"PRI64d" nConf=%-5d dPriority=%-20.1f\n", nValueIn, nConf, dPriority);
             }
 
@@ -3742,7 +4045,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfS
             else
                 mapPriority.insert(make_pair(-dPriority, &(*mi).second));
 
-            if (fDebug && GetBoolArg("-printpriority"))
+            if (LogAccept(LOG_PRIORITY))
             {
                 printf("priority %-20.1f %s\n%s", dPriority, tx.GetHash().ToString().substr(0,10).c_str(), tx.ToString().c_str());
                 if (porphan)
@@ -3825,7 +4128,7 @@ CBlock* CreateNewBlock(CReserveKey& reservekey, CWallet* pwallet, bool fProofOfS
 
         nLastBlockTx = nBlockTx;
         nLastBlockSize = nBlockSize;
-        if (fDebug && GetBoolArg("-printpriority"))
+        if (LogAccept(LOG_PRIORITY))
             printf("CreateNewBlock(): total size %lu\n", nBlockSize);
 
     }
@@ -31,7 +31,10 @@ class CNode;
 static const unsigned int MAX_BLOCK_SIZE = 1000000;
 static const unsigned int MAX_BLOCK_SIZE_GEN = MAX_BLOCK_SIZE/2;
 static const unsigned int MAX_BLOCK_SIGOPS = MAX_BLOCK_SIZE/50;
-static const unsigned int MAX_ORPHAN_TRANSACTIONS = MAX_BLOCK_SIZE/100;
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+static const unsigned int MAX_ORPHAN_POOL_USAGE = 10000000;
+static const unsigned int MAX_ORPHAN_PEER_USAGE = MAX_ORPHAN_POOL_USAGE / 8;
+static const int64 ORPHAN_TX_EXPIRE_TIME = 20 * 60;
 static const int LAST_POW_BLOCK = 10000;
 static const int64 MIN_TX_FEE = 1000000;
 static const int64 MIN_RELAY_TX_FEE = MIN_TX_FEE;
@@ -45,6 +48,7 @@ static const int STAKE_START_TIME = 1408636800; //                1429488000 FOR
 static const int STAKE_TARGET_SPACING = 240;
 static const int STAKE_MIN_AGE = 60 * 60;
 static const int STAKE_MAX_AGE = 60 * 60 * 24 * 366;
+static const int HISTORICAL_BLOCK_DEPTH = 144; // blocks this far below the best are served at low send priority
 
 #ifdef USE_UPNP
 static const int fHaveUPnP = true;
@@ -54,6 +58,7 @@ static const int fHaveUPnP = false;
 
 static const uint256 hashGenesisBlockOfficial("0x0000093552b65419832195c462790ef35d96dae22942dafb677985f0cc91cb59");
 static const uint256 hashGenesisBlockTestNet("0x0000093552b65419832195c462790ef35d96dae22942dafb677985f0cc91cb59");
+static const uint256 hashGenesisBlockRegTest("0x1ba7cccef198a0a05d9f19366360861005914d2392d531a50d6c3525ff2850f4");
 
 static const int64 nMaxClockDrift = 64 * 60;
 
@@ -98,13 +103,16 @@ extern int64 nTransactionFee;
 class CReserveKey;
 class CTxDB;
 class CTxIndex;
+class CDiskTxPos;
 
 void RegisterWallet(CWallet* pwalletIn);
 void UnregisterWallet(CWallet* pwalletIn);
-bool ProcessBlock(CNode* pfrom, CBlock* pblock);
+bool ProcessBlock(CNode* pfrom, CBlock* pblock, bool fCheckedBlock=false);
 bool CheckDiskSpace(uint64 nAdditionalBytes=0);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
 FILE* AppendBlockFile(unsigned int& nFileRet);
+bool ReadBlockBytes(unsigned int nFile, unsigned int nBlockPos, std::vector<char>& vchRet);
+bool ReadTransactionBytes(const CDiskTxPos& pos, std::vector<char>& vchRet);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 bool ProcessMessages(CNode* pfrom);
@@ -123,6 +131,8 @@ bool IsInitialBlockDownload();
 std::string GetWarnings(std::string strFor);
 uint256 WantedByOrphan(const CBlock* pblockOrphan);
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake);
+void SetBlockIndexByHeight(CBlockIndex* pindexNew);
+CBlockIndex* FindBlockByHeight(int nHeight);
 void BitcoinMiner(CWallet *pwallet, bool fProofOfStake);
 
 
@@ -591,11 +601,21 @@ public:
     }
 
     int64 GetMinFee(unsigned int nBlockSize=1, bool fAllowFree=false, enum GetMinFee_mode mode=GMF_BLOCK) const
+    {
+        bool fDustOutput = false;
+        BOOST_FOREACH(const CTxOut& txout, vout)
+            if (txout.nValue < CENT)
+                fDustOutput = true;
+        return GetMinFee(::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION), fDustOutput, nBlockSize, fAllowFree, mode);
+    }
+
+    // The minimum fee for a transaction of nBytes, with or without an output
+    // below CENT
+    static int64 GetMinFee(unsigned int nBytes, bool fDustOutput, unsigned int nBlockSize, bool fAllowFree, enum GetMinFee_mode mode)
     {
         // Base fee is either MIN_TX_FEE or MIN_RELAY_TX_FEE
         int64 nBaseFee = (mode == GMF_RELAY) ? MIN_RELAY_TX_FEE : MIN_TX_FEE;
 
-        unsigned int nBytes = ::GetSerializeSize(*this, SER_NETWORK, PROTOCOL_VERSION);
         unsigned int nNewBlockSize = nBlockSize + nBytes;
         int64 nMinFee = (1 + (int64)nBytes / 1000) * nBaseFee;
 
@@ -617,12 +637,8 @@ public:
         }
 
         // To limit dust spam, require MIN_TX_FEE/MIN_RELAY_TX_FEE if any output is less than 0.01
-        if (nMinFee < nBaseFee)
-        {
-            BOOST_FOREACH(const CTxOut& txout, vout)
-                if (txout.nValue < CENT)
-                    nMinFee = nBaseFee;
-        }
+        if (nMinFee < nBaseFee && fDustOutput)
+            nMinFee = nBaseFee;
 
         // Raise the price as the block approaches full
         if (nBlockSize != 1 && nNewBlockSize >= MAX_BLOCK_SIZE_GEN/2)
@@ -990,8 +1006,15 @@ public:
         vMerkleTree.clear();
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
+        return BuildMerkleTree(vMerkleTree);
+    }
+
+    // Append the inner nodes of the tree over the transaction hashes in
+    // vMerkleTree and return its root
+    static uint256 BuildMerkleTree(std::vector<uint256>& vMerkleTree)
+    {
         int j = 0;
-        for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
+        for (int nSize = vMerkleTree.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
             for (int i = 0; i < nSize; i += 2)
             {
@@ -1170,7 +1193,8 @@ public:
     };
 
     uint64 nStakeModifier; // hash modifier for proof-of-stake
-    unsigned int nStakeModifierChecksum; // checksum of index; in-memeory only
+    unsigned int nStakeModifierChecksum; // checksum of index
+    const CBlockIndex* pindexKernelModifier; // block whose modifier applies to kernels from this block; in-memory only
 
     // proof-of-stake specific fields
     COutPoint prevoutStake;
@@ -1199,6 +1223,7 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
+        pindexKernelModifier = NULL;
         hashProofOfStake = 0;
         prevoutStake.SetNull();
         nStakeTime = 0;
@@ -1224,6 +1249,7 @@ public:
         nFlags = 0;
         nStakeModifier = 0;
         nStakeModifierChecksum = 0;
+        pindexKernelModifier = NULL;
         hashProofOfStake = 0;
         if (block.IsProofOfStake())
         {
@@ -1442,6 +1468,14 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        // PFN: chain trust and stake modifier checksum, so they need not be
+        // recomputed when loading the block index
+        if (nVersion >= DISK_BLOCKINDEX_TRUST_VERSION)
+        {
+            READWRITE(bnChainTrust);
+            READWRITE(nStakeModifierChecksum);
+        }
     )
 
     uint256 GetBlockHash() const
@@ -1785,9 +1819,10 @@ public:
     {
         if (!IsInEffect())
             return false;
-        // returns true if wasn't already contained in the set
-        if (pnode->setKnown.insert(GetHash()).second)
+        uint256 hash = GetHash();
+        if (!pnode->filterKnown.contains(hash))
         {
+            pnode->filterKnown.insert(hash);
             if (AppliesTo(pnode->nVersion, pnode->strSubVer) ||
                 AppliesToMe() ||
                 GetAdjustedTime() < nRelayUntil)
@@ -1847,4 +1882,83 @@ public:
 
 extern CTxMemPool mempool;
 
+/** Transactions whose inputs are not known yet, kept deserialized so that
+ * they are ready to accept when a parent arrives. Memory use is bounded
+ * overall and per sending address, and entries expire after
+ * ORPHAN_TX_EXPIRE_TIME. Protected by cs_main.
+ */
+class COrphanPool
+{
+private:
+    struct COrphanTx
+    {
+        CTransaction tx;
+        CNetAddr addrFrom;
+        int64 nTimeExpire;
+        unsigned int nUsage;
+    };
+
+    struct CPeerOrphans
+    {
+        unsigned int nUsage;
+        std::set<std::pair<int64, uint256> > setByExpire;
+
+        CPeerOrphans() : nUsage(0) {}
+    };
+
+    std::map<uint256, COrphanTx> mapTx;
+    std::map<uint256, std::set<uint256> > mapByPrev;
+    std::set<std::pair<int64, uint256> > setByExpire;
+    std::map<CNetAddr, CPeerOrphans> mapPeer;
+    unsigned int nUsage;
+
+public:
+    COrphanPool() : nUsage(0) {}
+
+    bool add(const CTransaction& tx, const CNetAddr& addrFrom);
+    bool erase(const uint256& hash);
+
+    // Drop orphans that have timed out
+    unsigned int expire();
+
+    // Evict until at most nMaxUsage bytes are used, oldest orphans of the
+    // biggest sender first
+    unsigned int limit(unsigned int nMaxUsage);
+
+    // Orphans that spend an output of hashPrev
+    void getChildren(const uint256& hashPrev, std::vector<uint256>& vHashRet) const;
+
+    bool exists(const uint256& hash) const
+    {
+        return (mapTx.count(hash) != 0);
+    }
+
+    // NULL if the orphan is not (or no longer) in the pool
+    CTransaction* lookup(const uint256& hash)
+    {
+        std::map<uint256, COrphanTx>::iterator mi = mapTx.find(hash);
+        if (mi == mapTx.end())
+            return NULL;
+        return &(*mi).second.tx;
+    }
+
+    unsigned long size() const
+    {
+        return mapTx.size();
+    }
+
+    unsigned int GetUsage() const
+    {
+        return nUsage;
+    }
+
+    unsigned int GetUsage(const CNetAddr& addrFrom) const
+    {
+        std::map<CNetAddr, CPeerOrphans>::const_iterator it = mapPeer.find(addrFrom);
+        return (it == mapPeer.end() ? 0 : it->second.nUsage);
+    }
+};
+
+extern COrphanPool orphanpool;
+
 #endif
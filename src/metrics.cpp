@@ -0,0 +1,272 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <boost/foreach.hpp>
+
+#include "metrics.h"
+#include "net.h"
+
+using namespace std;
+
+bool fMetrics = false;
+
+const int64 CMetricHistogram::nBucketMicros[CMetricHistogram::BUCKETS] =
+    { 100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000 };
+
+CMetricFamily<CMetricCounter> metricMessagesReceived("pfn_messages_received_total", "counter", "Messages received from peers", "command");
+CMetricFamily<CMetricCounter> metricBytesReceived("pfn_bytes_received_total", "counter", "Bytes of messages received from peers, including headers", "command");
+CMetricFamily<CMetricCounter> metricMessagesSent("pfn_messages_sent_total", "counter", "Messages sent to peers", "command");
+CMetricFamily<CMetricCounter> metricBytesSent("pfn_bytes_sent_total", "counter", "Bytes of messages sent to peers, including headers", "command");
+CMetricFamily<CMetricHistogram> metricConnectBlock("pfn_connectblock_seconds", "histogram", "Time to connect a block to the best chain");
+CMetricFamily<CMetricHistogram> metricCheckBlock("pfn_checkblock_seconds", "histogram", "Time for the context-free checks of a block");
+CMetricFamily<CMetricHistogram> metricFetchInputs("pfn_fetchinputs_seconds", "histogram", "Time to fetch the previous transactions of a transaction");
+CMetricFamily<CMetricHistogram> metricConnectInputs("pfn_connectinputs_seconds", "histogram", "Time to check and mark spent the inputs of a transaction");
+CMetricFamily<CMetricHistogram> metricSetBestChain("pfn_setbestchain_seconds", "histogram", "Time to make a block the best chain, including reorganizations");
+CMetricFamily<CMetricCounter> metricSignatureChecks("pfn_signature_checks_total", "counter", "Input signatures verified");
+CMetricFamily<CMetricHistogram> metricMempoolAccept("pfn_mempool_accept_seconds", "histogram", "Time to check a transaction for the memory pool");
+CMetricFamily<CMetricCounter> metricMempoolRejects("pfn_mempool_rejects_total", "counter", "Transactions not accepted to the memory pool");
+CMetricFamily<CMetricCounter> metricStakeKernelChecks("pfn_stake_kernel_checks_total", "counter", "Stake kernels checked while minting");
+CMetricFamily<CMetricHistogram> metricDBRead("pfn_db_read_seconds", "histogram", "Database record read time");
+CMetricFamily<CMetricHistogram> metricDBWrite("pfn_db_write_seconds", "histogram", "Database record write time");
+CMetricFamily<CMetricCounter> metricDBBytesWritten("pfn_db_written_bytes_total", "counter", "Bytes of database keys and values written");
+CMetricFamily<CMetricHistogram> metricRPC("pfn_rpc_seconds", "histogram", "RPC call time", "method");
+
+// Constructed on first use, families register themselves during static
+// initialization
+static vector<CMetricFamilyBase*>& GetMetricFamilies()
+{
+    static vector<CMetricFamilyBase*> vFamilies;
+    return vFamilies;
+}
+
+CMetricFamilyBase::CMetricFamilyBase(const char* pszName, const char* pszType, const char* pszHelp) : strName(pszName), strHelp(pszHelp), strType(pszType)
+{
+    GetMetricFamilies().push_back(this);
+}
+
+CMetricFamilyBase::~CMetricFamilyBase()
+{
+    vector<CMetricFamilyBase*>& vFamilies = GetMetricFamilies();
+    vFamilies.erase(std::remove(vFamilies.begin(), vFamilies.end(), this), vFamilies.end());
+}
+
+static string FormatSeconds(int64 nMicros)
+{
+    return strprintf("%"PRI64d".%06"PRI64d, nMicros / 1000000, nMicros % 1000000);
+}
+
+// Label values are quoted, with backslash, quote and newline escaped
+static string FormatLabel(const string& strLabel, const string& strValue)
+{
+    string str = strLabel + "=\"";
+    BOOST_FOREACH(char c, strValue)
+    {
+        if (c == '\\' || c == '"')
+            str += '\\';
+        if (c == '\n')
+            str += "\\n";
+        else
+            str += c;
+    }
+    return str + "\"";
+}
+
+void CMetricCounter::Write(string& str, const string& strName, const string& strLabels) const
+{
+    str += strName;
+    if (!strLabels.empty())
+        str += "{" + strLabels + "}";
+    str += strprintf(" %"PRI64d"\n", Get());
+}
+
+void CMetricHistogram::Observe(int64 nMicros)
+{
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        if (nMicros <= nBucketMicros[i])
+        {
+            __sync_fetch_and_add(&vnBucket[i], 1);
+            break;
+        }
+    }
+    __sync_fetch_and_add(&nSumMicros, nMicros);
+    __sync_fetch_and_add(&nCount, 1);
+}
+
+void CMetricHistogram::Write(string& str, const string& strName, const string& strLabels) const
+{
+    string strPrefix = strLabels.empty() ? "" : strLabels + ",";
+    int64 nCumulative = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        nCumulative += vnBucket[i];
+        str += strprintf("%s_bucket{%sle=\"%s\"} %"PRI64d"\n", strName.c_str(), strPrefix.c_str(), FormatSeconds(nBucketMicros[i]).c_str(), nCumulative);
+    }
+    int64 nCountNow = nCount;
+    str += strprintf("%s_bucket{%sle=\"+Inf\"} %"PRI64d"\n", strName.c_str(), strPrefix.c_str(), std::max(nCountNow, nCumulative));
+    string strBraced = strLabels.empty() ? "" : "{" + strLabels + "}";
+    str += strprintf("%s_sum%s %s\n", strName.c_str(), strBraced.c_str(), FormatSeconds(nSumMicros).c_str());
+    str += strprintf("%s_count%s %"PRI64d"\n", strName.c_str(), strBraced.c_str(), std::max(nCountNow, nCumulative));
+}
+
+template<typename T>
+void CMetricFamily<T>::Write(string& str) const
+{
+    str += "# HELP " + strName + " " + strHelp + "\n";
+    str += "# TYPE " + strName + " " + strType + "\n";
+    if (strLabel.empty())
+    {
+        metric.Write(str, strName, "");
+        return;
+    }
+    LOCK(cs_family);
+    for (typename map<string, T*>::const_iterator mi = mapLabeled.begin(); mi != mapLabeled.end(); ++mi)
+        (*mi).second->Write(str, strName, FormatLabel(strLabel, (*mi).first));
+}
+
+template class CMetricFamily<CMetricCounter>;
+template class CMetricFamily<CMetricHistogram>;
+
+string GetMetricsText()
+{
+    string str;
+    str.reserve(16384);
+    BOOST_FOREACH(const CMetricFamilyBase* pfamily, GetMetricFamilies())
+        pfamily->Write(str);
+    return str;
+}
+
+//
+// Minimal HTTP server for scrapers: one request per connection, answered
+// from this thread
+//
+static void ServeMetricsRequest(SOCKET hSocket)
+{
+    // Read the request line and headers, up to a blank line
+    string strRequest;
+    int64 nStart = GetTimeMillis();
+    while (strRequest.find("\r\n\r\n") == string::npos && strRequest.find("\n\n") == string::npos)
+    {
+        if (strRequest.size() > 8192 || GetTimeMillis() - nStart > 2000 || fShutdown)
+            return;
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 100000;
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        FD_SET(hSocket, &fdsetRecv);
+        if (select(hSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+            continue;
+        char pchBuf[1024];
+        int nBytes = recv(hSocket, pchBuf, sizeof(pchBuf), 0);
+        if (nBytes <= 0)
+            return;
+        strRequest.append(pchBuf, nBytes);
+    }
+
+    string strStatus = "200 OK";
+    string strBody;
+    if (strRequest.compare(0, 13, "GET /metrics ") == 0 || strRequest.compare(0, 6, "GET / ") == 0)
+        strBody = GetMetricsText();
+    else
+    {
+        strStatus = "404 Not Found";
+        strBody = "Not found\n";
+    }
+    string strReply = strprintf(
+            "HTTP/1.0 %s\r\n"
+            "Content-Type: text/plain; version=0.0.4\r\n"
+            "Content-Length: %u\r\n"
+            "Connection: close\r\n"
+            "\r\n", strStatus.c_str(), (unsigned int)strBody.size()) + strBody;
+
+    // The socket is blocking, send everything
+    const char* pch = strReply.data();
+    size_t nLeft = strReply.size();
+    while (nLeft > 0)
+    {
+        int nBytes = send(hSocket, pch, nLeft, MSG_NOSIGNAL);
+        if (nBytes <= 0)
+            return;
+        pch += nBytes;
+        nLeft -= nBytes;
+    }
+}
+
+static void ThreadMetricsServer2(void* parg)
+{
+    printf("ThreadMetricsServer started\n");
+    int nPort = GetArg("-metricsport", 0);
+
+    SOCKET hListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (hListenSocket == INVALID_SOCKET)
+    {
+        printf("ThreadMetricsServer : socket() failed, error %d\n", WSAGetLastError());
+        return;
+    }
+#ifdef SO_NOSIGPIPE
+    int nOne = 1;
+    setsockopt(hListenSocket, SOL_SOCKET, SO_NOSIGPIPE, (void*)&nOne, sizeof(int));
+#endif
+#ifndef WIN32
+    int nReuse = 1;
+    setsockopt(hListenSocket, SOL_SOCKET, SO_REUSEADDR, (void*)&nReuse, sizeof(int));
+#endif
+
+    // Local scrapers only
+    struct sockaddr_in sockaddr;
+    memset(&sockaddr, 0, sizeof(sockaddr));
+    sockaddr.sin_family = AF_INET;
+    sockaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sockaddr.sin_port = htons(nPort);
+    if (::bind(hListenSocket, (struct sockaddr*)&sockaddr, sizeof(sockaddr)) == SOCKET_ERROR ||
+        listen(hListenSocket, 8) == SOCKET_ERROR)
+    {
+        printf("ThreadMetricsServer : unable to listen on port %d, error %d\n", nPort, WSAGetLastError());
+        closesocket(hListenSocket);
+        return;
+    }
+    fMetrics = true;
+
+    while (!fShutdown)
+    {
+        struct timeval timeout;
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 200000;
+        fd_set fdsetRecv;
+        FD_ZERO(&fdsetRecv);
+        FD_SET(hListenSocket, &fdsetRecv);
+        if (select(hListenSocket + 1, &fdsetRecv, NULL, NULL, &timeout) <= 0)
+            continue;
+
+        struct sockaddr_in sockaddrPeer;
+        socklen_t len = sizeof(sockaddrPeer);
+        SOCKET hSocket = accept(hListenSocket, (struct sockaddr*)&sockaddrPeer, &len);
+        if (hSocket == INVALID_SOCKET)
+            continue;
+        ServeMetricsRequest(hSocket);
+        closesocket(hSocket);
+    }
+    fMetrics = false;
+    closesocket(hListenSocket);
+}
+
+void ThreadMetricsServer(void* parg)
+{
+    IMPLEMENT_RANDOMIZE_STACK(ThreadMetricsServer(parg));
+    try
+    {
+        vnThreadsRunning[THREAD_METRICS]++;
+        ThreadMetricsServer2(parg);
+        vnThreadsRunning[THREAD_METRICS]--;
+    }
+    catch (std::exception& e) {
+        vnThreadsRunning[THREAD_METRICS]--;
+        PrintException(&e, "ThreadMetricsServer()");
+    } catch (...) {
+        vnThreadsRunning[THREAD_METRICS]--;
+        PrintException(NULL, "ThreadMetricsServer()");
+    }
+    printf("ThreadMetricsServer exiting\n");
+}
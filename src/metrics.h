@@ -0,0 +1,144 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_METRICS_H
+#define PPCOIN_METRICS_H
+
+#include "util.h"
+
+//
+// Counters and latency histograms, exported in the Prometheus text format
+// on 127.0.0.1:<port> with -metricsport=<port>. Updates are atomic adds, and
+// are skipped entirely while the metrics server is off.
+//
+extern bool fMetrics;
+
+class CMetricCounter
+{
+private:
+    volatile int64 nValue;
+
+public:
+    CMetricCounter() : nValue(0) {}
+
+    void Inc(int64 n = 1) { __sync_fetch_and_add(&nValue, n); }
+    int64 Get() const { return nValue; }
+
+    void Write(std::string& str, const std::string& strName, const std::string& strLabels) const;
+};
+
+// Latency histogram with fixed buckets from 100us to 10s
+class CMetricHistogram
+{
+public:
+    enum { BUCKETS = 11 };
+    static const int64 nBucketMicros[BUCKETS];
+
+private:
+    volatile int64 vnBucket[BUCKETS];
+    volatile int64 nCount;
+    volatile int64 nSumMicros;
+
+public:
+    CMetricHistogram() : nCount(0), nSumMicros(0)
+    {
+        for (int i = 0; i < BUCKETS; i++)
+            vnBucket[i] = 0;
+    }
+
+    void Observe(int64 nMicros);
+    int64 GetCount() const { return nCount; }
+    int64 GetSumMicros() const { return nSumMicros; }
+
+    void Write(std::string& str, const std::string& strName, const std::string& strLabels) const;
+};
+
+class CMetricFamilyBase
+{
+protected:
+    std::string strName;
+    std::string strHelp;
+    std::string strType;
+
+public:
+    CMetricFamilyBase(const char* pszName, const char* pszType, const char* pszHelp);
+    virtual ~CMetricFamilyBase();
+
+    virtual void Write(std::string& str) const = 0;
+};
+
+// A metric, or a set of them told apart by the value of one label. Label
+// values beyond MAX_LABELS are counted under "other", so that peers sending
+// made-up commands can't grow the set.
+template<typename T>
+class CMetricFamily : public CMetricFamilyBase
+{
+private:
+    enum { MAX_LABELS = 100 };
+
+    std::string strLabel;
+    T metric;
+    mutable CCriticalSection cs_family;
+    std::map<std::string, T*> mapLabeled;
+
+public:
+    CMetricFamily(const char* pszName, const char* pszType, const char* pszHelp, const char* pszLabel = "") :
+        CMetricFamilyBase(pszName, pszType, pszHelp), strLabel(pszLabel) {}
+
+    T& Get() { return metric; }
+
+    T& Get(const std::string& strValue)
+    {
+        LOCK(cs_family);
+        typename std::map<std::string, T*>::iterator mi = mapLabeled.find(strValue);
+        if (mi != mapLabeled.end())
+            return *(*mi).second;
+        if (mapLabeled.size() >= MAX_LABELS && strValue != "other")
+            return Get("other");
+        T* p = new T();
+        mapLabeled[strValue] = p;
+        return *p;
+    }
+
+    void Write(std::string& str) const;
+};
+
+// Records the time from construction to destruction in a histogram
+class CMetricTimer
+{
+private:
+    CMetricHistogram* phistogram;
+    int64 nStart;
+
+public:
+    CMetricTimer(CMetricHistogram& histogram) : phistogram(fMetrics ? &histogram : NULL), nStart(phistogram ? GetTimeMicros() : 0) {}
+    CMetricTimer(CMetricHistogram* phistogramIn) : phistogram(fMetrics ? phistogramIn : NULL), nStart(phistogram ? GetTimeMicros() : 0) {}
+    ~CMetricTimer()
+    {
+        if (phistogram)
+            phistogram->Observe(GetTimeMicros() - nStart);
+    }
+};
+
+extern CMetricFamily<CMetricCounter> metricMessagesReceived;
+extern CMetricFamily<CMetricCounter> metricBytesReceived;
+extern CMetricFamily<CMetricCounter> metricMessagesSent;
+extern CMetricFamily<CMetricCounter> metricBytesSent;
+extern CMetricFamily<CMetricHistogram> metricConnectBlock;
+extern CMetricFamily<CMetricHistogram> metricCheckBlock;
+extern CMetricFamily<CMetricHistogram> metricFetchInputs;
+extern CMetricFamily<CMetricHistogram> metricConnectInputs;
+extern CMetricFamily<CMetricHistogram> metricSetBestChain;
+extern CMetricFamily<CMetricCounter> metricSignatureChecks;
+extern CMetricFamily<CMetricHistogram> metricMempoolAccept;
+extern CMetricFamily<CMetricCounter> metricMempoolRejects;
+extern CMetricFamily<CMetricCounter> metricStakeKernelChecks;
+extern CMetricFamily<CMetricHistogram> metricDBRead;
+extern CMetricFamily<CMetricHistogram> metricDBWrite;
+extern CMetricFamily<CMetricCounter> metricDBBytesWritten;
+extern CMetricFamily<CMetricHistogram> metricRPC;
+
+std::string GetMetricsText();
+void ThreadMetricsServer(void* parg);
+
+#endif
@@ -11,6 +11,7 @@
 #include "strlcpy.h"
 #include "addrman.h"
 #include "ui_interface.h"
+#include "config.h"
 
 #ifdef WIN32
 #include <string.h>
@@ -28,6 +29,9 @@ using namespace boost;
 
 static const int MAX_OUTBOUND_CONNECTIONS = 8;
 
+// Most bytes a peer writes in its turn while upload is limited
+static const unsigned int SEND_QUANTUM = 0x10000;
+
 void ThreadMessageHandler2(void* parg);
 void ThreadSocketHandler2(void* parg);
 void ThreadOpenConnections2(void* parg);
@@ -268,7 +272,7 @@ void ThreadGetMyExternalIP(void* parg)
         if (addrLocalHost.IsRoutable())
         {
             // If we already connected to a few before we had our IP, go back and addr them.
-            // setAddrKnown automatically filters any duplicate sends.
+            // filterAddrKnown automatically filters any duplicate sends.
             CAddress addr(addrLocalHost);
             addr.nTime = GetAdjustedTime();
             {
@@ -444,9 +448,9 @@ bool CNode::Misbehaving(int howmuch)
     }
 
     nMisbehavior += howmuch;
-    if (nMisbehavior >= GetArg("-banscore", 100))
+    if (nMisbehavior >= configBanScore.Get())
     {
-        int64 banTime = GetTime()+GetArg("-bantime", 60*60*24);  // Default 24-hour ban
+        int64 banTime = GetTime()+configBanTime.Get();  // Default 24-hour ban
         {
             LOCK(cs_setBanned);
             if (setBanned[addr] < banTime)
@@ -479,8 +483,90 @@ void CNode::copyStats(CNodeStats &stats)
 
 
 
+int GetSendPriority(const string& strCommand, const char* pchPayload, unsigned int nPayloadSize)
+{
+    if (strCommand == "tx" || strCommand == "addr")
+        return SEND_PRIORITY_TX;
+    if (strCommand != "inv")
+        return SEND_PRIORITY_NEW;
+
+    // An inv that announces any block goes ahead of transactions
+    const unsigned char* pch = (const unsigned char*)pchPayload;
+    const unsigned char* pend = pch + nPayloadSize;
+    if (pch == pend)
+        return SEND_PRIORITY_TX;
+    uint64 nCount = *pch++;
+    unsigned int nCountSize = (nCount == 253 ? 2 : nCount == 254 ? 4 : nCount == 255 ? 8 : 0);
+    if (nCountSize)
+    {
+        if ((unsigned int)(pend - pch) < nCountSize)
+            return SEND_PRIORITY_TX;
+        nCount = 0;
+        for (unsigned int i = 0; i < nCountSize; i++)
+            nCount |= (uint64)pch[i] << (8 * i);
+        pch += nCountSize;
+    }
+    for (uint64 i = 0; i < nCount && pend - pch >= 36; i++, pch += 36)
+    {
+        int nType = pch[0] | (pch[1] << 8) | (pch[2] << 16) | (pch[3] << 24);
+        if (nType == MSG_BLOCK)
+            return SEND_PRIORITY_NEW;
+    }
+    return SEND_PRIORITY_TX;
+}
 
-
+// Write out queued messages of one priority class until the socket would
+// block, nMaxBytes are sent, or a higher class has something waiting.
+// Returns the number of bytes sent. Requires cs_vSend.
+static unsigned int SocketSendData(CNode* pnode, int nPriority, unsigned int nMaxBytes)
+{
+    unsigned int nSent = 0;
+    while (nSent < nMaxBytes)
+    {
+        if (pnode->nSendOffset == pnode->vSendCurrent.size())
+        {
+            if (pnode->GetNextSendPriority() != nPriority)
+                break;
+            deque<vector<char> >& vQueue = pnode->vSendQueue[nPriority];
+            pnode->vSendCurrent.swap(vQueue.front());
+            vQueue.pop_front();
+            pnode->nSendOffset = 0;
+            pnode->nSendPriority = nPriority;
+        }
+        unsigned int nWant = min((unsigned int)pnode->vSendCurrent.size() - pnode->nSendOffset, nMaxBytes - nSent);
+        int nBytes = send(pnode->hSocket, &pnode->vSendCurrent[pnode->nSendOffset], nWant, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (nBytes > 0)
+        {
+            pnode->nSendOffset += nBytes;
+            pnode->nSendQueueSize -= nBytes;
+            pnode->nLastSend = GetTime();
+            nSent += nBytes;
+            if ((unsigned int)nBytes < nWant)
+                break;
+        }
+        else
+        {
+            if (nBytes < 0)
+            {
+                // error
+                int nErr = WSAGetLastError();
+                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                {
+                    printf("socket send error %d\n", nErr);
+                    pnode->CloseSocketDisconnect();
+                }
+            }
+            break;
+        }
+    }
+    if (pnode->nSendOffset == pnode->vSendCurrent.size())
+    {
+        // Don't hold on to the buffer of a large message
+        vector<char>().swap(pnode->vSendCurrent);
+        pnode->nSendOffset = 0;
+    }
+    return nSent;
+}
 
 
 
@@ -510,6 +596,9 @@ void ThreadSocketHandler2(void* parg)
     printf("ThreadSocketHandler started\n");
     list<CNode*> vNodesDisconnected;
     unsigned int nPrevNodeCount = 0;
+    int64 nUploadTokens = 0;
+    int64 nLastRefill = GetTimeMillis();
+    unsigned int nSendRotation = 0;
 
     loop
     {
@@ -522,8 +611,15 @@ void ThreadSocketHandler2(void* parg)
             vector<CNode*> vNodesCopy = vNodes;
             BOOST_FOREACH(CNode* pnode, vNodesCopy)
             {
+                bool fSendDone = false;
+                if (pnode->GetRefCount() <= 0)
+                {
+                    TRY_LOCK(pnode->cs_vSend, lockSend);
+                    if (lockSend)
+                        fSendDone = pnode->vSend.empty() && pnode->nSendQueueSize == 0;
+                }
                 if (pnode->fDisconnect ||
-                    (pnode->GetRefCount() <= 0 && pnode->vRecv.empty() && pnode->vSend.empty()))
+                    (pnode->GetRefCount() <= 0 && pnode->vRecv.empty() && fSendDone))
                 {
                     // remove from vNodes
                     vNodes.erase(remove(vNodes.begin(), vNodes.end(), pnode), vNodes.end());
@@ -584,6 +680,21 @@ void ThreadSocketHandler2(void* parg)
         }
 
 
+        //
+        // Refill the upload token bucket, which holds at most one second's
+        // worth. Sends may overdraw it by one quantum; the debt is paid
+        // back before anything else goes out.
+        //
+        int64 nMaxUpload = configMaxUploadTarget.Get() * 1000;
+        int64 nNow = GetTimeMillis();
+        if (nMaxUpload > 0)
+            nUploadTokens = min(nUploadTokens + nMaxUpload * (nNow - nLastRefill) / 1000, nMaxUpload);
+        else
+            nUploadTokens = 0;
+        nLastRefill = nNow;
+        bool fUploadAllowed = (nMaxUpload <= 0 || nUploadTokens > 0);
+
+
         //
         // Find which sockets have data to receive
         //
@@ -613,7 +724,7 @@ void ThreadSocketHandler2(void* parg)
                 hSocketMax = max(hSocketMax, pnode->hSocket);
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSend.empty())
+                    if (lockSend && fUploadAllowed && pnode->nSendQueueSize != 0)
                         FD_SET(pnode->hSocket, &fdsetSend);
                 }
             }
@@ -665,7 +776,7 @@ void ThreadSocketHandler2(void* parg)
                 if (WSAGetLastError() != WSAEWOULDBLOCK)
                     printf("socket error accept failed: %d\n", WSAGetLastError());
             }
-            else if (nInbound >= GetArg("-maxconnections", 125) - MAX_OUTBOUND_CONNECTIONS)
+            else if (nInbound >= configMaxConnections.Get() - MAX_OUTBOUND_CONNECTIONS)
             {
                 {
                     LOCK(cs_setservAddNodeAddresses);
@@ -692,7 +803,7 @@ void ThreadSocketHandler2(void* parg)
 
 
         //
-        // Service each socket
+        // Receive on each socket
         //
         vector<CNode*> vNodesCopy;
         {
@@ -755,49 +866,62 @@ void ThreadSocketHandler2(void* parg)
                     }
                 }
             }
+        }
 
-            //
-            // Send
-            //
-            if (pnode->hSocket == INVALID_SOCKET)
-                continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+        //
+        // Send, a priority class at a time across all writable sockets. While
+        // upload is limited, peers take turns at the budget one quantum each,
+        // starting from a different peer every round.
+        //
+        vector<CNode*> vSendNodes;
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+            if (pnode->hSocket != INVALID_SOCKET && FD_ISSET(pnode->hSocket, &fdsetSend))
+                vSendNodes.push_back(pnode);
+        nSendRotation++;
+        for (int nPriority = 0; nPriority < SEND_PRIORITY_MAX && !vSendNodes.empty(); nPriority++)
+        {
+            for (unsigned int i = 0; i < vSendNodes.size(); i++)
+            {
+                if (nMaxUpload > 0 && nUploadTokens <= 0)
+                    break;
+                CNode* pnode = vSendNodes[(i + nSendRotation) % vSendNodes.size()];
+                if (pnode->hSocket == INVALID_SOCKET)
+                    continue;
+                TRY_LOCK(pnode->cs_vSend, lockSend);
+                if (!lockSend || pnode->GetNextSendPriority() != nPriority)
+                    continue;
+                if (nMaxUpload > 0)
+                    nUploadTokens -= SocketSendData(pnode, nPriority, SEND_QUANTUM);
+                else
+                    SocketSendData(pnode, nPriority, UINT_MAX);
+            }
+        }
+
+        BOOST_FOREACH(CNode* pnode, vNodesCopy)
+        {
+            // getdata stops at SendBufferSize(), so only the block that
+            // crossed it can take a well-behaved peer past the limit
+            bool fSendLocked = false;
+            uint64 nSendQueueSize = 0;
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
                 {
-                    CDataStream& vSend = pnode->vSend;
-                    if (!vSend.empty())
-                    {
-                        int nBytes = send(pnode->hSocket, &vSend[0], vSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
-                        if (nBytes > 0)
-                        {
-                            vSend.erase(vSend.begin(), vSend.begin() + nBytes);
-                            pnode->nLastSend = GetTime();
-                        }
-                        else if (nBytes < 0)
-                        {
-                            // error
-                            int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                            {
-                                printf("socket send error %d\n", nErr);
-                                pnode->CloseSocketDisconnect();
-                            }
-                        }
-                        if (vSend.size() > SendBufferSize()) {
-                            if (!pnode->fDisconnect)
-                                printf("socket send flood control disconnect (%d bytes)\n", vSend.size());
-                            pnode->CloseSocketDisconnect();
-                        }
-                    }
+                    fSendLocked = true;
+                    nSendQueueSize = pnode->nSendQueueSize;
                 }
             }
+            if (nSendQueueSize > SendBufferSize() + MAX_BLOCK_SIZE)
+            {
+                if (!pnode->fDisconnect)
+                    printf("socket send flood control disconnect (%"PRI64u" bytes)\n", nSendQueueSize);
+                pnode->CloseSocketDisconnect();
+            }
 
             //
             // Inactivity checking
             //
-            if (pnode->vSend.empty())
+            if (fSendLocked && nSendQueueSize == 0)
                 pnode->nLastSendEmpty = GetTime();
             if (GetTime() - pnode->nTimeConnected > 60)
             {
@@ -1040,7 +1164,7 @@ void ThreadDNSAddressSeed2(void* parg)
                 {
                     int nOneDay = 24*3600;
                     CAddress addr = CAddress(CService(ip, GetDefaultPort()));
-                    addr.nTime = GetTime() - 3*nOneDay - GetRand(4*nOneDay); // use a random age between 3 and 7 days old
+                    addr.nTime = GetTime() - 3*nOneDay - GetFastRand(4*nOneDay); // use a random age between 3 and 7 days old
                     vAdd.push_back(addr);
                     found++;
                 }
@@ -1100,6 +1224,35 @@ void ThreadDumpAddress(void* parg)
     printf("ThreadDumpAddress exiting\n");
 }
 
+void ThreadDumpLockStats2(void* parg)
+{
+    int64 nInterval = GetArg("-lockstatsinterval", 100);
+    vnThreadsRunning[THREAD_DUMPLOCKSTATS]++;
+    while (!fShutdown)
+    {
+        vnThreadsRunning[THREAD_DUMPLOCKSTATS]--;
+        Sleep(nInterval * 1000);
+        vnThreadsRunning[THREAD_DUMPLOCKSTATS]++;
+        if (fShutdown)
+            break;
+        PrintLockStats(20);
+    }
+    vnThreadsRunning[THREAD_DUMPLOCKSTATS]--;
+}
+
+void ThreadDumpLockStats(void* parg)
+{
+    IMPLEMENT_RANDOMIZE_STACK(ThreadDumpLockStats(parg));
+    try
+    {
+        ThreadDumpLockStats2(parg);
+    }
+    catch (std::exception& e) {
+        PrintException(&e, "ThreadDumpLockStats()");
+    }
+    printf("ThreadDumpLockStats exiting\n");
+}
+
 void ThreadOpenConnections(void* parg)
 {
     IMPLEMENT_RANDOMIZE_STACK(ThreadOpenConnections(parg));
@@ -1175,7 +1328,7 @@ void ThreadOpenConnections2(void* parg)
                 struct in_addr ip;
                 memcpy(&ip, &pnSeed[i], sizeof(ip));
                 CAddress addr(CService(ip, GetDefaultPort()));
-                addr.nTime = GetTime()-GetRand(nOneWeek)-nOneWeek;
+                addr.nTime = GetTime()-GetFastRand(nOneWeek)-nOneWeek;
                 vAdd.push_back(addr);
             }
             addrman.Add(vAdd, CNetAddr("127.0.0.1"));
@@ -1386,7 +1539,7 @@ void ThreadMessageHandler2(void* parg)
         // Poll the connected nodes for messages
         CNode* pnodeTrickle = NULL;
         if (!vNodesCopy.empty())
-            pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
+            pnodeTrickle = vNodesCopy[GetFastRand(vNodesCopy.size())];
         BOOST_FOREACH(CNode* pnode, vNodesCopy)
         {
             // Receive messages
@@ -1537,7 +1690,7 @@ void StartNode(void* parg)
 {
     if (semOutbound == NULL) {
         // initialize semaphore
-        int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, (int)GetArg("-maxconnections", 125));
+        int nMaxOutbound = min(MAX_OUTBOUND_CONNECTIONS, (int)configMaxConnections.Get());
         semOutbound = new CSemaphore(nMaxOutbound);
     }
 
@@ -1659,6 +1812,11 @@ void StartNode(void* parg)
     if (!CreateThread(ThreadDumpAddress, NULL))
         printf("Error; CreateThread(ThreadDumpAddress) failed\n");
 
+    // Write the lock profile to debug.log every -lockstatsinterval seconds
+    if (fLockProfile && GetArg("-lockstatsinterval", 100) > 0)
+        if (!CreateThread(ThreadDumpLockStats, NULL))
+            printf("Error: CreateThread(ThreadDumpLockStats) failed\n");
+
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", false), pwalletMain);
 
@@ -1697,7 +1855,11 @@ bool StopNode()
     if (vnThreadsRunning[THREAD_ADDEDCONNECTIONS] > 0) printf("ThreadOpenAddedConnections still running\n");
     if (vnThreadsRunning[THREAD_DUMPADDRESS] > 0) printf("ThreadDumpAddresses still running\n");
     if (vnThreadsRunning[THREAD_MINTER] > 0) printf("ThreadStakeMinter still running\n");
-    while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCSERVER] > 0)
+    if (vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX] > 0) printf("ThreadUpgradeBlockIndex still running\n");
+    if (vnThreadsRunning[THREAD_METRICS] > 0) printf("ThreadMetricsServer still running\n");
+    if (vnThreadsRunning[THREAD_DUMPLOCKSTATS] > 0) printf("ThreadDumpLockStats still running\n");
+    // The block index upgrade writes to the database, which is closed next
+    while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCSERVER] > 0 || vnThreadsRunning[THREAD_UPGRADEBLOCKINDEX] > 0)
         Sleep(20);
     Sleep(50);
     DumpAddresses();
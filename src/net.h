@@ -14,10 +14,12 @@
 #include <arpa/inet.h>
 #endif
 
-#include "mruset.h"
+#include "bloom.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "addrman.h"
+#include "config.h"
+#include "metrics.h"
 
 #include <openssl/rand.h>
 
@@ -49,6 +51,21 @@ enum
     MSG_BLOCK,
 };
 
+/** Send priority classes, highest first. Each peer's finished messages are
+ * queued by class and written out highest class first; with -maxuploadtarget
+ * the upload budget also goes to every peer's higher classes before any
+ * peer's lower ones. */
+enum
+{
+    SEND_PRIORITY_NEW = 0,      // control messages, block announcements and recent blocks
+    SEND_PRIORITY_TX,           // transactions, their inventory, and addresses
+    SEND_PRIORITY_HISTORICAL,   // old blocks served to peers that are syncing
+
+    SEND_PRIORITY_MAX
+};
+
+int GetSendPriority(const std::string& strCommand, const char* pchPayload, unsigned int nPayloadSize);
+
 class CRequestTracker
 {
 public:
@@ -81,6 +98,9 @@ enum threadId
     THREAD_ADDEDCONNECTIONS,
     THREAD_DUMPADDRESS,
     THREAD_MINTER,
+    THREAD_UPGRADEBLOCKINDEX,
+    THREAD_METRICS,
+    THREAD_DUMPLOCKSTATS,
 
     THREAD_MAX
 };
@@ -133,6 +153,15 @@ public:
     SOCKET hSocket;
     CDataStream vSend;
     CDataStream vRecv;
+    // Finished messages move out of vSend into a queue per send priority.
+    // The socket thread writes out vSendCurrent, then the front of the
+    // highest priority queue that has anything. Protected by cs_vSend.
+    std::deque<std::vector<char> > vSendQueue[SEND_PRIORITY_MAX];
+    std::vector<char> vSendCurrent;
+    unsigned int nSendOffset;
+    int nSendPriority;
+    uint64 nSendQueueSize;
+    int nMessagePriority;
     CCriticalSection cs_vSend;
     CCriticalSection cs_vRecv;
     int64 nLastSend;
@@ -171,18 +200,24 @@ public:
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
-    std::set<CAddress> setAddrKnown;
+    CRollingBloomFilter filterAddrKnown;
     bool fGetAddr;
-    std::set<uint256> setKnown;
+    CRollingBloomFilter filterKnown;
     uint256 hashCheckpointKnown; // PFN: known sent sync-checkpoint
 
     // inventory based relay
-    mruset<CInv> setInventoryKnown;
+    CRollingBloomFilter filterInventoryKnown;
     std::vector<CInv> vInventoryToSend;
     CCriticalSection cs_inventory;
     std::multimap<int64, CInv> mapAskFor;
-
-    CNode(SOCKET hSocketIn, CAddress addrIn, bool fInboundIn=false) : vSend(SER_NETWORK, MIN_PROTO_VERSION), vRecv(SER_NETWORK, MIN_PROTO_VERSION)
+    std::deque<CInv> vRecvGetData; // PFN: requested while the send queue was full; cs_vRecv
+
+    // PFN: known addresses and inventory are kept in fixed-size rolling
+    // filters instead of sets, so a peer costs the same memory however much
+    // it relays. A false positive only skips one announcement to one peer.
+    // Inventory is keyed by hash alone, as a tx and a block never share one.
+    CNode(SOCKET hSocketIn, CAddress addrIn, bool fInboundIn=false) : vSend(SER_NETWORK, MIN_PROTO_VERSION), vRecv(SER_NETWORK, MIN_PROTO_VERSION),
+        filterAddrKnown(5000, 0.001), filterKnown(100, 0.000001), filterInventoryKnown(SendBufferSize() / 1000, 0.000001)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -192,6 +227,10 @@ public:
         nTimeConnected = GetTime();
         nHeaderStart = -1;
         nMessageStart = -1;
+        nSendOffset = 0;
+        nSendPriority = SEND_PRIORITY_NEW;
+        nSendQueueSize = 0;
+        nMessagePriority = -1;
         addr = addrIn;
         addrName = addr.ToStringIPPort();
         nVersion = 0;
@@ -211,7 +250,6 @@ public:
         fGetAddr = false;
         nMisbehavior = 0;
         hashCheckpointKnown = 0;
-        setInventoryKnown.max_size(SendBufferSize() / 1000);
 
         // Be shy and don't send version until we hear
         if (!fInbound)
@@ -256,7 +294,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
-        setAddrKnown.insert(addr);
+        filterAddrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr)
@@ -264,7 +302,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
-        if (addr.IsValid() && !setAddrKnown.count(addr))
+        if (addr.IsValid() && !filterAddrKnown.contains(addr.GetKey()))
             vAddrToSend.push_back(addr);
     }
 
@@ -273,7 +311,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            setInventoryKnown.insert(inv);
+            filterInventoryKnown.insert(inv.hash);
         }
     }
 
@@ -281,7 +319,7 @@ public:
     {
         {
             LOCK(cs_inventory);
-            if (!setInventoryKnown.count(inv))
+            if (!filterInventoryKnown.contains(inv.hash))
                 vInventoryToSend.push_back(inv);
         }
     }
@@ -307,11 +345,48 @@ public:
 
 
 
-    void BeginMessage(const char* pszCommand)
+    // Whether every finished message has been written to the socket
+    bool SendQueueEmpty()
+    {
+        LOCK(cs_vSend);
+        return nSendQueueSize == 0;
+    }
+
+    // Whether every finished message of one priority class has at least
+    // started going out to the socket
+    bool SendQueueEmpty(int nPriority)
+    {
+        LOCK(cs_vSend);
+        return vSendQueue[nPriority].empty();
+    }
+
+    // Bytes of finished messages not yet written to the socket; the socket
+    // thread lowers it as it writes
+    uint64 GetSendQueueSize()
+    {
+        LOCK(cs_vSend);
+        return nSendQueueSize;
+    }
+
+    // Class of the next bytes to write, or -1 if there are none. A message
+    // that is partly written has to finish before anything else.
+    int GetNextSendPriority() const
+    {
+        if (nSendOffset < vSendCurrent.size())
+            return nSendPriority;
+        for (int n = 0; n < SEND_PRIORITY_MAX; n++)
+            if (!vSendQueue[n].empty())
+                return n;
+        return -1;
+    }
+
+    // nPriority of -1 picks the class from the message itself
+    void BeginMessage(const char* pszCommand, int nPriority = -1)
     {
         ENTER_CRITICAL_SECTION(cs_vSend);
         if (nHeaderStart != -1)
             AbortMessage();
+        nMessagePriority = nPriority;
         nHeaderStart = vSend.size();
         vSend << CMessageHeader(pszCommand, 0);
         nMessageStart = vSend.size();
@@ -336,7 +411,7 @@ public:
 
     void EndMessage()
     {
-        if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
+        if (configDropMessagesTest.Get() > 0 && GetRand(configDropMessagesTest.Get()) == 0)
         {
             printf("dropmessages DROPPING SEND MESSAGE\n");
             AbortMessage();
@@ -361,6 +436,26 @@ public:
             printf("(%d bytes)\n", nSize);
         }
 
+        if (fMetrics)
+        {
+            std::string strCommand((char*)&vSend[nHeaderStart] + offsetof(CMessageHeader, pchCommand), CMessageHeader::COMMAND_SIZE);
+            strCommand.resize(strlen(strCommand.c_str()));
+            metricMessagesSent.Get(strCommand).Inc();
+            metricBytesSent.Get(strCommand).Inc(vSend.size() - nHeaderStart);
+        }
+
+        // Hand the finished message to the socket thread
+        int nPriority = nMessagePriority;
+        if (nPriority < 0)
+        {
+            std::string strCommand((char*)&vSend[nHeaderStart] + offsetof(CMessageHeader, pchCommand), CMessageHeader::COMMAND_SIZE);
+            strCommand.resize(strlen(strCommand.c_str()));
+            nPriority = GetSendPriority(strCommand, nSize ? &vSend[nMessageStart] : NULL, nSize);
+        }
+        vSendQueue[nPriority].push_back(std::vector<char>(vSend.begin() + nHeaderStart, vSend.end()));
+        nSendQueueSize += vSend.size() - nHeaderStart;
+        vSend.resize(nHeaderStart);
+
         nHeaderStart = -1;
         nMessageStart = -1;
         LEAVE_CRITICAL_SECTION(cs_vSend);
@@ -412,6 +507,23 @@ public:
         }
     }
 
+    // Same as PushMessage, but queued under the given send priority
+    template<typename T1>
+    void PushMessageWithPriority(int nPriority, const char* pszCommand, const T1& a1)
+    {
+        try
+        {
+            BeginMessage(pszCommand, nPriority);
+            vSend << a1;
+            EndMessage();
+        }
+        catch (...)
+        {
+            AbortMessage();
+            throw;
+        }
+    }
+
     template<typename T1, typename T2>
     void PushMessage(const char* pszCommand, const T1& a1, const T2& a2)
     {
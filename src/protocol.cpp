@@ -19,10 +19,14 @@
 static unsigned char pchMessageStartMain[4] = { 0x46, 0x4a, 0x14, 0x4e };
 // Public testnet message start
 static unsigned char pchMessageStartTest[4] = { 0x4d, 0x54, 0x54, 0x44 };
+// Private regression test network message start
+static unsigned char pchMessageStartRegTest[4] = { 0x4d, 0x54, 0x52, 0x47 };
 
 void GetMessageStart(unsigned char pchMessageStart[], bool fPersistent)
 {
-    if (fTestNet)
+    if (fRegTest)
+        memcpy(pchMessageStart, pchMessageStartRegTest, sizeof(pchMessageStartRegTest));
+    else if (fTestNet)
         memcpy(pchMessageStart, pchMessageStartTest, sizeof(pchMessageStartTest));
     else
         memcpy(pchMessageStart, pchMessageStartMain, sizeof(pchMessageStartMain));
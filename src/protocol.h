@@ -19,14 +19,17 @@
 #define RPC_PORT     21864
 #define TESTNET_PORT 11066
 #define TESTNET_RPC_PORT 21066
+#define REGTEST_PORT 11166
+#define REGTEST_RPC_PORT 21166
 
 extern bool fTestNet;
+extern bool fRegTest;
 
 void GetMessageStart(unsigned char pchMessageStart[], bool fPersistent = false);
 
 static inline unsigned short GetDefaultPort(const bool testnet = fTestNet)
 {
-    return testnet ? TESTNET_PORT : PPCOIN_PORT;
+    return testnet ? (fRegTest ? REGTEST_PORT : TESTNET_PORT) : PPCOIN_PORT;
 }
 
 
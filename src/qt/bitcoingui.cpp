@@ -27,6 +27,7 @@
 #include "guiutil.h"
 #include "rpcconsole.h"
 #include "wallet.h"
+#include "config.h"
 
 #ifdef Q_WS_MAC
 #include "macdockiconhandler.h"
@@ -606,7 +607,7 @@ void BitcoinGUI::setNumBlocks(int count)
     labelBlocksIcon->setToolTip(tooltip);
     progressBarLabel->setToolTip(tooltip);
     progressBar->setToolTip(tooltip);
-    if(GetBoolArg("-chart", true) && count > 0 && nTotalBlocks > 0)
+    if(configChart.Get() && count > 0 && nTotalBlocks > 0)
     {
         overviewPage->updatePlot(count);
     }
@@ -9,6 +9,7 @@
 #include "guiutil.h"
 #include "guiconstants.h"
 #include "main.h"
+#include "config.h"
 
 double GetPoSKernelPS2(const CBlockIndex* pindex);
 double GetDifficulty(const CBlockIndex* blockindex = NULL);
@@ -137,7 +138,7 @@ OverviewPage::OverviewPage(QWidget *parent) :
 
     connect(ui->listTransactions, SIGNAL(clicked(QModelIndex)), this, SIGNAL(transactionClicked(QModelIndex)));
 
-    if(GetBoolArg("-chart", true))
+    if(configChart.Get())
     {
         // setup Plot
         // create graph
@@ -176,7 +177,7 @@ void OverviewPage::updatePlot(int count)
 {
     static int64_t lastUpdate = 0;
     // Double Check to make sure we don't try to update the plot when it is disabled
-    if(!GetBoolArg("-chart", true)) { return; }
+    if(!configChart.Get()) { return; }
     if (GetTime() - lastUpdate < 10) { return; } // This is just so it doesn't redraw rapidly during syncing
 
     if(fDebug) { printf("Plot: Getting Ready: pindexBest: %p\n", pindexBest); }
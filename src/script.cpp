@@ -15,6 +15,7 @@ using namespace boost;
 #include "key.h"
 #include "main.h"
 #include "util.h"
+#include "config.h"
 
 bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode, const CTransaction& txTo, unsigned int nIn, int nHashType);
 
@@ -1133,7 +1134,7 @@ public:
         // (~200 bytes per cache entry times 50,000 entries)
         // Since there are a maximum of 20,000 signature operations per block
         // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
+        int64 nMaxCacheSize = configMaxSigCacheSize.Get();
         if (nMaxCacheSize <= 0) return;
 
         LOCK(cs_sigcache);
@@ -1144,7 +1145,7 @@ public:
             // foil would-be DoS attackers who might try to pre-generate
             // and re-use a set of valid signatures just-slightly-greater
             // than our cache size.
-            uint256 randomHash = GetRandHash();
+            uint256 randomHash = GetFastRandHash();
             std::vector<unsigned char> unused;
             std::set<sigdata_type>::iterator it =
                 setValid.lower_bound(sigdata_type(randomHash, unused, unused));
@@ -1638,14 +1639,21 @@ bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsig
 }
 
 unsigned int CScript::GetSigOpCount(bool fAccurate) const
+{
+    if (empty())
+        return 0;
+    return GetSigOpCount(&(*this)[0], &(*this)[0] + size(), fAccurate);
+}
+
+unsigned int CScript::GetSigOpCount(const unsigned char* pbegin, const unsigned char* pend, bool fAccurate)
 {
     unsigned int n = 0;
-    const_iterator pc = begin();
+    const unsigned char* pc = pbegin;
     opcodetype lastOpcode = OP_INVALIDOPCODE;
-    while (pc < end())
+    while (pc < pend)
     {
         opcodetype opcode;
-        if (!GetOp(pc, opcode))
+        if (!GetOp(pc, pend, opcode, NULL))
             break;
         if (opcode == OP_CHECKSIG || opcode == OP_CHECKSIGVERIFY)
             n++;
@@ -400,8 +400,25 @@ public:
         if (pc >= end())
             return false;
 
+        const unsigned char* pbegin = &(*this)[0];
+        const unsigned char* p = pbegin + (pc - begin());
+        bool fRet = GetOp(p, pbegin + size(), opcodeRet, pvchRet);
+        pc = begin() + (p - pbegin);
+        return fRet;
+    }
+
+    // Read one instruction from script bytes that are not in a CScript,
+    // such as a script inside a serialized transaction
+    static bool GetOp(const unsigned char*& pc, const unsigned char* pend, opcodetype& opcodeRet, std::vector<unsigned char>* pvchRet)
+    {
+        opcodeRet = OP_INVALIDOPCODE;
+        if (pvchRet)
+            pvchRet->clear();
+        if (pc >= pend)
+            return false;
+
         // Read instruction
-        if (end() - pc < 1)
+        if (pend - pc < 1)
             return false;
         unsigned int opcode = *pc++;
 
@@ -415,13 +432,13 @@ public:
             }
             else if (opcode == OP_PUSHDATA1)
             {
-                if (end() - pc < 1)
+                if (pend - pc < 1)
                     return false;
                 nSize = *pc++;
             }
             else if (opcode == OP_PUSHDATA2)
             {
-                if (end() - pc < 2)
+                if (pend - pc < 2)
                     return false;
                 nSize = 0;
                 memcpy(&nSize, &pc[0], 2);
@@ -429,12 +446,12 @@ public:
             }
             else if (opcode == OP_PUSHDATA4)
             {
-                if (end() - pc < 4)
+                if (pend - pc < 4)
                     return false;
                 memcpy(&nSize, &pc[0], 4);
                 pc += 4;
             }
-            if (end() - pc < nSize)
+            if (pend - pc < nSize)
                 return false;
             if (pvchRet)
                 pvchRet->assign(pc, pc + nSize);
@@ -495,6 +512,7 @@ public:
     // counted more accurately, assuming they are of the form
     //  ... OP_N CHECKMULTISIG ...
     unsigned int GetSigOpCount(bool fAccurate) const;
+    static unsigned int GetSigOpCount(const unsigned char* pbegin, const unsigned char* pend, bool fAccurate);
 
     // Accurately count sigOps, including sigOps in
     // pay-to-script-hash transactions:
@@ -718,7 +718,8 @@ struct ser_streamplaceholder
 class CDataStream
 {
 protected:
-    typedef std::vector<char, zero_after_free_allocator<char> > vector_type;
+    // PFN: pooled buffers, cleared on release only for secure streams
+    typedef std::vector<char, stream_allocator<char> > vector_type;
     vector_type vch;
     unsigned int nReadPos;
     short state;
@@ -737,7 +738,9 @@ public:
     typedef vector_type::const_iterator   const_iterator;
     typedef vector_type::reverse_iterator reverse_iterator;
 
-    explicit CDataStream(int nTypeIn, int nVersionIn)
+    // Streams that may hold private keys must be constructed with fSecure,
+    // so that their buffers are cleared when released
+    explicit CDataStream(int nTypeIn, int nVersionIn, bool fSecure=false) : vch(allocator_type(fSecure))
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -748,7 +751,7 @@ public:
     }
 
 #if !defined(_MSC_VER) || _MSC_VER >= 1300
-    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn) : vch(pbegin, pend)
+    CDataStream(const char* pbegin, const char* pend, int nTypeIn, int nVersionIn, bool fSecure=false) : vch(pbegin, pend, allocator_type(fSecure))
     {
         Init(nTypeIn, nVersionIn);
     }
@@ -807,6 +810,7 @@ public:
     size_type size() const                           { return vch.size() - nReadPos; }
     bool empty() const                               { return vch.size() == nReadPos; }
     void resize(size_type n, value_type c=0)         { vch.resize(n + nReadPos, c); }
+    allocator_type get_allocator() const             { return vch.get_allocator(); }
     void reserve(size_type n)                        { vch.reserve(n + nReadPos); }
     const_reference operator[](size_type pos) const  { return vch[pos + nReadPos]; }
     reference operator[](size_type pos)              { return vch[pos + nReadPos]; }
@@ -12,14 +12,10 @@
 #include "wallet.h"
 #include "net.h"
 #include "util.h"
+#include "config.h"
 
 #include <stdint.h>
 
-// Tests this internal-to-main.cpp method:
-extern bool AddOrphanTx(const CDataStream& vMsg);
-extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
-extern std::map<uint256, CDataStream*> mapOrphanTransactions;
-extern std::map<uint256, std::map<uint256, CDataStream*> > mapOrphanTransactionsByPrev;
 
 CService ip(uint32_t i)
 {
@@ -51,7 +47,9 @@ BOOST_AUTO_TEST_CASE(DoS_banning)
 BOOST_AUTO_TEST_CASE(DoS_banscore)
 {
     CNode::ClearBanned();
-    mapArgs["-banscore"] = "111"; // because 11 is my favorite number
+    std::string strErr;
+    std::string strBanScore = configBanScore.ToString();
+    BOOST_CHECK(SetConfig("banscore", "111", strErr)); // because 11 is my favorite number
     CAddress addr1(ip(0xa0b0c001));
     CNode dummyNode1(INVALID_SOCKET, addr1, true);
     dummyNode1.Misbehaving(100);
@@ -60,7 +58,7 @@ BOOST_AUTO_TEST_CASE(DoS_banscore)
     BOOST_CHECK(!CNode::IsBanned(addr1));
     dummyNode1.Misbehaving(1);
     BOOST_CHECK(CNode::IsBanned(addr1));
-    mapArgs.erase("-banscore");
+    BOOST_CHECK(SetConfig("banscore", strBanScore, strErr));
 }
 
 BOOST_AUTO_TEST_CASE(DoS_bantime)
@@ -132,16 +130,9 @@ BOOST_AUTO_TEST_CASE(DoS_checknbits)
     
 }
 
-CTransaction RandomOrphan()
+static CTransaction RandomOrphan(const std::vector<CTransaction>& vOrphans)
 {
-    std::map<uint256, CDataStream*>::iterator it;
-    it = mapOrphanTransactions.lower_bound(GetRandHash());
-    if (it == mapOrphanTransactions.end())
-        it = mapOrphanTransactions.begin();
-    const CDataStream* pvMsg = it->second;
-    CTransaction tx;
-    CDataStream(*pvMsg) >> tx;
-    return tx;
+    return vOrphans[GetRandInt(vOrphans.size())];
 }
 
 BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
@@ -150,6 +141,10 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
     key.MakeNewKey(true);
     CBasicKeyStore keystore;
     keystore.AddKey(key);
+    int64 nStartTime = GetTime();
+    SetMockTime(nStartTime);
+    CNetAddr addr1(ip(0xa0b0c001)), addr2(ip(0xa0b0c002));
+    std::vector<CTransaction> vOrphans;
 
     // 50 orphan transactions:
     for (int i = 0; i < 50; i++)
@@ -163,15 +158,16 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetBitcoinAddress(key.GetPubKey());
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        BOOST_CHECK(orphanpool.add(tx, addr1));
+        BOOST_CHECK(!orphanpool.add(tx, addr1));
+        vOrphans.push_back(tx);
     }
 
-    // ... and 50 that depend on other orphans:
+    // ... and 50 that depend on other orphans, a minute later:
+    SetMockTime(nStartTime + 60);
     for (int i = 0; i < 50; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans);
 
         CTransaction tx;
         tx.vin.resize(1);
@@ -182,15 +178,24 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         tx.vout[0].scriptPubKey.SetBitcoinAddress(key.GetPubKey());
         SignSignature(keystore, txPrev, tx, 0);
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        BOOST_CHECK(orphanpool.add(tx, addr2));
+        vOrphans.push_back(tx);
+
+        // Children are found from the parent without parsing anything
+        std::vector<uint256> vChildren;
+        orphanpool.getChildren(txPrev.GetHash(), vChildren);
+        BOOST_CHECK(std::find(vChildren.begin(), vChildren.end(), tx.GetHash()) != vChildren.end());
+        CTransaction* ptx = orphanpool.lookup(tx.GetHash());
+        BOOST_CHECK(ptx && ptx->GetHash() == tx.GetHash());
     }
+    BOOST_CHECK_EQUAL(orphanpool.size(), 100U);
+    BOOST_CHECK_EQUAL(orphanpool.GetUsage(), orphanpool.GetUsage(addr1) + orphanpool.GetUsage(addr2));
+    BOOST_CHECK(orphanpool.lookup(0) == NULL);
 
     // This really-big orphan should be ignored:
     for (int i = 0; i < 10; i++)
     {
-        CTransaction txPrev = RandomOrphan();
+        CTransaction txPrev = RandomOrphan(vOrphans);
 
         CTransaction tx;
         tx.vout.resize(1);
@@ -208,19 +213,48 @@ BOOST_AUTO_TEST_CASE(DoS_mapOrphans)
         for (int j = 1; j < tx.vin.size(); j++)
             tx.vin[j].scriptSig = tx.vin[0].scriptSig;
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        BOOST_CHECK(!AddOrphanTx(ds));
+        BOOST_CHECK(!orphanpool.add(tx, addr1));
+    }
+
+    // Eviction takes from the biggest sender first
+    unsigned int nUsage1 = orphanpool.GetUsage(addr1);
+    unsigned int nUsage2 = orphanpool.GetUsage(addr2);
+    BOOST_CHECK(nUsage2 > nUsage1);
+    orphanpool.limit(orphanpool.GetUsage() - 1);
+    BOOST_CHECK_EQUAL(orphanpool.GetUsage(addr1), nUsage1);
+    BOOST_CHECK(orphanpool.GetUsage(addr2) < nUsage2);
+    orphanpool.limit(orphanpool.GetUsage() / 2);
+    BOOST_CHECK(orphanpool.size() < 100);
+
+    // The first batch expires first
+    SetMockTime(nStartTime + ORPHAN_TX_EXPIRE_TIME);
+    orphanpool.expire();
+    BOOST_CHECK_EQUAL(orphanpool.GetUsage(addr1), 0U);
+    BOOST_CHECK(orphanpool.GetUsage(addr2) > 0);
+    SetMockTime(nStartTime + 60 + ORPHAN_TX_EXPIRE_TIME);
+    orphanpool.expire();
+    BOOST_CHECK_EQUAL(orphanpool.size(), 0U);
+    BOOST_CHECK_EQUAL(orphanpool.GetUsage(), 0U);
+
+    // One sender cannot take more than its share
+    int nAdded = 0;
+    for (int i = 0; i < 100000; i++)
+    {
+        CTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vout.resize(1);
+        if (!orphanpool.add(tx, addr1))
+            break;
+        nAdded++;
     }
+    BOOST_CHECK(nAdded > 0 && nAdded < 100000);
+    BOOST_CHECK(orphanpool.GetUsage(addr1) <= MAX_ORPHAN_PEER_USAGE);
 
-    // Test LimitOrphanTxSize() function:
-    LimitOrphanTxSize(40);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 40);
-    LimitOrphanTxSize(10);
-    BOOST_CHECK(mapOrphanTransactions.size() <= 10);
-    LimitOrphanTxSize(0);
-    BOOST_CHECK(mapOrphanTransactions.empty());
-    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    orphanpool.limit(0);
+    BOOST_CHECK_EQUAL(orphanpool.size(), 0U);
+    BOOST_CHECK_EQUAL(orphanpool.GetUsage(), 0U);
+    SetMockTime(0);
 }
 
 BOOST_AUTO_TEST_CASE(DoS_checkSig)
@@ -246,9 +280,7 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
         tx.vout[0].nValue = 1*CENT;
         tx.vout[0].scriptPubKey.SetBitcoinAddress(key.GetPubKey());
 
-        CDataStream ds(SER_DISK, CLIENT_VERSION);
-        ds << tx;
-        AddOrphanTx(ds);
+        orphanpool.add(tx, CNetAddr());
     }
 
     // Create a transaction that depends on orphans:
@@ -299,16 +331,18 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
 
     // Exercise -maxsigcachesize code:
-    mapArgs["-maxsigcachesize"] = "10";
+    std::string strErr;
+    std::string strMaxSigCacheSize = configMaxSigCacheSize.ToString();
+    BOOST_CHECK(SetConfig("maxsigcachesize", "10", strErr));
     // Generate a new, different signature for vin[0] to trigger cache clear:
     CScript oldSig = tx.vin[0].scriptSig;
     BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0));
     BOOST_CHECK(tx.vin[0].scriptSig != oldSig);
     for (int j = 0; j < tx.vin.size(); j++)
         BOOST_CHECK(VerifySignature(orphans[j], tx, j, true, SIGHASH_ALL));
-    mapArgs.erase("-maxsigcachesize");
+    BOOST_CHECK(SetConfig("maxsigcachesize", strMaxSigCacheSize, strErr));
 
-    LimitOrphanTxSize(0);
+    orphanpool.limit(0);
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,203 @@
+//
+// Unit tests for the per-account balance index
+//
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "wallet.h"
+#include "walletdb.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(accounting_tests)
+
+BOOST_AUTO_TEST_CASE(account_balance_depth)
+{
+    const int nUnconfirmed = std::numeric_limits<int>::max();
+
+    CAccountBalance balance;
+    balance.Add(CAccountBalance::FIXED, 0, 5 * COIN);
+    balance.Add(CAccountBalance::RECEIVED, 100, 10 * COIN);
+    balance.Add(CAccountBalance::RECEIVED, 105, 20 * COIN);
+    balance.Add(CAccountBalance::RECEIVED, nUnconfirmed, 40 * COIN);
+    balance.Add(CAccountBalance::GENERATED, 50, 100 * COIN);
+    balance.Add(CAccountBalance::FIXED, 0, -1 * COIN);
+
+    // Everything, including unconfirmed receives
+    BOOST_CHECK_EQUAL(balance.Get(nUnconfirmed, nUnconfirmed), 174 * COIN);
+    // Confirmed receives only, generated coins still immature
+    BOOST_CHECK_EQUAL(balance.Get(105, 49), 34 * COIN);
+    BOOST_CHECK_EQUAL(balance.Get(104, 50), 114 * COIN);
+    BOOST_CHECK_EQUAL(balance.Get(99, 50), 104 * COIN);
+
+    // Removing a transaction drops its height bucket
+    balance.Add(CAccountBalance::RECEIVED, 105, -20 * COIN);
+    BOOST_CHECK(balance.mapReceived.count(105) == 0);
+    BOOST_CHECK_EQUAL(balance.Get(105, 50), 114 * COIN);
+}
+
+// Account balance the way GetAccountBalance found it before the index, by
+// scanning every wallet transaction and accounting entry
+static int64 ScanAccountBalance(CWallet& wallet, const string& strAccount, int nMinDepth)
+{
+    int64 nBalance = 0;
+    for (map<uint256, CWalletTx>::iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        if (!wtx.IsFinal())
+            continue;
+
+        int64 nGenerated, nReceived, nSent, nFee;
+        wtx.GetAccountAmounts(strAccount, nGenerated, nReceived, nSent, nFee);
+        if (nReceived != 0 && wtx.GetDepthInMainChain() >= nMinDepth)
+            nBalance += nReceived;
+        nBalance += nGenerated - nSent - nFee;
+    }
+    nBalance += CWalletDB(wallet.strWalletFile).GetAccountCreditDebit(strAccount);
+    return nBalance;
+}
+
+static void CheckAccountBalances(CWallet& wallet)
+{
+    const char* pszAccounts[] = { "", "a", "b" };
+    for (int i = 0; i < 3; i++)
+        for (int nMinDepth = 0; nMinDepth <= 2; nMinDepth++)
+            BOOST_CHECK_EQUAL(wallet.GetAccountBalance(pszAccounts[i], nMinDepth), ScanAccountBalance(wallet, pszAccounts[i], nMinDepth));
+}
+
+static CTransaction MakePayment(const COutPoint& prevout, const CBitcoinAddress& address, int64 nValue)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = prevout;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey.SetBitcoinAddress(address);
+    tx.vout[0].nValue = nValue;
+    return tx;
+}
+
+// Put wtx alone in the block of pindex, as SetMerkleBranch would
+static void SetTestBlock(CWalletTx& wtx, CBlockIndex* pindex)
+{
+    pindex->hashMerkleRoot = wtx.GetHash();
+    wtx.hashBlock = pindex->GetBlockHash();
+    wtx.nIndex = 0;
+    wtx.vMerkleBranch.clear();
+}
+
+static void ConnectTestBlock(CBlockIndex* pindex)
+{
+    mapBlockIndex[pindex->GetBlockHash()] = pindex;
+    if (pindex->pprev)
+        pindex->pprev->pnext = pindex;
+    pindexBest = pindex;
+    nBestHeight = pindex->nHeight;
+}
+
+static void DisconnectTestBlock(CBlockIndex* pindex)
+{
+    mapBlockIndex.erase(pindex->GetBlockHash());
+    if (pindex->pprev)
+        pindex->pprev->pnext = NULL;
+    pindexBest = pindex->pprev;
+    nBestHeight = pindexBest->nHeight;
+}
+
+BOOST_AUTO_TEST_CASE(account_index_matches_scan)
+{
+    CBlockIndex* pindexBestSave = pindexBest;
+    int nBestHeightSave = nBestHeight;
+
+    // File backed, so that accounting entries can be written
+    const string strFile = "accounting_tests.dat";
+    CWalletDB(strFile, "cr+");
+    CWallet wallet(strFile);
+
+    CKey keyA, keyB, keyOther;
+    keyA.MakeNewKey(false);
+    keyB.MakeNewKey(false);
+    keyOther.MakeNewKey(false);
+    wallet.LoadKey(keyA);
+    wallet.LoadKey(keyB);
+    CBitcoinAddress addressA(keyA.GetPubKey()), addressB(keyB.GetPubKey()), addressOther(keyOther.GetPubKey());
+    wallet.mapAddressBook[addressA] = "a";
+    wallet.mapAddressBook[addressB] = "b";
+
+    // Chain 0-1-2, later extended by 3 and then reorganized onto 3'
+    uint256 hashBlocks[5];
+    CBlockIndex index[5];
+    for (int i = 0; i < 5; i++)
+    {
+        hashBlocks[i] = GetRandHash();
+        index[i].phashBlock = &hashBlocks[i];
+        index[i].pprev = (i == 0 ? NULL : (i == 4 ? &index[2] : &index[i - 1]));
+        index[i].nHeight = (index[i].pprev ? index[i].pprev->nHeight + 1 : 0);
+    }
+    for (int i = 0; i < 3; i++)
+        ConnectTestBlock(&index[i]);
+
+    // Build the index, so that the transactions below go through
+    // AddToWallet's update of it
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 0), 0);
+
+    // A confirmed receive to b in block 1
+    CWalletTx wtxB(&wallet, MakePayment(COutPoint(GetRandHash(), 0), addressB, 3 * COIN));
+    SetTestBlock(wtxB, &index[1]);
+    BOOST_CHECK(wallet.AddToWallet(wtxB));
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("b", 2), 3 * COIN);
+    CheckAccountBalances(wallet);
+
+    // An unconfirmed receive to a
+    CWalletTx wtxA(&wallet, MakePayment(COutPoint(GetRandHash(), 0), addressA, 5 * COIN));
+    BOOST_CHECK(wallet.AddToWallet(wtxA));
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 0), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 1), 0);
+    CheckAccountBalances(wallet);
+
+    // b's coins sent elsewhere from the default account
+    CWalletTx wtxSend(&wallet, MakePayment(COutPoint(wtxB.GetHash(), 0), addressOther, 2 * COIN));
+    BOOST_CHECK(wallet.AddToWallet(wtxSend));
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 0), -3 * COIN);
+    CheckAccountBalances(wallet);
+
+    // wtxA is seen in block 3 before the block is connected; it is counted
+    // once the block joins the main chain
+    SetTestBlock(wtxA, &index[3]);
+    BOOST_CHECK(wallet.AddToWallet(wtxA));
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 1), 0);
+    CheckAccountBalances(wallet);
+    ConnectTestBlock(&index[3]);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 1), 5 * COIN);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 2), 0);
+    CheckAccountBalances(wallet);
+
+    // A move between accounts
+    CAccountingEntry entry;
+    entry.strAccount = "a";
+    entry.nCreditDebit = -1 * COIN;
+    CWalletDB(strFile).WriteAccountingEntry(entry);
+    wallet.AddAccountCreditDebit(entry.strAccount, entry.nCreditDebit);
+    entry.strAccount = "b";
+    entry.nCreditDebit = 1 * COIN;
+    CWalletDB(strFile).WriteAccountingEntry(entry);
+    wallet.AddAccountCreditDebit(entry.strAccount, entry.nCreditDebit);
+    CheckAccountBalances(wallet);
+
+    // Reorganize block 3 away: wtxA is unconfirmed again
+    DisconnectTestBlock(&index[3]);
+    ConnectTestBlock(&index[4]);
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("a", 1), -1 * COIN);
+    CheckAccountBalances(wallet);
+
+    // Erasing a transaction takes it out of the index
+    BOOST_CHECK(wallet.EraseFromWallet(wtxSend.GetHash()));
+    BOOST_CHECK_EQUAL(wallet.GetAccountBalance("", 0), 0);
+    CheckAccountBalances(wallet);
+
+    for (int i = 4; i >= 0; i--)
+        mapBlockIndex.erase(hashBlocks[i]);
+    pindexBest = pindexBestSave;
+    nBestHeight = nBestHeightSave;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
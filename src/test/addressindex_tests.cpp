@@ -0,0 +1,128 @@
+//
+// Unit tests for the per-address received index
+//
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "wallet.h"
+#include "walletdb.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(addressindex_tests)
+
+// Total received by address the way the received-by RPCs used to find it,
+// by scanning every wallet transaction
+static int64 ScanReceived(const CWallet& wallet, const CBitcoinAddress& address, int nMinDepth)
+{
+    CScript scriptPubKey;
+    scriptPubKey.SetBitcoinAddress(address);
+    int64 nAmount = 0;
+    for (map<uint256, CWalletTx>::const_iterator it = wallet.mapWallet.begin(); it != wallet.mapWallet.end(); ++it)
+    {
+        const CWalletTx& wtx = (*it).second;
+        if (wtx.IsCoinBase() || wtx.IsCoinStake() || !wtx.IsFinal())
+            continue;
+        BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+            if (txout.scriptPubKey == scriptPubKey && wtx.GetDepthInMainChain() >= nMinDepth)
+                nAmount += txout.nValue;
+    }
+    return nAmount;
+}
+
+// The same total from the index, as getreceivedbyaddress tallies it now
+static int64 IndexReceived(CWallet& wallet, const CBitcoinAddress& address, int nMinDepth)
+{
+    int64 nAmount = 0;
+    const map<CBitcoinAddress, vector<COutPoint> >& mapAddressReceived = wallet.GetAddressReceived();
+    map<CBitcoinAddress, vector<COutPoint> >::const_iterator mi = mapAddressReceived.find(address);
+    if (mi == mapAddressReceived.end())
+        return 0;
+    BOOST_FOREACH(const COutPoint& outpoint, (*mi).second)
+    {
+        const CWalletTx& wtx = wallet.mapWallet[outpoint.hash];
+        if (wtx.IsFinal() && wtx.GetDepthInMainChain() >= nMinDepth)
+            nAmount += wtx.vout[outpoint.n].nValue;
+    }
+    return nAmount;
+}
+
+static CTransaction MakePayment(const vector<pair<CBitcoinAddress, int64> >& vPay)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    BOOST_FOREACH(const PAIRTYPE(CBitcoinAddress, int64)& pay, vPay)
+    {
+        CTxOut txout;
+        txout.scriptPubKey.SetBitcoinAddress(pay.first);
+        txout.nValue = pay.second;
+        tx.vout.push_back(txout);
+    }
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(addressindex_matches_scan)
+{
+    // File backed, so that transactions can be erased again
+    const string strFile = "addressindex_tests.dat";
+    CWalletDB(strFile, "cr+");
+    CWallet wallet(strFile);
+
+    CKey key1, key2, keyOther;
+    key1.MakeNewKey(false);
+    key2.MakeNewKey(false);
+    keyOther.MakeNewKey(false);
+    wallet.LoadKey(key1);
+    wallet.LoadKey(key2);
+    CBitcoinAddress address1(key1.GetPubKey()), address2(key2.GetPubKey()), addressOther(keyOther.GetPubKey());
+    vector<CBitcoinAddress> vAddress;
+    vAddress.push_back(address1);
+    vAddress.push_back(address2);
+    vAddress.push_back(addressOther);
+
+    // Build the index first, so that the transactions below go through
+    // AddToWallet's update of it
+    BOOST_CHECK(wallet.GetAddressReceived().empty());
+
+    // One transaction pays address1 twice
+    vector<pair<CBitcoinAddress, int64> > vPay;
+    vPay.push_back(make_pair(address1, 1 * COIN));
+    vPay.push_back(make_pair(address2, 2 * COIN));
+    vPay.push_back(make_pair(address1, 4 * COIN));
+    vPay.push_back(make_pair(addressOther, 8 * COIN));
+    CWalletTx wtx1(&wallet, MakePayment(vPay));
+    BOOST_CHECK(wallet.AddToWallet(wtx1));
+
+    vPay.clear();
+    vPay.push_back(make_pair(address2, 16 * COIN));
+    CWalletTx wtx2(&wallet, MakePayment(vPay));
+    BOOST_CHECK(wallet.AddToWallet(wtx2));
+
+    // Adding the same transaction again does not count it twice
+    BOOST_CHECK(wallet.AddToWallet(wtx2));
+
+    BOOST_CHECK_EQUAL(wallet.GetAddressReceived().find(address1)->second.size(), 2U);
+    BOOST_CHECK_EQUAL(IndexReceived(wallet, address1, 0), 5 * COIN);
+    BOOST_CHECK_EQUAL(IndexReceived(wallet, address2, 0), 18 * COIN);
+    BOOST_FOREACH(const CBitcoinAddress& address, vAddress)
+    {
+        BOOST_CHECK_EQUAL(IndexReceived(wallet, address, 0), ScanReceived(wallet, address, 0));
+        // nothing is confirmed
+        BOOST_CHECK_EQUAL(IndexReceived(wallet, address, 1), 0);
+        BOOST_CHECK_EQUAL(ScanReceived(wallet, address, 1), 0);
+    }
+
+    // Erasing a transaction takes all its outputs out of the index
+    BOOST_CHECK(wallet.EraseFromWallet(wtx1.GetHash()));
+    BOOST_CHECK(wallet.GetAddressReceived().count(address1) == 0);
+    BOOST_CHECK(wallet.GetAddressReceived().count(addressOther) == 0);
+    BOOST_CHECK_EQUAL(IndexReceived(wallet, address2, 0), 16 * COIN);
+    BOOST_FOREACH(const CBitcoinAddress& address, vAddress)
+        BOOST_CHECK_EQUAL(IndexReceived(wallet, address, 0), ScanReceived(wallet, address, 0));
+
+    BOOST_CHECK(wallet.EraseFromWallet(wtx2.GetHash()));
+    BOOST_CHECK(wallet.GetAddressReceived().empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,101 @@
+//
+// Unit tests for the address manager
+//
+#include <boost/test/unit_test.hpp>
+
+#include "addrman.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(addrman_tests)
+
+// Exposes the protected lookup of CAddrMan
+class CAddrManTest : public CAddrMan
+{
+public:
+    CAddrInfo* Find(const CNetAddr& addr) { return CAddrMan::Find(addr); }
+};
+
+static CAddress MakeAddress(const char* pszIP)
+{
+    CAddress addr(CService(pszIP, 9901));
+    addr.nTime = GetAdjustedTime() - 60;
+    return addr;
+}
+
+BOOST_AUTO_TEST_CASE(addrman_load_version0)
+{
+    // Addresses from different groups and sources, some of them tried
+    CAddrManTest addrman;
+    vector<CAddress> vAddr;
+    for (int i = 0; i < 50; i++)
+    {
+        CAddress addr = MakeAddress(strprintf("%d.%d.1.1", 20 + i, i).c_str());
+        BOOST_CHECK(addrman.Add(addr, CNetAddr(strprintf("%d.1.1.1", 100 + i).c_str())));
+        vAddr.push_back(addr);
+    }
+    for (int i = 0; i < 10; i++)
+        addrman.Good(vAddr[i]);
+    BOOST_CHECK_EQUAL(addrman.size(), 50);
+
+    // A version 0 record has the same layout; its bucket lists were placed
+    // with the old hash, so every new entry is bucketed again on load
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << addrman;
+    ss[0] = 0;
+    CAddrManTest addrman2;
+    ss >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), 50);
+    for (int i = 0; i < 50; i++)
+        BOOST_CHECK(addrman2.Find(vAddr[i]) != NULL);
+
+    // and it is written back as version 1, with the tried entries still
+    // tried, and loads the same again
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << addrman2;
+    CDataStream ssHeader(ss2);
+    unsigned char nVersion;
+    vector<unsigned char> vchKey;
+    int nNew, nTried;
+    ssHeader >> nVersion >> vchKey >> nNew >> nTried;
+    BOOST_CHECK_EQUAL(nVersion, 1);
+    BOOST_CHECK_EQUAL(nNew, 40);
+    BOOST_CHECK_EQUAL(nTried, 10);
+    CAddrManTest addrman3;
+    ss2 >> addrman3;
+    BOOST_CHECK_EQUAL(addrman3.size(), 50);
+    BOOST_CHECK(addrman3.Select().IsValid());
+}
+
+BOOST_AUTO_TEST_CASE(addrman_load_version0_overflow)
+{
+    // A version 0 record with 100 new entries that all map to the same
+    // bucket now: the ones that find it full are dropped
+    vector<unsigned char> vchKey(32, 0x5a);
+    int nNew = 100, nTried = 0, nUBuckets = ADDRMAN_NEW_BUCKET_COUNT;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << (unsigned char)0 << vchKey << nNew << nTried << nUBuckets;
+    CNetAddr source("1.2.3.4");
+    for (int i = 0; i < nNew; i++)
+        ss << CAddrInfo(MakeAddress(strprintf("5.6.%d.1", i).c_str()), source);
+    for (int b = 0; b < nUBuckets; b++)
+        ss << 0;
+
+    CAddrManTest addrman;
+    ss >> addrman;
+    BOOST_CHECK_EQUAL(addrman.size(), ADDRMAN_NEW_BUCKET_SIZE);
+    int nFound = 0;
+    for (int i = 0; i < nNew; i++)
+        if (addrman.Find(CNetAddr(strprintf("5.6.%d.1", i).c_str())))
+            nFound++;
+    BOOST_CHECK_EQUAL(nFound, ADDRMAN_NEW_BUCKET_SIZE);
+
+    // What was kept survives another round trip
+    CDataStream ss2(SER_DISK, CLIENT_VERSION);
+    ss2 << addrman;
+    CAddrManTest addrman2;
+    ss2 >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), ADDRMAN_NEW_BUCKET_SIZE);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
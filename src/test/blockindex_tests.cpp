@@ -0,0 +1,73 @@
+//
+// Unit tests for the block index records on disk
+//
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(blockindex_tests)
+
+BOOST_AUTO_TEST_CASE(blockindex_upgrade_record)
+{
+    uint256 hashPrev = 12345;
+    CBlockIndex indexPrev;
+    indexPrev.phashBlock = &hashPrev;
+
+    CBlockIndex index;
+    index.pprev = &indexPrev;
+    index.nFile = 1;
+    index.nBlockPos = 200;
+    index.nHeight = 1;
+    index.nMint = 5 * COIN;
+    index.nMoneySupply = 100 * COIN;
+    index.SetProofOfStake();
+    index.nStakeModifier = 0x1234567890abcdefULL;
+    index.prevoutStake = COutPoint(hashPrev, 2);
+    index.nStakeTime = 1400000000;
+    index.hashProofOfStake = 777;
+    index.nVersion = 1;
+    index.hashMerkleRoot = 999;
+    index.nTime = 1400000100;
+    index.nBits = 0x1d00ffff;
+    index.nNonce = 42;
+    index.bnChainTrust = 1000;
+    index.nStakeModifierChecksum = 0xdeadbeef;
+    CDiskBlockIndex diskindex(&index);
+
+    // A record of a version before DISK_BLOCKINDEX_TRUST_VERSION has no
+    // chain trust or checksum; LoadBlockIndex recomputes those and queues
+    // the record for ThreadUpgradeBlockIndex
+    CDataStream ssOld(SER_DISK, DISK_BLOCKINDEX_TRUST_VERSION - 1);
+    ssOld << diskindex;
+    CDataStream ssRead(ssOld.begin(), ssOld.end(), SER_DISK, CLIENT_VERSION);
+    CDiskBlockIndex diskindexOld;
+    ssRead >> diskindexOld;
+    BOOST_CHECK(ssRead.empty());
+    BOOST_CHECK(diskindexOld.bnChainTrust == 0);
+    BOOST_CHECK_EQUAL(diskindexOld.nStakeModifierChecksum, 0U);
+    BOOST_CHECK(diskindexOld.GetBlockHash() == diskindex.GetBlockHash());
+    BOOST_CHECK(diskindexOld.hashPrev == hashPrev);
+    BOOST_CHECK_EQUAL(diskindexOld.nHeight, 1);
+    BOOST_CHECK_EQUAL(diskindexOld.nMoneySupply, 100 * COIN);
+    BOOST_CHECK_EQUAL(diskindexOld.nStakeModifier, 0x1234567890abcdefULL);
+    BOOST_CHECK(diskindexOld.IsProofOfStake());
+    BOOST_CHECK(diskindexOld.prevoutStake == index.prevoutStake);
+    BOOST_CHECK(diskindexOld.hashProofOfStake == index.hashProofOfStake);
+
+    // The upgraded record, as ThreadUpgradeBlockIndex writes it, keeps them
+    // after the same fields
+    CDataStream ssNew(SER_DISK, CLIENT_VERSION);
+    ssNew << diskindex;
+    BOOST_CHECK(ssNew.size() > ssOld.size());
+    BOOST_CHECK(memcmp(&ssNew[4], &ssOld[4], ssOld.size() - 4) == 0);
+    CDiskBlockIndex diskindexNew;
+    ssNew >> diskindexNew;
+    BOOST_CHECK(ssNew.empty());
+    BOOST_CHECK(diskindexNew.bnChainTrust == 1000);
+    BOOST_CHECK_EQUAL(diskindexNew.nStakeModifierChecksum, 0xdeadbeefU);
+    BOOST_CHECK(diskindexNew.GetBlockHash() == diskindex.GetBlockHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,67 @@
+#include <boost/test/unit_test.hpp>
+
+#include "bloom.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(bloom_tests)
+
+static vector<unsigned char> RandomKey()
+{
+    uint256 hash = GetFastRandHash();
+    return vector<unsigned char>(hash.begin(), hash.begin() + 20);
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom)
+{
+    // Last 100 entries are always remembered, with a 1% false positive rate
+    CRollingBloomFilter rb1(100, 0.01);
+
+    // Overfill
+    vector<vector<unsigned char> > vData;
+    for (int i = 0; i < 399; i++)
+    {
+        vector<unsigned char> vKey = RandomKey();
+        rb1.insert(vKey);
+        vData.push_back(vKey);
+    }
+    // Last 100 are guaranteed to be remembered
+    for (int i = 299; i < 399; i++)
+        BOOST_CHECK(rb1.contains(vData[i]));
+
+    // false positive rate is 1%, so we should get about 100 hits when
+    // testing 10,000 random keys. Allow up to twice that.
+    int nHits = 0;
+    for (int i = 0; i < 10000; i++)
+        if (rb1.contains(RandomKey()))
+            nHits++;
+    BOOST_CHECK(nHits <= 200);
+
+    // Hashes and byte vectors share the filter
+    uint256 hash = GetFastRandHash();
+    rb1.insert(hash);
+    BOOST_CHECK(rb1.contains(hash));
+
+    // reset forgets everything
+    rb1.reset();
+    int nRemembered = 0;
+    for (int i = 299; i < 399; i++)
+        if (rb1.contains(vData[i]))
+            nRemembered++;
+    BOOST_CHECK(nRemembered <= 5);
+}
+
+BOOST_AUTO_TEST_CASE(rolling_bloom_size)
+{
+    // Memory is fixed up front, and a tighter rate costs more of it
+    CRollingBloomFilter rb1(10000, 0.001), rb2(10000, 0.000001);
+    size_t nSize = rb1.GetMemoryUsage();
+    for (int i = 0; i < 50000; i++)
+        rb1.insert(GetFastRandHash());
+    BOOST_CHECK_EQUAL(rb1.GetMemoryUsage(), nSize);
+    BOOST_CHECK(rb2.GetMemoryUsage() > nSize);
+    BOOST_CHECK(rb2.GetMemoryUsage() < 200000);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,78 @@
+//
+// Unit tests for the typed configuration settings
+//
+#include <boost/test/unit_test.hpp>
+
+#include "config.h"
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(config_tests)
+
+BOOST_AUTO_TEST_CASE(config_load)
+{
+    string strError;
+    const char *argv_test[] = {"-ignored", "-keypool=7", "-reservebalance=1.5", "-nochart", "-avatar", "-blocknotify=echo %s"};
+    ParseParameters(6, argv_test);
+    BOOST_CHECK(InitConfig(strError));
+    BOOST_CHECK_EQUAL(configKeyPool.Get(), 7);
+    BOOST_CHECK_EQUAL(configReserveBalance.Get(), 3 * COIN / 2);
+    BOOST_CHECK(!configChart.Get());
+    BOOST_CHECK(configAvatar.Get());
+    BOOST_CHECK_EQUAL(configMaxSigCacheSize.Get(), 50000);
+
+    // Defaults are restored when the options are gone
+    ParseParameters(1, argv_test);
+    BOOST_CHECK(InitConfig(strError));
+    BOOST_CHECK_EQUAL(configKeyPool.Get(), 100);
+    BOOST_CHECK(configChart.Get());
+    BOOST_CHECK(!configAvatar.Get());
+
+    const char *argv_bad[] = {"-ignored", "-keypool=lots"};
+    ParseParameters(2, argv_bad);
+    BOOST_CHECK(!InitConfig(strError));
+    BOOST_CHECK(strError.find("-keypool") != string::npos);
+    ParseParameters(0, NULL);
+    BOOST_CHECK(InitConfig(strError));
+}
+
+BOOST_AUTO_TEST_CASE(config_set)
+{
+    string strError;
+    ParseParameters(0, NULL);
+    BOOST_CHECK(InitConfig(strError));
+
+    BOOST_CHECK(SetConfig("keypool", "250", strError));
+    BOOST_CHECK_EQUAL(configKeyPool.Get(), 250);
+    // mapArgs is left alone while running
+    BOOST_CHECK_EQUAL(GetArg("-keypool", 100), 100);
+    BOOST_CHECK(SetConfig("-reservebalance", "12", strError));
+    BOOST_CHECK_EQUAL(configReserveBalance.Get(), 12 * COIN);
+
+    // Invalid values leave the setting unchanged
+    BOOST_CHECK(!SetConfig("keypool", "25x", strError));
+    BOOST_CHECK(!SetConfig("reservebalance", "-1", strError));
+    BOOST_CHECK(!SetConfig("nosuchsetting", "1", strError));
+    // Commands to run are never settable over RPC
+    BOOST_CHECK(!SetConfig("blocknotify", "touch /tmp/x", strError));
+    // Settings sized once at startup are not either
+    BOOST_CHECK(!SetConfig("maxconnections", "8", strError));
+    BOOST_CHECK(strError.find("startup") != string::npos);
+    BOOST_CHECK_EQUAL(configMaxConnections.Get(), 125);
+    BOOST_CHECK_EQUAL(configKeyPool.Get(), 250);
+    BOOST_CHECK_EQUAL(configReserveBalance.Get(), 12 * COIN);
+
+    vector<pair<string, string> > vConfig;
+    GetConfig(vConfig);
+    bool fFound = false;
+    for (unsigned int i = 0; i < vConfig.size(); i++)
+        if (vConfig[i].first == "-keypool")
+            fFound = (vConfig[i].second == "250");
+    BOOST_CHECK(fFound);
+
+    ParseParameters(0, NULL);
+    BOOST_CHECK(InitConfig(strError));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
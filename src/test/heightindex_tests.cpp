@@ -0,0 +1,44 @@
+//
+// Unit tests for the main chain lookup by height
+//
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(heightindex_tests)
+
+BOOST_AUTO_TEST_CASE(heightindex_reorg)
+{
+    // Chain 0-1-2-3-4 and a fork 2-5-6-7
+    CBlockIndex index[8];
+    for (int i = 0; i < 8; i++)
+    {
+        index[i].pprev = (i == 0 ? NULL : (i == 5 ? &index[2] : &index[i - 1]));
+        index[i].nHeight = (index[i].pprev ? index[i].pprev->nHeight + 1 : 0);
+    }
+
+    SetBlockIndexByHeight(&index[4]);
+    for (int i = 0; i <= 4; i++)
+        BOOST_CHECK(FindBlockByHeight(i) == &index[i]);
+    BOOST_CHECK(FindBlockByHeight(5) == NULL);
+    BOOST_CHECK(FindBlockByHeight(-1) == NULL);
+
+    // Switch to the longer fork
+    SetBlockIndexByHeight(&index[7]);
+    BOOST_CHECK(FindBlockByHeight(2) == &index[2]);
+    BOOST_CHECK(FindBlockByHeight(3) == &index[5]);
+    BOOST_CHECK(FindBlockByHeight(5) == &index[7]);
+
+    // And back to a shorter chain
+    SetBlockIndexByHeight(&index[3]);
+    BOOST_CHECK(FindBlockByHeight(3) == &index[3]);
+    BOOST_CHECK(FindBlockByHeight(4) == NULL);
+
+    // Put back the real main chain, so nothing points at these blocks
+    SetBlockIndexByHeight(pindexBest);
+    BOOST_CHECK(FindBlockByHeight(3) != &index[3]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,176 @@
+//
+// Unit tests for the RPC JSON parser
+//
+#include <boost/test/unit_test.hpp>
+#include <float.h>
+#include <math.h>
+
+#include "json/json_spirit_reader_template.h"
+#include "json/json_spirit_writer_template.h"
+#include "jsonparse.h"
+
+using namespace std;
+using namespace json_spirit;
+
+BOOST_AUTO_TEST_SUITE(jsonparse_tests)
+
+static bool SameValue(const Value& a, const Value& b)
+{
+    if (a.type() != b.type())
+        return false;
+    switch (a.type())
+    {
+        case obj_type:
+        {
+            const Object& objA = a.get_obj();
+            const Object& objB = b.get_obj();
+            if (objA.size() != objB.size())
+                return false;
+            for (unsigned int i = 0; i < objA.size(); i++)
+                if (objA[i].name_ != objB[i].name_ || !SameValue(objA[i].value_, objB[i].value_))
+                    return false;
+            return true;
+        }
+        case array_type:
+        {
+            const Array& arrayA = a.get_array();
+            const Array& arrayB = b.get_array();
+            if (arrayA.size() != arrayB.size())
+                return false;
+            for (unsigned int i = 0; i < arrayA.size(); i++)
+                if (!SameValue(arrayA[i], arrayB[i]))
+                    return false;
+            return true;
+        }
+        case str_type:
+            return a.get_str() == b.get_str();
+        case bool_type:
+            return a.get_bool() == b.get_bool();
+        case int_type:
+            if (a.is_uint64() != b.is_uint64())
+                return false;
+            return (a.is_uint64() ? a.get_uint64() == b.get_uint64() : a.get_int64() == b.get_int64());
+        case real_type:
+            // json_spirit gives NaN for zero times an overflowing exponent
+            if (isnan(a.get_real()))
+                return b.get_real() == 0;
+            return a.get_real() == b.get_real();
+        default:
+            return true;
+    }
+}
+
+static const char* pszCorpus[] = {
+    "{\"method\":\"getblockrange\",\"params\":[100,25,true],\"id\":1}",
+    "{\"jsonrpc\": \"1.0\", \"id\":\"curltest\", \"method\": \"sendmany\", \"params\": [\"\", {\"PAddr1\":0.01,\"PAddr2\":0.02}, 6, \"testing\"] }",
+    "{\"result\":{\"balance\":12.345678,\"blocks\":12345,\"errors\":\"\"},\"error\":null,\"id\":\"curl\"}",
+    "[1.5,-2,+3,.5,5.,1e5,1E-3,-0.25e+2,0.1,123456789.123456789,1e-300,2.5e300]",
+    "[18446744073709551615,-9223372036854775808,9223372036854775807,9223372036854775808]",
+    "{\"a\":\"x\\ty\\u0041\\x41\\q\\/\\\\\\\"\\101\",\"b\":null,\"c\":[true,false,{}],\"a\":[]}",
+    " [ \"\\u00\" , \"\\x4\" , \"\\x7F\" ] trailing text",
+    "\"plain string\"",
+    "-17",
+    "1e",
+    "1.e5",
+    "+.5e-3",
+    "\"abc",
+    "[1,]",
+    "{\"a\":1,}",
+    "{\"a\" 1}",
+    "[\"\\x\"]",
+    "[\"\\xFF\"]",
+    "[\"\\x1\\\\\"]",
+    "[\"\\u12r\\\\\"]",
+    "[\"a\\x41\\\\\",\"\\u004\\\\\",\"\\x7\\\"\"]",
+    "-",
+    "+18446744073709551615",
+    "18446744073709551616",
+    "1e400",
+    "[1.7976931348623157e308,1.7976931348623159e308,-1.7976931348623159e308,1.797693134862316e308]",
+    "[4.9e-324,-4.9e-324,3e-324,2e-324,1e-320,1e-310,2.2250738585072011e-308,1e-400]",
+    "[1554.5e-11,98.5e-4,-64.202909e22,.7597853383793e-4,0.1,0.3,2.675]",
+    "[179769313486231580793728971405303415079934132710037826936173778980444968292764750946649017977587207096330286416692887910946555547851940402630657488671505820681908902000708383676273854845817711531764475730270069855571366959622842914819860834936475292719074168444365510704342711559699508093042880177904174497791.0]",
+    "[0e400,-0e400]",
+    "[nul]",
+    "",
+};
+
+BOOST_AUTO_TEST_CASE(jsonparse_equivalence)
+{
+    for (unsigned int i = 0; i < sizeof(pszCorpus) / sizeof(pszCorpus[0]); i++)
+    {
+        string str = pszCorpus[i];
+        Value valueSpirit, value;
+        bool fSpirit = read_string(str, valueSpirit);
+        bool fParse = ParseJSON(str, value);
+        BOOST_CHECK_MESSAGE(fSpirit == fParse, str);
+        if (fSpirit && fParse)
+            BOOST_CHECK_MESSAGE(SameValue(valueSpirit, value), str + " -> " + write_string(value, false));
+    }
+
+    Value value;
+    BOOST_CHECK(ParseJSON("[1.5,-2,+3,.5,5.]", value));
+    const Array& array = value.get_array();
+    BOOST_CHECK_EQUAL(array.size(), 5U);
+    BOOST_CHECK(array[0].type() == real_type && array[0].get_real() == 1.5);
+    BOOST_CHECK(array[1].type() == int_type && array[1].get_int64() == -2);
+    BOOST_CHECK(array[2].type() == int_type && array[2].get_int64() == 3);
+    BOOST_CHECK(array[3].get_real() == 0.5);
+    BOOST_CHECK(array[4].get_real() == 5.0);
+
+    BOOST_CHECK(ParseJSON("18446744073709551615", value));
+    BOOST_CHECK(value.is_uint64() && value.get_uint64() == 18446744073709551615ULL);
+
+    // Reals come out as json_spirit rounds them, not as strtod does
+    BOOST_CHECK(ParseJSON("[1.7976931348623159e308,4.9e-324,0e400]", value));
+    BOOST_CHECK(value.get_array()[0].get_real() == DBL_MAX);
+    BOOST_CHECK(value.get_array()[1].get_real() == 0);
+    BOOST_CHECK(value.get_array()[2].get_real() == 0);
+
+    // ...and are rejected when their digits alone overflow a double
+    BOOST_CHECK(!ParseJSON("[" + string(309, '9') + ".0]", value));
+    BOOST_CHECK(ParseJSON("[" + string(308, '9') + ".0]", value));
+}
+
+BOOST_AUTO_TEST_CASE(jsonparse_depth)
+{
+    // Deep nesting is refused instead of exhausting the stack
+    Value value;
+    BOOST_CHECK(ParseJSON(string(100, '[') + string(100, ']'), value));
+    BOOST_CHECK(!ParseJSON(string(100000, '['), value));
+    BOOST_CHECK(!ParseJSON(string(100000, '[') + string(100000, ']'), value));
+}
+
+BOOST_AUTO_TEST_CASE(jsonparse_fuzz)
+{
+    // Random edits of the corpus must be accepted or rejected exactly as
+    // json_spirit does, with the same resulting value
+    static const char pszAlphabet[] = "{}[]\",:.-+eE0123456789\\ntfuxX \tabl";
+    unsigned int nRand = 12345;
+    int nCorpus = sizeof(pszCorpus) / sizeof(pszCorpus[0]);
+    for (int i = 0; i < 20000; i++)
+    {
+        string str = pszCorpus[i % nCorpus];
+        int nEdits = 1 + i % 4;
+        for (int j = 0; j < nEdits; j++)
+        {
+            nRand = nRand * 1103515245 + 12345;
+            unsigned int nPos = (nRand >> 8) % (str.size() + 1);
+            char c = pszAlphabet[(nRand >> 20) % (sizeof(pszAlphabet) - 1)];
+            switch ((nRand >> 16) % 3)
+            {
+                case 0: if (nPos < str.size()) str.erase(nPos, 1); break;
+                case 1: str.insert(nPos, 1, c); break;
+                case 2: if (nPos < str.size()) str[nPos] = c; break;
+            }
+        }
+        Value valueSpirit, value;
+        bool fSpirit = read_string(str, valueSpirit);
+        bool fParse = ParseJSON(str, value);
+        BOOST_CHECK_MESSAGE(fSpirit == fParse, str);
+        if (fSpirit && fParse)
+            BOOST_CHECK_MESSAGE(SameValue(valueSpirit, value), str);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
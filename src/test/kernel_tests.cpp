@@ -0,0 +1,290 @@
+//
+// Unit tests for the proof-of-stake kernel
+//
+#include <map>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "kernel.h"
+#include "util.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(kernel_tests)
+
+// Synthetic chain of block indexes; the hashes are owned by vHash so that
+// phashBlock stays valid
+struct CTestChain
+{
+    vector<CBlockIndex*> vIndex;
+    vector<uint256*> vHash;
+
+    ~CTestChain()
+    {
+        // The modifier computation may still point into this chain
+        ResetStakeModifierCandidates();
+        BOOST_FOREACH(CBlockIndex* pindex, vIndex)
+            delete pindex;
+        BOOST_FOREACH(uint256* phash, vHash)
+            delete phash;
+    }
+
+    CBlockIndex* Add(CBlockIndex* pindexPrev, unsigned int nTime, uint64& nRand)
+    {
+        nRand = nRand * 6364136223846793005ULL + 1442695040888963407ULL;
+        CBlockIndex* pindex = new CBlockIndex();
+        uint256* phash = new uint256();
+        for (int i = 0; i < 4; i++)
+        {
+            nRand = nRand * 6364136223846793005ULL + 1442695040888963407ULL;
+            *phash <<= 64;
+            *phash |= nRand;
+        }
+        pindex->phashBlock = phash;
+        pindex->pprev = pindexPrev;
+        pindex->nHeight = pindexPrev ? pindexPrev->nHeight + 1 : 0;
+        pindex->nTime = nTime;
+        if ((nRand >> 33) % 4 != 0)
+        {
+            pindex->SetProofOfStake();
+            pindex->hashProofOfStake = Hash(phash->begin(), phash->end());
+        }
+        pindex->SetStakeEntropyBit((nRand >> 40) & 1);
+        vIndex.push_back(pindex);
+        vHash.push_back(phash);
+        return pindex;
+    }
+};
+
+// Reference implementation of the modifier selection as originally written:
+// candidates sorted as (time, hash) pairs and rescanned and rehashed each round
+static uint64 ReferenceStakeModifier(const CBlockIndex* pindexPrev, uint64 nStakeModifierPrev, int64 nSelectionIntervalStart)
+{
+    map<uint256, const CBlockIndex*> mapIndex;
+    vector<pair<int64, uint256> > vSortedByTimestamp;
+    const CBlockIndex* pindex = pindexPrev;
+    while (pindex && pindex->GetBlockTime() >= nSelectionIntervalStart)
+    {
+        vSortedByTimestamp.push_back(make_pair(pindex->GetBlockTime(), pindex->GetBlockHash()));
+        mapIndex[pindex->GetBlockHash()] = pindex;
+        pindex = pindex->pprev;
+    }
+    sort(vSortedByTimestamp.begin(), vSortedByTimestamp.end());
+
+    uint64 nStakeModifierNew = 0;
+    int64 nSelectionIntervalStop = nSelectionIntervalStart;
+    map<uint256, const CBlockIndex*> mapSelectedBlocks;
+    for (int nRound=0; nRound<min(64, (int)vSortedByTimestamp.size()); nRound++)
+    {
+        nSelectionIntervalStop += nModifierInterval * 63 / (63 + ((63 - nRound) * (MODIFIER_INTERVAL_RATIO - 1)));
+        bool fSelected = false;
+        uint256 hashBest = 0;
+        const CBlockIndex* pindexSelected = NULL;
+        BOOST_FOREACH(const PAIRTYPE(int64, uint256)& item, vSortedByTimestamp)
+        {
+            pindex = mapIndex[item.second];
+            if (fSelected && pindex->GetBlockTime() > nSelectionIntervalStop)
+                break;
+            if (mapSelectedBlocks.count(pindex->GetBlockHash()) > 0)
+                continue;
+            uint256 hashProof = pindex->IsProofOfStake()? pindex->hashProofOfStake : pindex->GetBlockHash();
+            CDataStream ss(SER_GETHASH, 0);
+            ss << hashProof << nStakeModifierPrev;
+            uint256 hashSelection = Hash(ss.begin(), ss.end());
+            if (pindex->IsProofOfStake())
+                hashSelection >>= 32;
+            if (!fSelected || hashSelection < hashBest)
+            {
+                fSelected = true;
+                hashBest = hashSelection;
+                pindexSelected = pindex;
+            }
+        }
+        nStakeModifierNew |= (((uint64)pindexSelected->GetStakeEntropyBit()) << nRound);
+        mapSelectedBlocks.insert(make_pair(pindexSelected->GetBlockHash(), pindexSelected));
+    }
+    return nStakeModifierNew;
+}
+
+// Compute the modifier of pindex and compare a newly generated one against
+// the reference implementation
+static void CheckNextStakeModifier(CBlockIndex* pindex, int64 nSelectionInterval)
+{
+    uint64 nStakeModifier = 0;
+    bool fGenerated = false;
+    BOOST_REQUIRE(ComputeNextStakeModifier(pindex, nStakeModifier, fGenerated));
+    if (fGenerated && pindex->pprev)
+    {
+        const CBlockIndex* pindexLast = pindex->pprev;
+        while (pindexLast->pprev && !pindexLast->GeneratedStakeModifier())
+            pindexLast = pindexLast->pprev;
+        int64 nStart = (pindex->pprev->GetBlockTime() / nModifierInterval) * nModifierInterval - nSelectionInterval;
+        BOOST_CHECK_EQUAL(nStakeModifier, ReferenceStakeModifier(pindex->pprev, pindexLast->nStakeModifier, nStart));
+    }
+    pindex->SetStakeModifier(nStakeModifier, fGenerated);
+}
+
+BOOST_AUTO_TEST_CASE(stake_modifier_selection)
+{
+    unsigned int nModifierIntervalSave = nModifierInterval;
+    nModifierInterval = 20 * 60;
+    int64 nSelectionInterval = 0;
+    for (int nSection=0; nSection<64; nSection++)
+        nSelectionInterval += nModifierInterval * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1)));
+
+    CTestChain chain;
+    uint64 nRand = 42;
+    unsigned int nTime = 1400000000;
+    CBlockIndex* pindexGenesis = chain.Add(NULL, nTime, nRand);
+    CheckNextStakeModifier(pindexGenesis, nSelectionInterval);
+
+    // main chain with timestamps that occasionally step backwards
+    CBlockIndex* pindex = pindexGenesis;
+    vector<CBlockIndex*> vMain;
+    for (int i = 0; i < 3000; i++)
+    {
+        nRand = nRand * 6364136223846793005ULL + 1442695040888963407ULL;
+        nTime = nTime + 60 + (nRand >> 33) % 180 - ((nRand >> 50) % 8 == 0 ? 300 : 0);
+        pindex = chain.Add(pindex, nTime, nRand);
+        CheckNextStakeModifier(pindex, nSelectionInterval);
+        vMain.push_back(pindex);
+    }
+
+    // a fork from the middle of the chain, then back to the main chain
+    pindex = vMain[1500];
+    nTime = pindex->nTime;
+    for (int i = 0; i < 500; i++)
+    {
+        nTime += 90;
+        pindex = chain.Add(pindex, nTime, nRand);
+        CheckNextStakeModifier(pindex, nSelectionInterval);
+    }
+    pindex = vMain.back();
+    nTime = pindex->nTime;
+    for (int i = 0; i < 500; i++)
+    {
+        nTime += 45;
+        pindex = chain.Add(pindex, nTime, nRand);
+        CheckNextStakeModifier(pindex, nSelectionInterval);
+    }
+
+    nModifierInterval = nModifierIntervalSave;
+}
+
+// Block whose modifier applies to kernels from pindexFrom, found by walking
+// the main chain the way GetKernelStakeModifier() does without its cache;
+// NULL if the chain does not reach far enough yet
+static const CBlockIndex* ReferenceKernelModifierBlock(const CBlockIndex* pindexFrom, int64 nSelectionInterval)
+{
+    const CBlockIndex* pindex = pindexFrom;
+    int64 nStakeModifierTime = pindexFrom->GetBlockTime();
+    while (nStakeModifierTime < pindexFrom->GetBlockTime() + nSelectionInterval)
+    {
+        if (!pindex->pnext)
+            return NULL;
+        pindex = pindex->pnext;
+        if (pindex->GeneratedStakeModifier())
+            nStakeModifierTime = pindex->GetBlockTime();
+    }
+    return pindex;
+}
+
+// Attach pindex to the end of the main chain as SetBestChain() does
+static void ConnectTestBlock(CBlockIndex* pindex)
+{
+    mapBlockIndex[pindex->GetBlockHash()] = pindex;
+    if (pindex->pprev)
+        pindex->pprev->pnext = pindex;
+    pindexBest = pindex;
+    ConnectKernelStakeModifier(pindex);
+}
+
+// Look up the kernel stake modifier of each block twice, the second time
+// from the cache, and compare both against the uncached walk
+static void CheckKernelStakeModifiers(const vector<CBlockIndex*>& vChain, int64 nSelectionInterval)
+{
+    BOOST_FOREACH(CBlockIndex* pindex, vChain)
+    {
+        const CBlockIndex* pindexRef = ReferenceKernelModifierBlock(pindex, nSelectionInterval);
+        for (int nPass = 0; nPass < 2; nPass++)
+        {
+            uint64 nStakeModifier = 0;
+            int nStakeModifierHeight = 0;
+            int64 nStakeModifierTime = 0;
+            bool fFound = GetKernelStakeModifier(pindex->GetBlockHash(), nStakeModifier, nStakeModifierHeight, nStakeModifierTime, false);
+            BOOST_CHECK_EQUAL(fFound, pindexRef != NULL);
+            if (!fFound || !pindexRef)
+                continue;
+            BOOST_CHECK_EQUAL(nStakeModifier, pindexRef->nStakeModifier);
+            BOOST_CHECK_EQUAL(nStakeModifierHeight, pindexRef->nHeight);
+            BOOST_CHECK_EQUAL(nStakeModifierTime, pindexRef->GetBlockTime());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(kernel_stake_modifier_cache)
+{
+    unsigned int nModifierIntervalSave = nModifierInterval;
+    CBlockIndex* pindexBestSave = pindexBest;
+    nModifierInterval = 20 * 60;
+    int64 nSelectionInterval = 0;
+    for (int nSection=0; nSection<64; nSection++)
+        nSelectionInterval += nModifierInterval * 63 / (63 + ((63 - nSection) * (MODIFIER_INTERVAL_RATIO - 1)));
+
+    CTestChain chain;
+    uint64 nRand = 7;
+    unsigned int nTime = 1400000000;
+    CBlockIndex* pindex = chain.Add(NULL, nTime, nRand);
+    CheckNextStakeModifier(pindex, nSelectionInterval);
+    ConnectTestBlock(pindex);
+    vector<CBlockIndex*> vMain(1, pindex);
+    for (int i = 0; i < 1500; i++)
+    {
+        nRand = nRand * 6364136223846793005ULL + 1442695040888963407ULL;
+        nTime = nTime + 60 + (nRand >> 33) % 180;
+        pindex = chain.Add(pindex, nTime, nRand);
+        CheckNextStakeModifier(pindex, nSelectionInterval);
+        ConnectTestBlock(pindex);
+        vMain.push_back(pindex);
+    }
+    CheckKernelStakeModifiers(vMain, nSelectionInterval);
+
+    // reorganize onto a fork with a different block spacing; the cached
+    // modifiers that pointed into the disconnected branch must not be used
+    const int nFork = 1000;
+    int nStale = 0;
+    for (int i = 0; i <= nFork; i++)
+        if (vMain[i]->pindexKernelModifier && vMain[i]->pindexKernelModifier->nHeight > nFork)
+            nStale++;
+    BOOST_CHECK(nStale > 0);
+    for (int i = vMain.size() - 1; i > nFork; i--)
+    {
+        vMain[i]->pprev->pnext = NULL;
+        DisconnectKernelStakeModifier(vMain[i]);
+        mapBlockIndex.erase(vMain[i]->GetBlockHash());
+    }
+    vMain.resize(nFork + 1);
+    pindexBest = vMain.back();
+    pindex = vMain.back();
+    nTime = pindex->nTime;
+    for (int i = 0; i < 600; i++)
+    {
+        nTime += 97;
+        pindex = chain.Add(pindex, nTime, nRand);
+        CheckNextStakeModifier(pindex, nSelectionInterval);
+        ConnectTestBlock(pindex);
+        vMain.push_back(pindex);
+    }
+    CheckKernelStakeModifiers(vMain, nSelectionInterval);
+
+    BOOST_FOREACH(CBlockIndex* pindexMain, vMain)
+    {
+        DisconnectKernelStakeModifier(pindexMain);
+        mapBlockIndex.erase(pindexMain->GetBlockHash());
+    }
+    pindexBest = pindexBestSave;
+    nModifierInterval = nModifierIntervalSave;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,75 @@
+//
+// Unit tests for the key stores
+//
+#include <boost/test/unit_test.hpp>
+
+#include "keystore.h"
+#include "script.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(keystore_tests)
+
+// Exposes the protected encryption calls of CCryptoKeyStore
+class CTestCryptoKeyStore : public CCryptoKeyStore
+{
+public:
+    bool EncryptKeys(CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::EncryptKeys(vMasterKeyIn); }
+    bool Unlock(const CKeyingMaterial& vMasterKeyIn) { return CCryptoKeyStore::Unlock(vMasterKeyIn); }
+};
+
+BOOST_AUTO_TEST_CASE(keystore_encrypt)
+{
+    CTestCryptoKeyStore keystore;
+    CKey key1, key2;
+    key1.MakeNewKey(true);
+    key2.MakeNewKey(false);
+    CBitcoinAddress address1(key1.GetPubKey());
+    CBitcoinAddress address2(key2.GetPubKey());
+
+    BOOST_CHECK(keystore.AddKey(key1));
+    BOOST_CHECK(keystore.HaveKey(address1));
+    BOOST_CHECK(!keystore.IsLocked());
+
+    // A failed encryption leaves the keys in the clear
+    CKeyingMaterial vMasterKeyBad(16, 0x42);
+    BOOST_CHECK(!keystore.EncryptKeys(vMasterKeyBad));
+    BOOST_CHECK(!keystore.IsCrypted());
+    CKey keyPlain;
+    BOOST_CHECK(keystore.GetKey(address1, keyPlain));
+
+    CKeyingMaterial vMasterKey(32, 0x42);
+    BOOST_CHECK(keystore.EncryptKeys(vMasterKey));
+    BOOST_CHECK(keystore.IsCrypted());
+    BOOST_CHECK(keystore.HaveKey(address1));
+
+    // Keys added while unlocked are encrypted
+    BOOST_CHECK(keystore.Unlock(vMasterKey));
+    BOOST_CHECK(keystore.AddKey(key2));
+    BOOST_CHECK(keystore.HaveKey(address2));
+
+    CKey keyOut;
+    BOOST_CHECK(keystore.GetKey(address1, keyOut));
+    BOOST_CHECK(keyOut.GetPubKey() == key1.GetPubKey());
+    vector<unsigned char> vchPubKey;
+    BOOST_CHECK(keystore.GetPubKey(address2, vchPubKey));
+    BOOST_CHECK(vchPubKey == key2.GetPubKey());
+
+    set<CBitcoinAddress> setAddress;
+    keystore.GetKeys(setAddress);
+    BOOST_CHECK_EQUAL(setAddress.size(), 2U);
+
+    // Nothing can be added or read while locked
+    BOOST_CHECK(keystore.Lock());
+    BOOST_CHECK(keystore.IsLocked());
+    CKey key3;
+    key3.MakeNewKey(true);
+    BOOST_CHECK(!keystore.AddKey(key3));
+    BOOST_CHECK(keystore.GetPubKey(address1, vchPubKey));
+
+    CKeyingMaterial vWrongKey(32, 0x43);
+    BOOST_CHECK(!keystore.Unlock(vWrongKey));
+    BOOST_CHECK(keystore.IsLocked());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
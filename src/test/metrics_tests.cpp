@@ -0,0 +1,56 @@
+//
+// Unit tests for the metrics registry
+//
+#include <boost/test/unit_test.hpp>
+
+#include "metrics.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(metrics_tests)
+
+BOOST_AUTO_TEST_CASE(metrics_histogram)
+{
+    CMetricHistogram histogram;
+    histogram.Observe(50);
+    histogram.Observe(100);
+    histogram.Observe(2000);
+    histogram.Observe(20000000);
+    BOOST_CHECK_EQUAL(histogram.GetCount(), 4);
+
+    string str;
+    histogram.Write(str, "test_seconds", "method=\"a\"");
+    BOOST_CHECK(str.find("test_seconds_bucket{method=\"a\",le=\"0.000100\"} 2\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_bucket{method=\"a\",le=\"0.001000\"} 2\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_bucket{method=\"a\",le=\"0.005000\"} 3\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_bucket{method=\"a\",le=\"10.000000\"} 3\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_bucket{method=\"a\",le=\"+Inf\"} 4\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_sum{method=\"a\"} 20.002150\n") != string::npos);
+    BOOST_CHECK(str.find("test_seconds_count{method=\"a\"} 4\n") != string::npos);
+}
+
+BOOST_AUTO_TEST_CASE(metrics_family)
+{
+    CMetricFamily<CMetricCounter> family("test_total", "counter", "Test counter", "command");
+    family.Get("inv").Inc();
+    family.Get("inv").Inc(2);
+    family.Get("a\"b").Inc();
+    BOOST_CHECK_EQUAL(family.Get("inv").Get(), 3);
+
+    string str;
+    family.Write(str);
+    BOOST_CHECK(str.find("# HELP test_total Test counter\n# TYPE test_total counter\n") == 0);
+    BOOST_CHECK(str.find("test_total{command=\"inv\"} 3\n") != string::npos);
+    BOOST_CHECK(str.find("test_total{command=\"a\\\"b\"} 1\n") != string::npos);
+
+    // Label values past the limit are counted together
+    for (int i = 0; i < 200; i++)
+        family.Get(strprintf("cmd%d", i)).Inc();
+    BOOST_CHECK(family.Get("cmd199").Get() > 1);
+    BOOST_CHECK_EQUAL(&family.Get("cmd199"), &family.Get("other"));
+
+    BOOST_CHECK(GetMetricsText().find("# TYPE pfn_rpc_seconds histogram\n") != string::npos);
+    BOOST_CHECK(GetMetricsText().find("# HELP test_total") != string::npos);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
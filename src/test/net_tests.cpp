@@ -0,0 +1,66 @@
+//
+// Unit tests for per-peer send queues
+//
+#include <boost/test/unit_test.hpp>
+
+#include "main.h"
+#include "net.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(net_tests)
+
+static int PriorityOf(const string& strCommand, const CDataStream& ss)
+{
+    return GetSendPriority(strCommand, ss.empty() ? NULL : &ss[0], ss.size());
+}
+
+BOOST_AUTO_TEST_CASE(send_priority)
+{
+    CDataStream ssEmpty(SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(PriorityOf("version", ssEmpty), (int)SEND_PRIORITY_NEW);
+    BOOST_CHECK_EQUAL(PriorityOf("ping", ssEmpty), (int)SEND_PRIORITY_NEW);
+    BOOST_CHECK_EQUAL(PriorityOf("block", ssEmpty), (int)SEND_PRIORITY_NEW);
+    BOOST_CHECK_EQUAL(PriorityOf("tx", ssEmpty), (int)SEND_PRIORITY_TX);
+    BOOST_CHECK_EQUAL(PriorityOf("addr", ssEmpty), (int)SEND_PRIORITY_TX);
+    BOOST_CHECK_EQUAL(PriorityOf("inv", ssEmpty), (int)SEND_PRIORITY_TX);
+
+    // An inv goes ahead of transactions if it announces any block,
+    // including past a multi-byte count
+    vector<CInv> vInv;
+    for (int i = 0; i < 300; i++)
+        vInv.push_back(CInv(MSG_TX, GetRandHash()));
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << vInv;
+    BOOST_CHECK_EQUAL(PriorityOf("inv", ssTx), (int)SEND_PRIORITY_TX);
+
+    vInv.push_back(CInv(MSG_BLOCK, GetRandHash()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << vInv;
+    BOOST_CHECK_EQUAL(PriorityOf("inv", ssBlock), (int)SEND_PRIORITY_NEW);
+
+    // A truncated inv is not read past its end
+    BOOST_CHECK_EQUAL(GetSendPriority("inv", &ssBlock[0], ssBlock.size() - 1), (int)SEND_PRIORITY_TX);
+}
+
+BOOST_AUTO_TEST_CASE(send_queue)
+{
+    // Finished messages are queued by class; a message being built is not
+    CNode node(INVALID_SOCKET, CAddress(CService("127.0.0.1", 0)), true);
+    BOOST_CHECK(node.SendQueueEmpty());
+    BOOST_CHECK_EQUAL(node.GetNextSendPriority(), -1);
+
+    node.PushMessageWithPriority(SEND_PRIORITY_HISTORICAL, "block", string("x"));
+    BOOST_CHECK(!node.SendQueueEmpty(SEND_PRIORITY_HISTORICAL));
+    BOOST_CHECK(node.SendQueueEmpty(SEND_PRIORITY_NEW));
+    BOOST_CHECK_EQUAL(node.GetNextSendPriority(), (int)SEND_PRIORITY_HISTORICAL);
+    node.PushMessage("tx", string("y"));
+    BOOST_CHECK_EQUAL(node.GetNextSendPriority(), (int)SEND_PRIORITY_TX);
+    node.PushMessage("ping");
+    BOOST_CHECK_EQUAL(node.GetNextSendPriority(), (int)SEND_PRIORITY_NEW);
+    BOOST_CHECK(!node.SendQueueEmpty());
+    BOOST_CHECK(node.vSend.empty());
+    BOOST_CHECK_EQUAL(node.nSendQueueSize, 3 * 24 + 2 + 2U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -4,6 +4,8 @@
 #include "base58.h"
 #include "util.h"
 #include "bitcoinrpc.h"
+#include "db.h"
+#include "main.h"
 
 using namespace std;
 using namespace json_spirit;
@@ -66,4 +68,179 @@ BOOST_FIXTURE_TEST_CASE(rpc_addmultisig, TestNetFixture)
     BOOST_CHECK_THROW(addmultisig(createArgs(2, short2.c_str()), false), runtime_error);
 }
 
+extern int ReadHTTP(std::basic_istream<char>& stream, map<string, string>& mapHeadersRet, string& strMessageRet, int& nProtoRet);
+
+// Read back a streamed reply as the RPC client does
+static Object ReadStreamedReply(const string& strReply)
+{
+    istringstream stream(strReply);
+    map<string, string> mapHeaders;
+    string strMessage;
+    int nProto = 0;
+    BOOST_CHECK_EQUAL(ReadHTTP(stream, mapHeaders, strMessage, nProto), 200);
+    BOOST_CHECK_EQUAL(nProto, 1);
+    BOOST_CHECK_EQUAL(mapHeaders["transfer-encoding"], "chunked");
+    Value valReply;
+    BOOST_CHECK(read_string(strMessage, valReply));
+    return valReply.get_obj();
+}
+
+BOOST_AUTO_TEST_CASE(rpc_httpversion)
+{
+    // Only HTTP/1.1 requests may get a chunked reply
+    map<string, string> mapHeaders;
+    string strMessage;
+    int nProto = -1;
+    istringstream stream10("POST / HTTP/1.0\r\nContent-Length: 2\r\n\r\n{}");
+    ReadHTTP(stream10, mapHeaders, strMessage, nProto);
+    BOOST_CHECK_EQUAL(nProto, 0);
+    BOOST_CHECK_EQUAL(strMessage, "{}");
+    istringstream stream11("POST / HTTP/1.1\r\nContent-Length: 2\r\n\r\n{}");
+    ReadHTTP(stream11, mapHeaders, strMessage, nProto);
+    BOOST_CHECK_EQUAL(nProto, 1);
+}
+
+BOOST_AUTO_TEST_CASE(rpc_streamwriter)
+{
+    // Collected result
+    CRPCStreamWriter writerCollect;
+    writerCollect.BeginObject();
+    writerCollect.Write("a", 1);
+    writerCollect.Write("b", "x");
+    writerCollect.Finish();
+    BOOST_CHECK_EQUAL(write_string(writerCollect.GetResult(), false), "{\"a\":1,\"b\":\"x\"}");
+
+    // Streamed result, large enough to take several chunks
+    ostringstream stream;
+    CRPCStreamWriter writer(stream, 7);
+    writer.BeginArray();
+    for (int i = 0; i < 20000; i++)
+        writer.Write(strprintf("element %d", i));
+    BOOST_CHECK(writer.IsStarted());
+    writer.Finish();
+    Object reply = ReadStreamedReply(stream.str());
+    const Array& result = find_value(reply, "result").get_array();
+    BOOST_CHECK_EQUAL(result.size(), 20000U);
+    BOOST_CHECK_EQUAL(result[19999].get_str(), "element 19999");
+    BOOST_CHECK(find_value(reply, "error").type() == null_type);
+    BOOST_CHECK_EQUAL(find_value(reply, "id").get_int(), 7);
+
+    // Error after the reply started
+    ostringstream streamError;
+    CRPCStreamWriter writerError(streamError, 8);
+    writerError.BeginArray();
+    writerError.Write(1);
+    Object error;
+    error.push_back(Pair("code", -1));
+    writerError.Finish(error);
+    reply = ReadStreamedReply(streamError.str());
+    BOOST_CHECK_EQUAL(find_value(find_value(reply, "error").get_obj(), "code").get_int(), -1);
+}
+
+// Raw bytes returned by getrawblock or getrawtransaction in either format
+static CDataStream DecodeRawData(const Value& value, const string& strFormat)
+{
+    string str = value.get_str();
+    vector<unsigned char> vch;
+    if (strFormat == "hex")
+        vch = ParseHex(str);
+    else
+        vch = DecodeBase64(str.c_str());
+    return CDataStream(vch, SER_NETWORK, PROTOCOL_VERSION);
+}
+
+static CTransaction MakeRawTestTransaction(int n)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), n);
+    tx.vin[0].scriptSig << n << vector<unsigned char>(70, n);
+    tx.vout.resize(2);
+    tx.vout[0].nValue = n * COIN;
+    tx.vout[0].scriptPubKey << OP_TRUE;
+    tx.vout[1].nValue = CENT;
+    tx.vout[1].scriptPubKey << vector<unsigned char>(33, 2) << OP_CHECKSIG;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(rpc_rawdata)
+{
+    rpcfn_type getrawblock = tableRPC["getrawblock"]->actor;
+    rpcfn_type getrawtransaction = tableRPC["getrawtransaction"]->actor;
+    rpcfn_type getrawmempool = tableRPC["getrawmempool"]->actor;
+    const char* pszFormats[] = { "hex", "base64" };
+
+    // A block written to the block file and indexed, as ConnectBlock does
+    CBlock block;
+    block.nVersion = 1;
+    block.nTime = 1400000000;
+    block.nBits = 0x1d00ffff;
+    for (int i = 1; i <= 3; i++)
+        block.vtx.push_back(MakeRawTestTransaction(i));
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    unsigned int nFile, nBlockPos;
+    BOOST_REQUIRE(block.WriteToDisk(nFile, nBlockPos));
+    uint256 hashBlock = block.GetHash();
+    CBlockIndex index;
+    index.phashBlock = &hashBlock;
+    index.nFile = nFile;
+    index.nBlockPos = nBlockPos;
+    mapBlockIndex[hashBlock] = &index;
+    {
+        CTxDB txdb("cr+");
+        unsigned int nTxPos = nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - (2 * GetSizeOfCompactSize(0)) + GetSizeOfCompactSize(block.vtx.size());
+        BOOST_FOREACH(const CTransaction& tx, block.vtx)
+        {
+            BOOST_CHECK(txdb.AddTxIndex(tx, CDiskTxPos(nFile, nBlockPos, nTxPos), 1));
+            nTxPos += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+        }
+    }
+
+    // A transaction in the memory pool only
+    CTransaction txPool = MakeRawTestTransaction(4);
+    mempool.addUnchecked(txPool);
+
+    for (int i = 0; i < 2; i++)
+    {
+        Array params;
+        params.push_back(hashBlock.GetHex());
+        params.push_back(pszFormats[i]);
+        CDataStream ssBlock = DecodeRawData(getrawblock(params, false), pszFormats[i]);
+        CBlock blockRead;
+        ssBlock >> blockRead;
+        BOOST_CHECK(ssBlock.empty());
+        BOOST_CHECK(blockRead.GetHash() == hashBlock);
+        BOOST_CHECK(blockRead.BuildMerkleTree() == block.hashMerkleRoot);
+
+        // every transaction of the block is cut out of it whole
+        vector<CTransaction> vtx = block.vtx;
+        vtx.push_back(txPool);
+        BOOST_FOREACH(const CTransaction& tx, vtx)
+        {
+            params[0] = tx.GetHash().GetHex();
+            CDataStream ssTx = DecodeRawData(getrawtransaction(params, false), pszFormats[i]);
+            CTransaction txRead;
+            ssTx >> txRead;
+            BOOST_CHECK(ssTx.empty());
+            BOOST_CHECK(txRead.GetHash() == tx.GetHash());
+        }
+    }
+
+    Array params;
+    Array mempoolIds = getrawmempool(params, false).get_array();
+    bool fFound = false;
+    BOOST_FOREACH(const Value& value, mempoolIds)
+        fFound |= (value.get_str() == txPool.GetHash().GetHex());
+    BOOST_CHECK(fFound);
+
+    params.push_back(GetRandHash().GetHex());
+    BOOST_CHECK_THROW(getrawblock(params, false), Object);
+    params.push_back("binary");
+    params[0] = hashBlock.GetHex();
+    BOOST_CHECK_THROW(getrawblock(params, false), Object);
+
+    mempool.remove(txPool);
+    mapBlockIndex.erase(hashBlock);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
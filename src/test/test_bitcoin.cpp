@@ -1,6 +1,9 @@
 #define BOOST_TEST_MODULE Bitcoin Test Suite
 #include <boost/test/unit_test.hpp>
 
+#include <boost/filesystem.hpp>
+
+#include "db.h"
 #include "main.h"
 #include "wallet.h"
 
@@ -8,8 +11,16 @@ CWallet* pwalletMain;
 
 extern bool fPrintToConsole;
 struct TestingSetup {
+    // Tests that open wallet or block databases do so in a fresh data
+    // directory, removed again at the end
+    boost::filesystem::path pathTemp;
+
     TestingSetup() {
         fPrintToConsole = true; // don't want to write to debug.log file
+        pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(pathTemp);
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
         pwalletMain = new CWallet();
         RegisterWallet(pwalletMain);
     }
@@ -17,6 +28,12 @@ struct TestingSetup {
     {
         delete pwalletMain;
         pwalletMain = NULL;
+        // tests may have reset mapArgs; the environment is removed from
+        // the data directory as well
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        DBFlush(true);
+        boost::filesystem::remove_all(pathTemp);
     }
 };
 
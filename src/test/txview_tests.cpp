@@ -0,0 +1,292 @@
+//
+// Unit tests for the transaction and block views
+//
+#include <algorithm>
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include "txview.h"
+
+using namespace std;
+
+BOOST_AUTO_TEST_SUITE(txview_tests)
+
+static CTransaction MakeTransaction(int n)
+{
+    CTransaction tx;
+    tx.nTime = 1400000000 + n;
+    tx.vin.resize(1 + n % 3);
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        tx.vin[i].prevout.hash = Hash(BEGIN(n), END(n));
+        tx.vin[i].prevout.n = i;
+        tx.vin[i].scriptSig << vector<unsigned char>(65 + i, n) << OP_CHECKSIG;
+    }
+    tx.vout.resize(2);
+    tx.vout[0].nValue = n * COIN;
+    tx.vout[0].scriptPubKey << OP_DUP << OP_HASH160 << vector<unsigned char>(20, n) << OP_EQUALVERIFY << OP_CHECKSIG;
+    tx.vout[1].nValue = 42;
+    tx.nLockTime = n;
+    return tx;
+}
+
+BOOST_AUTO_TEST_CASE(txview_transaction)
+{
+    CTransaction tx = MakeTransaction(7);
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tx << string("trailing");
+
+    CTransactionView txView;
+    BOOST_CHECK(txView.SetData(ss));
+    BOOST_CHECK(txView.IsCanonical());
+    BOOST_CHECK(txView.GetHash() == tx.GetHash());
+    BOOST_CHECK_EQUAL(txView.GetSerializeSize(), ::GetSerializeSize(tx, SER_NETWORK, PROTOCOL_VERSION));
+
+    // The fields are those of the transaction, with the scripts left in place
+    BOOST_CHECK_EQUAL(txView.nTime, tx.nTime);
+    BOOST_CHECK_EQUAL(txView.nLockTime, tx.nLockTime);
+    BOOST_CHECK_EQUAL(txView.vin.size(), tx.vin.size());
+    for (unsigned int i = 0; i < tx.vin.size(); i++)
+    {
+        BOOST_CHECK(txView.vin[i].prevout == tx.vin[i].prevout);
+        BOOST_CHECK(txView.vin[i].scriptSig.ToScript() == tx.vin[i].scriptSig);
+        BOOST_CHECK_EQUAL(txView.vin[i].nSequence, tx.vin[i].nSequence);
+    }
+    BOOST_CHECK_EQUAL(txView.vout.size(), tx.vout.size());
+    for (unsigned int i = 0; i < tx.vout.size(); i++)
+    {
+        BOOST_CHECK_EQUAL(txView.vout[i].nValue, tx.vout[i].nValue);
+        BOOST_CHECK(txView.vout[i].scriptPubKey.ToScript() == tx.vout[i].scriptPubKey);
+    }
+    BOOST_CHECK_EQUAL(txView.GetValueOut(), tx.GetValueOut());
+    BOOST_CHECK_EQUAL(txView.GetMinFee(), tx.GetMinFee());
+    BOOST_CHECK_EQUAL(txView.GetLegacySigOpCount(), tx.GetLegacySigOpCount());
+
+    // Truncated data is rejected at every length
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    for (unsigned int n = 0; n < ssTx.size(); n++)
+        BOOST_CHECK(!txView.SetData(&ssTx.begin()[0], &ssTx.begin()[0] + n));
+}
+
+BOOST_AUTO_TEST_CASE(txview_noncanonical_size)
+{
+    // The input count written as 0xfd plus two bytes instead of one byte
+    // parses as the same transaction, but the bytes hash differently
+    CTransaction tx = MakeTransaction(7);
+    CDataStream ssTx(SER_NETWORK, PROTOCOL_VERSION);
+    ssTx << tx;
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.write(&ssTx[0], 8);
+    ss << (unsigned char)253 << (unsigned short)tx.vin.size();
+    ss.write(&ssTx[9], ssTx.size() - 9);
+
+    CTransactionView txView;
+    BOOST_CHECK(txView.SetData(ss));
+    BOOST_CHECK(!txView.IsCanonical());
+    BOOST_CHECK(txView.GetHash() != tx.GetHash());
+    CTransaction tx2;
+    ss >> tx2;
+    BOOST_CHECK(tx2.GetHash() == tx.GetHash());
+
+    // which is how a caller given untrusted bytes would tell them apart
+    BOOST_CHECK(txView.GetSerializeSize() != ::GetSerializeSize(tx2, SER_NETWORK, PROTOCOL_VERSION));
+}
+
+BOOST_AUTO_TEST_CASE(txview_oversized_count)
+{
+    // A huge input count must fail without looping over it
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << 1 << (unsigned int)0;
+    WriteCompactSize(ss, 0x01000000);
+    ss << vector<char>(100);
+    CTransactionView txView;
+    BOOST_CHECK(!txView.SetData(ss));
+    BOOST_CHECK(txView.IsNull());
+}
+
+BOOST_AUTO_TEST_CASE(txview_block)
+{
+    // Transactions are found one after another inside a serialized block,
+    // as ReadTransactionBytes does
+    CBlock block;
+    block.nTime = 1400000000;
+    for (int n = 0; n < 11; n++)
+        block.vtx.push_back(MakeTransaction(n));
+    block.vchBlockSig = vector<unsigned char>(72, 0x30);
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    BOOST_CHECK(Hash(ss.begin(), ss.begin() + 80) == block.GetHash());
+
+    CByteReader reader(&ss.begin()[0], &ss.begin()[0] + ss.size(), SER_NETWORK, PROTOCOL_VERSION);
+    reader.Skip(80);
+    BOOST_CHECK_EQUAL(ReadCompactSize(reader), block.vtx.size());
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        CTransactionView txView;
+        txView.Read(reader);
+        BOOST_CHECK(txView.GetHash() == block.vtx[i].GetHash());
+    }
+    BOOST_CHECK_EQUAL(ReadCompactSize(reader), block.vchBlockSig.size());
+
+    CBlockView blockView;
+    BOOST_CHECK(blockView.SetData(ss));
+    BOOST_CHECK(blockView.IsCanonical());
+    BOOST_CHECK(blockView.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(blockView.GetSerializeSize(), ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    BOOST_CHECK_EQUAL(blockView.nTime, block.nTime);
+    BOOST_CHECK_EQUAL(blockView.vtx.size(), block.vtx.size());
+    BOOST_CHECK(blockView.BuildMerkleTree() == block.BuildMerkleTree());
+    BOOST_CHECK(blockView.vchBlockSig.ToVector() == block.vchBlockSig);
+
+    // The transaction count written as 0xfd plus two bytes
+    CDataStream ss2(SER_NETWORK, PROTOCOL_VERSION);
+    ss2.write(&ss[0], 80);
+    ss2 << (unsigned char)253 << (unsigned short)block.vtx.size();
+    ss2.write(&ss[81], ss.size() - 81);
+    BOOST_CHECK(blockView.SetData(ss2));
+    BOOST_CHECK(!blockView.IsCanonical());
+}
+
+BOOST_AUTO_TEST_CASE(txview_sigops)
+{
+    // Counted the same as in a CScript, including a truncated push
+    vector<CScript> vScript(4);
+    vScript[0] << OP_2 << vector<unsigned char>(33, 2) << vector<unsigned char>(33, 3) << OP_2 << OP_CHECKMULTISIG;
+    vScript[1] << OP_CHECKSIG << OP_CHECKSIGVERIFY << OP_CHECKMULTISIGVERIFY;
+    vScript[2] << OP_CHECKSIG << OP_PUSHDATA2;
+    vScript[2].push_back(0xff);
+    vScript[3] << OP_CHECKSIG << OP_PUSHDATA1 << OP_CHECKSIG << OP_CHECKSIG;
+    BOOST_FOREACH(const CScript& script, vScript)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss << script;
+        CByteReader reader(&ss.begin()[0], &ss.begin()[0] + ss.size(), SER_NETWORK, PROTOCOL_VERSION);
+        CScriptView scriptView;
+        scriptView.pbegin = (const unsigned char*)reader.Skip(ReadCompactSize(reader));
+        scriptView.pend = scriptView.pbegin + script.size();
+        BOOST_CHECK(scriptView.ToScript() == script);
+        BOOST_CHECK_EQUAL(scriptView.GetSigOpCount(false), script.GetSigOpCount(false));
+        BOOST_CHECK_EQUAL(scriptView.GetSigOpCount(true), script.GetSigOpCount(true));
+    }
+}
+
+// A proof-of-stake block that passes CheckBlock, signed with key
+static CBlock MakeStakeBlock(CKey& key)
+{
+    CBlock block;
+    block.nTime = GetAdjustedTime();
+    block.nBits = 0x1d00ffff;
+
+    CTransaction txCoinBase;
+    txCoinBase.nTime = block.nTime;
+    txCoinBase.vin.resize(1);
+    txCoinBase.vin[0].prevout.SetNull();
+    txCoinBase.vin[0].scriptSig << 1 << 2;
+    txCoinBase.vout.resize(1);
+    txCoinBase.vout[0].SetEmpty();
+    block.vtx.push_back(txCoinBase);
+
+    CTransaction txCoinStake;
+    txCoinStake.nTime = block.nTime;
+    txCoinStake.vin.resize(1);
+    txCoinStake.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txCoinStake.vout.resize(2);
+    txCoinStake.vout[0].SetEmpty();
+    txCoinStake.vout[1].nValue = 10 * COIN;
+    txCoinStake.vout[1].scriptPubKey << key.GetPubKey() << OP_CHECKSIG;
+    block.vtx.push_back(txCoinStake);
+
+    for (int n = 0; n < 3; n++)
+    {
+        CTransaction tx = MakeTransaction(n + 1);
+        tx.nTime = block.nTime;
+        tx.vout[1].nValue = COIN;
+        block.vtx.push_back(tx);
+    }
+    return block;
+}
+
+static void SignStakeBlock(CBlock& block, CKey& key)
+{
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    block.vchBlockSig.clear();
+    BOOST_CHECK(key.Sign(block.GetHash(), block.vchBlockSig));
+}
+
+// CBlockView::CheckBlock must decide as CBlock::CheckBlock does
+static void CheckBlockSame(const CBlock& block, bool fExpected)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlockView blockView;
+    BOOST_CHECK(blockView.SetData(ss));
+    bool fBlock = block.CheckBlock();
+    BOOST_CHECK_EQUAL(fBlock, fExpected);
+    BOOST_CHECK_EQUAL(blockView.CheckBlock(), fBlock);
+    BOOST_CHECK_EQUAL(blockView.nDoS, block.nDoS);
+}
+
+BOOST_AUTO_TEST_CASE(txview_checkblock)
+{
+    CKey key;
+    key.MakeNewKey(false);
+
+    CBlock block = MakeStakeBlock(key);
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, true);
+
+    // Bad signature
+    block = MakeStakeBlock(key);
+    SignStakeBlock(block, key);
+    block.vchBlockSig[block.vchBlockSig.size() - 2] ^= 1;
+    CheckBlockSame(block, false);
+
+    // Merkle root of other transactions
+    block = MakeStakeBlock(key);
+    SignStakeBlock(block, key);
+    block.vtx[2].nLockTime++;
+    CheckBlockSame(block, false);
+
+    // Duplicate transaction
+    block = MakeStakeBlock(key);
+    block.vtx.push_back(block.vtx[2]);
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+
+    // Coinbase not first
+    block = MakeStakeBlock(key);
+    swap(block.vtx[0], block.vtx[2]);
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+
+    // Output below the minimum
+    block = MakeStakeBlock(key);
+    block.vtx[3].vout[1].nValue = MIN_TXOUT_AMOUNT - 1;
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+
+    // Transaction later than the block
+    block = MakeStakeBlock(key);
+    block.vtx[4].nTime = block.nTime + 1;
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+
+    // Too many sigops
+    block = MakeStakeBlock(key);
+    for (unsigned int i = 0; i < MAX_BLOCK_SIGOPS / 20 + 1; i++)
+        block.vtx[2].vout[0].scriptPubKey << OP_CHECKMULTISIG;
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+
+    // Coinstake out of place
+    block = MakeStakeBlock(key);
+    block.vtx.push_back(block.vtx[1]);
+    block.vtx.back().vin[0].prevout.n = 1;
+    SignStakeBlock(block, key);
+    CheckBlockSame(block, false);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -1,6 +1,7 @@
 #include <vector>
 #include <boost/test/unit_test.hpp>
 #include <boost/foreach.hpp>
+#include <boost/filesystem/fstream.hpp>
 
 #include "main.h"
 #include "wallet.h"
@@ -30,6 +31,61 @@ BOOST_AUTO_TEST_CASE(util_criticalsection)
     } while(0);
 }
 
+static void LockTwice(CCriticalSection* pcs)
+{
+    for (int i = 0; i < 2; i++)
+    {
+        LOCK(*pcs);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(util_lockprofile)
+{
+    CCriticalSection cs;
+    vector<CLockStats> vStats;
+    GetLockStats(vStats, true);
+
+    fLockProfile = true;
+    for (int i = 0; i < 3; i++)
+    {
+        LOCK(cs);
+        TRY_LOCK(cs, lockTry);
+        bool fLocked = lockTry;
+        BOOST_CHECK(fLocked);
+    }
+    fLockProfile = false;
+    {
+        LOCK(cs);
+    }
+
+    GetLockStats(vStats, true);
+    int nSites = 0;
+    BOOST_FOREACH(const CLockStats& stats, vStats)
+    {
+        if (stats.strName != "cs")
+            continue;
+        nSites++;
+        BOOST_CHECK_EQUAL(stats.nCount, 3);
+        BOOST_CHECK_EQUAL(stats.nContended, 0);
+    }
+    BOOST_CHECK_EQUAL(nSites, 2);
+
+    GetLockStats(vStats);
+    BOOST_CHECK(vStats.empty());
+
+    // Counts of a thread that has exited are kept
+    fLockProfile = true;
+    boost::thread t(LockTwice, &cs);
+    t.join();
+    fLockProfile = false;
+    GetLockStats(vStats, true);
+    int64 nCount = 0;
+    BOOST_FOREACH(const CLockStats& stats, vStats)
+        if (stats.strName == "*pcs")
+            nCount += stats.nCount;
+    BOOST_CHECK_EQUAL(nCount, 2);
+}
+
 BOOST_AUTO_TEST_CASE(util_MedianFilter)
 {    
     CMedianFilter<int> filter(5, 15);
@@ -110,6 +166,23 @@ BOOST_AUTO_TEST_CASE(util_DateTimeStrFormat)
     BOOST_CHECK_EQUAL(DateTimeStrFormat("%x %H:%M", 1317425777), "09/30/11 23:36");
 }
 
+BOOST_AUTO_TEST_CASE(util_AdvanceTime)
+{
+    // Without mock time the clock moves forward and keeps running
+    int64 nNow = time(NULL);
+    AdvanceTime(3600);
+    BOOST_CHECK(GetTime() >= nNow + 3600);
+    BOOST_CHECK(GetTime() <= time(NULL) + 3600);
+    AdvanceTime(-3600);
+    BOOST_CHECK(GetTime() <= time(NULL));
+
+    // With mock time the mock time moves
+    SetMockTime(1000);
+    AdvanceTime(60);
+    BOOST_CHECK_EQUAL(GetTime(), 1060);
+    SetMockTime(0);
+}
+
 BOOST_AUTO_TEST_CASE(util_ParseParameters)
 {
     const char *argv_test[] = {"-ignored", "-a", "-b", "-ccc=argument", "-ccc=multiple", "f", "-d=e"};
@@ -259,4 +332,245 @@ BOOST_AUTO_TEST_CASE(util_IsHex)
     BOOST_CHECK(!IsHex("0x0000"));
 }
 
+BOOST_AUTO_TEST_CASE(util_StreamBufferPool)
+{
+    // Released buffers are reused by the same thread
+    stream_allocator<char> alloc;
+    char* p1 = alloc.allocate(100);
+    alloc.deallocate(p1, 100);
+    char* p2 = alloc.allocate(120);
+    BOOST_CHECK(p1 == p2);
+    alloc.deallocate(p2, 120);
+
+    // Secure buffers are cleared before going back to the pool
+    stream_allocator<char> allocSecure(true);
+    char* p3 = allocSecure.allocate(1000);
+    memset(p3, 0xAA, 1000);
+    allocSecure.deallocate(p3, 1000);
+    char* p4 = alloc.allocate(1000);
+    BOOST_CHECK(p3 == p4);
+    BOOST_CHECK(p4[0] == 0 && p4[999] == 0);
+    alloc.deallocate(p4, 1000);
+
+    // Copies of a secure stream stay secure
+    CDataStream ss(SER_DISK, CLIENT_VERSION, true);
+    ss << string("secret");
+    CDataStream ssCopy = ss;
+    BOOST_CHECK(ssCopy.get_allocator().fSecure);
+    BOOST_CHECK(!CDataStream(SER_DISK, CLIENT_VERSION).get_allocator().fSecure);
+    BOOST_CHECK(ssCopy.str() == ss.str());
+
+    // So do assignments, and a swap exchanges the flags with the buffers
+    CDataStream ssAssign(SER_DISK, CLIENT_VERSION);
+    ssAssign << string("public");
+    ssAssign = ss;
+    BOOST_CHECK(ssAssign.get_allocator().fSecure);
+    BOOST_CHECK(ssAssign.str() == ss.str());
+    CDataStream ssPlain(SER_DISK, CLIENT_VERSION);
+    ssPlain << string("public");
+    std::vector<char, stream_allocator<char> > vSecure(ss.begin(), ss.end(), stream_allocator<char>(true));
+    std::vector<char, stream_allocator<char> > vPlain(ssPlain.begin(), ssPlain.end());
+    vSecure.swap(vPlain);
+    BOOST_CHECK(vPlain.get_allocator().fSecure && !vSecure.get_allocator().fSecure);
+    BOOST_CHECK(string(vPlain.begin(), vPlain.end()) == ss.str());
+    BOOST_CHECK(stream_allocator<char>(true) != stream_allocator<int>(false));
+    BOOST_CHECK(stream_allocator<char>(true) == stream_allocator<int>(true));
+}
+
+BOOST_AUTO_TEST_CASE(util_InitLogLevels)
+{
+    const char *argv_test[] = {"-ignored", "-printcoinstake", "-loglevel=fee:info", "-loglevel=priority"};
+    ParseParameters(4, argv_test);
+    fDebug = false;
+    InitLogLevels();
+    BOOST_CHECK(!LogAccept(LOG_COINSTAKE));
+    BOOST_CHECK(LogAccept(LOG_FEE, LOGLEVEL_INFO));
+    BOOST_CHECK(!LogAccept(LOG_FEE));
+    BOOST_CHECK(LogAccept(LOG_PRIORITY));
+    BOOST_CHECK(!LogAccept(LOG_KEYPOOL, LOGLEVEL_INFO));
+
+    fDebug = true;
+    InitLogLevels();
+    BOOST_CHECK(LogAccept(LOG_COINSTAKE));
+    fDebug = false;
+
+    const char *argv_all[] = {"-ignored", "-loglevel=all:none"};
+    ParseParameters(2, argv_all);
+    InitLogLevels();
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        BOOST_CHECK(!LogAccept((LogCategory)i, LOGLEVEL_INFO));
+}
+
+static void LogWriterTestThread(int n)
+{
+    for (int i = 0; i < 200; i++)
+        printf("thread %d line %d %s\n", n, i, string(i * 10, 'a' + n).c_str());
+}
+
+// Log to debug.log in a fresh data directory, and back to the console with
+// the previous settings afterwards
+class CLogWriterTestDir
+{
+public:
+    boost::filesystem::path pathTemp;
+    map<string, string> mapArgsSave;
+
+    CLogWriterTestDir()
+    {
+        pathTemp = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path();
+        boost::filesystem::create_directories(pathTemp);
+        mapArgsSave = mapArgs;
+        mapArgs["-datadir"] = pathTemp.string();
+        ClearDatadirCache();
+        fPrintToConsole = false;
+    }
+
+    ~CLogWriterTestDir()
+    {
+        StopLogWriter();
+        fPrintToConsole = true;
+        CloseDebugLog();
+        mapArgs = mapArgsSave;
+        ClearDatadirCache();
+        boost::filesystem::remove_all(pathTemp);
+    }
+};
+
+BOOST_AUTO_TEST_CASE(util_LogWriter)
+{
+    CLogWriterTestDir testdir;
+    boost::filesystem::path pathTemp = testdir.pathTemp;
+
+    StartLogWriter();
+    boost::thread_group threads;
+    for (int n = 0; n < 4; n++)
+        threads.create_thread(boost::bind(&LogWriterTestThread, n));
+    threads.join_all();
+    for (int i = 0; i < 100; i++)
+        printf("repeated line\n");
+    printf("last line\n");
+    StopLogWriter();
+    fPrintToConsole = true;
+
+    // every line arrives whole, and the repeats are collapsed
+    boost::filesystem::ifstream file(pathTemp / "debug.log");
+    string strLine;
+    map<int, int> mapNext;
+    int nRepeatedLines = 0;
+    vector<string> vTail;
+    while (getline(file, strLine))
+    {
+        int n, i;
+        if (sscanf(strLine.c_str(), "thread %d line %d", &n, &i) == 2)
+        {
+            BOOST_CHECK_EQUAL(i, mapNext[n]++);
+            BOOST_CHECK(strLine.size() >= (unsigned int)i * 10 && strLine.substr(strLine.size() - i * 10) == string(i * 10, 'a' + n));
+        }
+        if (strLine == "repeated line")
+            nRepeatedLines++;
+        vTail.push_back(strLine);
+    }
+    for (int n = 0; n < 4; n++)
+        BOOST_CHECK_EQUAL(mapNext[n], 200);
+    BOOST_CHECK_EQUAL(nRepeatedLines, 1);
+    BOOST_REQUIRE(vTail.size() >= 2);
+    BOOST_CHECK_EQUAL(vTail[vTail.size() - 2], "last message repeated 99 times");
+    BOOST_CHECK_EQUAL(vTail.back(), "last line");
+}
+
+BOOST_AUTO_TEST_CASE(util_LogWriterTruncated)
+{
+    CLogWriterTestDir testdir;
+
+    // A message too long for the ring is cut short with a marker
+    StartLogWriter();
+    printf("%s\n", string(300000, 'x').c_str());
+    printf("after\n");
+    StopLogWriter();
+    fPrintToConsole = true;
+
+    boost::filesystem::ifstream file(testdir.pathTemp / "debug.log");
+    string strLine;
+    vector<string> vLines;
+    while (getline(file, strLine))
+        vLines.push_back(strLine);
+    BOOST_REQUIRE(vLines.size() >= 2);
+    const string& strLong = vLines[vLines.size() - 2];
+    BOOST_CHECK(strLong.size() < 300000);
+    BOOST_CHECK(strLong.size() > 200000);
+    BOOST_CHECK(strLong.substr(strLong.size() - 15) == "... (truncated)");
+    BOOST_CHECK_EQUAL(vLines.back(), "after");
+}
+
+BOOST_AUTO_TEST_CASE(util_LogWriterStop)
+{
+    CLogWriterTestDir testdir;
+
+    // Lines logged while the writer stops are written out, in order
+    StartLogWriter();
+    boost::thread_group threads;
+    for (int n = 0; n < 4; n++)
+        threads.create_thread(boost::bind(&LogWriterTestThread, n));
+    StopLogWriter();
+    threads.join_all();
+    fPrintToConsole = true;
+
+    boost::filesystem::ifstream file(testdir.pathTemp / "debug.log");
+    string strLine;
+    map<int, int> mapNext;
+    while (getline(file, strLine))
+    {
+        int n, i;
+        if (sscanf(strLine.c_str(), "thread %d line %d", &n, &i) == 2)
+            BOOST_CHECK_EQUAL(i, mapNext[n]++);
+    }
+    for (int n = 0; n < 4; n++)
+        BOOST_CHECK_EQUAL(mapNext[n], 200);
+}
+
+BOOST_AUTO_TEST_CASE(util_FastRandom)
+{
+    // ChaCha20 keystream for the all-zero key and nonce
+    CFastRandom randZero(0);
+    BOOST_CHECK_EQUAL(randZero.Rand32(), 0xade0b876U);
+    BOOST_CHECK_EQUAL(randZero.Rand32(), 0x903df1a0U);
+    for (int i = 0; i < 14; i++)
+        randZero.Rand32();
+    BOOST_CHECK_EQUAL(randZero.Rand32(), 0xbee7079fU);
+
+    // The same seed gives the same stream, a different one does not
+    CFastRandom rand1(1), rand2(1), rand3(2);
+    BOOST_CHECK(rand1.RandHash() == rand2.RandHash());
+    BOOST_CHECK(rand1.RandHash() != rand3.RandHash());
+
+    BOOST_CHECK_EQUAL(GetFastRand(0), 0U);
+    BOOST_CHECK_EQUAL(GetFastRand(1), 0U);
+    set<int> setSeen;
+    for (int i = 0; i < 1000; i++)
+    {
+        int n = GetFastRandInt(10);
+        BOOST_CHECK(n >= 0 && n < 10);
+        setSeen.insert(n);
+    }
+    BOOST_CHECK_EQUAL(setSeen.size(), 10U);
+    BOOST_CHECK(GetFastRandHash() != GetFastRandHash());
+}
+
+BOOST_AUTO_TEST_CASE(util_SipHash)
+{
+    // Reference vectors for key 00 01 .. 0f and message 00 01 .. (n-1)
+    const uint64 k0 = 0x0706050403020100ULL, k1 = 0x0F0E0D0C0B0A0908ULL;
+    unsigned char pch[15];
+    for (int i = 0; i < 15; i++)
+        pch[i] = i;
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Finalize(), 0x726fdb47dd0e0e31ULL);
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Write(pch, 1).Finalize(), 0x74f839c593dc67fdULL);
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Write(pch, 8).Finalize(), 0x93f5f5799a932462ULL);
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Write(pch, 15).Finalize(), 0xa129ca6149be45e5ULL);
+
+    // Word and byte writes of the same input agree, however they are split
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Write(0x0706050403020100ULL).Finalize(), 0x93f5f5799a932462ULL);
+    BOOST_CHECK_EQUAL(CSipHasher(k0, k1).Write(pch, 3).Write(pch + 3, 12).Finalize(), 0xa129ca6149be45e5ULL);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
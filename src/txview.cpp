@@ -0,0 +1,172 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "txview.h"
+
+using namespace std;
+
+// Read a compact size, clearing fCanonical unless it was written in the
+// shortest form, the one WriteCompactSize uses
+static uint64 ReadSize(CByteReader& reader, bool& fCanonical)
+{
+    const char* p = reader.GetPos();
+    uint64 nSize = ReadCompactSize(reader);
+    if ((uint64)(reader.GetPos() - p) != GetSizeOfCompactSize(nSize))
+        fCanonical = false;
+    return nSize;
+}
+
+// Read the element count of a vector whose elements take at least nMinSize
+// bytes each, rejecting counts the remaining data can't hold
+static unsigned int ReadCount(CByteReader& reader, unsigned int nMinSize, bool& fCanonical)
+{
+    uint64 nCount = ReadSize(reader, fCanonical);
+    if (nCount > reader.GetRemaining() / nMinSize)
+        throw std::ios_base::failure("ReadCount() : count larger than data");
+    return nCount;
+}
+
+static void ReadScript(CByteReader& reader, CScriptView& script, bool& fCanonical)
+{
+    uint64 nSize = ReadSize(reader, fCanonical);
+    script.pbegin = (const unsigned char*)reader.Skip(nSize);
+    script.pend = script.pbegin + nSize;
+}
+
+void CTransactionView::SetNull()
+{
+    pbegin = pend = NULL;
+    hash = 0;
+    fCanonical = false;
+    nVersion = 1;
+    nTime = 0;
+    vin.clear();
+    vout.clear();
+    nLockTime = 0;
+    nDoS = 0;
+}
+
+void CTransactionView::Read(CByteReader& reader)
+{
+    pbegin = reader.GetPos();
+    fCanonical = true;
+    reader >> nVersion >> nTime;
+    vin.resize(ReadCount(reader, 41, fCanonical));
+    BOOST_FOREACH(CTxInView& txin, vin)
+    {
+        reader >> txin.prevout;
+        ReadScript(reader, txin.scriptSig, fCanonical);
+        reader >> txin.nSequence;
+    }
+    vout.resize(ReadCount(reader, 9, fCanonical));
+    BOOST_FOREACH(CTxOutView& txout, vout)
+    {
+        reader >> txout.nValue;
+        ReadScript(reader, txout.scriptPubKey, fCanonical);
+    }
+    reader >> nLockTime;
+    pend = reader.GetPos();
+    hash = Hash(pbegin, pend);
+}
+
+bool CTransactionView::SetData(const char* pbeginIn, const char* pendIn)
+{
+    try {
+        CByteReader reader(pbeginIn, pendIn, SER_NETWORK, PROTOCOL_VERSION);
+        Read(reader);
+    }
+    catch (std::exception &e) {
+        SetNull();
+        return false;
+    }
+    return true;
+}
+
+bool CTransactionView::SetData(const CDataStream& ss)
+{
+    if (ss.empty())
+        return false;
+    return SetData(&ss.begin()[0], &ss.begin()[0] + ss.size());
+}
+
+unsigned int CTransactionView::GetLegacySigOpCount() const
+{
+    unsigned int nSigOps = 0;
+    BOOST_FOREACH(const CTxInView& txin, vin)
+        nSigOps += txin.scriptSig.GetSigOpCount(false);
+    BOOST_FOREACH(const CTxOutView& txout, vout)
+        nSigOps += txout.scriptPubKey.GetSigOpCount(false);
+    return nSigOps;
+}
+
+int64 CTransactionView::GetMinFee(unsigned int nBlockSize, bool fAllowFree, enum GetMinFee_mode mode) const
+{
+    bool fDustOutput = false;
+    BOOST_FOREACH(const CTxOutView& txout, vout)
+        if (txout.nValue < CENT)
+            fDustOutput = true;
+    return CTransaction::GetMinFee(GetSerializeSize(), fDustOutput, nBlockSize, fAllowFree, mode);
+}
+
+void CBlockView::SetNull()
+{
+    pbegin = pend = NULL;
+    hash = 0;
+    fCanonical = false;
+    nVersion = 1;
+    hashPrevBlock = 0;
+    hashMerkleRoot = 0;
+    nTime = 0;
+    nBits = 0;
+    nNonce = 0;
+    vtx.clear();
+    vchBlockSig = CScriptView();
+    nDoS = 0;
+}
+
+void CBlockView::Read(CByteReader& reader)
+{
+    pbegin = reader.GetPos();
+    fCanonical = true;
+    reader >> nVersion >> hashPrevBlock >> hashMerkleRoot >> nTime >> nBits >> nNonce;
+    hash = Hash(pbegin, reader.GetPos());
+    vtx.resize(ReadCount(reader, 14, fCanonical));
+    BOOST_FOREACH(CTransactionView& tx, vtx)
+    {
+        tx.Read(reader);
+        if (!tx.IsCanonical())
+            fCanonical = false;
+    }
+    ReadScript(reader, vchBlockSig, fCanonical);
+    pend = reader.GetPos();
+}
+
+bool CBlockView::SetData(const char* pbeginIn, const char* pendIn)
+{
+    try {
+        CByteReader reader(pbeginIn, pendIn, SER_NETWORK, PROTOCOL_VERSION);
+        Read(reader);
+    }
+    catch (std::exception &e) {
+        SetNull();
+        return false;
+    }
+    return true;
+}
+
+bool CBlockView::SetData(const CDataStream& ss)
+{
+    if (ss.empty())
+        return false;
+    return SetData(&ss.begin()[0], &ss.begin()[0] + ss.size());
+}
+
+uint256 CBlockView::BuildMerkleTree() const
+{
+    vector<uint256> vMerkleTree;
+    vMerkleTree.reserve(vtx.size() * 2);
+    BOOST_FOREACH(const CTransactionView& tx, vtx)
+        vMerkleTree.push_back(tx.GetHash());
+    return CBlock::BuildMerkleTree(vMerkleTree);
+}
@@ -0,0 +1,254 @@
+// Copyright (c) 2012-2013 The PFN developers
+// Distributed under the MIT/X11 software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+#ifndef PPCOIN_TXVIEW_H
+#define PPCOIN_TXVIEW_H
+
+#include "main.h"
+
+//
+// Read-only views of serialized transactions and blocks.
+// A view references byte ranges inside a buffer owned by the caller, so
+// parsing it needs no per-script allocations; the view must not outlive
+// the buffer. Blocks and transactions from the network are hashed and
+// checked on views, and only built as CBlock/CTransaction once they are to
+// be kept.
+//
+// Hashes are of the bytes as given. They are the real ids only when every
+// size in the data is in its shortest encoding, as serializing the object
+// again would write it; IsCanonical() tells whether that is so.
+//
+
+// Minimal stream over a byte range, usable with ReadCompactSize/READDATA
+class CByteReader
+{
+private:
+    const char* pcur;
+    const char* pend;
+
+public:
+    int nType;
+    int nVersion;
+
+    CByteReader(const char* pbegin, const char* pendIn, int nTypeIn, int nVersionIn) : pcur(pbegin), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    const char* GetPos() const { return pcur; }
+    size_t GetRemaining() const { return pend - pcur; }
+
+    void read(char* pch, size_t nSize)
+    {
+        memcpy(pch, Skip(nSize), nSize);
+    }
+
+    template<typename T>
+    CByteReader& operator>>(T& obj)
+    {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return *this;
+    }
+
+    // Advance over nSize bytes and return where they start
+    const char* Skip(uint64 nSize)
+    {
+        if (nSize > (uint64)(pend - pcur))
+            throw std::ios_base::failure("CByteReader::Skip() : end of data");
+        const char* p = pcur;
+        pcur += nSize;
+        return p;
+    }
+};
+
+// A script, or any other length-prefixed byte string
+class CScriptView
+{
+public:
+    const unsigned char* pbegin;
+    const unsigned char* pend;
+
+    CScriptView() : pbegin(NULL), pend(NULL) {}
+
+    unsigned int size() const { return pend - pbegin; }
+    bool empty() const { return pbegin == pend; }
+
+    unsigned int GetSigOpCount(bool fAccurate) const
+    {
+        return CScript::GetSigOpCount(pbegin, pend, fAccurate);
+    }
+
+    CScript ToScript() const { return CScript(pbegin, pend); }
+    std::vector<unsigned char> ToVector() const { return std::vector<unsigned char>(pbegin, pend); }
+};
+
+class CTxInView
+{
+public:
+    COutPoint prevout;
+    CScriptView scriptSig;
+    unsigned int nSequence;
+};
+
+class CTxOutView
+{
+public:
+    int64 nValue;
+    CScriptView scriptPubKey;
+
+    bool IsEmpty() const
+    {
+        return (nValue == 0 && scriptPubKey.empty());
+    }
+};
+
+class CTransactionView
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    uint256 hash;
+    bool fCanonical;
+
+public:
+    int nVersion;
+    unsigned int nTime;
+    std::vector<CTxInView> vin;
+    std::vector<CTxOutView> vout;
+    unsigned int nLockTime;
+
+    // Denial-of-service detection, as for CTransaction
+    mutable int nDoS;
+    bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
+
+    CTransactionView()
+    {
+        SetNull();
+    }
+
+    void SetNull();
+    bool IsNull() const { return (pbegin == NULL); }
+
+    // Parse the transaction at the reader's position, throwing
+    // std::ios_base::failure on malformed data
+    void Read(CByteReader& reader);
+
+    // Parse the transaction at the start of a buffer; trailing data is
+    // ignored, as when unserializing a CTransaction
+    bool SetData(const char* pbeginIn, const char* pendIn);
+    bool SetData(const CDataStream& ss);
+
+    bool IsCanonical() const { return fCanonical; }
+
+    // Same as CTransaction::GetHash for canonical data, without serializing
+    // again
+    uint256 GetHash() const { return hash; }
+
+    // The size as given, whatever the serialization type
+    unsigned int GetSerializeSize(int nType=0, int nVersion=0) const
+    {
+        return pend - pbegin;
+    }
+
+    bool IsCoinBase() const
+    {
+        return (vin.size() == 1 && vin[0].prevout.IsNull() && vout.size() >= 1);
+    }
+
+    bool IsCoinStake() const
+    {
+        // PFN: the coin stake transaction is marked with the first output empty
+        return (vin.size() > 0 && (!vin[0].prevout.IsNull()) && vout.size() >= 2 && vout[0].IsEmpty());
+    }
+
+    unsigned int GetLegacySigOpCount() const;
+
+    int64 GetValueOut() const
+    {
+        int64 nValueOut = 0;
+        BOOST_FOREACH(const CTxOutView& txout, vout)
+        {
+            nValueOut += txout.nValue;
+            if (!MoneyRange(txout.nValue) || !MoneyRange(nValueOut))
+                throw std::runtime_error("CTransactionView::GetValueOut() : value out of range");
+        }
+        return nValueOut;
+    }
+
+    int64 GetMinFee(unsigned int nBlockSize=1, bool fAllowFree=false, enum GetMinFee_mode mode=GMF_BLOCK) const;
+
+    // CTransaction::CheckTransaction on the view; defined in main.cpp,
+    // where the checks are shared with CTransaction
+    bool CheckTransaction() const;
+};
+
+class CBlockView
+{
+private:
+    const char* pbegin;
+    const char* pend;
+    uint256 hash;
+    bool fCanonical;
+
+public:
+    // header
+    int nVersion;
+    uint256 hashPrevBlock;
+    uint256 hashMerkleRoot;
+    unsigned int nTime;
+    unsigned int nBits;
+    unsigned int nNonce;
+
+    std::vector<CTransactionView> vtx;
+
+    // PFN: block signature, a plain byte string
+    CScriptView vchBlockSig;
+
+    // Denial-of-service detection, as for CBlock
+    mutable int nDoS;
+    bool DoS(int nDoSIn, bool fIn) const { nDoS += nDoSIn; return fIn; }
+
+    CBlockView()
+    {
+        SetNull();
+    }
+
+    void SetNull();
+    bool IsNull() const { return (pbegin == NULL); }
+
+    void Read(CByteReader& reader);
+    bool SetData(const char* pbeginIn, const char* pendIn);
+    bool SetData(const CDataStream& ss);
+
+    bool IsCanonical() const { return fCanonical; }
+
+    // Same as CBlock::GetHash: the header fields are serialized as laid out
+    // in memory
+    uint256 GetHash() const { return hash; }
+
+    unsigned int GetSerializeSize(int nType=0, int nVersion=0) const
+    {
+        return pend - pbegin;
+    }
+
+    int64 GetBlockTime() const
+    {
+        return (int64)nTime;
+    }
+
+    bool IsProofOfStake() const
+    {
+        return (vtx.size() > 1 && vtx[1].IsCoinStake());
+    }
+
+    bool IsProofOfWork() const
+    {
+        return !IsProofOfStake();
+    }
+
+    uint256 BuildMerkleTree() const;
+
+    // CBlock::CheckBlock and CheckBlockSignature on the view; defined in
+    // main.cpp
+    bool CheckBlock() const;
+    bool CheckBlockSignature() const;
+};
+
+#endif
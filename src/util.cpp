@@ -24,8 +24,6 @@ namespace boost {
 #include <boost/program_options/parsers.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
-#include <boost/interprocess/sync/interprocess_mutex.hpp>
-#include <boost/interprocess/sync/interprocess_recursive_mutex.hpp>
 #include <boost/foreach.hpp>
 #include <boost/thread.hpp>
 #include <openssl/crypto.h>
@@ -73,12 +71,14 @@ bool fServer = false;
 bool fCommandLine = false;
 string strMiscWarning;
 bool fTestNet = false;
+bool fRegTest = false;
 bool fNoListen = false;
 bool fLogTimestamps = false;
+bool fLockProfile = false;
 CMedianFilter<int64> vTimeOffsets(200,0);
 
 // Init openssl library multithreading support
-static boost::interprocess::interprocess_mutex** ppmutexOpenSSL;
+static boost::mutex** ppmutexOpenSSL;
 void locking_callback(int mode, int i, const char* file, int line)
 {
     if (mode & CRYPTO_LOCK)
@@ -94,9 +94,9 @@ public:
     CInit()
     {
         // Init openssl library multithreading support
-        ppmutexOpenSSL = (boost::interprocess::interprocess_mutex**)OPENSSL_malloc(CRYPTO_num_locks() * sizeof(boost::interprocess::interprocess_mutex*));
+        ppmutexOpenSSL = (boost::mutex**)OPENSSL_malloc(CRYPTO_num_locks() * sizeof(boost::mutex*));
         for (int i = 0; i < CRYPTO_num_locks(); i++)
-            ppmutexOpenSSL[i] = new boost::interprocess::interprocess_mutex();
+            ppmutexOpenSSL[i] = new boost::mutex();
         CRYPTO_set_locking_callback(locking_callback);
 
 #ifdef WIN32
@@ -187,6 +187,176 @@ uint256 GetRandHash()
     return hash;
 }
 
+static inline unsigned int RotateLeft(unsigned int n, int nBits)
+{
+    return (n << nBits) | (n >> (32 - nBits));
+}
+
+#define CHACHA_QUARTERROUND(a, b, c, d) \
+    a += b; d = RotateLeft(d ^ a, 16);  \
+    c += d; b = RotateLeft(b ^ c, 12);  \
+    a += b; d = RotateLeft(d ^ a, 8);   \
+    c += d; b = RotateLeft(b ^ c, 7);
+
+CFastRandom::CFastRandom()
+{
+    uint256 seed;
+    RAND_bytes((unsigned char*)&seed, sizeof(seed));
+    *this = CFastRandom(seed);
+}
+
+// Key from the seed, then a 64-bit block counter and a zero nonce
+CFastRandom::CFastRandom(const uint256& seed)
+{
+    static const char* pszSigma = "expand 32-byte k";
+    memcpy(&input[0], pszSigma, 16);
+    memcpy(&input[4], &seed, 32);
+    memset(&input[12], 0, 16);
+    nOutputPos = 16;
+}
+
+void CFastRandom::Refill()
+{
+    unsigned int x[16];
+    memcpy(x, input, sizeof(x));
+    for (int i = 0; i < 10; i++)
+    {
+        CHACHA_QUARTERROUND(x[0], x[4], x[8],  x[12])
+        CHACHA_QUARTERROUND(x[1], x[5], x[9],  x[13])
+        CHACHA_QUARTERROUND(x[2], x[6], x[10], x[14])
+        CHACHA_QUARTERROUND(x[3], x[7], x[11], x[15])
+        CHACHA_QUARTERROUND(x[0], x[5], x[10], x[15])
+        CHACHA_QUARTERROUND(x[1], x[6], x[11], x[12])
+        CHACHA_QUARTERROUND(x[2], x[7], x[8],  x[13])
+        CHACHA_QUARTERROUND(x[3], x[4], x[9],  x[14])
+    }
+    for (int i = 0; i < 16; i++)
+        output[i] = x[i] + input[i];
+    if (++input[12] == 0)
+        ++input[13];
+    nOutputPos = 0;
+}
+
+uint64 CFastRandom::RandRange(uint64 nMax)
+{
+    if (nMax == 0)
+        return 0;
+
+    // Same rejection as GetRand, to keep every value equally likely
+    uint64 nRange = (std::numeric_limits<uint64>::max() / nMax) * nMax;
+    uint64 nRand;
+    do
+        nRand = Rand64();
+    while (nRand >= nRange);
+    return (nRand % nMax);
+}
+
+uint256 CFastRandom::RandHash()
+{
+    uint256 hash;
+    for (unsigned int* pn = (unsigned int*)hash.begin(); pn < (unsigned int*)hash.end(); pn++)
+        *pn = Rand32();
+    return hash;
+}
+
+#define SIPROUND do { \
+    v0 += v1; v1 = (v1 << 13) | (v1 >> 51); v1 ^= v0; v0 = (v0 << 32) | (v0 >> 32); \
+    v2 += v3; v3 = (v3 << 16) | (v3 >> 48); v3 ^= v2; \
+    v0 += v3; v3 = (v3 << 21) | (v3 >> 43); v3 ^= v0; \
+    v2 += v1; v1 = (v1 << 17) | (v1 >> 47); v1 ^= v2; v2 = (v2 << 32) | (v2 >> 32); \
+} while (0)
+
+CSipHasher::CSipHasher(uint64 k0, uint64 k1)
+{
+    v[0] = 0x736f6d6570736575ULL ^ k0;
+    v[1] = 0x646f72616e646f6dULL ^ k1;
+    v[2] = 0x6c7967656e657261ULL ^ k0;
+    v[3] = 0x7465646279746573ULL ^ k1;
+    tmp = 0;
+    nCount = 0;
+}
+
+// Eight bytes, little endian, at an eight byte boundary of the input
+CSipHasher& CSipHasher::Write(uint64 n)
+{
+    assert(nCount % 8 == 0);
+    uint64 v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    v3 ^= n;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= n;
+    v[0] = v0; v[1] = v1; v[2] = v2; v[3] = v3;
+    nCount += 8;
+    return *this;
+}
+
+CSipHasher& CSipHasher::Write(const unsigned char* pch, size_t nSize)
+{
+    uint64 v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    uint64 t = tmp;
+    int c = nCount;
+    while (nSize--)
+    {
+        t |= ((uint64)(*(pch++))) << (8 * (c % 8));
+        c++;
+        if ((c & 7) == 0)
+        {
+            v3 ^= t;
+            SIPROUND;
+            SIPROUND;
+            v0 ^= t;
+            t = 0;
+        }
+    }
+    v[0] = v0; v[1] = v1; v[2] = v2; v[3] = v3;
+    nCount = c;
+    tmp = t;
+    return *this;
+}
+
+uint64 CSipHasher::Finalize() const
+{
+    uint64 v0 = v[0], v1 = v[1], v2 = v[2], v3 = v[3];
+    uint64 t = tmp | (((uint64)nCount) << 56);
+    v3 ^= t;
+    SIPROUND;
+    SIPROUND;
+    v0 ^= t;
+    v2 ^= 0xFF;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    SIPROUND;
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static CFastRandom& GetFastRandom()
+{
+    // Never destroyed, like the stream buffer pools
+    static boost::thread_specific_ptr<CFastRandom>* ptsp = new boost::thread_specific_ptr<CFastRandom>();
+    CFastRandom* prand = ptsp->get();
+    if (prand == NULL)
+    {
+        prand = new CFastRandom();
+        ptsp->reset(prand);
+    }
+    return *prand;
+}
+
+uint64 GetFastRand(uint64 nMax)
+{
+    return GetFastRandom().RandRange(nMax);
+}
+
+int GetFastRandInt(int nMax)
+{
+    return GetFastRand(nMax);
+}
+
+uint256 GetFastRandHash()
+{
+    return GetFastRandom().RandHash();
+}
 
 
 
@@ -194,11 +364,352 @@ uint256 GetRandHash()
 
 
 
+
+int nLogLevels[LOG_CATEGORY_COUNT] = {};
+
+static const char* pszLogCategories[LOG_CATEGORY_COUNT] =
+{
+    "selectcoin",
+    "coinstake",
+    "fee",
+    "keypool",
+    "stakemodifier",
+    "creation",
+    "coinage",
+    "messagestart",
+    "priority",
+};
+
+// Parse the log levels once, so that checking them costs an array lookup
+// instead of a mapArgs search at every call site
+void InitLogLevels()
+{
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        nLogLevels[i] = (fDebug && GetBoolArg(string("-print") + pszLogCategories[i])) ? LOGLEVEL_DEBUG : LOGLEVEL_NONE;
+
+    BOOST_FOREACH(const string& strArg, mapMultiArgs["-loglevel"])
+    {
+        string strCategory = strArg;
+        int nLevel = LOGLEVEL_DEBUG;
+        size_t nColon = strArg.find(':');
+        if (nColon != string::npos)
+        {
+            strCategory = strArg.substr(0, nColon);
+            string strLevel = strArg.substr(nColon + 1);
+            if (strLevel == "none")
+                nLevel = LOGLEVEL_NONE;
+            else if (strLevel == "info")
+                nLevel = LOGLEVEL_INFO;
+            else if (strLevel == "debug")
+                nLevel = LOGLEVEL_DEBUG;
+            else
+                nLevel = atoi(strLevel);
+        }
+        bool fFound = false;
+        for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+        {
+            if (strCategory == pszLogCategories[i] || strCategory == "all")
+            {
+                nLogLevels[i] = nLevel;
+                fFound = true;
+            }
+        }
+        if (!fFound)
+            printf("InitLogLevels() : unknown log category %s\n", strCategory.c_str());
+    }
+}
+
 static FILE* fileout = NULL;
+static boost::mutex mutexDebugLog;
+
+static void OpenDebugLog()
+{
+    if (!fileout)
+    {
+        boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
+        fileout = fopen(pathDebug.string().c_str(), "a");
+        if (fileout) setbuf(fileout, NULL); // unbuffered until the writer thread starts
+    }
+}
+
+//
+// Asynchronous debug.log writer.
+// While it runs, printf formats into a bounded lock-free ring of fixed size
+// cells (Vyukov's bounded queue, with a single consumer) and returns; a
+// background thread drains the ring into the buffered file, adds the
+// timestamps and collapses repeated lines. A message longer than one cell
+// reserves consecutive cells with a single compare-and-swap, so messages
+// from different threads never interleave. Only a message longer than
+// LOG_MESSAGE_MAX_CELLS cells is cut short, and it ends in "(truncated)".
+//
+static const unsigned int LOG_QUEUE_CELLS = 4096;                 // power of 2
+static const unsigned int LOG_CELL_DATA = 240;
+static const unsigned int LOG_MESSAGE_MAX_CELLS = LOG_QUEUE_CELLS / 4;
+static const char LOG_TRUNCATED[] = "... (truncated)\n";
+static const int64 LOG_REPEAT_SUMMARY_INTERVAL = 30;
+
+struct CLogCell
+{
+    volatile unsigned int nSequence;
+    unsigned int nSize;
+    int64 nTime;
+    char pch[LOG_CELL_DATA];
+};
+
+static CLogCell vLogCells[LOG_QUEUE_CELLS];
+static volatile unsigned int nLogEnqueuePos = 0;
+static unsigned int nLogDequeuePos = 0;
+static volatile bool fLogWriterRunning = false;
+static volatile int nLogProducers = 0; // threads past the fLogWriterRunning check
+static boost::thread* pthreadLogWriter = NULL;
+
+static void LogQueueInit()
+{
+    for (unsigned int i = 0; i < LOG_QUEUE_CELLS; i++)
+        vLogCells[i].nSequence = i;
+    nLogEnqueuePos = nLogDequeuePos = 0;
+}
+
+// Queue a message; returns false if the writer stopped while the ring was full
+static bool LogEnqueue(const char* pch, unsigned int nSize, int64 nTime)
+{
+    unsigned int nCells = std::max(1U, (nSize + LOG_CELL_DATA - 1) / LOG_CELL_DATA);
+    bool fTruncated = false;
+    if (nCells > LOG_MESSAGE_MAX_CELLS)
+    {
+        nCells = LOG_MESSAGE_MAX_CELLS;
+        nSize = nCells * LOG_CELL_DATA;
+        fTruncated = true;
+    }
+
+    // Cells are freed in order by the single consumer, so when the last
+    // cell of the range is free all of them are
+    unsigned int nPos;
+    loop
+    {
+        nPos = nLogEnqueuePos;
+        unsigned int nLast = nPos + nCells - 1;
+        unsigned int nSequence = vLogCells[nLast & (LOG_QUEUE_CELLS - 1)].nSequence;
+        __sync_synchronize();
+        int nDiff = (int)(nSequence - nLast);
+        if (nDiff == 0)
+        {
+            if (__sync_bool_compare_and_swap(&nLogEnqueuePos, nPos, nPos + nCells))
+                break;
+        }
+        else if (nDiff < 0)
+        {
+            // ring full: wait for the writer
+            if (!fLogWriterRunning)
+                return false;
+            Sleep(1);
+        }
+    }
+
+    for (unsigned int i = 0; i < nCells; i++)
+    {
+        CLogCell& cell = vLogCells[(nPos + i) & (LOG_QUEUE_CELLS - 1)];
+        cell.nSize = std::min(nSize - i * LOG_CELL_DATA, LOG_CELL_DATA);
+        cell.nTime = nTime;
+        memcpy(cell.pch, pch + i * LOG_CELL_DATA, cell.nSize);
+        if (fTruncated && i == nCells - 1)
+            memcpy(cell.pch + cell.nSize - (sizeof(LOG_TRUNCATED) - 1), LOG_TRUNCATED, sizeof(LOG_TRUNCATED) - 1);
+        __sync_synchronize();
+        cell.nSequence = nPos + i + 1;
+    }
+    return true;
+}
+
+// Line assembly and repeated line suppression, used by the writer thread only
+class CLogLineWriter
+{
+private:
+    string strLine;
+    int64 nLineTime;
+    string strLastLine;
+    int nRepeated;
+    int64 nRepeatSince;
+    int64 nTimestampTime;
+    string strTimestamp;
+
+    void Write(const string& str, int64 nTime)
+    {
+        if (fLogTimestamps)
+        {
+            if (nTime != nTimestampTime)
+            {
+                strTimestamp = DateTimeStrFormat(nTime) + " ";
+                nTimestampTime = nTime;
+            }
+            fwrite(strTimestamp.data(), 1, strTimestamp.size(), fileout);
+        }
+        fwrite(str.data(), 1, str.size(), fileout);
+    }
+
+    void WriteRepeated(int64 nTime)
+    {
+        Write(strprintf("last message repeated %d times\n", nRepeated), nTime);
+        nRepeated = 0;
+        nRepeatSince = nTime;
+    }
+
+    void WriteLine()
+    {
+        if (strLine == strLastLine)
+        {
+            if (nRepeated++ == 0)
+                nRepeatSince = nLineTime;
+        }
+        else
+        {
+            if (nRepeated > 0)
+                WriteRepeated(nLineTime);
+            Write(strLine, nLineTime);
+            strLastLine.swap(strLine);
+        }
+        strLine.clear();
+    }
+
+public:
+    CLogLineWriter() : nLineTime(0), nRepeated(0), nRepeatSince(0), nTimestampTime(-1) {}
+
+    void Append(const char* pch, unsigned int nSize, int64 nTime)
+    {
+        while (nSize > 0)
+        {
+            if (strLine.empty())
+                nLineTime = nTime;
+            const char* pchEnd = (const char*)memchr(pch, '\n', nSize);
+            unsigned int n = pchEnd ? pchEnd - pch + 1 : nSize;
+            strLine.append(pch, n);
+            if (pchEnd)
+                WriteLine();
+            pch += n;
+            nSize -= n;
+        }
+    }
+
+    // Called when the ring is empty: report long runs of a repeated line
+    // periodically, and everything pending on shutdown
+    void Idle(bool fFinal)
+    {
+        int64 nNow = GetTime();
+        if (nRepeated > 0 && (fFinal || nNow - nRepeatSince >= LOG_REPEAT_SUMMARY_INTERVAL))
+            WriteRepeated(nNow);
+        if (fFinal && !strLine.empty())
+            Write(strLine, nLineTime);
+    }
+};
+
+// Drain the ring into debug.log; returns whether anything was written.
+// Called with mutexDebugLog held.
+static bool LogDrain(CLogLineWriter& writer)
+{
+    bool fWrote = false;
+    loop
+    {
+        CLogCell& cell = vLogCells[nLogDequeuePos & (LOG_QUEUE_CELLS - 1)];
+        unsigned int nSequence = cell.nSequence;
+        __sync_synchronize();
+        if (nSequence != nLogDequeuePos + 1)
+            break;
+        writer.Append(cell.pch, cell.nSize, cell.nTime);
+        __sync_synchronize();
+        cell.nSequence = nLogDequeuePos + LOG_QUEUE_CELLS;
+        nLogDequeuePos++;
+        fWrote = true;
+    }
+    return fWrote;
+}
+
+static CLogLineWriter* plogLineWriter = NULL;
+
+static void ThreadLogWriter()
+{
+    while (fLogWriterRunning)
+    {
+        bool fWrote;
+        {
+            boost::mutex::scoped_lock scoped_lock(mutexDebugLog);
+            if (!plogLineWriter)
+                break;
+            fWrote = LogDrain(*plogLineWriter);
+            if (!fWrote)
+                plogLineWriter->Idle(false);
+        }
+        if (fWrote)
+            fflush(fileout);
+        else
+            Sleep(20);
+    }
+}
+
+// Once fLogWriterRunning is cleared, wait for the producers that got past
+// it to finish queueing and write out the ring. Called with mutexDebugLog
+// held, by StopLogWriter or by whichever thread logs synchronously first,
+// so nothing queued is written after it. The writer thread may still be
+// flushing, so the buffering is left to StopLogWriter.
+static void LogFinish()
+{
+    while (nLogProducers > 0)
+        Sleep(1);
+    LogDrain(*plogLineWriter);
+    plogLineWriter->Idle(true);
+    delete plogLineWriter;
+    plogLineWriter = NULL;
+    fflush(fileout);
+}
+
+void StartLogWriter()
+{
+    if (fPrintToConsole || pthreadLogWriter)
+        return;
+    OpenDebugLog();
+    if (!fileout)
+        return;
+    {
+        boost::mutex::scoped_lock scoped_lock(mutexDebugLog);
+        fflush(fileout);
+        setvbuf(fileout, NULL, _IOFBF, 65536);
+    }
+    LogQueueInit();
+    plogLineWriter = new CLogLineWriter();
+    fLogWriterRunning = true;
+    pthreadLogWriter = new boost::thread(ThreadLogWriter);
+}
+
+// Write out everything queued and go back to synchronous unbuffered output
+void StopLogWriter()
+{
+    if (!pthreadLogWriter)
+        return;
+    fLogWriterRunning = false;
+    __sync_synchronize();
+    pthreadLogWriter->join();
+    delete pthreadLogWriter;
+    pthreadLogWriter = NULL;
+    boost::mutex::scoped_lock scoped_lock(mutexDebugLog);
+    if (plogLineWriter)
+        LogFinish();
+    // only now that the writer thread is gone
+    fflush(fileout);
+    setbuf(fileout, NULL);
+}
+
+// Close debug.log, so that the next line logged opens it again in the
+// current data directory. The writer thread must not be running.
+void CloseDebugLog()
+{
+    boost::mutex::scoped_lock scoped_lock(mutexDebugLog);
+    if (fileout)
+        fclose(fileout);
+    fileout = NULL;
+}
 
 inline int OutputDebugStringF(const char* pszFormat, ...)
 {
     int ret = 0;
+    bool fQueued = false;
     if (fPrintToConsole)
     {
         // print to console
@@ -206,21 +717,49 @@ inline int OutputDebugStringF(const char* pszFormat, ...)
         va_start(arg_ptr, pszFormat);
         ret = vprintf(pszFormat, arg_ptr);
         va_end(arg_ptr);
+        fQueued = true;
     }
     else
     {
-        // print to debug.log
-        if (!fileout)
+        // Queue for the writer thread. The writer is only finished off once
+        // every thread that saw it running has left here; a thread that
+        // comes later, or finds the ring full as it stops, writes below.
+        __sync_fetch_and_add(&nLogProducers, 1);
+        if (fLogWriterRunning)
         {
-            boost::filesystem::path pathDebug = GetDataDir() / "debug.log";
-            fileout = fopen(pathDebug.string().c_str(), "a");
-            if (fileout) setbuf(fileout, NULL); // unbuffered
+            char pszBuffer[1024];
+            char* p = pszBuffer;
+            int limit = sizeof(pszBuffer);
+            loop
+            {
+                va_list arg_ptr;
+                va_start(arg_ptr, pszFormat);
+                ret = _vsnprintf(p, limit, pszFormat, arg_ptr);
+                va_end(arg_ptr);
+                if (ret >= 0 && ret < limit)
+                    break;
+                if (p != pszBuffer)
+                    delete[] p;
+                limit *= 2;
+                p = new char[limit];
+            }
+            fQueued = (ret <= 0 || LogEnqueue(p, ret, GetTime()));
+            if (p != pszBuffer)
+                delete[] p;
         }
+        __sync_fetch_and_sub(&nLogProducers, 1);
+    }
+
+    if (!fQueued)
+    {
+        // print to debug.log
+        OpenDebugLog();
         if (fileout)
         {
             static bool fStartedNewLine = true;
-            static boost::mutex mutexDebugLog;
             boost::mutex::scoped_lock scoped_lock(mutexDebugLog);
+            if (plogLineWriter)
+                LogFinish();
 
             // Debug print useful for profiling
             if (fLogTimestamps && fStartedNewLine)
@@ -808,6 +1347,7 @@ void LogStackTrace() {
     printf("\n\n******* exception encountered *******\n");
     if (fileout)
     {
+        fflush(fileout);
 #ifndef WIN32
         void* pszBuffer[32];
         size_t size;
@@ -877,14 +1417,14 @@ boost::filesystem::path GetDefaultDataDir()
 #endif
 }
 
+static boost::filesystem::path pathCached[2];
+static CCriticalSection csPathCached;
+static bool cachedPath[2] = {false, false};
+
 const boost::filesystem::path &GetDataDir(bool fNetSpecific)
 {
     namespace fs = boost::filesystem;
 
-    static fs::path pathCached[2];
-    static CCriticalSection csPathCached;
-    static bool cachedPath[2] = {false, false};
-
     fs::path &path = pathCached[fNetSpecific];
 
     // This can be called during exceptions by printf, so we cache the
@@ -903,7 +1443,9 @@ const boost::filesystem::path &GetDataDir(bool fNetSpecific)
     } else {
         path = GetDefaultDataDir();
     }
-    if (fNetSpecific && GetBoolArg("-testnet", false))
+    if (fNetSpecific && GetBoolArg("-regtest", false))
+        path /= "regtest";
+    else if (fNetSpecific && GetBoolArg("-testnet", false))
         path /= "testnet";
 
     fs::create_directory(path);
@@ -912,6 +1454,15 @@ const boost::filesystem::path &GetDataDir(bool fNetSpecific)
     return path;
 }
 
+// Forget the cached data directory, so that the next GetDataDir call reads
+// -datadir again
+void ClearDatadirCache()
+{
+    LOCK(csPathCached);
+    cachedPath[0] = cachedPath[1] = false;
+    pathCached[0] = pathCached[1] = boost::filesystem::path();
+}
+
 boost::filesystem::path GetConfigFile()
 {
     namespace fs = boost::filesystem;
@@ -1014,12 +1565,13 @@ void ShrinkDebugFile()
 //  - The user (asking the user to fix the system clock if the first two disagree)
 //
 static int64 nMockTime = 0;  // For unit testing
+static int64 nTimeAdvance = 0;  // Moved forward by generate on -regtest
 
 int64 GetTime()
 {
     if (nMockTime) return nMockTime;
 
-    return time(NULL);
+    return time(NULL) + nTimeAdvance;
 }
 
 void SetMockTime(int64 nMockTimeIn)
@@ -1027,6 +1579,16 @@ void SetMockTime(int64 nMockTimeIn)
     nMockTime = nMockTimeIn;
 }
 
+// Move the node clock forward without stopping it: the offset is added to
+// the system clock, so GetTime keeps advancing in real time afterwards
+void AdvanceTime(int64 nSeconds)
+{
+    if (nMockTime)
+        nMockTime += nSeconds;
+    else
+        nTimeAdvance += nSeconds;
+}
+
 static int64 nTimeOffset = 0;
 
 int64 GetAdjustedTime()
@@ -1300,7 +1862,7 @@ private:
 
 typedef std::vector< std::pair<void*, CLockLocation> > LockStack;
 
-static boost::interprocess::interprocess_mutex dd_mutex;
+static boost::mutex dd_mutex;
 static std::map<std::pair<void*, void*>, LockStack> lockorders;
 static boost::thread_specific_ptr<LockStack> lockstack;
 
@@ -1377,3 +1939,263 @@ void LeaveCritical()
 }
 
 #endif /* DEBUG_LOCKORDER */
+
+
+
+//
+// CDataStream buffer pool.
+// Streams are created and destroyed for every database record, network
+// message and hash, mostly with buffers of a few common sizes. Freed buffers
+// are kept per thread in power of two size classes, so no locking is needed;
+// buffers above the largest class go straight back to the heap.
+//
+
+class CStreamBufferPool
+{
+public:
+    enum
+    {
+        MIN_SHIFT = 6,      // 64 bytes
+        MAX_SHIFT = 16,     // 64KB
+        MAX_FREE = 8,       // free buffers kept per size class
+    };
+
+    std::vector<void*> vFree[MAX_SHIFT - MIN_SHIFT + 1];
+
+    ~CStreamBufferPool()
+    {
+        for (int i = 0; i <= MAX_SHIFT - MIN_SHIFT; i++)
+            BOOST_FOREACH(void* p, vFree[i])
+                ::operator delete(p);
+    }
+
+    // Size class of a buffer, or -1 if it is not pooled
+    static int GetClass(size_t nSize)
+    {
+        int nShift = MIN_SHIFT;
+        while (((size_t)1 << nShift) < nSize)
+            if (++nShift > MAX_SHIFT)
+                return -1;
+        return nShift - MIN_SHIFT;
+    }
+};
+
+static CStreamBufferPool* GetStreamBufferPool()
+{
+    // Never destroyed, as streams in static objects may outlive it
+    static boost::thread_specific_ptr<CStreamBufferPool>* ptsp = new boost::thread_specific_ptr<CStreamBufferPool>();
+    CStreamBufferPool* pool = ptsp->get();
+    if (pool == NULL)
+    {
+        pool = new CStreamBufferPool();
+        ptsp->reset(pool);
+    }
+    return pool;
+}
+
+void* StreamBufferAllocate(size_t nSize)
+{
+    int nClass = CStreamBufferPool::GetClass(nSize);
+    if (nClass < 0)
+        return ::operator new(nSize);
+    std::vector<void*>& vFree = GetStreamBufferPool()->vFree[nClass];
+    if (vFree.empty())
+        return ::operator new((size_t)1 << (nClass + CStreamBufferPool::MIN_SHIFT));
+    void* p = vFree.back();
+    vFree.pop_back();
+    return p;
+}
+
+void StreamBufferFree(void* p, size_t nSize)
+{
+    int nClass = CStreamBufferPool::GetClass(nSize);
+    if (nClass >= 0)
+    {
+        std::vector<void*>& vFree = GetStreamBufferPool()->vFree[nClass];
+        if (vFree.size() < CStreamBufferPool::MAX_FREE)
+        {
+            vFree.push_back(p);
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
+
+
+//
+// Lock profiler.
+// CMutexLock reports the wait and hold time of each acquisition when
+// fLockProfile is set. Counters are kept per thread, each behind its own
+// mutex, which only GetLockStats contends for. A thread's counters are
+// folded into the totals and freed when it exits.
+//
+
+struct CLockSiteCounters
+{
+    const char* pszName;
+    int64 nCount;
+    int64 nContended;
+    int64 nWaitMicros;
+    int64 nMaxWaitMicros;
+    int64 nHoldMicros;
+};
+
+class CLockProfileThread
+{
+public:
+    boost::mutex mutex;
+    // keyed by __FILE__ and __LINE__ of the lock site
+    std::map<std::pair<const char*, int>, CLockSiteCounters> mapSites;
+};
+
+typedef std::map<std::pair<const char*, int>, CLockSiteCounters> LockSiteMap;
+
+static void AddLockSiteCounters(LockSiteMap& mapTo, const LockSiteMap& mapFrom)
+{
+    for (LockSiteMap::const_iterator mi = mapFrom.begin(); mi != mapFrom.end(); ++mi)
+    {
+        const CLockSiteCounters& from = (*mi).second;
+        LockSiteMap::iterator mt = mapTo.find((*mi).first);
+        if (mt == mapTo.end())
+        {
+            mapTo.insert(*mi);
+            continue;
+        }
+        CLockSiteCounters& to = (*mt).second;
+        to.nCount += from.nCount;
+        to.nContended += from.nContended;
+        to.nWaitMicros += from.nWaitMicros;
+        to.nMaxWaitMicros = std::max(to.nMaxWaitMicros, from.nMaxWaitMicros);
+        to.nHoldMicros += from.nHoldMicros;
+    }
+}
+
+class CLockProfiler
+{
+public:
+    boost::mutex mutex;
+    std::vector<CLockProfileThread*> vThreads;
+    // counters of threads that have exited
+    LockSiteMap mapExited;
+    boost::thread_specific_ptr<CLockProfileThread> ptsThread;
+
+    static void ReleaseThreadCounters(CLockProfileThread* pthread);
+
+    CLockProfiler() : ptsThread(ReleaseThreadCounters) {}
+};
+
+static CLockProfiler& GetLockProfiler()
+{
+    // Never destroyed, as locks are still taken during static destruction
+    static CLockProfiler* pprofiler = new CLockProfiler();
+    return *pprofiler;
+}
+
+// Called at thread exit: fold the thread's counters into mapExited, so short
+// lived threads neither lose their counts nor grow vThreads
+void CLockProfiler::ReleaseThreadCounters(CLockProfileThread* pthread)
+{
+    CLockProfiler& profiler = GetLockProfiler();
+    {
+        boost::mutex::scoped_lock lock(profiler.mutex);
+        {
+            boost::mutex::scoped_lock lockThread(pthread->mutex);
+            AddLockSiteCounters(profiler.mapExited, pthread->mapSites);
+        }
+        profiler.vThreads.erase(std::remove(profiler.vThreads.begin(), profiler.vThreads.end(), pthread), profiler.vThreads.end());
+    }
+    delete pthread;
+}
+
+void LockProfileRecord(const char* pszName, const char* pszFile, int nLine, bool fContended, int64 nWaitMicros, int64 nHoldMicros)
+{
+    CLockProfiler& profiler = GetLockProfiler();
+    CLockProfileThread* pthread = profiler.ptsThread.get();
+    if (pthread == NULL)
+    {
+        pthread = new CLockProfileThread();
+        profiler.ptsThread.reset(pthread);
+        boost::mutex::scoped_lock lock(profiler.mutex);
+        profiler.vThreads.push_back(pthread);
+    }
+
+    boost::mutex::scoped_lock lock(pthread->mutex);
+    LockSiteMap::iterator mi = pthread->mapSites.find(std::make_pair(pszFile, nLine));
+    if (mi == pthread->mapSites.end())
+    {
+        CLockSiteCounters counters = { pszName, 0, 0, 0, 0, 0 };
+        mi = pthread->mapSites.insert(std::make_pair(std::make_pair(pszFile, nLine), counters)).first;
+    }
+    CLockSiteCounters& counters = (*mi).second;
+    counters.nCount++;
+    if (fContended)
+        counters.nContended++;
+    counters.nWaitMicros += nWaitMicros;
+    counters.nMaxWaitMicros = std::max(counters.nMaxWaitMicros, nWaitMicros);
+    counters.nHoldMicros += nHoldMicros;
+}
+
+static bool CompareLockStatsByWait(const CLockStats& a, const CLockStats& b)
+{
+    return a.nWaitMicros > b.nWaitMicros;
+}
+
+// Add the counters of one thread to the totals per lock site
+static void SumLockStats(std::map<std::string, CLockStats>& mapStats, const LockSiteMap& mapSites)
+{
+    for (LockSiteMap::const_iterator mi = mapSites.begin(); mi != mapSites.end(); ++mi)
+    {
+        const CLockSiteCounters& counters = (*mi).second;
+        std::string strLocation = strprintf("%s:%d", (*mi).first.first, (*mi).first.second);
+        CLockStats& stats = mapStats[strLocation];
+        stats.strName = counters.pszName;
+        stats.strLocation = strLocation;
+        stats.nCount += counters.nCount;
+        stats.nContended += counters.nContended;
+        stats.nWaitMicros += counters.nWaitMicros;
+        stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, counters.nMaxWaitMicros);
+        stats.nHoldMicros += counters.nHoldMicros;
+    }
+}
+
+// Totals of all threads per lock site, ordered by total wait time
+void GetLockStats(std::vector<CLockStats>& vStats, bool fReset)
+{
+    // the same site may be reached through different __FILE__ pointers
+    std::map<std::string, CLockStats> mapStats;
+    CLockProfiler& profiler = GetLockProfiler();
+    {
+        boost::mutex::scoped_lock lock(profiler.mutex);
+        SumLockStats(mapStats, profiler.mapExited);
+        if (fReset)
+            profiler.mapExited.clear();
+        BOOST_FOREACH(CLockProfileThread* pthread, profiler.vThreads)
+        {
+            boost::mutex::scoped_lock lockThread(pthread->mutex);
+            SumLockStats(mapStats, pthread->mapSites);
+            if (fReset)
+                pthread->mapSites.clear();
+        }
+    }
+
+    vStats.clear();
+    vStats.reserve(mapStats.size());
+    for (std::map<std::string, CLockStats>::const_iterator mi = mapStats.begin(); mi != mapStats.end(); ++mi)
+        vStats.push_back((*mi).second);
+    sort(vStats.begin(), vStats.end(), CompareLockStatsByWait);
+}
+
+void PrintLockStats(unsigned int nMax)
+{
+    std::vector<CLockStats> vStats;
+    GetLockStats(vStats);
+    printf("Lock profile: %d lock sites\n", vStats.size());
+    for (unsigned int i = 0; i < vStats.size() && i < nMax; i++)
+    {
+        const CLockStats& stats = vStats[i];
+        printf("  %-20s %s count=%"PRI64d" contended=%"PRI64d" wait=%"PRI64d"ms maxwait=%"PRI64d"ms hold=%"PRI64d"ms\n",
+            stats.strName.c_str(), stats.strLocation.c_str(), stats.nCount, stats.nContended,
+            stats.nWaitMicros / 1000, stats.nMaxWaitMicros / 1000, stats.nHoldMicros / 1000);
+    }
+}
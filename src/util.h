@@ -22,10 +22,11 @@ typedef int pid_t; /* define for windows compatiblity */
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
-#include <boost/interprocess/sync/interprocess_recursive_mutex.hpp>
-#include <boost/interprocess/sync/scoped_lock.hpp>
-#include <boost/interprocess/sync/interprocess_semaphore.hpp>
-#include <boost/interprocess/sync/lock_options.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/date_time/gregorian/gregorian_types.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
@@ -132,8 +133,10 @@ extern bool fServer;
 extern bool fCommandLine;
 extern std::string strMiscWarning;
 extern bool fTestNet;
+extern bool fRegTest;
 extern bool fNoListen;
 extern bool fLogTimestamps;
+extern bool fLockProfile;
 
 void RandAddSeed();
 void RandAddSeedPerfmon();
@@ -168,6 +171,7 @@ bool WildcardMatch(const std::string& str, const std::string& mask);
 int GetFilesize(FILE* file);
 boost::filesystem::path GetDefaultDataDir();
 const boost::filesystem::path &GetDataDir(bool fNetSpecific = true);
+void ClearDatadirCache();
 boost::filesystem::path GetConfigFile();
 boost::filesystem::path GetPidFile();
 void CreatePidFile(const boost::filesystem::path &path, pid_t pid);
@@ -178,13 +182,102 @@ void ShrinkDebugFile();
 int GetRandInt(int nMax);
 uint64 GetRand(uint64 nMax);
 uint256 GetRandHash();
+int GetFastRandInt(int nMax);
+uint64 GetFastRand(uint64 nMax);
+uint256 GetFastRandHash();
 int64 GetTime();
 void SetMockTime(int64 nMockTimeIn);
+void AdvanceTime(int64 nSeconds);
 int64 GetAdjustedTime();
 std::string FormatFullVersion();
 std::string FormatSubVersion(const std::string& name, int nClientVersion, const std::vector<std::string>& comments);
 void AddTimeData(const CNetAddr& ip, int64 nTime);
+void StartLogWriter();
+void StopLogWriter();
+void CloseDebugLog();
+
+/** Fast random numbers for sampling, shuffling and timing, where taking
+ * OpenSSL's RNG lock for every value is too slow. The output is a ChaCha20
+ * keystream keyed from OpenSSL. Never use it for key material.
+ * GetFastRand() and friends use one instance per thread.
+ */
+class CFastRandom
+{
+private:
+    unsigned int input[16];
+    unsigned int output[16];
+    unsigned int nOutputPos;
+
+    void Refill();
+
+public:
+    CFastRandom();
+    explicit CFastRandom(const uint256& seed);
+
+    unsigned int Rand32()
+    {
+        if (nOutputPos == 16)
+            Refill();
+        return output[nOutputPos++];
+    }
+
+    uint64 Rand64()
+    {
+        uint64 n = Rand32();
+        return (n << 32) | Rand32();
+    }
+
+    uint64 RandRange(uint64 nMax);
+    uint256 RandHash();
+};
+
+/** SipHash-2-4, a fast keyed hash for bucket and table placement that must
+ * not be predictable without the key. Not a replacement for SHA-256.
+ */
+class CSipHasher
+{
+private:
+    uint64 v[4];
+    uint64 tmp;
+    int nCount;
+
+public:
+    CSipHasher(uint64 k0, uint64 k1);
+    CSipHasher& Write(uint64 n);
+    CSipHasher& Write(const unsigned char* pch, size_t nSize);
+    uint64 Finalize() const;
+};
+
+/** Debug log categories, set once at startup from -print<category> (with
+    -debug) or -loglevel=<category>:<level> */
+enum LogCategory
+{
+    LOG_SELECTCOIN,
+    LOG_COINSTAKE,
+    LOG_FEE,
+    LOG_KEYPOOL,
+    LOG_STAKEMODIFIER,
+    LOG_CREATION,
+    LOG_COINAGE,
+    LOG_MESSAGESTART,
+    LOG_PRIORITY,
+    LOG_CATEGORY_COUNT
+};
+
+enum LogLevel
+{
+    LOGLEVEL_NONE = 0,
+    LOGLEVEL_INFO = 1,
+    LOGLEVEL_DEBUG = 2
+};
+
+extern int nLogLevels[LOG_CATEGORY_COUNT];
+void InitLogLevels();
 
+inline bool LogAccept(LogCategory category, int nLevel = LOGLEVEL_DEBUG)
+{
+    return (nLogLevels[category] >= nLevel);
+}
 
 
 
@@ -195,11 +288,28 @@ void AddTimeData(const CNetAddr& ip, int64 nTime);
 
 
 
+
+inline int64 GetTimeMillis()
+{
+    return (boost::posix_time::ptime(boost::posix_time::microsec_clock::universal_time()) -
+            boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds();
+}
+
+inline int64 GetTimeMicros()
+{
+    return (boost::posix_time::ptime(boost::posix_time::microsec_clock::universal_time()) -
+            boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_microseconds();
+}
+
 /** Wrapped boost mutex: supports recursive locking, but no waiting  */
-typedef boost::interprocess::interprocess_recursive_mutex CCriticalSection;
+typedef boost::recursive_mutex CCriticalSection;
 
 /** Wrapped boost mutex: supports waiting but not recursive locking */
-typedef boost::interprocess::interprocess_mutex CWaitableCriticalSection;
+typedef boost::mutex CWaitableCriticalSection;
+
+/** Wrapped boost mutex: shared (read) or exclusive (write) locking, for
+    read-mostly data. Not recursive, in either mode. */
+typedef boost::shared_mutex CSharedCriticalSection;
 
 #ifdef DEBUG_LOCKORDER
 void EnterCritical(const char* pszName, const char* pszFile, int nLine, void* cs, bool fTry = false);
@@ -209,19 +319,73 @@ void static inline EnterCritical(const char* pszName, const char* pszFile, int n
 void static inline LeaveCritical() {}
 #endif
 
-/** Wrapper around boost::interprocess::scoped_lock */
-template<typename Mutex>
+/** Lock site counters of the lock profiler, enabled with -lockprofile */
+class CLockStats
+{
+public:
+    std::string strName;
+    std::string strLocation;
+    int64 nCount;
+    int64 nContended;
+    int64 nWaitMicros;
+    int64 nMaxWaitMicros;
+    int64 nHoldMicros;
+
+    CLockStats()
+    {
+        nCount = nContended = nWaitMicros = nMaxWaitMicros = nHoldMicros = 0;
+    }
+};
+
+void LockProfileRecord(const char* pszName, const char* pszFile, int nLine, bool fContended, int64 nWaitMicros, int64 nHoldMicros);
+void GetLockStats(std::vector<CLockStats>& vStats, bool fReset = false);
+void PrintLockStats(unsigned int nMax);
+
+/** Wrapper around boost::unique_lock, or boost::shared_lock for shared locking */
+template<typename Mutex, typename Lock = boost::unique_lock<Mutex> >
 class CMutexLock
 {
 private:
-    boost::interprocess::scoped_lock<Mutex> lock;
+    Lock lock;
+
+    // lock profiler state of the current acquisition; nLockedTime is 0
+    // when it is not profiled
+    const char* pszLockName;
+    const char* pszLockFile;
+    int nLockLine;
+    bool fLockContended;
+    int64 nLockWait;
+    int64 nLockedTime;
+
+    void ProfileLeave()
+    {
+        if (nLockedTime != 0)
+        {
+            LockProfileRecord(pszLockName, pszLockFile, nLockLine, fLockContended, nLockWait, GetTimeMicros() - nLockedTime);
+            nLockedTime = 0;
+        }
+    }
+
 public:
 
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
-        if (!lock.owns())
+        if (!lock.owns_lock())
         {
             EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()));
+            if (fLockProfile)
+            {
+                int64 nStart = GetTimeMicros();
+                fLockContended = !lock.try_lock();
+                if (fLockContended)
+                    lock.lock();
+                pszLockName = pszName;
+                pszLockFile = pszFile;
+                nLockLine = nLine;
+                nLockedTime = GetTimeMicros();
+                nLockWait = nLockedTime - nStart;
+                return;
+            }
 #ifdef DEBUG_LOCKCONTENTION
             if (!lock.try_lock())
             {
@@ -237,26 +401,36 @@ public:
 
     void Leave()
     {
-        if (lock.owns())
+        if (lock.owns_lock())
         {
             lock.unlock();
             LeaveCritical();
+            ProfileLeave();
         }
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
     {
-        if (!lock.owns())
+        if (!lock.owns_lock())
         {
             EnterCritical(pszName, pszFile, nLine, (void*)(lock.mutex()), true);
             lock.try_lock();
-            if (!lock.owns())
+            if (!lock.owns_lock())
                 LeaveCritical();
+            else if (fLockProfile)
+            {
+                pszLockName = pszName;
+                pszLockFile = pszFile;
+                nLockLine = nLine;
+                fLockContended = false;
+                nLockWait = 0;
+                nLockedTime = GetTimeMicros();
+            }
         }
-        return lock.owns();
+        return lock.owns_lock();
     }
 
-    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::interprocess::defer_lock)
+    CMutexLock(Mutex& mutexIn, const char* pszName, const char* pszFile, int nLine, bool fTry = false) : lock(mutexIn, boost::defer_lock), nLockedTime(0)
     {
         if (fTry)
             TryEnter(pszName, pszFile, nLine);
@@ -266,16 +440,19 @@ public:
 
     ~CMutexLock()
     {
-        if (lock.owns())
+        if (lock.owns_lock())
+        {
             LeaveCritical();
+            ProfileLeave();
+        }
     }
 
     operator bool()
     {
-        return lock.owns();
+        return lock.owns_lock();
     }
 
-    boost::interprocess::scoped_lock<Mutex> &GetLock()
+    Lock &GetLock()
     {
         return lock;
     }
@@ -287,6 +464,12 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
 #define LOCK2(cs1,cs2) CCriticalBlock criticalblock1(cs1, #cs1, __FILE__, __LINE__),criticalblock2(cs2, #cs2, __FILE__, __LINE__)
 #define TRY_LOCK(cs,name) CCriticalBlock name(cs, #cs, __FILE__, __LINE__, true)
 
+typedef CMutexLock<CSharedCriticalSection, boost::shared_lock<CSharedCriticalSection> > CSharedReadBlock;
+typedef CMutexLock<CSharedCriticalSection> CSharedWriteBlock;
+
+#define READ_LOCK(cs) CSharedReadBlock criticalblock(cs, #cs, __FILE__, __LINE__)
+#define WRITE_LOCK(cs) CSharedWriteBlock criticalblock(cs, #cs, __FILE__, __LINE__)
+
 #define ENTER_CRITICAL_SECTION(cs) \
     { \
         EnterCritical(#cs, __FILE__, __LINE__, (void*)(&cs)); \
@@ -299,47 +482,40 @@ typedef CMutexLock<CCriticalSection> CCriticalBlock;
         LeaveCritical(); \
     }
 
-#ifdef MAC_OSX
-// boost::interprocess::interprocess_semaphore seems to spinlock on OSX; prefer polling instead
 class CSemaphore
 {
 private:
-    CCriticalSection cs;
+    boost::condition_variable condition;
+    boost::mutex mutex;
     int val;
 
 public:
     CSemaphore(int init) : val(init) {}
 
     void wait() {
-        do {
-            {
-                LOCK(cs);
-                if (val>0) {
-                    val--;
-                    return;
-                }
-            }
-            Sleep(100);
-        } while(1);
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (val < 1) {
+            condition.wait(lock);
+        }
+        val--;
     }
 
     bool try_wait() {
-        LOCK(cs);
-        if (val>0) {
-            val--;
-            return true;
-        }
-        return false;
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (val < 1)
+            return false;
+        val--;
+        return true;
     }
 
     void post() {
-        LOCK(cs);
-        val++;
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            val++;
+        }
+        condition.notify_one();
     }
 };
-#else
-typedef boost::interprocess::interprocess_semaphore CSemaphore;
-#endif
 
 inline std::string i64tostr(int64 n)
 {
@@ -437,12 +613,6 @@ inline int64 GetPerformanceCounter()
     return nCounter;
 }
 
-inline int64 GetTimeMillis()
-{
-    return (boost::posix_time::ptime(boost::posix_time::microsec_clock::universal_time()) -
-            boost::posix_time::ptime(boost::gregorian::date(1970,1,1))).total_milliseconds();
-}
-
 inline std::string DateTimeStrFormat(const char* pszFormat, int64 nTime)
 {
     time_t n = nTime;
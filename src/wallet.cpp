@@ -9,6 +9,8 @@
 #include "crypter.h"
 #include "ui_interface.h"
 #include "kernel.h"
+#include "config.h"
+#include "metrics.h"
 
 using namespace std;
 
@@ -379,6 +381,11 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
             }
         }
 #endif
+        if (fAccountIndexValid && (fInsertedNew || fUpdated))
+            AccountIndexAdd(wtx);
+        if (fAddressReceivedValid && fInsertedNew)
+            AddressReceivedAdd(wtx);
+
         // Notify UI
         vWalletUpdated.push_back(hash);
 
@@ -421,8 +428,15 @@ bool CWallet::EraseFromWallet(uint256 hash)
         return false;
     {
         LOCK(cs_wallet);
-        if (mapWallet.erase(hash))
+        map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+        {
+            if (fAddressReceivedValid)
+                AddressReceivedRemove((*mi).second);
+            mapWallet.erase(mi);
             CWalletDB(strWalletFile).EraseTx(hash);
+        }
+        AccountIndexRemove(hash);
     }
     return true;
 }
@@ -687,6 +701,9 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
     CBlockIndex* pindex = pindexStart;
     {
         LOCK(cs_wallet);
+        // Transactions found out of order can change the debit of those
+        // already in the wallet
+        fAccountIndexValid = false;
         while (pindex)
         {
             CBlock block;
@@ -806,7 +823,7 @@ void CWallet::ResendWalletTransactions()
     if (GetTime() < nNextTime)
         return;
     bool fFirst = (nNextTime == 0);
-    nNextTime = GetTime() + GetRand(30 * 60);
+    nNextTime = GetTime() + GetFastRand(30 * 60);
     if (fFirst)
         return;
 
@@ -914,6 +931,227 @@ int64 CWallet::GetNewMint() const
 }
 
 
+void CAccountBalance::Add(int nType, int nHeight, int64 nAmount)
+{
+    if (nType == FIXED)
+    {
+        nFixed += nAmount;
+        return;
+    }
+    int64& nTotal = (nType == RECEIVED ? nReceived : nGenerated);
+    map<int, int64>& mapHeight = (nType == RECEIVED ? mapReceived : mapGenerated);
+    nTotal += nAmount;
+    if ((mapHeight[nHeight] += nAmount) == 0)
+        mapHeight.erase(nHeight);
+}
+
+int64 CAccountBalance::Get(int nMaxHeightReceived, int nMaxHeightGenerated) const
+{
+    int64 nBalance = nFixed + nReceived + nGenerated;
+    for (map<int, int64>::const_iterator it = mapReceived.upper_bound(nMaxHeightReceived); it != mapReceived.end(); ++it)
+        nBalance -= (*it).second;
+    for (map<int, int64>::const_iterator it = mapGenerated.upper_bound(nMaxHeightGenerated); it != mapGenerated.end(); ++it)
+        nBalance -= (*it).second;
+    return nBalance;
+}
+
+void CWallet::AccountIndexApply(const CAccountTxEntry& entry, int nSign)
+{
+    typedef boost::tuple<string, int, int64> AccountAmount;
+    BOOST_FOREACH(const AccountAmount& amount, entry.vAmounts)
+        mapAccountBalance[amount.get<0>()].Add(amount.get<1>(), entry.nHeight, nSign * amount.get<2>());
+}
+
+void CWallet::AccountIndexRemove(const uint256& hash)
+{
+    map<uint256, CAccountTxEntry>::iterator mi = mapAccountTx.find(hash);
+    if (mi == mapAccountTx.end())
+        return;
+    AccountIndexApply((*mi).second, -1);
+    mapAccountTx.erase(mi);
+    setAccountRecheck.erase(hash);
+}
+
+// Index the same amounts GetAccountAmounts reports for wtx, with the height
+// of its block deciding which minimum depths count them
+void CWallet::AccountIndexAdd(const CWalletTx& wtx)
+{
+    uint256 hash = wtx.GetHash();
+    AccountIndexRemove(hash);
+
+    CAccountTxEntry& entry = mapAccountTx[hash];
+    if (!wtx.IsFinal())
+    {
+        entry.fFinal = false;
+        setAccountRecheck.insert(hash);
+        return;
+    }
+
+    CBlockIndex* pindex = NULL;
+    if (wtx.GetDepthInMainChain(pindex) > 0)
+        entry.nHeight = pindex->nHeight;
+    else if (wtx.hashBlock != 0 && wtx.nIndex != -1)
+        setAccountRecheck.insert(hash);
+
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+    {
+        CBitcoinAddress address;
+        if (IsMine(txout) && ExtractAddress(txout.scriptPubKey, address))
+            setAccountAddresses.insert(address);
+    }
+
+    if (wtx.IsCoinBase() || wtx.IsCoinStake())
+    {
+        entry.vAmounts.push_back(boost::make_tuple(string(""), (int)CAccountBalance::GENERATED, GetCredit(wtx) - GetDebit(wtx)));
+    }
+    else
+    {
+        int64 nGeneratedImmature, nGeneratedMature, nFee;
+        string strSentAccount;
+        list<pair<CBitcoinAddress, int64> > listReceived;
+        list<pair<CBitcoinAddress, int64> > listSent;
+        wtx.GetAmounts(nGeneratedImmature, nGeneratedMature, listReceived, listSent, nFee, strSentAccount);
+
+        int64 nSent = nFee;
+        BOOST_FOREACH(const PAIRTYPE(CBitcoinAddress,int64)& s, listSent)
+            nSent += s.second;
+        if (nSent != 0)
+            entry.vAmounts.push_back(boost::make_tuple(strSentAccount, (int)CAccountBalance::FIXED, -nSent));
+
+        BOOST_FOREACH(const PAIRTYPE(CBitcoinAddress,int64)& r, listReceived)
+        {
+            map<CBitcoinAddress, string>::const_iterator mi = mapAddressBook.find(r.first);
+            string strAccount = (mi != mapAddressBook.end() ? (*mi).second : string(""));
+            entry.vAmounts.push_back(boost::make_tuple(strAccount, (int)CAccountBalance::RECEIVED, r.second));
+        }
+    }
+    AccountIndexApply(entry, 1);
+}
+
+// Bring the account index up to date with the wallet and the best chain
+void CWallet::SyncAccountIndex()
+{
+    // A block the index counted from may have left the main chain
+    if (fAccountIndexValid && pindexAccountIndex != pindexBest)
+    {
+        CBlockIndex* pindex = pindexBest;
+        while (pindex && pindexAccountIndex && pindex->nHeight > pindexAccountIndex->nHeight)
+            pindex = pindex->pprev;
+        if (pindex != pindexAccountIndex)
+            fAccountIndexValid = false;
+    }
+
+    if (!fAccountIndexValid)
+    {
+        int64 nStart = GetTimeMillis();
+        mapAccountBalance.clear();
+        mapAccountTx.clear();
+        setAccountRecheck.clear();
+        setAccountAddresses.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            AccountIndexAdd((*it).second);
+
+        if (fFileBacked)
+        {
+            list<CAccountingEntry> entries;
+            CWalletDB(strWalletFile).ListAccountCreditDebit("*", entries);
+            BOOST_FOREACH(const CAccountingEntry& entry, entries)
+                mapAccountBalance[entry.strAccount].Add(CAccountBalance::FIXED, 0, entry.nCreditDebit);
+        }
+        fAccountIndexValid = true;
+        printf("SyncAccountIndex() : rebuilt index of %d accounts in %"PRI64d"ms\n", (int)mapAccountBalance.size(), GetTimeMillis() - nStart);
+    }
+    else
+    {
+        vector<uint256> vRecheck(setAccountRecheck.begin(), setAccountRecheck.end());
+        BOOST_FOREACH(const uint256& hash, vRecheck)
+        {
+            map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(hash);
+            if (mi == mapWallet.end())
+            {
+                AccountIndexRemove(hash);
+                continue;
+            }
+            const CWalletTx& wtx = (*mi).second;
+            if (mapAccountTx[hash].fFinal == wtx.IsFinal() && !wtx.IsInMainChain())
+                continue;
+            AccountIndexAdd(wtx);
+        }
+    }
+    pindexAccountIndex = pindexBest;
+}
+
+int64 CWallet::GetAccountBalance(const string& strAccount, int nMinDepth)
+{
+    LOCK(cs_wallet);
+    SyncAccountIndex();
+
+    map<string, CAccountBalance>::const_iterator mi = mapAccountBalance.find(strAccount);
+    if (mi == mapAccountBalance.end())
+        return 0;
+    int nMaxHeightReceived = (nMinDepth > 0 ? nBestHeight + 1 - nMinDepth : std::numeric_limits<int>::max());
+    int nMaxHeightGenerated = nBestHeight + 1 - (nCoinbaseMaturity + 20);
+    return (*mi).second.Get(nMaxHeightReceived, nMaxHeightGenerated);
+}
+
+void CWallet::AddAccountCreditDebit(const string& strAccount, int64 nCreditDebit)
+{
+    LOCK(cs_wallet);
+    if (fAccountIndexValid)
+        mapAccountBalance[strAccount].Add(CAccountBalance::FIXED, 0, nCreditDebit);
+}
+
+void CWallet::AddressReceivedAdd(const CWalletTx& wtx)
+{
+    if (wtx.IsCoinBase() || wtx.IsCoinStake())
+        return;
+    uint256 hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+    {
+        CBitcoinAddress address;
+        if (ExtractAddress(wtx.vout[i].scriptPubKey, address))
+            mapAddressReceived[address].push_back(COutPoint(hash, i));
+    }
+}
+
+void CWallet::AddressReceivedRemove(const CWalletTx& wtx)
+{
+    uint256 hash = wtx.GetHash();
+    BOOST_FOREACH(const CTxOut& txout, wtx.vout)
+    {
+        CBitcoinAddress address;
+        if (!ExtractAddress(txout.scriptPubKey, address))
+            continue;
+        map<CBitcoinAddress, vector<COutPoint> >::iterator mi = mapAddressReceived.find(address);
+        if (mi == mapAddressReceived.end())
+            continue;
+        vector<COutPoint>& vOutPoints = (*mi).second;
+        for (unsigned int i = 0; i < vOutPoints.size(); )
+        {
+            if (vOutPoints[i].hash == hash)
+                vOutPoints.erase(vOutPoints.begin() + i);
+            else
+                i++;
+        }
+        if (vOutPoints.empty())
+            mapAddressReceived.erase(mi);
+    }
+}
+
+const map<CBitcoinAddress, vector<COutPoint> >& CWallet::GetAddressReceived()
+{
+    LOCK(cs_wallet);
+    if (!fAddressReceivedValid)
+    {
+        mapAddressReceived.clear();
+        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+            AddressReceivedAdd((*it).second);
+        fAddressReceivedValid = true;
+    }
+    return mapAddressReceived;
+}
+
+
 bool CWallet::SelectCoinsMinConf(int64 nTargetValue, unsigned int nSpendTime, int nConfMine, int nConfTheirs, set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, int64& nValueRet) const
 {
     setCoinsRet.clear();
@@ -932,7 +1170,7 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, unsigned int nSpendTime, in
        vCoins.reserve(mapWallet.size());
        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
            vCoins.push_back(&(*it).second);
-       random_shuffle(vCoins.begin(), vCoins.end(), GetRandInt);
+       random_shuffle(vCoins.begin(), vCoins.end(), GetFastRandInt);
 
        BOOST_FOREACH(const CWalletTx* pcoin, vCoins)
        {
@@ -1052,7 +1290,7 @@ bool CWallet::SelectCoinsMinConf(int64 nTargetValue, unsigned int nSpendTime, in
             }
 
         //// debug print
-        if (fDebug && GetBoolArg("-printselectcoin"))
+        if (LogAccept(LOG_SELECTCOIN))
         {
             printf("SelectCoins() best subset: ");
             for (unsigned int i = 0; i < vValue.size(); i++)
@@ -1147,7 +1385,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CW
                     //  rediscover unknown transactions that were written with keys of ours to recover
                     //  post-backup change.
 
-                    if (!GetBoolArg("-avatar")) // PFN: not avatar mode
+                    if (!configAvatar.Get()) // PFN: not avatar mode
                     {
                         // Reserve a new key pair from key pool
                         vector<unsigned char> vchPubKey = reservekey.GetReservedKey();
@@ -1160,7 +1398,7 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> >& vecSend, CW
                     }
 
                     // Insert change txn at random position:
-                    vector<CTxOut>::iterator position = wtxNew.vout.begin()+GetRandInt(wtxNew.vout.size());
+                    vector<CTxOut>::iterator position = wtxNew.vout.begin()+GetFastRandInt(wtxNew.vout.size());
                     wtxNew.vout.insert(position, CTxOut(nChange, scriptChange));
                 }
                 else
@@ -1229,9 +1467,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
     txNew.vout.push_back(CTxOut(0, scriptEmpty));
     // Choose coins to use
     int64 nBalance = GetBalance();
-    int64 nReserveBalance = 0;
-    if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-        return error("CreateCoinStake : invalid reserve balance amount");
+    int64 nReserveBalance = configReserveBalance.Get();
     if (nBalance <= nReserveBalance)
         return false;
     set<pair<const CWalletTx*,unsigned int> > setCoins;
@@ -1265,10 +1501,12 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
             // Search nSearchInterval seconds back up to nMaxStakeSearchInterval
             uint256 hashProofOfStake = 0;
             COutPoint prevoutStake = COutPoint(pcoin.first->GetHash(), pcoin.second);
+            if (fMetrics)
+                metricStakeKernelChecks.Get().Inc();
             if (CheckStakeKernelHash(nBits, block, txindex.pos.nTxPos - txindex.pos.nBlockPos, *pcoin.first, prevoutStake, txNew.nTime - n, hashProofOfStake))
             {
                 // Found a kernel
-                if (fDebug && GetBoolArg("-printcoinstake"))
+                if (LogAccept(LOG_COINSTAKE))
                     printf("CreateCoinStake : kernel found\n");
                 vector<valtype> vSolutions;
                 txnouttype whichType;
@@ -1276,15 +1514,15 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
                 scriptPubKeyKernel = pcoin.first->vout[pcoin.second].scriptPubKey;
                 if (!Solver(scriptPubKeyKernel, whichType, vSolutions))
                 {
-                    if (fDebug && GetBoolArg("-printcoinstake"))
+                    if (LogAccept(LOG_COINSTAKE))
                         printf("CreateCoinStake : failed to parse kernel\n", whichType);
                     break;
                 }
-                if (fDebug && GetBoolArg("-printcoinstake"))
+                if (LogAccept(LOG_COINSTAKE))
                     printf("CreateCoinStake : parsed kernel type=%d\n", whichType);
                 if (whichType != TX_PUBKEY && whichType != TX_PUBKEYHASH)
                 {
-                    if (fDebug && GetBoolArg("-printcoinstake"))
+                    if (LogAccept(LOG_COINSTAKE))
                         printf("CreateCoinStake : no support for kernel type=%d\n", whichType);
                     break;  // only support pay to public key and pay to address
                 }
@@ -1294,7 +1532,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
                     CKey key;
                     if (!keystore.GetKey(uint160(vSolutions[0]), key))
                     {
-                        if (fDebug && GetBoolArg("-printcoinstake"))
+                        if (LogAccept(LOG_COINSTAKE))
                             printf("CreateCoinStake : failed to get key for kernel type=%d\n", whichType);
                         break;  // unable to find corresponding public key
                     }
@@ -1310,7 +1548,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
                 txNew.vout.push_back(CTxOut(0, scriptPubKeyOut));
                 if (block.GetBlockTime() + nStakeSplitAge > txNew.nTime)
                     txNew.vout.push_back(CTxOut(0, scriptPubKeyOut)); //split stake
-                if (fDebug && GetBoolArg("-printcoinstake"))
+                if (LogAccept(LOG_COINSTAKE))
                     printf("CreateCoinStake : added kernel type=%d\n", whichType);
                 fKernelFound = true;
                 break;
@@ -1390,7 +1628,7 @@ bool CWallet::CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int
         }
         else
         {
-            if (fDebug && GetBoolArg("-printfee"))
+            if (LogAccept(LOG_FEE))
                 printf("CreateCoinStake : fee for coinstake %s\n", FormatMoney(nMinFee).c_str());
             break;
         }
@@ -1540,6 +1778,12 @@ int CWallet::LoadWallet(bool& fFirstRunRet)
 
 bool CWallet::SetAddressBookName(const CBitcoinAddress& address, const string& strName)
 {
+    {
+        LOCK(cs_wallet);
+        map<CBitcoinAddress, string>::const_iterator mi = mapAddressBook.find(address);
+        if (setAccountAddresses.count(address) && (mi == mapAddressBook.end() || (*mi).second != strName))
+            fAccountIndexValid = false;
+    }
     mapAddressBook[address] = strName;
     AddressBookRepaint();
     if (!fFileBacked)
@@ -1549,6 +1793,11 @@ bool CWallet::SetAddressBookName(const CBitcoinAddress& address, const string& s
 
 bool CWallet::DelAddressBookName(const CBitcoinAddress& address)
 {
+    {
+        LOCK(cs_wallet);
+        if (setAccountAddresses.count(address))
+            fAccountIndexValid = false;
+    }
     mapAddressBook.erase(address);
     AddressBookRepaint();
     if (!fFileBacked)
@@ -1624,7 +1873,7 @@ bool CWallet::NewKeyPool()
         if (IsLocked())
             return false;
 
-        int64 nKeys = max(GetArg("-keypool", 100), (int64)0);
+        int64 nKeys = max(configKeyPool.Get(), (int64)0);
         for (int i = 0; i < nKeys; i++)
         {
             int64 nIndex = i+1;
@@ -1647,7 +1896,7 @@ bool CWallet::TopUpKeyPool()
         CWalletDB walletdb(strWalletFile);
 
         // Top up key pool
-        unsigned int nTargetSize = max(GetArg("-keypool", 100), 0LL);
+        unsigned int nTargetSize = max(configKeyPool.Get(), 0LL);
         while (setKeyPool.size() < (nTargetSize + 1))
         {
             int64 nEnd = 1;
@@ -1685,7 +1934,7 @@ void CWallet::ReserveKeyFromKeyPool(int64& nIndex, CKeyPool& keypool)
         if (!HaveKey(Hash160(keypool.vchPubKey)))
             throw runtime_error("ReserveKeyFromKeyPool() : unknown key in key pool");
         assert(!keypool.vchPubKey.empty());
-        if (fDebug && GetBoolArg("-printkeypool"))
+        if (LogAccept(LOG_KEYPOOL))
             printf("keypool reserve %"PRI64d"\n", nIndex);
     }
 }
@@ -1723,7 +1972,7 @@ void CWallet::ReturnKey(int64 nIndex)
         LOCK(cs_wallet);
         setKeyPool.insert(nIndex);
     }
-    if (fDebug && GetBoolArg("-printkeypool"))
+    if (LogAccept(LOG_KEYPOOL))
         printf("keypool return %"PRI64d"\n", nIndex);
 }
 
@@ -1903,9 +2152,7 @@ bool CWallet::GetStakeWeight(const CKeyStore& keystore, uint64& nMinWeight, uint
     // Choose coins to use
     int64 nBalance = GetBalance();
     
-    int64 nReserveBalance = 0;
-    if (mapArgs.count("-reservebalance") && !ParseMoney(mapArgs["-reservebalance"], nReserveBalance))
-        return error("GetStakeWeight : invalid reserve balance amount");
+    int64 nReserveBalance = configReserveBalance.Get();
 
     if (nBalance <= nReserveBalance)
         return false;
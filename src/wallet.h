@@ -11,6 +11,8 @@
 #include "keystore.h"
 #include "script.h"
 
+#include <boost/tuple/tuple.hpp>
+
 extern bool fWalletUnlockMintOnly;
 
 class CWalletTx;
@@ -29,6 +31,43 @@ enum WalletFeature
 };
 
 
+/** Balance of one account in the account index. Amounts that count at any
+ * depth are summed in nFixed; received and generated amounts are also kept
+ * by the height of their block, so that a minimum depth only needs the
+ * entries of the last few blocks to be subtracted.
+ */
+class CAccountBalance
+{
+public:
+    enum { FIXED, RECEIVED, GENERATED };
+
+    int64 nFixed;
+    int64 nReceived;
+    int64 nGenerated;
+    std::map<int, int64> mapReceived;
+    std::map<int, int64> mapGenerated;
+
+    CAccountBalance() : nFixed(0), nReceived(0), nGenerated(0) {}
+
+    void Add(int nType, int nHeight, int64 nAmount);
+
+    // Fixed amounts plus the received amounts in blocks up to
+    // nMaxHeightReceived and the generated amounts up to nMaxHeightGenerated
+    int64 Get(int nMaxHeightReceived, int nMaxHeightGenerated) const;
+};
+
+/** Amounts one wallet transaction adds to accounts in the account index */
+class CAccountTxEntry
+{
+public:
+    int nHeight;
+    bool fFinal;
+    std::vector<boost::tuple<std::string, int, int64> > vAmounts;
+
+    CAccountTxEntry() : nHeight(std::numeric_limits<int>::max()), fFinal(true) {}
+};
+
+
 /** A key pool entry */
 class CKeyPool
 {
@@ -73,6 +112,33 @@ private:
     // the maxmimum wallet format version: memory-only variable that specifies to what version this wallet may be upgraded
     int nWalletMaxVersion;
 
+    // PFN: per-account balance index used by GetAccountBalance. It follows
+    // wallet transaction changes and accounting entries, and is rebuilt on
+    // first use after a change it can't follow (rescans, reorgs, relabeling
+    // an address that already received coins)
+    bool fAccountIndexValid;
+    CBlockIndex* pindexAccountIndex;
+    std::map<std::string, CAccountBalance> mapAccountBalance;
+    std::map<uint256, CAccountTxEntry> mapAccountTx;
+    // transactions not final yet, or in a block not yet in the main chain
+    std::set<uint256> setAccountRecheck;
+    // addresses of our outputs in indexed transactions
+    std::set<CBitcoinAddress> setAccountAddresses;
+
+    void AccountIndexAdd(const CWalletTx& wtx);
+    void AccountIndexRemove(const uint256& hash);
+    void AccountIndexApply(const CAccountTxEntry& entry, int nSign);
+    void SyncAccountIndex();
+
+    // PFN: outputs of non-generated wallet transactions by the address they
+    // pay to, built on first use and then kept up to date by AddToWallet and
+    // EraseFromWallet
+    bool fAddressReceivedValid;
+    std::map<CBitcoinAddress, std::vector<COutPoint> > mapAddressReceived;
+
+    void AddressReceivedAdd(const CWalletTx& wtx);
+    void AddressReceivedRemove(const CWalletTx& wtx);
+
 public:
     mutable CCriticalSection cs_wallet;
 
@@ -93,6 +159,9 @@ public:
         fFileBacked = false;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        fAccountIndexValid = false;
+        pindexAccountIndex = NULL;
+        fAddressReceivedValid = false;
     }
     CWallet(std::string strWalletFileIn)
     {
@@ -102,6 +171,9 @@ public:
         fFileBacked = true;
         nMasterKeyMaxID = 0;
         pwalletdbEncryption = NULL;
+        fAccountIndexValid = false;
+        pindexAccountIndex = NULL;
+        fAddressReceivedValid = false;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -150,6 +222,12 @@ public:
     int64 GetUnconfirmedBalance() const;
     int64 GetStake() const;
     int64 GetNewMint() const;
+    int64 GetAccountBalance(const std::string& strAccount, int nMinDepth);
+    // Add an accounting entry already written to the wallet database
+    void AddAccountCreditDebit(const std::string& strAccount, int64 nCreditDebit);
+    // Outputs paying to each address, for the received-by RPCs; cs_wallet
+    // must be held while the result is used
+    const std::map<CBitcoinAddress, std::vector<COutPoint> >& GetAddressReceived();
     bool CreateTransaction(const std::vector<std::pair<CScript, int64> >& vecSend, CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet);
     bool CreateTransaction(CScript scriptPubKey, int64 nValue, CWalletTx& wtxNew, CReserveKey& reservekey, int64& nFeeRet);
     bool CreateCoinStake(const CKeyStore& keystore, unsigned int nBits, int64 nSearchInterval, CTransaction& txNew);
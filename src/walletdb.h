@@ -27,6 +27,7 @@ class CWalletDB : public CDB
 public:
     CWalletDB(std::string strFilename, const char* pszMode="r+") : CDB(strFilename.c_str(), pszMode)
     {
+        fSecure = true;
     }
 private:
     CWalletDB(const CWalletDB&);